@@ -46,6 +46,32 @@
 extern "C" {
 #endif
 
+	/// @brief The statistics of a split-ordered hash table
+	typedef struct _QcSoHashStats
+	{
+		/// @brief The number of items
+		int Count;
+
+		/// @brief The number of buckets
+		int TableSize;
+
+		/// @brief The ratio of item count to table size at which the table is expanded
+		float MaxLoad;
+
+		/// @brief The number of bytes the bucket table takes
+		unsigned long long TableBytes;
+
+		/// @brief The number of bytes of a node
+		unsigned long long NodeBytes;
+	} QcSoHashStats;
+
+	/// @brief The function called for each item of a table by the iteration
+	/// @param key The key of the item, modulo 2^31
+	/// @param pValue The value of the item, or the pointer to the value for 64-bit integer valued tables
+	/// @param pContext The context given to the iteration
+	/// @return 0 to carry on or any other value to stop the iteration
+	typedef int (*QcSoHashCallback)(unsigned int key, void *pValue, void *pContext);
+
 	/// @brief Matches wildcards to source string
 	/// @param pszSource The source string
 	/// @param pszPattern The wildcard pattern
@@ -62,6 +88,41 @@ extern "C" {
 	/// @return The number of characters in regular expression if conversion successful or -1
 	int QcWildCardToRegex(const char *pszWcPattern, char **pszRegex);
 
+	/// @brief Compiles a wildcard pattern for matching many times
+	/// @param pszPattern The wildcard pattern, which is copied
+	/// @return The compiled pattern
+	void* QcWildcardCompile(const char *pszPattern);
+
+	/// @brief Matches a source string to a compiled pattern
+	/// @param pPattern The compiled pattern
+	/// @param pSource The source string, which doesn't have to be zero-terminated if its length is given
+	/// @param length The number of characters in the source string or -1 if it's zero-terminated
+	/// @param aMatches To return the offsets in the source of the beginning and end of each match entry,
+	///        alternately, or NULL. An end of a quotation that's never closed is returned as -1.
+	/// @param maxMatches The maximum number of match entries to return, each taking two integers
+	/// @return The number of match entries if matching, which can be more than maxMatches, or -1
+	/// @remarks The quotations are worked out with an automaton in time linear in the length of the source,
+	///          on scratch memory each thread keeps between the calls, so no memory is allocated for patterns
+	///          with fewer than 16 quotations once a thread has matched one of the size. A compiled pattern can
+	///          be matched by many threads at the same time.
+	int QcWildcardMatchCompiled(void *pPattern, const char *pSource, int length, int *aMatches, int maxMatches);
+
+	/// @brief Determines which of a batch of source strings match a compiled pattern
+	/// @param pPattern The compiled pattern
+	/// @param apSources The source strings
+	/// @param aLengths The number of characters in each source, -1 for a zero-terminated one, or NULL if they
+	///        are all zero-terminated
+	/// @param count The number of source strings
+	/// @param aMatched To return whether each source matches or NULL to ignore
+	/// @return The number of sources that match
+	/// @remarks The quotations are not worked out, which makes the matching linear for each source
+	int QcWildcardMatchMany(void *pPattern, const char *const *apSources, const int *aLengths, int count,
+		BOOL *aMatched);
+
+	/// @brief Finalises a compiled pattern
+	/// @param pPattern The compiled pattern
+	void QcWildcardFree(void *pPattern);
+
 	/// @brief Creates a split-ordered hash table
 	/// @param The max-load which is the ratio of item count to table size at which the table should be expanded
 	/// @param The function that dispose of the values added to the table
@@ -91,6 +152,159 @@ extern "C" {
 	/// @param pSoHash The hash table to finalise
 	void QcSoHashDestroy(void *pSoHash);
 
+	/// @brief Adds items to a split-ordered hash table in a batch (existing ones will be replaced)
+	/// @param pSoHash The hash table
+	/// @param aKeys The keys to the items to add
+	/// @param apValues The values the keys are mapped to, one for each key
+	/// @param count The number of items
+	/// @return The number of items added or replaced
+	/// @remarks The table is locked once for the whole batch
+	int QcSoHashSetMany(void *pSoHash, const unsigned int *aKeys, void *const *apValues, int count);
+
+	/// @brief Looks for the items with the specified keys in a split-ordered hash table
+	/// @param pSoHash The hash table
+	/// @param aKeys The keys to the items to look for
+	/// @param count The number of keys
+	/// @param apValues To return the values, NULL for the keys that are not found
+	/// @param aFound To return whether each key is found or NULL to ignore
+	/// @return The number of keys found
+	int QcSoHashFindMany(void *pSoHash, const unsigned int *aKeys, int count, void **apValues, BOOL *aFound);
+
+	/// @brief Removes the items with the specified keys from a split-ordered hash table in a batch
+	/// @param pSoHash The hash table
+	/// @param aKeys The keys to the items to remove
+	/// @param count The number of keys
+	/// @return The number of items removed
+	/// @remarks The table is locked once for the whole batch
+	int QcSoHashRemoveMany(void *pSoHash, const unsigned int *aKeys, int count);
+
+	/// @brief Creates a split-ordered hash table with 64-bit integer values stored in the items
+	/// @param maxLoad The ratio of item count to table size at which the table should be expanded
+	/// @return The split-ordered hash table
+	void* QcSoHashU64Create(float maxLoad);
+
+	/// @brief Adds an item to a 64-bit integer valued table (an existing one will be replaced)
+	/// @param pSoHash The hash table
+	/// @param key The key to the item to add
+	/// @param value The value the key is mapped to
+	void QcSoHashU64Set(void *pSoHash, unsigned int key, unsigned long long value);
+
+	/// @brief Looks for the item with the specified key in a 64-bit integer valued table
+	/// @param pSoHash The hash table
+	/// @param key The key to the item to look for
+	/// @param pValue To return the value or NULL to ignore
+	/// @return 0 if the item has been found or -1 if it's not found
+	int QcSoHashU64Find(void *pSoHash, unsigned int key, unsigned long long *pValue);
+
+	/// @brief Removes an item from a 64-bit integer valued table
+	/// @param pSoHash The hash table
+	/// @param key The key to the item to remove
+	/// @return 0 if the item has been removed or -1 if it's not found
+	int QcSoHashU64Remove(void *pSoHash, unsigned int key);
+
+	/// @brief Adds items to a 64-bit integer valued table in a batch (existing ones will be replaced)
+	/// @param pSoHash The hash table
+	/// @param aKeys The keys to the items to add
+	/// @param aValues The values the keys are mapped to, one for each key
+	/// @param count The number of items
+	/// @return The number of items added or replaced
+	int QcSoHashU64SetMany(void *pSoHash, const unsigned int *aKeys, const unsigned long long *aValues, int count);
+
+	/// @brief Looks for the items with the specified keys in a 64-bit integer valued table
+	/// @param pSoHash The hash table
+	/// @param aKeys The keys to the items to look for
+	/// @param count The number of keys
+	/// @param aValues To return the values, 0 for the keys that are not found
+	/// @param aFound To return whether each key is found or NULL to ignore
+	/// @return The number of keys found
+	int QcSoHashU64FindMany(void *pSoHash, const unsigned int *aKeys, int count, unsigned long long *aValues,
+		BOOL *aFound);
+
+	/// @brief Removes the items with the specified keys from a 64-bit integer valued table in a batch
+	/// @param pSoHash The hash table
+	/// @param aKeys The keys to the items to remove
+	/// @param count The number of keys
+	/// @return The number of items removed
+	int QcSoHashU64RemoveMany(void *pSoHash, const unsigned int *aKeys, int count);
+
+	/// @brief Finalises a 64-bit integer valued table
+	/// @param pSoHash The hash table to finalise
+	void QcSoHashU64Destroy(void *pSoHash);
+
+	/// @brief Returns the number of items in a split-ordered hash table
+	/// @param pSoHash The hash table
+	/// @return The number of items
+	int QcSoHashCount(void *pSoHash);
+
+	/// @brief Grows the bucket table of a split-ordered hash table in advance for a number of items
+	/// @param pSoHash The hash table
+	/// @param count The number of items
+	void QcSoHashReserve(void *pSoHash, int count);
+
+	/// @brief Gets the statistics of a split-ordered hash table
+	/// @param pSoHash The hash table
+	/// @param pStats To return the statistics
+	void QcSoHashGetStats(void *pSoHash, QcSoHashStats *pStats);
+
+	/// @brief Calls a function for each item of a split-ordered hash table in the split order
+	/// @param pSoHash The hash table
+	/// @param callback The function
+	/// @param pContext The context to pass to the function
+	/// @return The number of items the function has been called for
+	/// @remarks The items are read in runs and the function is called without the table locked, so it can
+	///          modify the table
+	int QcSoHashIterate(void *pSoHash, QcSoHashCallback callback, void *pContext);
+
+	/// @brief Creates a cursor that reads the items of a table in runs, of either kind of table
+	/// @param pSoHash The hash table, which is to outlive the cursor
+	/// @return The cursor
+	/// @remarks The cursor stays valid while items are added to or removed from the table; the items added
+	///          behind it are not seen
+	void* QcSoHashCursorCreate(void *pSoHash);
+
+	/// @brief Reads the next run of items of a split-ordered hash table with a cursor
+	/// @param pCursor The cursor
+	/// @param aKeys To return the keys, modulo 2^31
+	/// @param apValues To return the values
+	/// @param max The maximum number of items to read
+	/// @return The number of items read, 0 at the end
+	/// @remarks The table is locked once for each run
+	int QcSoHashCursorNext(void *pCursor, unsigned int *aKeys, void **apValues, int max);
+
+	/// @brief Finalises a cursor
+	/// @param pCursor The cursor
+	void QcSoHashCursorDestroy(void *pCursor);
+
+	/// @brief Returns the number of items in a 64-bit integer valued table
+	/// @param pSoHash The hash table
+	/// @return The number of items
+	int QcSoHashU64Count(void *pSoHash);
+
+	/// @brief Grows the bucket table of a 64-bit integer valued table in advance for a number of items
+	/// @param pSoHash The hash table
+	/// @param count The number of items
+	void QcSoHashU64Reserve(void *pSoHash, int count);
+
+	/// @brief Gets the statistics of a 64-bit integer valued table
+	/// @param pSoHash The hash table
+	/// @param pStats To return the statistics
+	void QcSoHashU64GetStats(void *pSoHash, QcSoHashStats *pStats);
+
+	/// @brief Calls a function for each item of a 64-bit integer valued table in the split order
+	/// @param pSoHash The hash table
+	/// @param callback The function, which is given a pointer to a copy of each value
+	/// @param pContext The context to pass to the function
+	/// @return The number of items the function has been called for
+	int QcSoHashU64Iterate(void *pSoHash, QcSoHashCallback callback, void *pContext);
+
+	/// @brief Reads the next run of items of a 64-bit integer valued table with a cursor
+	/// @param pCursor The cursor created with QcSoHashCursorCreate()
+	/// @param aKeys To return the keys, modulo 2^31
+	/// @param aValues To return the values
+	/// @param max The maximum number of items to read
+	/// @return The number of items read, 0 at the end
+	int QcSoHashU64CursorNext(void *pCursor, unsigned int *aKeys, unsigned long long *aValues, int max);
+
 #if defined(__cplusplus)
 }	/* extern "C" */
 #endif
@@ -0,0 +1,193 @@
+#if !defined(_BITREVERSE_H_)
+#define _BITREVERSE_H_
+
+#include <cstddef>
+#include "qtl/system/system.h"
+
+// Scalar kernels that can be selected for bit reversal
+#define _QTL_BITREVERSE_TABLE	1
+#define _QTL_BITREVERSE_SWAP	2
+#define _QTL_BITREVERSE_BUILTIN	3
+#define _QTL_BITREVERSE_RBIT	4
+
+// Picks the scalar kernel at compile time unless the user has already chosen one
+#if !defined(_QTL_BITREVERSE_KERNEL)
+#   if defined(__has_builtin)
+#      if __has_builtin(__builtin_bitreverse32)
+#         define _QTL_BITREVERSE_KERNEL _QTL_BITREVERSE_BUILTIN
+#      endif
+#   endif
+#endif
+#if !defined(_QTL_BITREVERSE_KERNEL)
+#   if defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#      define _QTL_BITREVERSE_KERNEL _QTL_BITREVERSE_RBIT
+#   else
+#      define _QTL_BITREVERSE_KERNEL _QTL_BITREVERSE_SWAP
+#   endif
+#endif
+
+#if _QTL_BITREVERSE_KERNEL == _QTL_BITREVERSE_RBIT
+#   include <arm_acle.h>
+#endif
+
+// Picks the batch kernel at compile time
+#if defined(__AVX2__)
+#   define _QTL_BITREVERSE_BATCH_AVX2 1
+#   include <immintrin.h>
+#elif defined(__SSSE3__)
+#   define _QTL_BITREVERSE_BATCH_SSSE3 1
+#   include <tmmintrin.h>
+#endif
+
+namespace Qtl { namespace Scheme { namespace Hash {
+
+/// @brief Bit reversal kernels for 32-bit split-order keys
+/// @remarks Reverse() and ReverseBatch() are bound to the fastest kernels available to the compiler,
+///          the others are kept accessible for comparison and testing
+struct BitReverse
+{
+	/// @brief The type of the value to reverse
+	typedef unsigned int ValueType;
+
+	/// @brief Reverses the bits using the multiply-and-modulo byte reversal
+	/// @param x The value to reverse
+	/// @return The bit-reversal of the value
+	/// @remarks This is the 3-operation approach from
+	///   1. http://graphics.stanford.edu/~seander/bithacks.html#BitReverseObvious
+	///   2. http://stackoverflow.com/questions/1688532/how-to-reverse-bits-of-a-byte
+	static ValueType Multiply(ValueType x)
+	{
+		unsigned long long b0 = x & 0xff;
+		unsigned long long b1 = (x >> 8) & 0xff;
+		unsigned long long b2 = (x >> 16) & 0xff;
+		unsigned long long b3 = (x >> 24) & 0xff;
+		b0 = (b0*0x0202020202ULL & 0x010884422010ULL)%1023;
+		b1 = (b1*0x0202020202ULL & 0x010884422010ULL)%1023;
+		b2 = (b2*0x0202020202ULL & 0x010884422010ULL)%1023;
+		b3 = (b3*0x0202020202ULL & 0x010884422010ULL)%1023;
+		return (ValueType)((b0 << 24) | (b1 << 16) | (b2 << 8) | b3);
+	}
+
+	/// @brief Reverses the bits by looking up the reversal of each byte
+	/// @param x The value to reverse
+	/// @return The bit-reversal of the value
+	static ValueType Table(ValueType x)
+	{
+#define _QTL_BR2(n)	n, n + 2*64, n + 1*64, n + 3*64
+#define _QTL_BR4(n)	_QTL_BR2(n), _QTL_BR2(n + 2*16), _QTL_BR2(n + 1*16), _QTL_BR2(n + 3*16)
+#define _QTL_BR6(n)	_QTL_BR4(n), _QTL_BR4(n + 2*4), _QTL_BR4(n + 1*4), _QTL_BR4(n + 3*4)
+		static const unsigned char table[256] =
+		{
+			_QTL_BR6(0), _QTL_BR6(2), _QTL_BR6(1), _QTL_BR6(3)
+		};
+#undef _QTL_BR6
+#undef _QTL_BR4
+#undef _QTL_BR2
+		return ((ValueType)table[x & 0xff] << 24) | ((ValueType)table[(x >> 8) & 0xff] << 16)
+			| ((ValueType)table[(x >> 16) & 0xff] << 8) | (ValueType)table[x >> 24];
+	}
+
+	/// @brief Reverses the bits by swapping adjacent bit groups of doubling size
+	/// @param x The value to reverse
+	/// @return The bit-reversal of the value
+	static ValueType Swap(ValueType x)
+	{
+		x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+		x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+		x = ((x >> 4) & 0x0F0F0F0FU) | ((x & 0x0F0F0F0FU) << 4);
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_bswap32(x);
+#else
+		x = ((x >> 8) & 0x00FF00FFU) | ((x & 0x00FF00FFU) << 8);
+		return (x >> 16) | (x << 16);
+#endif
+	}
+
+#if _QTL_BITREVERSE_KERNEL == _QTL_BITREVERSE_BUILTIN
+	/// @brief Reverses the bits with the compiler intrinsic
+	/// @param x The value to reverse
+	/// @return The bit-reversal of the value
+	static ValueType Builtin(ValueType x)
+	{
+		return __builtin_bitreverse32(x);
+	}
+#elif _QTL_BITREVERSE_KERNEL == _QTL_BITREVERSE_RBIT
+	/// @brief Reverses the bits with the RBIT instruction
+	/// @param x The value to reverse
+	/// @return The bit-reversal of the value
+	static ValueType Builtin(ValueType x)
+	{
+		return __rbit(x);
+	}
+#endif
+
+	/// @brief Reverses the bits with the kernel selected at compile time
+	/// @param x The value to reverse
+	/// @return The bit-reversal of the value
+	static ValueType Reverse(ValueType x)
+	{
+#if _QTL_BITREVERSE_KERNEL == _QTL_BITREVERSE_BUILTIN || _QTL_BITREVERSE_KERNEL == _QTL_BITREVERSE_RBIT
+		return Builtin(x);
+#elif _QTL_BITREVERSE_KERNEL == _QTL_BITREVERSE_TABLE
+		return Table(x);
+#else
+		return Swap(x);
+#endif
+	}
+
+	/// @brief Reverses the bits of each of the values in a buffer
+	/// @param values The values to reverse
+	/// @param reversed The buffer to receive the reversed values (may be the same as values)
+	/// @param count The number of values
+	static void ReverseBatch(const ValueType *values, ValueType *reversed, size_t count)
+	{
+		size_t i = 0;
+#if _QTL_BITREVERSE_BATCH_AVX2
+		// each byte is reversed by looking up its two nibbles and then the bytes of each lane are swapped
+		const __m256i nibbleMask = _mm256_set1_epi8(0x0f);
+		const __m256i loTable = _mm256_setr_epi8(
+			0x00, (char)0x80, 0x40, (char)0xc0, 0x20, (char)0xa0, 0x60, (char)0xe0,
+			0x10, (char)0x90, 0x50, (char)0xd0, 0x30, (char)0xb0, 0x70, (char)0xf0,
+			0x00, (char)0x80, 0x40, (char)0xc0, 0x20, (char)0xa0, 0x60, (char)0xe0,
+			0x10, (char)0x90, 0x50, (char)0xd0, 0x30, (char)0xb0, 0x70, (char)0xf0);
+		const __m256i hiTable = _mm256_setr_epi8(
+			0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf,
+			0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf);
+		const __m256i byteSwap = _mm256_setr_epi8(
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+			__m256i lo = _mm256_shuffle_epi8(loTable, _mm256_and_si256(v, nibbleMask));
+			__m256i hi = _mm256_shuffle_epi8(hiTable, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibbleMask));
+			v = _mm256_shuffle_epi8(_mm256_or_si256(lo, hi), byteSwap);
+			_mm256_storeu_si256((__m256i*)(reversed + i), v);
+		}
+#elif _QTL_BITREVERSE_BATCH_SSSE3
+		const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+		const __m128i loTable = _mm_setr_epi8(
+			0x00, (char)0x80, 0x40, (char)0xc0, 0x20, (char)0xa0, 0x60, (char)0xe0,
+			0x10, (char)0x90, 0x50, (char)0xd0, 0x30, (char)0xb0, 0x70, (char)0xf0);
+		const __m128i hiTable = _mm_setr_epi8(
+			0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf);
+		const __m128i byteSwap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+			__m128i lo = _mm_shuffle_epi8(loTable, _mm_and_si128(v, nibbleMask));
+			__m128i hi = _mm_shuffle_epi8(hiTable, _mm_and_si128(_mm_srli_epi16(v, 4), nibbleMask));
+			v = _mm_shuffle_epi8(_mm_or_si128(lo, hi), byteSwap);
+			_mm_storeu_si128((__m128i*)(reversed + i), v);
+		}
+#endif
+		for (; i < count; i++)
+		{
+			reversed[i] = Reverse(values[i]);
+		}
+	}
+};
+
+}}}
+
+#endif
@@ -0,0 +1,183 @@
+#if !defined(_BLOOMFILTER_H_)
+#define _BLOOMFILTER_H_
+
+#include <cstdlib>
+#include <cstring>
+#include "qtl/system/threading.h"
+
+namespace Qtl { namespace Scheme { namespace Hash {
+
+/// @brief A blocked counting Bloom filter over 32-bit keys
+/// @remarks All the probes of a key fall in one cache-line sized block of 4-bit counters so a query costs at
+///          most one cache miss. Counters saturate at 15 and are never decremented from there so removals
+///          cannot introduce false negatives. Updates must be serialized by the owner; queries can run
+///          concurrently with them and only see each counter before or after an update.
+class CountingBloomFilter
+{
+public:
+	/// @brief The type of the key
+	typedef unsigned int KeyType;
+
+	/// @brief The number of bytes in a block
+	static const int BlockSize = 64;
+
+	/// @brief The number of counters each key increments
+	static const int ProbeCount = 4;
+
+private:
+	/// @brief The value at which a counter sticks
+	static const unsigned char CounterMax = 15;
+
+	/// @brief The counters packed two per byte
+	unsigned char *_counters;
+
+	/// @brief The number of bits to address a block
+	int _blockIndexBits;
+
+public:
+	/// @brief Instantiates a filter for the specified number of keys
+	/// @param capacity The number of keys the filter is sized for
+	/// @param countersPerKey The number of counters provided per key, which determines the false positive rate
+	CountingBloomFilter(int capacity, int countersPerKey) : _counters(NULL),
+		_blockIndexBits(GetBlockIndexBits(capacity, countersPerKey))
+	{
+		_counters = (unsigned char*)calloc(GetMemorySize(), 1);
+	}
+
+	/// @brief Finalises the filter
+	~CountingBloomFilter()
+	{
+		free(_counters);
+	}
+
+private:
+	/// @brief Disallows copying
+	CountingBloomFilter(const CountingBloomFilter &);
+
+	/// @brief Disallows assignment
+	CountingBloomFilter &operator=(const CountingBloomFilter &);
+
+public:
+	/// @brief Returns the number of bytes the counters take
+	/// @return The number of bytes
+	size_t GetMemorySize() const
+	{
+		return (size_t)BlockSize << _blockIndexBits;
+	}
+
+	/// @brief Returns the number of bytes the counters of a filter take
+	/// @param capacity The number of keys the filter is sized for
+	/// @param countersPerKey The number of counters provided per key
+	/// @return The number of bytes
+	static size_t GetMemorySize(int capacity, int countersPerKey)
+	{
+		return (size_t)BlockSize << GetBlockIndexBits(capacity, countersPerKey);
+	}
+
+	/// @brief Adds a key to the filter
+	/// @param key The key to add
+	void Add(KeyType key)
+	{
+		unsigned char *block;
+		unsigned int probes;
+		Locate(key, block, probes);
+		for (int i = 0; i < ProbeCount; i++, probes >>= 7)
+		{
+			unsigned char *cell = block + ((probes & 0x7f) >> 1);
+			int shift = (probes & 1) * 4;
+			unsigned char byte = *cell;
+			if (((byte >> shift) & 0xf) < CounterMax)
+			{
+				Qtl::System::Threading::AtomicStoreRelease(cell, (unsigned char)(byte + (1 << shift)));
+			}
+		}
+	}
+
+	/// @brief Removes a key that has been added to the filter
+	/// @param key The key to remove
+	void Remove(KeyType key)
+	{
+		unsigned char *block;
+		unsigned int probes;
+		Locate(key, block, probes);
+		for (int i = 0; i < ProbeCount; i++, probes >>= 7)
+		{
+			unsigned char *cell = block + ((probes & 0x7f) >> 1);
+			int shift = (probes & 1) * 4;
+			unsigned char byte = *cell;
+			unsigned char counter = (byte >> shift) & 0xf;
+			if (counter > 0 && counter < CounterMax)
+			{
+				Qtl::System::Threading::AtomicStoreRelease(cell, (unsigned char)(byte - (1 << shift)));
+			}
+		}
+	}
+
+	/// @brief Determines if the key may have been added
+	/// @param key The key to check
+	/// @return false if the key has definitely not been added
+	bool MayContain(KeyType key) const
+	{
+		unsigned char *block;
+		unsigned int probes;
+		Locate(key, block, probes);
+		for (int i = 0; i < ProbeCount; i++, probes >>= 7)
+		{
+			unsigned char byte = Qtl::System::Threading::AtomicLoadAcquire(block + ((probes & 0x7f) >> 1));
+			if (((byte >> ((probes & 1) * 4)) & 0xf) == 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/// @brief Removes all the keys
+	void Clear()
+	{
+		memset(_counters, 0, GetMemorySize());
+	}
+
+private:
+	/// @brief Works out the number of bits to address the blocks of a filter
+	/// @param capacity The number of keys the filter is sized for
+	/// @param countersPerKey The number of counters provided per key
+	/// @return The number of bits, which makes the blocks hold at least the counters
+	static int GetBlockIndexBits(int capacity, int countersPerKey)
+	{
+		size_t counters = (size_t)(capacity > 0? capacity : 1) * (size_t)countersPerKey;
+		int bits = 0;
+		while (((size_t)BlockSize*2 << bits) < counters && bits < 31)
+		{
+			bits++;
+		}
+		return bits;
+	}
+
+	/// @brief Works out the block and the positions of the counters within it for a key
+	/// @param key The key
+	/// @param block To return the block
+	/// @param probes To return the 7-bit counter indices packed from the lowest bits
+	void Locate(KeyType key, unsigned char *&block, unsigned int &probes) const
+	{
+		// murmur3 finalizer so that sequential keys spread across blocks
+		unsigned int h = key;
+		h ^= h >> 16;
+		h *= 0x85ebca6bU;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35U;
+		h ^= h >> 16;
+		unsigned int blockIndex = (_blockIndexBits > 0)? h >> (32 - _blockIndexBits) : 0;
+		block = _counters + (size_t)blockIndex * BlockSize;
+		// a differently seeded mix for the counters within the block
+		unsigned int g = (key ^ 0x5bd1e995U) * 0x9e3779b1U;
+		g ^= g >> 15;
+		g *= 0x85ebca77U;
+		g ^= g >> 13;
+		probes = g;
+	}
+};
+
+}}}
+
+#endif
@@ -0,0 +1,483 @@
+#if !defined(_SOCACHE_H_)
+#define _SOCACHE_H_
+
+#include <vector>
+#include "qtl/system/threading.h"
+#include "qtl/system/rcu.h"
+#include "qtl/scheme/hash/sohash.h"
+
+namespace Qtl { namespace Scheme { namespace Hash {
+
+/// @brief A bounded concurrent cache on top of the split-ordered hash
+/// @param TValue The type of the cached values
+/// @param TDisposer The functor called on a value when it is evicted, expired, removed, replaced or cleared
+/// @remarks Lookups go straight to the lock-free read path of the hash and only mark the entry as
+///          recently used. Insertions and removals are serialized by the cache and evict with the CLOCK
+///          algorithm, which favours expired entries and then entries that have not been looked up since
+///          the hand last passed them. The hash runs in the read-mostly mode with a domain of the cache and
+///          the lookups in its read sections, so an entry dropped while a lookup is reading it is freed and
+///          its value disposed of only once the lookup is over. The writers reclaim the dropped entries
+///          whose lookups are all over before they return.
+template <class TValue, class TDisposer=DefaultDisposer<TValue> >
+class SoCache
+{
+public:
+	/// @brief The type of the key
+	typedef unsigned int KeyType;
+
+	/// @brief The type of the cached values
+	typedef TValue ValueType;
+
+	/// @brief The counters of the cache
+	struct Statistics
+	{
+		/// @brief The number of lookups that found a live entry
+		long Hits;
+
+		/// @brief The number of lookups that found nothing or an expired entry
+		long Misses;
+
+		/// @brief The number of entries evicted to make room for others
+		long Evictions;
+
+		/// @brief The number of entries removed because they expired
+		long Expirations;
+
+		/// @brief The number of entries in the cache
+		int Count;
+
+		/// @brief The total cost of the entries in the cache
+		size_t Cost;
+	};
+
+private:
+	/// @brief A cached value with its bookkeeping
+	struct Entry
+	{
+		/// @brief The key the entry is cached with
+		KeyType Key;
+
+		/// @brief The value
+		ValueType Value;
+
+		/// @brief The cost the entry is charged against the budget
+		size_t Cost;
+
+		/// @brief When the entry expires in milliseconds as returned by GetTickMilliseconds(), 0 if never
+		long long ExpiryTime;
+
+		/// @brief Set by lookups and cleared by the clock hand
+		volatile unsigned char Referenced;
+
+		/// @brief The position of the entry in the clock ring
+		int Slot;
+	};
+
+	/// @brief Finalises the entries the hash drops
+	struct EntryDisposer
+	{
+		/// @brief The disposer of the values
+		TDisposer *ValueDisposer;
+
+		void operator()(Entry *&entry)
+		{
+			(*ValueDisposer)(entry->Value);
+			delete entry;
+		}
+	};
+
+	/// @brief Copies the value a lookup finds
+	struct CopyAction
+	{
+		/// @brief To return the copy
+		ValueType *Value;
+
+		void operator()(const ValueType &value)
+		{
+			*Value = value;
+		}
+	};
+
+	/// @brief Selects the expired entries for a purge and releases their slots in the ring
+	struct ExpiryPredicate
+	{
+		/// @brief The cache being purged
+		SoCache *Cache;
+
+		/// @brief The current time in milliseconds
+		long long Now;
+
+		bool operator()(Entry *entry)
+		{
+			if (!IsExpired(entry, Now))
+			{
+				return false;
+			}
+			Cache->ReleaseSlot(entry);
+			Cache->_expirations++;
+			return true;
+		}
+	};
+
+	/// @brief The number of stripes the lookup counters are spread over
+	static const int CounterStripes = 16;
+
+	/// @brief A counter padded to a cache line so that the stripes don't share one
+	struct PaddedCounter
+	{
+		volatile long Value;
+		char Padding[64 - sizeof(long)];
+	};
+
+	/// @brief The hash type that maps the keys to the entries
+	typedef SoHashLinear<Entry*, EntryDisposer> HashType;
+
+private:
+	/// @brief The value disposer
+	TDisposer _disposer;
+
+	/// @brief The domain the dropped entries wait in for the lookups reading them, which outlives the hash
+	mutable Qtl::System::Rcu::QsbrDomain _domain;
+
+	/// @brief The hash that maps the keys to the entries
+	HashType _hash;
+
+	/// @brief The clock ring with one slot per entry allowed
+	std::vector<Entry*> _ring;
+
+	/// @brief The slots in the ring that are not occupied
+	std::vector<int> _freeSlots;
+
+	/// @brief The position of the clock hand
+	int _hand;
+
+	/// @brief The maximum total cost, 0 if unlimited
+	size_t _maxCost;
+
+	/// @brief The total cost of the entries
+	size_t _cost;
+
+	/// @brief The time to live given to entries inserted without one, 0 if they never expire
+	int _defaultTtl;
+
+	/// @brief Serializes insertions, removals and evictions
+	Qtl::System::Threading::Mutex _mutex;
+
+	/// @brief The hit counters, striped by key
+	mutable PaddedCounter _hits[CounterStripes];
+
+	/// @brief The miss counters, striped by key
+	mutable PaddedCounter _misses[CounterStripes];
+
+	/// @brief The number of evictions
+	long _evictions;
+
+	/// @brief The number of expirations
+	long _expirations;
+
+public:
+	/// @brief Instantiates a cache
+	/// @param maxEntries The maximum number of entries
+	/// @param maxCost The maximum total cost of the entries, 0 for no limit other than the number of entries
+	/// @param defaultTtl The time to live in milliseconds for entries inserted without one, 0 for no expiry
+	/// @param maxLoad The max-load of the underlying hash
+	SoCache(int maxEntries, size_t maxCost=0, int defaultTtl=0, float maxLoad=2)
+		: _hash(maxLoad, MakeEntryDisposer())
+	{
+		Initialize(maxEntries, maxCost, defaultTtl);
+	}
+
+	/// @brief Instantiates a cache with the specified disposer
+	/// @param maxEntries The maximum number of entries
+	/// @param maxCost The maximum total cost of the entries, 0 for no limit other than the number of entries
+	/// @param defaultTtl The time to live in milliseconds for entries inserted without one, 0 for no expiry
+	/// @param maxLoad The max-load of the underlying hash
+	/// @param disposer The functor that finalizes the values
+	SoCache(int maxEntries, size_t maxCost, int defaultTtl, float maxLoad, const TDisposer &disposer)
+		: _disposer(disposer), _hash(maxLoad, MakeEntryDisposer())
+	{
+		Initialize(maxEntries, maxCost, defaultTtl);
+	}
+
+	/// @brief Finalises the cache disposing of all the values
+	~SoCache()
+	{
+		_hash.Clear();
+	}
+
+private:
+	/// @brief Disallows copying
+	SoCache(const SoCache &);
+
+	/// @brief Disallows assignment
+	SoCache &operator=(const SoCache &);
+
+public:
+	/// @brief Looks up a value without taking any lock
+	/// @param key The key to look up
+	/// @param value To return a copy of the value
+	/// @return true if a live entry is found
+	bool Get(KeyType key, ValueType &value) const
+	{
+		CopyAction copy;
+		copy.Value = &value;
+		return Visit(key, copy);
+	}
+
+	/// @brief Looks up a value without taking any lock and hands it to an action while it cannot be disposed of
+	/// @param key The key to look up
+	/// @param action The functor that's called with a const ValueType& if a live entry is found. It must
+	///        not throw or call the writers of the cache
+	/// @return true if a live entry is found
+	template <class TAction>
+	bool Visit(KeyType key, TAction &action) const
+	{
+		bool found = false;
+		int phase = _domain.EnterReadSection(key);
+		Entry **ppEntry;
+		if (_hash.FindFirst(key, &ppEntry))
+		{
+			Entry *entry = *ppEntry;
+			if (!IsExpired(entry, entry->ExpiryTime != 0? Qtl::System::Threading::GetTickMilliseconds() : 0))
+			{
+				// only written when clear so that hot entries don't keep dirtying their cache lines
+				if (entry->Referenced == 0)
+				{
+					entry->Referenced = 1;
+				}
+				const ValueType &value = entry->Value;
+				action(value);
+				found = true;
+			}
+		}
+		_domain.ExitReadSection(phase, key);
+		Count(found? _hits : _misses, key);
+		return found;
+	}
+
+	/// @brief Inserts or replaces a value evicting other entries as needed
+	/// @param key The key to cache the value with
+	/// @param value The value
+	/// @param cost The cost of the entry against the cost budget
+	/// @param ttl The time to live in milliseconds, 0 for no expiry or negative for the default
+	/// @return false if the entry alone exceeds the cost budget, in which case the value is disposed of
+	bool Put(KeyType key, ValueType value, size_t cost=1, int ttl=-1)
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+
+		RemoveEntry(key, false);
+
+		if (_maxCost > 0 && cost > _maxCost)
+		{
+			_disposer(value);
+			_domain.Reclaim();
+			return false;
+		}
+
+		long long now = Qtl::System::Threading::GetTickMilliseconds();
+		while (_freeSlots.empty() || (_maxCost > 0 && _cost + cost > _maxCost))
+		{
+			EvictOne(now);
+		}
+
+		Entry *entry = new Entry;
+		entry->Key = key;
+		entry->Value = value;
+		entry->Cost = cost;
+		if (ttl < 0)
+		{
+			ttl = _defaultTtl;
+		}
+		entry->ExpiryTime = (ttl > 0)? now + ttl : 0;
+		entry->Referenced = 0;
+		entry->Slot = _freeSlots.back();
+		_freeSlots.pop_back();
+		_ring[entry->Slot] = entry;
+		_cost += cost;
+
+		_hash.AddKeyValuePair(key, entry);
+		_domain.Reclaim();
+		return true;
+		// unlock
+	}
+
+	/// @brief Removes the entry with the specified key disposing of its value
+	/// @param key The key of the entry
+	/// @return true if an entry was removed
+	bool Remove(KeyType key)
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		bool removed = RemoveEntry(key, false);
+		_domain.Reclaim();
+		return removed;
+		// unlock
+	}
+
+	/// @brief Removes all the expired entries in one sweep of the hash
+	/// @return The number of entries removed
+	int PurgeExpired()
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		ExpiryPredicate isExpired;
+		isExpired.Cache = this;
+		isExpired.Now = Qtl::System::Threading::GetTickMilliseconds();
+		int purged = _hash.EraseIf(isExpired);
+		_domain.Reclaim();
+		return purged;
+		// unlock
+	}
+
+	/// @brief Removes all the entries
+	void Clear()
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		_hash.Clear();
+		ResetRing();
+		_domain.Reclaim();
+		// unlock
+	}
+
+	/// @brief Returns the number of entries in the cache
+	/// @return The number of entries
+	int GetCount() const
+	{
+		return _hash.GetCount();
+	}
+
+	/// @brief Returns the counters of the cache
+	/// @param stats To return the counters
+	void GetStatistics(Statistics &stats) const
+	{
+		stats.Hits = 0;
+		stats.Misses = 0;
+		for (int i = 0; i < CounterStripes; i++)
+		{
+			stats.Hits += _hits[i].Value;
+			stats.Misses += _misses[i].Value;
+		}
+		stats.Evictions = _evictions;
+		stats.Expirations = _expirations;
+		stats.Count = _hash.GetCount();
+		stats.Cost = _cost;
+	}
+
+private:
+	/// @brief Returns the disposer the hash uses for the entries
+	/// @return The entry disposer bound to the value disposer of this cache
+	EntryDisposer MakeEntryDisposer()
+	{
+		EntryDisposer entryDisposer;
+		entryDisposer.ValueDisposer = &_disposer;
+		return entryDisposer;
+	}
+
+	/// @brief Sets the limits and the initial state of the cache
+	void Initialize(int maxEntries, size_t maxCost, int defaultTtl)
+	{
+		_ring.resize(maxEntries > 0? maxEntries : 1);
+		_maxCost = maxCost;
+		_defaultTtl = defaultTtl;
+		_hash.EnableReadMostly(_domain);
+		_evictions = 0;
+		_expirations = 0;
+		for (int i = 0; i < CounterStripes; i++)
+		{
+			_hits[i].Value = 0;
+			_misses[i].Value = 0;
+		}
+		ResetRing();
+	}
+
+	/// @brief Empties the clock ring
+	void ResetRing()
+	{
+		_freeSlots.clear();
+		for (int i = (int)_ring.size() - 1; i >= 0; i--)
+		{
+			_ring[i] = NULL;
+			_freeSlots.push_back(i);
+		}
+		_hand = 0;
+		_cost = 0;
+	}
+
+	/// @brief Increments the stripe of a counter the key falls in
+	void Count(PaddedCounter *counters, KeyType key) const
+	{
+		Qtl::System::Threading::AtomicAdd(&counters[key % CounterStripes].Value, 1L);
+	}
+
+	/// @brief Determines if an entry has expired
+	/// @param entry The entry
+	/// @param now The current time in milliseconds
+	static bool IsExpired(const Entry *entry, long long now)
+	{
+		return (entry->ExpiryTime != 0 && entry->ExpiryTime <= now);
+	}
+
+	/// @brief Advances the clock hand until an entry is evicted
+	/// @param now The current time in milliseconds
+	void EvictOne(long long now)
+	{
+		// the second sweep at the latest finds an entry as the first one clears all the reference bits
+		for (int steps = 0; steps < (int)_ring.size()*2 + 1; steps++)
+		{
+			Entry *entry = _ring[_hand];
+			_hand = (_hand + 1) % (int)_ring.size();
+			if (entry == NULL)
+			{
+				continue;
+			}
+			if (IsExpired(entry, now))
+			{
+				RemoveEntry(entry->Key, true);
+				return;
+			}
+			if (entry->Referenced != 0)
+			{
+				entry->Referenced = 0;
+				continue;
+			}
+			RemoveEntry(entry->Key, false);
+			_evictions++;
+			return;
+		}
+	}
+
+	/// @brief Takes an entry off the clock ring and the cost budget
+	/// @param entry The entry
+	void ReleaseSlot(Entry *entry)
+	{
+		_ring[entry->Slot] = NULL;
+		_freeSlots.push_back(entry->Slot);
+		_cost -= entry->Cost;
+	}
+
+	/// @brief Removes an entry and disposes of its value
+	/// @param key The key of the entry
+	/// @param expired true if it's removed for expiring
+	/// @return true if there was an entry with the key
+	bool RemoveEntry(KeyType key, bool expired)
+	{
+		Entry **ppEntry;
+		if (!_hash.FindFirst(key, &ppEntry))
+		{
+			return false;
+		}
+		ReleaseSlot(*ppEntry);
+		if (expired)
+		{
+			_expirations++;
+		}
+		_hash.DeleteKey(key);
+		return true;
+	}
+};
+
+}}}
+
+#endif
@@ -2,7 +2,14 @@
 #define _SOHASH_H_
 
 #include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 #include "qtl/system/threading.h"
+#include "qtl/system/memory.h"
+#include "qtl/system/rcu.h"
+#include "qtl/scheme/hash/bitreverse.h"
+#include "qtl/scheme/hash/bloomfilter.h"
 
 namespace Qtl { namespace Scheme { namespace Hash {
 
@@ -15,6 +22,243 @@ struct DefaultDisposer
 	}
 };
 
+/// @brief The value type of the hashes that store no values
+struct SoEmpty
+{
+};
+
+/// @brief The part of a node that holds the value
+template <class TValue, class TDummy=void>
+struct SoNodeStorage
+{
+	/// @brief The value the node contains
+	TValue Value;
+
+	/// @brief Instantiates the storage with the specified value
+	/// @param value The value
+	SoNodeStorage(const TValue &value) : Value(value)
+	{
+	}
+};
+
+/// @brief The storage of the nodes of value-less hashes, which takes no space in the node
+/// @remarks The value is a single static object so that the code accessing the values of the nodes
+///          works unchanged
+template <class TDummy>
+struct SoNodeStorage<SoEmpty, TDummy>
+{
+	/// @brief The value shared by all the nodes
+	static SoEmpty Value;
+
+	/// @brief Instantiates the storage
+	SoNodeStorage(const SoEmpty &)
+	{
+	}
+};
+
+template <class TDummy>
+SoEmpty SoNodeStorage<SoEmpty, TDummy>::Value;
+
+/// @brief The interface of the allocators that provide the memory for the nodes of a hash
+class NodeAllocator
+{
+public:
+	/// @brief Finalises the allocator
+	virtual ~NodeAllocator()
+	{
+	}
+
+	/// @brief Allocates memory for a node
+	/// @param size The size of the node
+	/// @return The memory
+	/// @remarks It can be called concurrently with itself and with Free()
+	virtual void *Allocate(size_t size) = 0;
+
+	/// @brief Frees the memory of a node
+	/// @param p The memory returned by Allocate()
+	/// @param size The size it was allocated with
+	virtual void Free(void *p, size_t size) = 0;
+};
+
+/// @brief How the bucket table of a hash is backed
+struct TableStatistics
+{
+	/// @brief The number of bytes the buckets take
+	size_t Bytes;
+
+	/// @brief The number of bytes taken from the system for the table
+	size_t MappedBytes;
+
+	/// @brief The number of huge pages the table spans, 0 if it is not backed with huge pages
+	int HugePages;
+
+	/// @brief The kind of memory the table is backed with
+	Qtl::System::Memory::PageKind::Enum Kind;
+};
+
+/// @brief The bucket table allocation policy that uses the C heap
+/// @remarks A policy provides static Allocate(), Reallocate(), Free() and GetStatistics(); the hash keeps
+///          the size of its table and the kind of memory returned with it and throws std::bad_alloc when a
+///          table can't be allocated
+struct MallocTableAllocator
+{
+	/// @brief Allocates a table
+	/// @param size The number of bytes
+	/// @param kind To return the kind of memory the table is backed with
+	/// @return The table or NULL if out of memory
+	static void *Allocate(size_t size, Qtl::System::Memory::PageKind::Enum &kind)
+	{
+		kind = Qtl::System::Memory::PageKind::Heap;
+		return malloc(size);
+	}
+
+	/// @brief Resizes a table, keeping its contents up to the smaller of the sizes
+	/// @param p The table
+	/// @param oldSize The number of bytes the table was allocated with
+	/// @param newSize The new number of bytes
+	/// @param kind To return the kind of memory the table is backed with
+	/// @return The table, which may have moved, or NULL if out of memory
+	static void *Reallocate(void *p, size_t oldSize, size_t newSize, Qtl::System::Memory::PageKind::Enum &kind)
+	{
+		(void)oldSize;
+		kind = Qtl::System::Memory::PageKind::Heap;
+		return realloc(p, newSize);
+	}
+
+	/// @brief Frees a table
+	/// @param p The table or NULL
+	/// @param size The number of bytes the table was allocated with
+	/// @param kind The kind of memory it was allocated with
+	static void Free(void *p, size_t size, Qtl::System::Memory::PageKind::Enum kind)
+	{
+		(void)size;
+		(void)kind;
+		free(p);
+	}
+
+	/// @brief Tells how a table is backed
+	/// @param size The number of bytes the table was allocated with
+	/// @param kind The kind of memory it was allocated with
+	/// @param stats To return the statistics
+	static void GetStatistics(size_t size, Qtl::System::Memory::PageKind::Enum kind, TableStatistics &stats)
+	{
+		stats.Bytes = size;
+		stats.MappedBytes = size;
+		stats.HugePages = 0;
+		stats.Kind = kind;
+	}
+};
+
+/// @brief The bucket table allocation policy that aligns tables to cache lines and backs the large ones with
+///        huge pages
+/// @remarks A table of half a huge page or more is mapped on its own, with huge pages if the system has them
+///          reserved, or else with normal pages aligned to the huge page size that the kernel is advised to
+///          back with transparent huge pages. A mapped table grows in place as long as it fits in the pages
+///          it has. Smaller tables, and the ones that can't be mapped, come from the C heap, moved up to the
+///          next cache line.
+struct HugePageTableAllocator
+{
+	/// @brief The smallest table to be mapped on its own
+	static const size_t MappingThreshold = Qtl::System::Memory::HugePageSize / 2;
+
+	/// @brief Allocates a table
+	/// @param size The number of bytes
+	/// @param kind To return the kind of memory the table is backed with
+	/// @return The table or NULL if out of memory
+	static void *Allocate(size_t size, Qtl::System::Memory::PageKind::Enum &kind)
+	{
+		using namespace Qtl::System::Memory;
+		if (size >= MappingThreshold)
+		{
+			size_t mappedSize;
+			void *mapped = AllocateHugePages(size, -1, mappedSize, kind);
+			if (mapped != NULL)
+			{
+				return mapped;
+			}
+		}
+		// the line in front of the table keeps the pointer to free
+		char *base = (char*)malloc(size + 2 * CacheLineSize);
+		if (base == NULL)
+		{
+			return NULL;
+		}
+		char *table = (char*)(((size_t)base + 2 * CacheLineSize - 1) / CacheLineSize * CacheLineSize);
+		((void**)table)[-1] = base;
+		kind = PageKind::Heap;
+		return table;
+	}
+
+	/// @brief Resizes a table, keeping its contents up to the smaller of the sizes
+	/// @param p The table
+	/// @param oldSize The number of bytes the table was allocated with
+	/// @param newSize The new number of bytes
+	/// @param kind The kind of memory the table is backed with, to return the kind after resizing
+	/// @return The table, which may have moved, or NULL if out of memory
+	static void *Reallocate(void *p, size_t oldSize, size_t newSize, Qtl::System::Memory::PageKind::Enum &kind)
+	{
+		if (kind != Qtl::System::Memory::PageKind::Heap && newSize >= MappingThreshold
+			&& GetMappedSize(oldSize) == GetMappedSize(newSize))
+		{
+			return p;
+		}
+		Qtl::System::Memory::PageKind::Enum newKind;
+		void *table = Allocate(newSize, newKind);
+		if (table == NULL)
+		{
+			return NULL;
+		}
+		memcpy(table, p, (oldSize < newSize)? oldSize : newSize);
+		Free(p, oldSize, kind);
+		kind = newKind;
+		return table;
+	}
+
+	/// @brief Frees a table
+	/// @param p The table or NULL
+	/// @param size The number of bytes the table was allocated with
+	/// @param kind The kind of memory it was allocated with
+	static void Free(void *p, size_t size, Qtl::System::Memory::PageKind::Enum kind)
+	{
+		if (p == NULL)
+		{
+			return;
+		}
+		if (kind != Qtl::System::Memory::PageKind::Heap)
+		{
+			Qtl::System::Memory::FreePages(p, GetMappedSize(size));
+		}
+		else
+		{
+			free(((void**)p)[-1]);
+		}
+	}
+
+	/// @brief Tells how a table is backed
+	/// @param size The number of bytes the table was allocated with
+	/// @param kind The kind of memory it was allocated with
+	/// @param stats To return the statistics
+	static void GetStatistics(size_t size, Qtl::System::Memory::PageKind::Enum kind, TableStatistics &stats)
+	{
+		using namespace Qtl::System::Memory;
+		stats.Bytes = size;
+		stats.Kind = kind;
+		stats.MappedBytes = (kind != PageKind::Heap)? GetMappedSize(size) : size + 2 * CacheLineSize;
+		stats.HugePages = (kind == PageKind::ExplicitHuge || kind == PageKind::TransparentHuge)?
+			(int)(stats.MappedBytes / HugePageSize) : 0;
+	}
+
+private:
+	/// @brief Returns the number of bytes mapped for a table
+	/// @param size The number of bytes of the table
+	/// @return The number of bytes
+	static size_t GetMappedSize(size_t size)
+	{
+		using namespace Qtl::System::Memory;
+		return (size + HugePageSize - 1) / HugePageSize * HugePageSize;
+	}
+};
+
 /// @brief Split-ordered hash base class
 template <class TValue, class TDisposer=DefaultDisposer<TValue> >
 class SoHash
@@ -29,6 +273,7 @@ public:
 protected:
 
 	/// @brief The base node used for dummy node and for normal node to inherit
+	/// @remarks It has no virtual table, nodes are told apart by the lowest bit of their SO-keys
 	struct BaseNode
 	{
 		/// @brief SO-key for the node (bit-reversal) plus 1 if non-dummy
@@ -42,27 +287,21 @@ protected:
 		BaseNode(KeyType key) : Key(key), Next(NULL)
 		{
 		}
-		
-		/// @brief Finalises the BaseNode
-		virtual ~BaseNode()
-		{
-		}
 	};
 
 	/// @brief Normal node as an extension of BaseNode
-	class Node : public BaseNode
+	class Node : public BaseNode, public SoNodeStorage<TValue>
 	{
 	private:
 		/// @brief The base class
 		typedef BaseNode	Base;
 
-	public:
-		/// @brief The value this node contains
-		ValueType Value;
+		/// @brief The part that holds the value (named Value)
+		typedef SoNodeStorage<TValue>	Storage;
 
 	public:
 		/// @brief Instantiates a Node with the specified key and value
-		Node(KeyType key, ValueType value) : Base(key), Value(value)
+		Node(KeyType key, const ValueType &value) : Base(key), Storage(value)
 		{
 		}
 	};
@@ -92,7 +331,7 @@ public:	// Nested types
 			do
 			{
 				_node = _node->Next;
-			} while (_node != NULL && dynamic_cast<Node*>(_node) == NULL);
+			} while (_node != NULL && (_node->Key & 0x1) == 0);
 		}
 	
 	protected:
@@ -101,6 +340,8 @@ public:	// Nested types
 		Iterator(BaseNode *node) : _node(node)
 		{
 		}
+
+		friend class SoHash;
 	
 	public:
 		/// @brief Instantiates an iterator associated to default (NULL) node
@@ -126,10 +367,18 @@ public:	// Nested types
 		/// @brief Determines if the two iterators are the same
 		/// @param other The iterator to compare this one to
 		/// @return true if they are considered the same or false
-		bool operator==(const Iterator &other)
+		bool operator==(const Iterator &other) const
 		{
 			return (_node == other._node);
 		}
+
+		/// @brief Determines if the two iterators are different
+		/// @param other The iterator to compare this one to
+		/// @return true if they are considered different or false
+		bool operator!=(const Iterator &other) const
+		{
+			return (_node != other._node);
+		}
 	
 		/// @brief Moves the iterator to the next node and returns the iterator itself after the move
 		/// @return The iterator
@@ -143,7 +392,7 @@ public:	// Nested types
 		/// @return A copy of the iterator before the move
 		Iterator operator++(int)
 		{
-			Iterator result(this);
+			Iterator result(*this);
 			MoveNext();
 			return result;
 		}
@@ -152,7 +401,7 @@ public:	// Nested types
 		/// @return The value
 		ValueType &operator*()
 		{
-			return (_node != NULL)? dynamic_cast<Node*>(_node)->Value : ValueType();
+			return static_cast<Node*>(_node)->Value;
 		}
 	};
 	
@@ -162,12 +411,26 @@ public:	// Nested types
 	private:
 		typedef Iterator Base;
 
+	protected:
+		/// @brief Instantiates an iterator with the specified node
+		/// @param node The node the iterator to bind to
+		ConstIterator(BaseNode *node) : Base(node)
+		{
+		}
+
+		friend class SoHash;
+
 	public:
+		/// @brief Instantiates an iterator associated to default (NULL) node
+		ConstIterator()
+		{
+		}
+
 		/// @brief Returns the read-only value the iterator references
 		/// @return The value
 		const ValueType &operator*() const
 		{
-			return (Base::_node != NULL)? dynamic_cast<Node*>(Base::_node)->Value : ValueType();
+			return static_cast<Node*>(Base::_node)->Value;
 		}
 	};	
 
@@ -181,6 +444,56 @@ public:	// Nested types
 			AddDuplicate
 		};
 	};	
+
+	/// @brief The position of a run of items read with GetItems()
+	/// @remarks It's the SO-key of the last item read and the number of items read with that SO-key. It stays
+	///          valid whatever is added to or deleted from the hash in between as long as no two items share
+	///          an SO-key, i.e. the keys are unique modulo 2^31. Otherwise an item added to or deleted from the
+	///          run of the last SO-key read shifts the run under the count, which makes the next read return an
+	///          item of the run again or skip one.
+	struct ItemPosition
+	{
+		/// @brief The SO-key of the last item read, 0 before the first item
+		KeyType SoKey;
+
+		/// @brief The number of items with the SO-key that have been read
+		int Skip;
+
+		/// @brief Instantiates a position before the first item
+		ItemPosition() : SoKey(0), Skip(0)
+		{
+		}
+	};
+
+	/// @brief What becomes of the source hash when its items are migrated to another
+	struct MigrationMode
+	{
+		enum Enum
+		{
+			Copy,	///< the source keeps its items and the values are copied
+			Move,	///< the source is emptied without disposing of the values, which the target now owns
+			Mirror	///< the source keeps its items and its writes are applied to the target as well until
+					///< FinishMigration() is called, the target owns the values and is written through the
+					///< source alone until then
+		};
+	};
+
+	/// @brief Statistics of the negative lookup filter
+	struct FilterStatistics
+	{
+		/// @brief The number of lookups the filter turned down without walking the list
+		long Rejections;
+
+		/// @brief The number of lookups the filter let through for keys that turned out to be absent
+		long FalsePositives;
+
+		/// @brief The proportion of lookups for absent keys that the filter failed to turn down
+		double FalsePositiveRate;
+
+		/// @brief The number of bytes the filter takes
+		size_t MemorySize;
+	};
+
 protected:
 	/// @brief The number of items
 	int _count;
@@ -189,20 +502,55 @@ protected:
 	int _tableIndexBits;
 
 	/// @brief The mutex used to make code re-entrant
-	Qtl::System::Threading::Mutex _mutex;
+	mutable Qtl::System::Threading::Mutex _mutex;
 
 private:
+	/// @brief The number of stripes the filter statistics are spread over
+	static const int FilterCounterStripes = 16;
+
+	/// @brief A counter padded to a cache line so that the stripes don't share one
+	struct PaddedCounter
+	{
+		volatile long Value;
+		char Padding[64 - sizeof(long)];
+	};
+
 	TDisposer _disposer;
 
+	/// @brief The allocator of the nodes or NULL for the global operator new
+	NodeAllocator *_nodeAllocator;
+
+	/// @brief The domain unlinked nodes are retired to in the read-mostly mode or NULL
+	Qtl::System::Rcu::QsbrDomain *_rcuDomain;
+
+	/// @brief The optional filter that turns down lookups of absent keys before the list is walked
+	CountingBloomFilter *_negativeFilter;
+
+	/// @brief The number of filter counters per item the filter is sized with
+	int _filterCountersPerKey;
+
+	/// @brief Filters replaced while lock-free readers might still be using them outside the read-mostly
+	///        mode, one of each size at most, to be reused
+	std::vector<CountingBloomFilter*> _retiredFilters;
+
+	/// @brief The hash the writes are applied to as well during an online migration or NULL
+	SoHash *_mirror;
+
+	/// @brief The stripes of the number of lookups the filter has turned down followed by the stripes of the
+	///        number it has let through for absent keys, allocated when the filter is first enabled
+	PaddedCounter *_filterCounters;
+
 protected:	// it's an abstract class so we make its constructor non-public
 	/// @brief Instantiates a SoHash
-	SoHash() : _count(0), _tableIndexBits(1)
+	SoHash() : _count(0), _tableIndexBits(1), _nodeAllocator(NULL), _rcuDomain(NULL), _negativeFilter(NULL), _filterCountersPerKey(0),
+		_mirror(NULL), _filterCounters(NULL)
 	{
 	}
 
 	/// @brief Instantiates a SoHash with the specified disposer
 	/// @param disposer The functor that finalizes the value
-	SoHash(const TDisposer &disposer) : _disposer(disposer), _count(0), _tableIndexBits(1)
+	SoHash(const TDisposer &disposer) : _count(0), _tableIndexBits(1), _disposer(disposer), _nodeAllocator(NULL), _rcuDomain(NULL), _negativeFilter(NULL),
+		_filterCountersPerKey(0), _mirror(NULL), _filterCounters(NULL)
 	{
 	}
 
@@ -211,6 +559,14 @@ public:
 	/// @brief destructor
 	virtual ~SoHash()
 	{
+		if (_rcuDomain != NULL)
+		{
+			// nothing can reach the retired nodes of a hash being destroyed
+			_rcuDomain->ReclaimNow(this);
+		}
+		delete _negativeFilter;
+		FreeRetiredFilters();
+		delete[] _filterCounters;
 	}
 
 public:	// properties
@@ -228,12 +584,267 @@ public:	// properties
 		return _tableIndexBits;
 	}
 
+	/// @brief Returns the number of bytes an item node takes
+	/// @return The number of bytes
+	static size_t GetNodeSize()
+	{
+		return sizeof(Node);
+	}
+
+	/// @brief Returns the allocator of the nodes
+	/// @return The allocator or NULL if the global operator new is used
+	NodeAllocator *GetNodeAllocator() const
+	{
+		return _nodeAllocator;
+	}
+
+	/// @brief Sets the allocator of the nodes
+	/// @param allocator The allocator that outlives the hash or NULL for the global operator new
+	/// @return false if the hash has nodes and the allocator is not changed
+	bool SetNodeAllocator(NodeAllocator *allocator)
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		if (GetBucket(0) != NULL)
+		{
+			return false;
+		}
+		_nodeAllocator = allocator;
+		return true;
+		// unlock
+	}
+
+	/// @brief Determines if the hash is in the read-mostly mode
+	/// @return true if it is
+	bool IsReadMostly() const
+	{
+		return _rcuDomain != NULL;
+	}
+
+	/// @brief Switches the hash to the read-mostly mode in which nothing a reader may be looking at is freed
+	///        or modified in place before a grace period of the domain has elapsed
+	/// @param domain The domain that outlives the hash and that the readers announce their quiescent states to
+	/// @return false if the hash is already in the read-mostly mode with another domain
+	/// @remarks Readers then take no locks and write no shared memory, the statistics of the negative filter
+	///          are not counted. A pointer to a value found stays valid until the reader's next quiescent
+	///          state. Replacing a value links a copy of the node in place of the original.
+	bool EnableReadMostly(Qtl::System::Rcu::QsbrDomain &domain)
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		if (_rcuDomain != NULL && _rcuDomain != &domain)
+		{
+			return false;
+		}
+		_rcuDomain = &domain;
+		return true;
+		// unlock
+	}
+
+	/// @brief Returns the statistics of the negative lookup filter
+	/// @param stats To return the statistics, all zero if the filter is not enabled
+	void GetFilterStatistics(FilterStatistics &stats) const
+	{
+		CountingBloomFilter *filter = Qtl::System::Threading::AtomicLoadAcquire(&_negativeFilter);
+		stats.Rejections = 0;
+		stats.FalsePositives = 0;
+		if (_filterCounters != NULL)
+		{
+			for (int i = 0; i < FilterCounterStripes; i++)
+			{
+				stats.Rejections += _filterCounters[i].Value;
+				stats.FalsePositives += _filterCounters[FilterCounterStripes + i].Value;
+			}
+		}
+		long negatives = stats.Rejections + stats.FalsePositives;
+		stats.FalsePositiveRate = (negatives > 0)? (double)stats.FalsePositives / negatives : 0;
+		stats.MemorySize = (filter != NULL)? filter->GetMemorySize() : 0;
+	}
+
 public:
+	/// @brief Puts a counting Bloom filter in front of the lookups so that most of the lookups for
+	///        absent keys return without walking the list
+	/// @param countersPerKey The number of 4-bit counters per item, more for fewer false positives
+	/// @remarks The filter is resized along with the bucket table and its counters are updated by
+	///          the writers under the lock; lookups read it without locking. The statistics are counted on
+	///          relaxed counters striped by key, which are allocated on the first call and reset on each
+	void EnableNegativeFilter(int countersPerKey=16)
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		_filterCountersPerKey = countersPerKey;
+		if (_filterCounters == NULL)
+		{
+			// published along with the filter, which the lookups check first
+			_filterCounters = new PaddedCounter[FilterCounterStripes*2];
+		}
+		for (int i = 0; i < FilterCounterStripes*2; i++)
+		{
+			_filterCounters[i].Value = 0;
+		}
+		RebuildNegativeFilter();
+		// unlock
+	}
+
+	/// @brief Removes the negative lookup filter
+	void DisableNegativeFilter()
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		if (_negativeFilter != NULL)
+		{
+			CountingBloomFilter *filter = _negativeFilter;
+			Qtl::System::Threading::AtomicStoreRelease(&_negativeFilter, (CountingBloomFilter*)NULL);
+			RetireFilter(filter);
+		}
+		// unlock
+	}
+
+	/// @brief Grows the bucket table in advance for a number of items
+	/// @param count The number of items
+	void Reserve(int count)
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		ExpandToFit(count);
+		// unlock
+	}
+
+	/// @brief Migrates all the items to another hash, e.g. one with a different load factor or table
+	///        allocator, using several threads
+	/// @param target The empty hash to migrate to
+	/// @param threadCount The number of threads to copy with, including the calling one
+	/// @param mode What becomes of this hash, see MigrationMode
+	/// @return The number of items migrated or -1 if the target is not empty, is this hash or either hash
+	///         is being migrated already
+	/// @remarks The split-ordered list is cut into partitions by the top bits of the SO-keys, which are
+	///          ranges of whole buckets in both tables; the threads take the partitions in turn and build
+	///          the chains of the target nodes, dummy ones included, which are then joined together. The
+	///          writers of this hash wait for the copy while its readers carry on. With MigrationMode::Mirror
+	///          the writes made after the copy go to both hashes, so that the readers can be moved to the
+	///          target at any time before FinishMigration() is called. The writers have to keep going through
+	///          this hash until then: the writes are mirrored by the positions of the items in it, so one
+	///          made to the target directly would put the two hashes out of step. The locks of this hash
+	///          and of the target are taken in this order. This hash keeps a pointer to the target until then,
+	///          so the target must not be destroyed before FinishMigration() is called or this hash is.
+	int MigrateTo(SoHash &target, int threadCount, typename MigrationMode::Enum mode=MigrationMode::Copy)
+	{
+		if (&target == this)
+		{
+			return -1;
+		}
+
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		// lock
+		Qtl::System::Threading::LockGuard targetLock(target._mutex);
+		if (target._count != 0 || _mirror != NULL || target._mirror != NULL)
+		{
+			return -1;
+		}
+		// the target may have dummy nodes left from the items it had
+		target.ClearNodes(true);
+		target.ExpandToFit(_count);
+
+		MigrationJob job;
+		job.Source = this;
+		job.Target = &target;
+		job.TargetTableSize = target.GetTableSize();
+		job.PartitionBits = 0;
+		while ((1 << job.PartitionBits) < threadCount * 4 && job.PartitionBits < _tableIndexBits
+			&& job.PartitionBits < target._tableIndexBits)
+		{
+			job.PartitionBits++;
+		}
+		int partitionCount = 1 << job.PartitionBits;
+		job.Starts.resize(partitionCount);
+		job.Heads.resize(partitionCount);
+		job.Tails.resize(partitionCount);
+		job.Counts.resize(partitionCount);
+		job.NextPartition = 0;
+		for (int k = 0; k < partitionCount; k++)
+		{
+			// the bucket whose dummy node starts partition k
+			int indexBucket = (job.PartitionBits == 0)? 0 : (int)Reverse((KeyType)k << (32 - job.PartitionBits));
+			BaseNode *start = GetBucket(indexBucket);
+			job.Starts[k] = (start != NULL)? start : InitializeBucket(indexBucket);
+		}
+
+		int helperCount = (threadCount < partitionCount? threadCount : partitionCount) - 1;
+		Qtl::System::Threading::Thread *helpers = (helperCount > 0)?
+			new Qtl::System::Threading::Thread[helperCount] : NULL;
+		for (int i = 0; i < helperCount; i++)
+		{
+			// the calling thread does the partitions left if a thread cannot be started
+			helpers[i].Start(MigratePartitions, &job);
+		}
+		MigratePartitions(&job);
+		delete[] helpers;	// joins the threads
+
+		BaseNode *tail = NULL;
+		int migrated = 0;
+		for (int k = 0; k < partitionCount; k++)
+		{
+			if (job.Heads[k] == NULL)
+			{
+				continue;
+			}
+			if (tail != NULL)
+			{
+				Qtl::System::Threading::AtomicStoreRelease(&tail->Next, job.Heads[k]);
+			}
+			tail = job.Tails[k];
+			migrated += job.Counts[k];
+		}
+		target._count = migrated;
+		if (target._negativeFilter != NULL)
+		{
+			target.RebuildNegativeFilter();
+		}
+
+		if (mode == MigrationMode::Move)
+		{
+			ClearNodes(false);
+		}
+		else if (mode == MigrationMode::Mirror)
+		{
+			_mirror = &target;
+		}
+		return migrated;
+		// unlock
+		// unlock
+	}
+
+	/// @brief Ends an online migration started with MigrationMode::Mirror, after which this hash is empty
+	/// @return false if this hash is not being migrated
+	/// @remarks The values are not disposed of as they belong to the target
+	bool FinishMigration()
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		if (_mirror == NULL)
+		{
+			return false;
+		}
+		_mirror = NULL;
+		ClearNodes(false);
+		return true;
+		// unlock
+	}
+
+	/// @brief Returns the hash the writes are applied to as well
+	/// @return The target of the online migration in progress or NULL
+	SoHash *GetMirror() const
+	{
+		return _mirror;
+	}
+
 	/// @brief Returns the iterator to the first non-dummy item
 	/// @return The iterator
 	Iterator GetBegin()
 	{
 		Iterator begin(GetBucket(0));
+		if (begin._node == NULL) return begin;
 		return ++begin;
 	}
 
@@ -249,7 +860,9 @@ public:
 	ConstIterator GetBegin() const
 	{
 		ConstIterator begin(GetBucket(0));
-		return ++begin;
+		if (begin._node == NULL) return begin;
+		++begin;
+		return begin;
 	}
 
 	/// @brief Returns the iterator to the tail (NULL)
@@ -268,40 +881,57 @@ public:
 	{
 		KeyType soDummyKey = Reverse(key);
 		KeyType soKey = soDummyKey | 0x1;
-		Node *node = new Node(soKey, value);
+		Node *node = CreateNode(soKey, value);
 
 		// lock
 		Qtl::System::Threading::LockGuard lock(_mutex);
-		
-		int indexBucket = (int) (key & ((KeyType) GetTableSize() - 1));
-		BaseNode *cp = GetBucket(indexBucket);
-		if (cp == NULL)
+		if (_mirror != NULL)
 		{
-			cp = InitializeBucket(indexBucket);
+			// the mirror has the same items so the strategy has the same outcome there
+			_mirror->AddKeyValuePair(key, value, addStrategy);
 		}
-		for (; cp->Next != NULL && cp->Next->Key < soKey; cp = cp->Next)
-        {
-        }
-		if (cp->Next != NULL && cp->Next->Key == soKey)
+		return LinkNode(key, node, addStrategy);
+		// unlock
+	}
+
+	/// @brief Adds key value pairs in a batch under one acquisition of the lock
+	/// @param keys The keys
+	/// @param values The values, one for each key
+	/// @param count The number of pairs
+	/// @param addStrategy How to deal with duplication
+	/// @return The number of pairs added
+	/// @remarks The nodes are created and the SO-keys worked out before the lock is taken
+	int AddBatch(const KeyType *keys, const ValueType *values, int count,
+		enum AddStrategy::Enum addStrategy=AddStrategy::ReplaceExisting)
+	{
+		const int blockSize = 64;
+		KeyType soKeys[blockSize];
+		std::vector<Node*> nodes(count);
+		for (int start = 0; start < count; start += blockSize)
 		{
-			switch (addStrategy)
-            {
-			case AddStrategy::ReplaceExisting:
-                ((Node*)cp->Next)->Value = value;
-                return true;
-			case AddStrategy::ReturnFalseOnExisting:
-                return false;
-            }
+			int blockCount = (count - start < blockSize)? count - start : blockSize;
+			BitReverse::ReverseBatch(keys + start, soKeys, blockCount);
+			for (int i = 0; i < blockCount; i++)
+			{
+				nodes[start+i] = CreateNode(soKeys[i] | 0x1, values[start+i]);
+			}
 		}
 
-		node->Next = cp->Next;
-        cp->Next = node;
-
-        _count++;
-
-        ExpandIfNeeded();
-		
-		return true;
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		if (_mirror != NULL)
+		{
+			_mirror->AddBatch(keys, values, count, addStrategy);
+		}
+		int numAdded = 0;
+		for (int i = 0; i < count; i++)
+		{
+			if (LinkNode(keys[i], nodes[i], addStrategy))
+			{
+				numAdded++;
+			}
+		}
+		return numAdded;
 		// unlock
 	}
 
@@ -310,25 +940,11 @@ public:
 	{
 		// lock
 		Qtl::System::Threading::LockGuard lock(_mutex);
-
-		BaseNode *cp = GetBucket(0);
-        if (cp == NULL) return;
-
-		BaseNode *cpNext;
-		for (; cp != NULL; cp = cpNext)
-        {
-			cpNext = cp->Next;
-			Node *node = dynamic_cast<Node*>(cp);
-			if (node != NULL)
-			{
-				_disposer(node->Value);
-			}
-			delete cp;
-        }
-
-        ResetBuckets();
-        _tableIndexBits = 1;
-        _count = 0;
+		if (_mirror != NULL)
+		{
+			_mirror->Clear();
+		}
+		ClearNodes(_mirror == NULL);
 		// unlock
 	}
 
@@ -356,6 +972,98 @@ public:
         return true;
 	}
 
+	/// @brief Gets the first items with each of the keys in a batch
+	/// @param keys The keys to find the items with
+	/// @param count The number of keys
+	/// @param ppValues To return the pointers to the values, NULL for keys that are not found
+	/// @return The number of keys found
+	/// @remarks The SO-keys are worked out in bulk with the batch bit-reversal kernel
+	int FindBatch(const KeyType *keys, int count, ValueType **ppValues) const
+	{
+		const int blockSize = 64;
+		KeyType soKeys[blockSize];
+		int numFound = 0;
+		for (int start = 0; start < count; start += blockSize)
+		{
+			int blockCount = (count - start < blockSize)? count - start : blockSize;
+			BitReverse::ReverseBatch(keys + start, soKeys, blockCount);
+			for (int i = 0; i < blockCount; i++)
+			{
+				Node *node = _FindFirstPtrBySoKey(keys[start+i], soKeys[i] | 0x1);
+				if (node != NULL)
+				{
+					ppValues[start+i] = &node->Value;
+					numFound++;
+				}
+				else
+				{
+					ppValues[start+i] = NULL;
+				}
+			}
+		}
+		return numFound;
+	}
+
+	/// @brief Copies the next run of items in the split order under one acquisition of the lock
+	/// @param position The position to read from, which is moved past the items read
+	/// @param keys To return the keys of the items; the highest bit of a key is not kept in its SO-key so
+	///        the keys are returned modulo 2^31
+	/// @param values To return the values of the items
+	/// @param max The maximum number of items to read
+	/// @return The number of items read, 0 at the end
+	/// @remarks Items added behind the position while the items are being read in runs are not seen and the
+	///          ones deleted ahead of it are not returned. With duplicate keys this holds only if the run of the
+	///          last SO-key read is left alone in between, see ItemPosition.
+	int GetItems(ItemPosition &position, KeyType *keys, ValueType *values, int max) const
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		BaseNode *cp = GetBucket(0);
+		if (cp == NULL)
+		{
+			return 0;
+		}
+		if (position.SoKey != 0)
+		{
+			// starts from the closest initialized bucket that precedes the position
+			int indexBucket = (int)(Reverse(position.SoKey) & ((KeyType)GetTableSize() - 1));
+			for (; GetBucket(indexBucket) == NULL; indexBucket = GetParent(indexBucket))
+			{
+			}
+			cp = GetBucket(indexBucket);
+		}
+		for (; cp != NULL && cp->Key < position.SoKey; cp = cp->Next)
+		{
+		}
+		for (int skipped = 0; cp != NULL && cp->Key == position.SoKey && skipped < position.Skip; cp = cp->Next)
+		{
+			skipped++;
+		}
+
+		int count = 0;
+		for (; cp != NULL && count < max; cp = cp->Next)
+		{
+			if ((cp->Key & 0x1) == 0)
+			{
+				continue;
+			}
+			keys[count] = Reverse(cp->Key) & 0x7fffffff;
+			values[count] = static_cast<Node*>(cp)->Value;
+			count++;
+			if (cp->Key == position.SoKey)
+			{
+				position.Skip++;
+			}
+			else
+			{
+				position.SoKey = cp->Key;
+				position.Skip = 1;
+			}
+		}
+		return count;
+		// unlock
+	}
+
 	/// @brief Gets the first item with the key
 	/// @param key The key to find the item with
 	/// @param values All the values with the key (multiple values if duplicate values allowed)
@@ -363,11 +1071,11 @@ public:
 	bool Find(KeyType key, std::vector<ValueType> &values) const
 	{
 		KeyType soKey;
-		Node *cp = _FindFirstPtr(key, soKey);
+		BaseNode *cp = _FindFirstPtr(key, soKey);
 		values.clear();
 		for (; cp != NULL && cp->Key == soKey; cp = cp->Next)
         {
-			values.push_back(dynamic_cast<Node*>(cp)->Value);
+			values.push_back(static_cast<Node*>(cp)->Value);
         }
 		
 		return (values.size() > 0);
@@ -385,7 +1093,7 @@ public:
 		{
 			*pSoKey = soKey;
 		}
-		return (*iter);
+		return iter;
 	}
 	
 	/// @brief Gets the constant to the first item with the key
@@ -398,33 +1106,366 @@ public:
 		ConstIterator iter = _FindFirstCItr(key, soKey);
 		if (pSoKey != NULL)
 		{
-			*pSoKey = soKey;
+			*pSoKey = soKey;
+		}
+		return iter;
+	}
+
+	/// @brief Deletes all the items with the specified key
+	/// @param key The key to delete items with
+	/// @return The number of items deleted
+	int DeleteKey(KeyType key)
+	{
+		AllwaysTruePredicate alwaysTrue;
+		return DeleteKeyValuePairs<AllwaysTruePredicate&>(key, alwaysTrue);
+	}
+
+	/// @brief Delete all the items with the specified key and satisfying the predicate
+	/// @param key The key to delete items with
+	/// @param isTarget The predicate to determine if the item with the key should be deleted
+	/// @return The number of items deleted
+	template <class TPredicate>
+	int DeleteKeyValuePairs(KeyType key, TPredicate isTarget)
+	{
+        // lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		if (_mirror != NULL)
+		{
+			// the predicate is called for the values of the mirror as well
+			_mirror->DeleteKeyValuePairs(key, isTarget);
+		}
+		std::vector<BaseNode*> retired;
+		int deleted = UnlinkNodes<TPredicate>(key, isTarget, retired);
+		RetireNodes(retired, _mirror == NULL);
+		return deleted;
+        // unlock
+	}
+
+	/// @brief Deletes all the items with each of the keys in a batch under one acquisition of the lock
+	/// @param keys The keys
+	/// @param count The number of keys
+	/// @param numDeleted To return the number of items deleted with each key or NULL
+	/// @return The number of items deleted
+	int DeleteBatch(const KeyType *keys, int count, int *numDeleted=NULL)
+	{
+		AllwaysTruePredicate alwaysTrue;
+		std::vector<BaseNode*> retired;
+		int total = 0;
+
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		if (_mirror != NULL)
+		{
+			_mirror->DeleteBatch(keys, count);
+		}
+		for (int i = 0; i < count; i++)
+		{
+			int deleted = UnlinkNodes<AllwaysTruePredicate&>(keys[i], alwaysTrue, retired);
+			if (numDeleted != NULL)
+			{
+				numDeleted[i] = deleted;
+			}
+			total += deleted;
+		}
+		RetireNodes(retired, _mirror == NULL);
+		return total;
+		// unlock
+	}
+
+	/// @brief Deletes all the items satisfying the predicate in a single sweep of the list
+	/// @param isTarget The predicate to determine if an item should be deleted
+	/// @return The number of items deleted
+	/// @remarks The items are unlinked under one acquisition of the lock and their values are disposed of
+	///          in a batch after the lock is released so that writers are not held up by the disposer. The
+	///          predicate is called once for each item; during a mirrored migration the same items are
+	///          erased from the target by their positions in the list.
+	template <class TPredicate>
+	int EraseIf(TPredicate isTarget)
+	{
+		std::vector<BaseNode*> erased;
+		bool dispose;
+		{
+			// lock
+			Qtl::System::Threading::LockGuard lock(_mutex);
+			// the predicate is called once per item and the mirror is told the positions of the items erased
+			std::vector<ItemPosition> positions;
+			PredicateSelector<TPredicate> select(isTarget, (_mirror != NULL)? &positions : NULL);
+			UnlinkSelected(select, erased);
+			if (_mirror != NULL)
+			{
+				_mirror->ErasePositions(positions);
+			}
+			dispose = (_mirror == NULL);
+			// unlock
+		}
+
+		RetireNodes(erased, dispose);
+		return (int)erased.size();
+	}
+
+protected:	// pure virtual (abstract) methods
+
+	/// @brief Gets the specified bucket of the bucket table for the hash algorithm to access
+	/// @param index The index of the bucket
+	virtual BaseNode * GetBucket(int index) const = 0;
+	
+	/// @brief Sets node for the specified bucket of the bucket table for the hash algorithm to access
+	/// @param index The index of the bucket
+	/// @param bucket The node to set to the specified bucket
+	virtual void SetBucket(int index, BaseNode *bucket) = 0;
+
+	/// @brief Sets the base node for the bucket that has been created by doubling the bucket table
+	virtual void AddBucket(int index, BaseNode *node) = 0;
+
+	/// @brief Calls the Double() method if the implementation reckons it should
+	virtual void ExpandIfNeeded() = 0;
+
+	/// @brief Calls the Double() method as many times as the implementation reckons it takes for a
+	///        number of items
+	/// @param count The number of items
+	virtual void ExpandToFit(int count) = 0;
+
+	/// @brief The size of the bucket table. It's provided by the implementer 
+	/// @return The table size
+	/// @remarks The current design requires it to start at 2 and double only after a double (expansion) operation, 
+	///          But there's no restriction on the allocation of the internal memory for the bucket table
+	virtual int GetTableSize() const = 0;
+	
+	/// @brief Resets the buckets to the initial state, normally part of the clear up process
+	virtual void ResetBuckets() = 0;
+
+private:
+	/// @brief The state shared by the threads of a migration
+	struct MigrationJob
+	{
+		/// @brief The hash migrated from
+		SoHash *Source;
+
+		/// @brief The hash migrated to
+		SoHash *Target;
+
+		/// @brief The size of the bucket table of the target
+		int TargetTableSize;
+
+		/// @brief The number of top bits of the SO-keys that tell the partitions apart
+		int PartitionBits;
+
+		/// @brief The first node of each partition in the source
+		std::vector<BaseNode*> Starts;
+
+		/// @brief The first node of the chain built for each partition or NULL if it is empty
+		std::vector<BaseNode*> Heads;
+
+		/// @brief The last node of the chain built for each partition
+		std::vector<BaseNode*> Tails;
+
+		/// @brief The number of items in each partition
+		std::vector<int> Counts;
+
+		/// @brief The next partition to be taken by a thread
+		volatile int NextPartition;
+	};
+
+	/// @brief Picks the items an EraseIf() predicate is true for, noting their positions for the mirror
+	template <class TPredicate>
+	struct PredicateSelector
+	{
+		/// @brief The predicate
+		TPredicate IsTarget;
+
+		/// @brief To add the positions of the items picked to or NULL
+		std::vector<ItemPosition> *Positions;
+
+		PredicateSelector(TPredicate isTarget, std::vector<ItemPosition> *positions)
+			: IsTarget(isTarget), Positions(positions)
+		{
+		}
+
+		bool operator()(const Node *node, int ordinal)
+		{
+			if (!IsTarget(node->Value))
+			{
+				return false;
+			}
+			if (Positions != NULL)
+			{
+				ItemPosition position;
+				position.SoKey = node->Key;
+				position.Skip = ordinal;
+				Positions->push_back(position);
+			}
+			return true;
+		}
+	};
+
+	/// @brief Picks the items at positions noted in the list order by a PredicateSelector
+	struct PositionSelector
+	{
+		/// @brief The positions
+		const std::vector<ItemPosition> &Positions;
+
+		/// @brief The index of the next position to pick
+		size_t Next;
+
+		PositionSelector(const std::vector<ItemPosition> &positions) : Positions(positions), Next(0)
+		{
+		}
+
+		bool operator()(const Node *node, int ordinal)
+		{
+			// the positions this hash does not have are passed over
+			for (; Next < Positions.size() && (Positions[Next].SoKey < node->Key
+				|| (Positions[Next].SoKey == node->Key && Positions[Next].Skip < ordinal)); Next++)
+			{
+			}
+			if (Next < Positions.size() && Positions[Next].SoKey == node->Key && Positions[Next].Skip == ordinal)
+			{
+				Next++;
+				return true;
+			}
+			return false;
+		}
+	};
+
+	/// @brief Takes the partitions of a migration in turn until there are none left
+	/// @param job The migration
+	static void MigratePartitions(void *job)
+	{
+		MigrationJob *migration = static_cast<MigrationJob*>(job);
+		int partitionCount = (int)migration->Starts.size();
+		for (;;)
+		{
+			int k = Qtl::System::Threading::AtomicAdd(&migration->NextPartition, 1) - 1;
+			if (k >= partitionCount)
+			{
+				break;
+			}
+			MigratePartition(*migration, k);
+		}
+	}
+
+	/// @brief Builds the chain of the target nodes for a partition of a migration
+	/// @param job The migration
+	/// @param k The partition
+	/// @remarks The partitions are ranges of whole buckets in the target table so the dummy nodes of the
+	///          buckets are created and set here without any lock
+	static void MigratePartition(MigrationJob &job, int k)
+	{
+		SoHash &target = *job.Target;
+		BaseNode *head = NULL;
+		BaseNode *tail = NULL;
+		int count = 0;
+		int lastBucket = -1;
+		if (k == 0)
+		{
+			// the dummy node of bucket 0 is the head of the whole list
+			head = tail = target.CreateDummyNode(0);
+			target.SetBucket(0, head);
+			lastBucket = 0;
+		}
+		for (BaseNode *cp = job.Starts[k]; cp != NULL; cp = cp->Next)
+		{
+			if (job.PartitionBits > 0 && (int)(cp->Key >> (32 - job.PartitionBits)) != k)
+			{
+				break;
+			}
+			if ((cp->Key & 0x1) == 0)
+			{
+				continue;
+			}
+			int indexBucket = (int)(BitReverse::Reverse(cp->Key) & ((KeyType)job.TargetTableSize - 1));
+			if (indexBucket != lastBucket)
+			{
+				BaseNode *dummyNode = target.CreateDummyNode(BitReverse::Reverse((KeyType)indexBucket));
+				target.SetBucket(indexBucket, dummyNode);
+				if (tail != NULL)
+				{
+					tail->Next = dummyNode;
+				}
+				else
+				{
+					head = dummyNode;
+				}
+				tail = dummyNode;
+				lastBucket = indexBucket;
+			}
+			Node *node = target.CreateNode(cp->Key, static_cast<Node*>(cp)->Value);
+			tail->Next = node;
+			tail = node;
+			count++;
+		}
+		job.Heads[k] = head;
+		job.Tails[k] = tail;
+		job.Counts[k] = count;
+	}
+
+	/// @brief Links a new node into the list with the lock held
+	/// @param key The key of the node
+	/// @param node The node created with the SO-key of the key
+	/// @param addStrategy How to deal with duplication
+	/// @return true if the node is added or replaces an existing one; the node is destroyed if it is not linked
+	bool LinkNode(KeyType key, Node *node, enum AddStrategy::Enum addStrategy)
+	{
+		KeyType soKey = node->Key;
+		int indexBucket = (int) (key & ((KeyType) GetTableSize() - 1));
+		BaseNode *cp = GetBucket(indexBucket);
+		if (cp == NULL)
+		{
+			cp = InitializeBucket(indexBucket);
+		}
+		for (; cp->Next != NULL && cp->Next->Key < soKey; cp = cp->Next)
+        {
+        }
+		if (cp->Next != NULL && cp->Next->Key == soKey)
+		{
+			switch (addStrategy)
+            {
+			case AddStrategy::ReplaceExisting:
+				if (_rcuDomain != NULL)
+				{
+					// readers may be looking at the value so the node is replaced as a whole
+					BaseNode *replaced = cp->Next;
+					node->Next = replaced->Next;
+					Qtl::System::Threading::AtomicStoreRelease(&cp->Next, (BaseNode*)node);
+					RetireNode(replaced, false);
+					return true;
+				}
+                ((Node*)cp->Next)->Value = node->Value;
+				DestroyNode(node);
+                return true;
+			case AddStrategy::ReturnFalseOnExisting:
+				DestroyNode(node);
+                return false;
+			default:
+				break;
+            }
+		}
+
+		if (_negativeFilter != NULL)
+		{
+			_negativeFilter->Add(soKey);
 		}
-		return (*iter);
-	}
 
-	/// @brief Deletes all the items with the specified key
-	/// @param key The key to delete items with
-	/// @return The number of items deleted
-	int DeleteKey(KeyType key)
-	{
-		AllwaysTruePredicate alwaysTrue;
-		return DeleteKeyValuePairs<AllwaysTruePredicate&>(key, alwaysTrue);
+		node->Next = cp->Next;
+		Qtl::System::Threading::AtomicStoreRelease(&cp->Next, (BaseNode*)node);
+
+        _count++;
+
+        ExpandIfNeeded();
+		
+		return true;
 	}
 
-	/// @brief Delete all the items with the specified key and satisfying the predicate
+	/// @brief Deletes the items with a key that satisfy a predicate with the lock held
 	/// @param key The key to delete items with
 	/// @param isTarget The predicate to determine if the item with the key should be deleted
+	/// @param retired To add the nodes to that are to be retired in a batch in the read-mostly mode
 	/// @return The number of items deleted
 	template <class TPredicate>
-	int DeleteKeyValuePairs(KeyType key, TPredicate isTarget)
+	int UnlinkNodes(KeyType key, TPredicate isTarget, std::vector<BaseNode*> &retired)
 	{
-		KeyType soDummyKey = Reverse(key);
-        KeyType soKey = soDummyKey | 0x1;
+		KeyType soKey = Reverse(key) | 0x1;
 
-        // lock
-		Qtl::System::Threading::LockGuard lock(_mutex);
-        
         int indexBucket = (int) (key & ((KeyType) GetTableSize() - 1));
         BaseNode *cp = GetBucket(indexBucket);
         if (cp == NULL) return 0;
@@ -437,12 +1478,15 @@ public:
 
         for (; cp->Next != NULL && cp->Next->Key == soKey;)
         {
-            Node* toDelete = dynamic_cast<Node*>(cp->Next);	// note the key ensures that it's of Node type
+            Node* toDelete = static_cast<Node*>(cp->Next);	// note the key ensures that it's of Node type
             if (isTarget(toDelete->Value))
             {
-                cp->Next = toDelete->Next;
-				_disposer(toDelete->Value);
-                delete toDelete;
+				Qtl::System::Threading::AtomicStoreRelease(&cp->Next, toDelete->Next);
+				if (_negativeFilter != NULL)
+				{
+					_negativeFilter->Remove(soKey);
+				}
+				RetireNodeInBatch(toDelete, _mirror == NULL, retired);
                 numDeleted++;
                 _count--;
             }
@@ -452,58 +1496,338 @@ public:
             }
         }
         return numDeleted;
-        // unlock
 	}
 
-protected:	// pure virtual (abstract) methods
+	/// @brief Unlinks the items a selector picks in a single sweep of the list with the lock held
+	/// @param select The functor that's called with each item node and the number of items with the same
+	///        SO-key before it and returns whether to unlink it
+	/// @param erased To add the nodes unlinked to
+	template <class TSelector>
+	void UnlinkSelected(TSelector &select, std::vector<BaseNode*> &erased)
+	{
+		BaseNode *cp = GetBucket(0);
+		if (cp == NULL) return;
 
-	/// @brief Gets the specified bucket of the bucket table for the hash algorithm to access
-	/// @param index The index of the bucket
-	virtual BaseNode * GetBucket(int index) const = 0;
-	
-	/// @brief Sets node for the specified bucket of the bucket table for the hash algorithm to access
-	/// @param index The index of the bucket
-	/// @param bucket The node to set to the specified bucket
-	virtual void SetBucket(int index, BaseNode *bucket) = 0;
+		size_t erasedBefore = erased.size();
+		KeyType runKey = 0;
+		int ordinal = 0;
+		while (cp->Next != NULL)
+		{
+			// non-dummy nodes are the ones with odd SO-keys
+			if ((cp->Next->Key & 0x1) == 0)
+			{
+				cp = cp->Next;
+				continue;
+			}
+			ordinal = (cp->Next->Key == runKey)? ordinal + 1 : 0;
+			runKey = cp->Next->Key;
+			if (select(static_cast<const Node*>(cp->Next), ordinal))
+			{
+				Node *toDelete = static_cast<Node*>(cp->Next);
+				Qtl::System::Threading::AtomicStoreRelease(&cp->Next, toDelete->Next);
+				if (_negativeFilter != NULL)
+				{
+					_negativeFilter->Remove(toDelete->Key);
+				}
+				erased.push_back(toDelete);
+			}
+			else
+			{
+				cp = cp->Next;
+			}
+		}
+		_count -= (int)(erased.size() - erasedBefore);
+	}
 
-	/// @brief Sets the base node for the bucket that has been created by doubling the bucket table
-	virtual void AddBucket(int index, BaseNode *node) = 0;
+	/// @brief Erases the items at the positions the source of a mirrored migration erased in EraseIf()
+	/// @param positions The SO-keys of the items with the numbers of items with the same SO-keys before
+	///        them, in the list order
+	/// @remarks The mirror holds the items of the source in the same order as the writes of the source
+	///          are applied to both in turn
+	void ErasePositions(const std::vector<ItemPosition> &positions)
+	{
+		if (positions.empty())
+		{
+			return;
+		}
+		std::vector<BaseNode*> erased;
+		bool dispose;
+		{
+			// lock
+			Qtl::System::Threading::LockGuard lock(_mutex);
+			PositionSelector select(positions);
+			UnlinkSelected(select, erased);
+			dispose = (_mirror == NULL);
+			// unlock
+		}
+		RetireNodes(erased, dispose);
+	}
 
-	/// @brief Calls the Double() method if the implementation reckons it should
-	virtual void ExpandIfNeeded() = 0;
+	/// @brief Removes all the nodes and reinitializes the hash with the lock held
+	/// @param dispose Whether the values are to be disposed of
+	void ClearNodes(bool dispose)
+	{
+		BaseNode *cp = GetBucket(0);
+        if (cp == NULL) return;
 
-	/// @brief The size of the bucket table. It's provided by the implementer 
-	/// @return The table size
-	/// @remarks The current design requires it to start at 2 and double only after a double (expansion) operation, 
-	///          But there's no restriction on the allocation of the internal memory for the bucket table
-	virtual int GetTableSize() const = 0;
-	
-	/// @brief Resets the buckets to the initial state, normally part of the clear up process
-	virtual void ResetBuckets() = 0;
+		std::vector<BaseNode*> retired;
+		BaseNode *cpNext;
+		for (; cp != NULL; cp = cpNext)
+        {
+			cpNext = cp->Next;
+			RetireNodeInBatch(cp, dispose, retired);
+        }
+		RetireNodes(retired, dispose);
+
+        ResetBuckets();
+        _tableIndexBits = 1;
+        _count = 0;
+
+		if (_negativeFilter != NULL)
+		{
+			_negativeFilter->Clear();
+		}
+		FreeRetiredFilters();
+	}
 
 protected:
 
+	/// @brief Allocates memory from the node allocator
+	/// @param size The number of bytes
+	/// @return The memory
+	void *AllocateNodeMemory(size_t size)
+	{
+		return (_nodeAllocator != NULL)? _nodeAllocator->Allocate(size) : ::operator new(size);
+	}
+
+	/// @brief Creates a normal node
+	/// @param soKey The SO-key of the node
+	/// @param value The value of the node
+	/// @return The node
+	Node *CreateNode(KeyType soKey, const ValueType &value)
+	{
+		return new (AllocateNodeMemory(sizeof(Node))) Node(soKey, value);
+	}
+
+	/// @brief Creates a dummy node
+	/// @param soKey The SO-key of the node
+	/// @return The node
+	BaseNode *CreateDummyNode(KeyType soKey)
+	{
+		return new (AllocateNodeMemory(sizeof(BaseNode))) BaseNode(soKey);
+	}
+
+	/// @brief Finalises a node and gives its memory back to the node allocator without disposing of its value
+	/// @param node The node created by CreateNode() or CreateDummyNode()
+	void DestroyNode(BaseNode *node)
+	{
+		size_t size = sizeof(BaseNode);
+		if ((node->Key & 0x1) != 0)
+		{
+			static_cast<Node*>(node)->~Node();
+			size = sizeof(Node);
+		}
+		else
+		{
+			node->~BaseNode();
+		}
+		if (_nodeAllocator != NULL)
+		{
+			_nodeAllocator->Free(node, size);
+		}
+		else
+		{
+			::operator delete(node);
+		}
+	}
+
+	/// @brief Gets rid of a node that has been unlinked, after a grace period in the read-mostly mode
+	/// @param node The node
+	/// @param dispose Whether the value of the node is to be disposed of
+	void RetireNode(BaseNode *node, bool dispose)
+	{
+		if (_rcuDomain != NULL)
+		{
+			_rcuDomain->Retire(node, dispose? ReclaimNode : ReclaimNodeOnly, this);
+			return;
+		}
+		if (dispose && (node->Key & 0x1) != 0)
+		{
+			_disposer(static_cast<Node*>(node)->Value);
+		}
+		DestroyNode(node);
+	}
+
+	/// @brief Gets rid of a node that has been unlinked right away or, in the read-mostly mode, adds it to a
+	///        batch to retire with RetireNodes()
+	/// @param node The node
+	/// @param dispose Whether the value of the node is to be disposed of
+	/// @param retired The batch
+	void RetireNodeInBatch(BaseNode *node, bool dispose, std::vector<BaseNode*> &retired)
+	{
+		if (_rcuDomain != NULL)
+		{
+			retired.push_back(node);
+			return;
+		}
+		RetireNode(node, dispose);
+	}
+
+	/// @brief Gets rid of nodes that have been unlinked, after one grace period in the read-mostly mode
+	/// @param nodes The nodes
+	/// @param dispose Whether the values of the nodes are to be disposed of
+	void RetireNodes(const std::vector<BaseNode*> &nodes, bool dispose)
+	{
+		if (nodes.empty())
+		{
+			return;
+		}
+		if (_rcuDomain != NULL)
+		{
+			_rcuDomain->RetireBatch(&nodes[0], (int)nodes.size(), dispose? ReclaimNode : ReclaimNodeOnly, this);
+			return;
+		}
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			RetireNode(nodes[i], dispose);
+		}
+	}
+
+	/// @brief Frees memory that readers may still be using
+	/// @param p The memory
+	/// @param reclaim The function that frees the memory, by default free()
+	void RetireMemory(void *p, Qtl::System::Rcu::QsbrDomain::ReclaimFunction reclaim=ReclaimMemory)
+	{
+		if (_rcuDomain != NULL)
+		{
+			_rcuDomain->Retire(p, reclaim, this);
+			return;
+		}
+		reclaim(p, this);
+	}
+
+	/// @brief Gets rid of a filter that has been replaced
+	/// @param filter The filter
+	/// @remarks Outside the read-mostly mode nothing tells when the lookups are done with the filter, so it's
+	///          kept for RebuildNegativeFilter() to reuse for the next filter of its size. The filters are
+	///          sized in powers of two and the one in use is never of the size of a kept one, so the filters
+	///          kept take less than the largest one twice.
+	void RetireFilter(CountingBloomFilter *filter)
+	{
+		if (_rcuDomain != NULL)
+		{
+			_rcuDomain->Retire(filter, ReclaimFilter, this);
+			return;
+		}
+		_retiredFilters.push_back(filter);
+	}
+
+	/// @brief Takes a retired filter of a size back into use
+	/// @param size The number of bytes of the counters of the filter
+	/// @return The filter cleared or NULL if none of the size is kept
+	CountingBloomFilter *ReuseFilter(size_t size)
+	{
+		for (size_t i = 0; i < _retiredFilters.size(); i++)
+		{
+			CountingBloomFilter *filter = _retiredFilters[i];
+			if (filter->GetMemorySize() == size)
+			{
+				_retiredFilters[i] = _retiredFilters.back();
+				_retiredFilters.pop_back();
+				filter->Clear();
+				return filter;
+			}
+		}
+		return NULL;
+	}
+
+	/// @brief Disposes of the value of a retired node, if it is not a dummy one, and destroys it
+	/// @param node The node
+	/// @param hash The hash that retired it
+	static void ReclaimNode(void *node, void *hash)
+	{
+		SoHash *self = static_cast<SoHash*>(hash);
+		BaseNode *baseNode = static_cast<BaseNode*>(node);
+		if ((baseNode->Key & 0x1) != 0)
+		{
+			self->_disposer(static_cast<Node*>(baseNode)->Value);
+		}
+		self->DestroyNode(baseNode);
+	}
+
+	/// @brief Destroys a retired node whose value lives on in another node
+	/// @param node The node
+	/// @param hash The hash that retired it
+	static void ReclaimNodeOnly(void *node, void *hash)
+	{
+		static_cast<SoHash*>(hash)->DestroyNode(static_cast<BaseNode*>(node));
+	}
+
+	/// @brief Deletes a retired filter
+	/// @param filter The filter
+	static void ReclaimFilter(void *filter, void *)
+	{
+		delete static_cast<CountingBloomFilter*>(filter);
+	}
+
+	/// @brief Frees retired memory
+	/// @param p The memory
+	static void ReclaimMemory(void *p, void *)
+	{
+		free(p);
+	}
+
+	/// @brief Counts a lookup on the stripe of a filter counter its key falls in
+	/// @param counters The stripes of the counter
+	/// @param key The key looked up
+	/// @remarks The lookups only share a cache line if their keys do, and they don't order anything with it
+	void CountFilterLookup(PaddedCounter *counters, KeyType key) const
+	{
+		Qtl::System::Threading::AtomicAddRelaxed(&counters[key % FilterCounterStripes].Value, 1L);
+	}
+
 	/// @brief Find the first item with the specified key
 	/// @param key The key to find the item with
 	/// @param soKey the SO-key of the item corresponding to the key
 	/// @return The first node with the key
 	Node* _FindFirstPtr(KeyType key, KeyType &soKey) const
 	{
-		int indexBucket = (int)(key & ((KeyType)GetTableSize() - 1));
         KeyType soDummyKey = Reverse(key);
         soKey = soDummyKey | 0x1;
+		return _FindFirstPtrBySoKey(key, soKey);
+	}
 
-        BaseNode *cp = GetBucket(indexBucket);
-		if (cp == NULL) return NULL;
+	/// @brief Find the first item with the specified key whose SO-key has already been worked out
+	/// @param key The key to find the item with
+	/// @param soKey the SO-key of the item corresponding to the key
+	/// @return The first node with the key
+	Node* _FindFirstPtrBySoKey(KeyType key, KeyType soKey) const
+	{
+		CountingBloomFilter *filter = Qtl::System::Threading::AtomicLoadAcquire(&_negativeFilter);
+		if (filter != NULL && !filter->MayContain(soKey))
+		{
+			if (_rcuDomain == NULL)
+			{
+				CountFilterLookup(_filterCounters, key);
+			}
+			return NULL;
+		}
+
+		int indexBucket = (int)(key & ((KeyType)GetTableSize() - 1));
 
+        BaseNode *cp = GetBucket(indexBucket);
         for (; cp != NULL && cp->Key < soKey; cp = cp->Next)
         {
         }
 
         if (cp != NULL && cp->Key == soKey)
         {
-            return dynamic_cast<Node*>(cp);
+            return static_cast<Node*>(cp);
         }
+		if (filter != NULL && _rcuDomain == NULL)
+		{
+			CountFilterLookup(_filterCounters + FilterCounterStripes, key);
+		}
         return NULL;
 	}
 	
@@ -580,13 +1904,13 @@ protected:
             }
             if (cp->Next != NULL && cp->Next->Key >> (32 - _tableIndexBits) == msb)
             {
-                BaseNode * dummyNode = new BaseNode((cp->Next->Key >> (31 - _tableIndexBits)) << (31 - _tableIndexBits));
+                BaseNode * dummyNode = CreateDummyNode((cp->Next->Key >> (31 - _tableIndexBits)) << (31 - _tableIndexBits));
 
                 AddBucket(oldSize + i, dummyNode);
 
                 // this order to ensure readers are unaffected
                 dummyNode->Next = cp->Next;
-                cp->Next = dummyNode;
+				Qtl::System::Threading::AtomicStoreRelease(&cp->Next, dummyNode);
             }
             else
             {
@@ -595,6 +1919,50 @@ protected:
         }
 
         _tableIndexBits++;
+
+		if (_negativeFilter != NULL)
+		{
+			RebuildNegativeFilter();
+		}
+	}
+
+	/// @brief Replaces the negative filter with one sized for the current item count and
+	///        loaded with all the items in the list
+	/// @remarks A lookup stalled on a filter since before it was retired may miss a key while the filter is
+	///          reused; the read-mostly mode frees the filters after a grace period instead.
+	void RebuildNegativeFilter()
+	{
+		CountingBloomFilter *filter = ReuseFilter(
+			CountingBloomFilter::GetMemorySize(_count*2, _filterCountersPerKey));
+		if (filter == NULL)
+		{
+			filter = new CountingBloomFilter(_count*2, _filterCountersPerKey);
+		}
+		BaseNode *cp = GetBucket(0);
+		for (; cp != NULL; cp = cp->Next)
+		{
+			if ((cp->Key & 0x1) != 0)
+			{
+				filter->Add(cp->Key);
+			}
+		}
+		CountingBloomFilter *replaced = _negativeFilter;
+		Qtl::System::Threading::AtomicStoreRelease(&_negativeFilter, filter);
+		if (replaced != NULL)
+		{
+			RetireFilter(replaced);
+		}
+	}
+
+	/// @brief Deletes the filters that have been replaced
+	void FreeRetiredFilters()
+	{
+		for (typename std::vector<CountingBloomFilter*>::iterator iter = _retiredFilters.begin();
+			iter != _retiredFilters.end(); ++iter)
+		{
+			delete *iter;
+		}
+		_retiredFilters.clear();
 	}
 
 	/// @brief Initialise a non-initialized (with a null pointer) bucket
@@ -607,7 +1975,7 @@ protected:
         if (indexBucket == 0)
         {
             // NOTE the bucket 0 is always by itself or recursively initialised before any other buckets
-            dummyNode = new BaseNode(soDummyKey);
+            dummyNode = CreateDummyNode(soDummyKey);
         }
         else
         {
@@ -617,7 +1985,7 @@ protected:
 			{
 				parent = InitializeBucket(indexParent);
 			}
-            dummyNode = new BaseNode(soDummyKey);
+            dummyNode = CreateDummyNode(soDummyKey);
             ListInsert(dummyNode, parent);
         }
 		SetBucket(indexBucket, dummyNode);
@@ -639,7 +2007,7 @@ protected:
             return start->Next;
         }
         node->Next = start->Next;
-        start->Next = node;
+		Qtl::System::Threading::AtomicStoreRelease(&start->Next, node);
             
         return node;
     }
@@ -647,39 +2015,17 @@ protected:
 	/// @brief returns the bit-reversal of the specified key
 	/// @param The key to bit-reverse
 	/// @return The bit-reversal of the key
-	/// @remarks The current implementation is based on the 3-operation approach from
-	///   1. http://graphics.stanford.edu/~seander/bithacks.html#BitReverseObvious
-    ///   2. http://stackoverflow.com/questions/1688532/how-to-reverse-bits-of-a-byte
+	/// @remarks The kernel is selected at compile time, see BitReverse
 	KeyType Reverse(KeyType key) const
 	{
-		KeyType b0 = key & 0xff;
-        KeyType b1 = (key >> 8) & 0xff;
-        KeyType b2 = (key >> 16) & 0xff;
-        KeyType b3 = (key >> 24) & 0xff;
-
-        // reverse the bytes
-        if (b0 != 0)
-        {
-            b0 = (KeyType) ((b0*0x0202020202UL & 0x010884422010UL)%1023);
-        }
-        if (b1 != 0)
-        {
-            b1 = (KeyType) ((b1*0x0202020202UL & 0x010884422010UL)%1023);
-        }
-        if (b2 != 0)
-        {
-            b2 = (KeyType) ((b2*0x0202020202UL & 0x010884422010UL)%1023);
-        }
-        if (b3 != 0)
-        {
-            b3 = (KeyType) ((b3*0x0202020202UL & 0x010884422010UL)%1023);
-        }
-
-        return ((b0 << 24) | (b1 << 16) | (b2 << 8) | b3);
+		return BitReverse::Reverse(key);
 	}
 };
 
-template <class TValue, class TDisposer=DefaultDisposer<TValue> >
+/// @brief Split-ordered hash with a linear bucket table
+/// @remarks TTableAllocator is the policy the bucket table is allocated with, MallocTableAllocator or
+///          HugePageTableAllocator
+template <class TValue, class TDisposer=DefaultDisposer<TValue>, class TTableAllocator=MallocTableAllocator>
 class SoHashLinear : public SoHash<TValue, TDisposer>
 {
 private:
@@ -688,12 +2034,27 @@ private:
 	typedef typename Base::BaseNode BaseNode;
 
 private:
+	/// @brief A bucket table retired in the read-mostly mode
+	struct RetiredTable
+	{
+		BaseNode **Buckets;
+		size_t Size;
+		Qtl::System::Memory::PageKind::Enum Kind;
+	};
+
 	BaseNode **_buckets;
 
 	float _maxLoad;
 
 	int _tableSize;
 
+	/// @brief The number of buckets the table is allocated with, which never shrinks in the read-mostly mode
+	///        so that a reader indexing with a size it read before a clear stays within the table
+	int _capacity;
+
+	/// @brief The kind of memory the bucket table is backed with
+	Qtl::System::Memory::PageKind::Enum _tableKind;
+
 public:
 	SoHashLinear(float maxLoad) : _buckets(NULL), _maxLoad(maxLoad)
 	{
@@ -707,8 +2068,10 @@ public:
 
 	virtual ~SoHashLinear()
 	{
+		// the values of a hash being migrated online belong to the target
+		Base::FinishMigration();
 		Base::Clear();
-		delete _buckets;
+		TTableAllocator::Free(_buckets, sizeof(*_buckets)*_capacity, _tableKind);
 	}
  	
 public:
@@ -717,13 +2080,24 @@ public:
 		return _maxLoad;
 	}
 
+	/// @brief Tells how the bucket table is backed
+	/// @param stats To return the statistics
+	void GetTableStatistics(TableStatistics &stats) const
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(Base::_mutex);
+		TTableAllocator::GetStatistics(sizeof(*_buckets)*_capacity, _tableKind, stats);
+		// unlock
+	}
+
 protected: 	// SoHash<TValue> members
 
 	/// @brief Gets the specified bucket of the bucket table for the hash algorithm to access
 	/// @param index The index of the bucket
 	virtual BaseNode *GetBucket(int indexBucket) const
 	{
-		return _buckets[indexBucket];
+		BaseNode **buckets = Qtl::System::Threading::AtomicLoadAcquire(&_buckets);
+		return Qtl::System::Threading::AtomicLoadAcquire(&buckets[indexBucket]);
 	}
 	
 	/// @brief Sets node for the specified bucket of the bucket table for the hash algorithm to access
@@ -731,7 +2105,7 @@ protected: 	// SoHash<TValue> members
 	/// @param bucket The node to set to the specified bucket
 	virtual void SetBucket(int indexBucket, BaseNode *node)
 	{
-		_buckets[indexBucket] = node;
+		Qtl::System::Threading::AtomicStoreRelease(&_buckets[indexBucket], node);
 	}
 
 	/// @brief The size of the bucket table; it's provided by the implementer however it should always hold that
@@ -739,25 +2113,66 @@ protected: 	// SoHash<TValue> members
 	/// @return The table size
 	virtual int GetTableSize() const
 	{
-		return _tableSize;
+		return Qtl::System::Threading::AtomicLoadAcquire(&_tableSize);
 	}
 
 	/// @brief Calls the Double() method if the implementation reckons it should
 	virtual void ExpandIfNeeded()
 	{
-		if (Base::GetCount()<=GetMaxLoad()*GetTableSize())
+		ExpandToFit(Base::GetCount());
+	}
+
+	/// @brief Calls the Double() method until the table is large enough for a number of items
+	/// @param count The number of items
+	virtual void ExpandToFit(int count)
+	{
+		while (count > GetMaxLoad()*GetTableSize())
 		{
-			return;
+			Expand();
 		}
+	}
+
+	/// @brief Doubles the bucket table
+	void Expand()
+	{
 
 		// NOTE this pre-allocates memory which is essential and doesn't increase the TableSize
-		_buckets = (BaseNode**)realloc(_buckets, sizeof(*_buckets)*GetTableSize()*2);
+		if (Base::IsReadMostly())
+		{
+			// the buckets past the size are null or set by Double() since the last clear, so a table that
+			// is large enough already is filled in place
+			if (_capacity < _tableSize*2)
+			{
+				// readers may still be using the old table, which is retired rather than moved
+				Qtl::System::Memory::PageKind::Enum kind;
+				BaseNode **buckets = AllocateTable(sizeof(*_buckets)*_tableSize*2, kind);
+				memcpy(buckets, _buckets, sizeof(*_buckets)*_capacity);
+				memset(buckets + _capacity, 0, sizeof(*_buckets)*(_tableSize*2 - _capacity));
+				BaseNode **old = _buckets;
+				Qtl::System::Threading::AtomicStoreRelease(&_buckets, buckets);
+				RetireTable(old, sizeof(*_buckets)*_capacity, _tableKind);
+				_tableKind = kind;
+				_capacity = _tableSize*2;
+			}
+		}
+		else
+		{
+			BaseNode **buckets = (BaseNode**)TTableAllocator::Reallocate(_buckets, sizeof(*_buckets)*_capacity,
+				sizeof(*_buckets)*_tableSize*2, _tableKind);
+			if (buckets == NULL)
+			{
+				throw std::bad_alloc();
+			}
+			_buckets = buckets;
+			_capacity = _tableSize*2;
+		}
 
 		// Note all the new buckets have been committed by the Double() method
 		// That's why _tableSize is by definition to be doubled and the buckets array was not initialized to zero
 		Base::Double();
 
-		_tableSize *= 2;
+		// the table is published before the size so that a reader never indexes past the table it sees
+		Qtl::System::Threading::AtomicStoreRelease(&_tableSize, _tableSize * 2);
 	}
 
 	/// @brief Adds a node to the specified bucket as part of the CAS expanding process;
@@ -765,7 +2180,7 @@ protected: 	// SoHash<TValue> members
 	/// @param indexBucket The location of the bucket (in some implementation might be ignored
 	virtual void AddBucket(int indexBucket, BaseNode *node)
     {
-    	_buckets[indexBucket] = node;
+		Qtl::System::Threading::AtomicStoreRelease(&_buckets[indexBucket], node);
     }
 
     /// <summary>
@@ -773,11 +2188,69 @@ protected: 	// SoHash<TValue> members
     /// </summary>
     virtual void ResetBuckets()
     {
+		if (_buckets != NULL && Base::IsReadMostly())
+		{
+			// the new table is as large as the old one for the readers that still see the old size
+			size_t size = sizeof(*_buckets)*_capacity;
+			Qtl::System::Memory::PageKind::Enum kind;
+			BaseNode **buckets = AllocateTable(size, kind);
+			memset(buckets, 0, size);
+			BaseNode **old = _buckets;
+			Qtl::System::Threading::AtomicStoreRelease(&_buckets, buckets);
+			Qtl::System::Threading::AtomicStoreRelease(&_tableSize, 2);
+			RetireTable(old, size, _tableKind);
+			_tableKind = kind;
+			return;
+		}
+		if (_buckets != NULL)
+		{
+			// a table mapped on its own would otherwise be kept at its largest size
+			TTableAllocator::Free(_buckets, sizeof(*_buckets)*_capacity, _tableKind);
+			_buckets = NULL;
+		}
 		_tableSize = 2;
-        _buckets = (BaseNode **)realloc(_buckets, sizeof(*_buckets)*_tableSize);
+		_capacity = 2;
+        _buckets = AllocateTable(sizeof(*_buckets)*_capacity, _tableKind);
 		_buckets[0] = NULL;
 		_buckets[1] = NULL;
     }
+
+private:
+	/// @brief Allocates a bucket table
+	/// @param size The number of bytes
+	/// @param kind To return the kind of memory the table is backed with
+	/// @return The table
+	static BaseNode **AllocateTable(size_t size, Qtl::System::Memory::PageKind::Enum &kind)
+	{
+		BaseNode **buckets = (BaseNode**)TTableAllocator::Allocate(size, kind);
+		if (buckets == NULL)
+		{
+			throw std::bad_alloc();
+		}
+		return buckets;
+	}
+
+	/// @brief Hands a replaced bucket table over to the domain of the read-mostly mode
+	/// @param buckets The table
+	/// @param size The number of bytes it was allocated with
+	/// @param kind The kind of memory it was allocated with
+	void RetireTable(BaseNode **buckets, size_t size, Qtl::System::Memory::PageKind::Enum kind)
+	{
+		RetiredTable *retired = new RetiredTable();
+		retired->Buckets = buckets;
+		retired->Size = size;
+		retired->Kind = kind;
+		Base::RetireMemory(retired, FreeTable);
+	}
+
+	/// @brief Frees a retired bucket table
+	/// @param retired The record of the table
+	static void FreeTable(void *retired, void *)
+	{
+		RetiredTable *table = static_cast<RetiredTable*>(retired);
+		TTableAllocator::Free(table->Buckets, table->Size, table->Kind);
+		delete table;
+	}
 };
 
 }}}
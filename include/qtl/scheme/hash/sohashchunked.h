@@ -0,0 +1,943 @@
+#if !defined(_SOHASHCHUNKED_H_)
+#define _SOHASHCHUNKED_H_
+
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "sohash.h"
+#include "bitreverse.h"
+#include "qtl/system/memory.h"
+#include "qtl/system/threading.h"
+
+namespace Qtl { namespace Scheme { namespace Hash {
+
+/// @brief Split-ordered hash whose list is made of unrolled chunks of sorted slots
+/// @remarks Each chunk is about a cache line and holds several (SO-key, value) slots, so a chain walk takes one
+///          cache miss per chunk rather than per item. A bucket points to a head chunk that starts with the
+///          bucket's dummy key; chunks split when they overflow and merge with their successors in the same
+///          bucket when they run low. Writers are serialized by a mutex. Readers are lock-free and validate
+///          each chunk with its sequence number, retrying from the bucket if a writer got in the way; chunks
+///          are recycled but never given back to the system before the hash is destroyed, which is what
+///          makes this safe. Since readers may copy out values that are being overwritten and then discard
+///          them, values are expected to be trivially copyable (like int or void*) if lookups run
+///          concurrently with updates.
+template <class TValue, class TDisposer=DefaultDisposer<TValue>, int TChunkSize=64>
+class SoHashChunked
+{
+public:	// Nested types
+
+	/// @brief The type of the key
+	typedef unsigned int KeyType;
+
+	/// @brief The type of the value
+	typedef TValue ValueType;
+
+	/// @brief The strategies of dealing with existing keys, the same as SoHash's
+	typedef typename SoHash<TValue, TDisposer>::AddStrategy AddStrategy;
+
+	enum
+	{
+		/// @brief The bytes taken by the sequence number, the count and the link of a chunk
+		HeaderSize = sizeof(unsigned int) * 2 + sizeof(void*),
+
+		/// @brief The bytes taken by a slot
+		SlotSize = sizeof(KeyType) + sizeof(TValue),
+
+		/// @brief The number of slots in a chunk; at least 4 so that splitting is worth it
+		SlotCount = ((TChunkSize - HeaderSize) / SlotSize < 4)? 4 : (TChunkSize - HeaderSize) / SlotSize,
+
+		/// @brief Two adjacent chunks of a bucket are merged when they have no more items than this together
+		MergeThreshold = SlotCount - SlotCount / 4
+	};
+
+private:
+	/// @brief A node of the list holding a run of sorted slots
+	struct Chunk
+	{
+		/// @brief The sequence number, which is odd while a writer is modifying the chunk
+		volatile unsigned int Version;
+
+		/// @brief The number of slots in use
+		int Count;
+
+		/// @brief The next chunk in the split order
+		Chunk * volatile Next;
+
+		/// @brief The SO-keys, dummy (even) ones only at the beginning of head chunks
+		KeyType Keys[SlotCount];
+
+		/// @brief The values of the slots
+		ValueType Values[SlotCount];
+
+		/// @brief Instantiates an empty chunk
+		Chunk() : Version(0), Count(0), Next(NULL)
+		{
+		}
+	};
+
+	enum
+	{
+		/// @brief The distance between chunks in the pool, rounded up to whole cache lines
+		ChunkStride = (sizeof(Chunk) + 63) / 64 * 64,
+
+		/// @brief The number of bytes requested from the system for chunks at a time
+		PoolPageSize = 64 * 1024,
+
+		/// @brief The number of chunks in a page of the pool
+		ChunksPerPage = PoolPageSize / ChunkStride
+	};
+
+	/// @brief A functor that accepts all key matches
+	struct AllwaysTruePredicate
+	{
+		bool operator()(ValueType &)
+		{
+			return true;
+		}
+	};
+
+	/// @brief Picks the items with a particular SO-key that satisfy a predicate
+	template <class TPredicate>
+	struct KeyMatcher
+	{
+		KeyType SoKey;
+		TPredicate &IsTarget;
+
+		KeyMatcher(KeyType soKey, TPredicate &isTarget) : SoKey(soKey), IsTarget(isTarget)
+		{
+		}
+
+		bool operator()(KeyType soKey, ValueType &value)
+		{
+			return soKey == SoKey && IsTarget(value);
+		}
+	};
+
+	/// @brief Picks any item that satisfies a predicate
+	template <class TPredicate>
+	struct ItemMatcher
+	{
+		TPredicate &IsTarget;
+
+		ItemMatcher(TPredicate &isTarget) : IsTarget(isTarget)
+		{
+		}
+
+		bool operator()(KeyType, ValueType &value)
+		{
+			return IsTarget(value);
+		}
+	};
+
+	/// @brief Collects the first value found by a lookup
+	struct FirstCollector
+	{
+		ValueType *PValue;
+		bool Found;
+
+		FirstCollector(ValueType *pValue) : PValue(pValue), Found(false)
+		{
+		}
+
+		void Reset()
+		{
+			Found = false;
+		}
+
+		bool Collect(const ValueType &value)
+		{
+			if (PValue != NULL)
+			{
+				*PValue = value;
+			}
+			Found = true;
+			return false;
+		}
+	};
+
+	/// @brief Collects all the values found by a lookup
+	struct AllCollector
+	{
+		std::vector<ValueType> &Values;
+		bool Found;
+
+		AllCollector(std::vector<ValueType> &values) : Values(values), Found(false)
+		{
+		}
+
+		void Reset()
+		{
+			Values.clear();
+			Found = false;
+		}
+
+		bool Collect(const ValueType &value)
+		{
+			Values.push_back(value);
+			Found = true;
+			return true;
+		}
+	};
+
+private:
+	/// @brief The bucket table, each pointing to a head chunk or NULL if not initialized
+	Chunk ** volatile _buckets;
+
+	/// @brief The number of buckets
+	volatile int _tableSize;
+
+	/// @brief The number of buckets allocated, which never shrinks so that readers that loaded a larger size
+	///        before a Clear() still index within the table
+	int _capacity;
+
+	/// @brief The bucket tables replaced on expansion, which readers may still be using until the hash is
+	///        destroyed; they add up to less than the live table
+	std::vector<Chunk**> _retiredTables;
+
+	/// @brief The maximum average number of items per bucket
+	float _maxLoad;
+
+	/// @brief The number of items
+	int _count;
+
+	/// @brief The disposer of the values
+	TDisposer _disposer;
+
+	/// @brief The mutex that serializes the writers
+	mutable Qtl::System::Threading::Mutex _mutex;
+
+	/// @brief The pages the chunks are carved out of
+	std::vector<void*> _pages;
+
+	/// @brief The next unused chunk in the last page
+	char *_poolCurrent;
+
+	/// @brief The chunks that have been unlinked and can be reused
+	Chunk *_freeChunks;
+
+public:
+	/// @brief Instantiates a hash
+	/// @param maxLoad The maximum average number of items per bucket before the table is doubled
+	SoHashChunked(float maxLoad) : _buckets(NULL), _tableSize(0), _capacity(0), _maxLoad(maxLoad), _count(0),
+		_poolCurrent(NULL), _freeChunks(NULL)
+	{
+		ResetBuckets();
+	}
+
+	/// @brief Instantiates a hash with a disposer
+	/// @param maxLoad The maximum average number of items per bucket before the table is doubled
+	/// @param disposer The disposer of the values
+	SoHashChunked(float maxLoad, const TDisposer &disposer) : _buckets(NULL), _tableSize(0), _capacity(0),
+		_maxLoad(maxLoad), _count(0), _disposer(disposer), _poolCurrent(NULL), _freeChunks(NULL)
+	{
+		ResetBuckets();
+	}
+
+	/// @brief Finalises the hash
+	~SoHashChunked()
+	{
+		Clear();
+		free(_buckets);
+		for (size_t i = 0; i < _retiredTables.size(); i++)
+		{
+			free(_retiredTables[i]);
+		}
+		for (size_t i = 0; i < _pages.size(); i++)
+		{
+			char *page = (char*)_pages[i];
+			char *end = (i + 1 == _pages.size())? _poolCurrent : page + ChunksPerPage * ChunkStride;
+			for (char *p = page; p < end; p += ChunkStride)
+			{
+				((Chunk*)p)->~Chunk();
+			}
+			Qtl::System::Memory::FreePages(page, PoolPageSize);
+		}
+	}
+
+private:
+	/// @brief Disallows copying
+	SoHashChunked(const SoHashChunked &);
+
+	/// @brief Disallows assignment
+	SoHashChunked &operator=(const SoHashChunked &);
+
+public:
+	/// @brief Returns the number of items
+	/// @return The number of items
+	int GetCount() const
+	{
+		return _count;
+	}
+
+	/// @brief Returns the maximum load
+	/// @return The maximum average number of items per bucket
+	float GetMaxLoad() const
+	{
+		return _maxLoad;
+	}
+
+	/// @brief Returns the number of chunks in the list
+	/// @return The number of chunks
+	int GetChunkCount() const
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		int count = 0;
+		for (Chunk *chunk = _buckets[0]; chunk != NULL; chunk = chunk->Next)
+		{
+			count++;
+		}
+		return count;
+		// unlock
+	}
+
+	/// @brief Adds a key value pair to the hash table
+	/// @param key The numeric key to the value
+	/// @param value The value associated with the key
+	/// @param addStrategy How to deal with duplication
+	/// @return true if the pair is added
+	bool AddKeyValuePair(KeyType key, ValueType value,
+		typename AddStrategy::Enum addStrategy=AddStrategy::ReplaceExisting)
+	{
+		KeyType soKey = Reverse(key) | 0x1;
+
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+
+		int indexBucket = (int)(key & ((KeyType)_tableSize - 1));
+		Chunk *chunk = _buckets[indexBucket];
+		if (chunk == NULL)
+		{
+			chunk = InitializeBucket(indexBucket);
+		}
+		chunk = FindChunk(chunk, soKey);
+		int pos = LowerBound(chunk, soKey);
+
+		// the first item with the key if any is either here or at the beginning of the next chunk
+		Chunk *existing = chunk;
+		int existingPos = pos;
+		if (pos == chunk->Count && chunk->Next != NULL)
+		{
+			existing = chunk->Next;
+			existingPos = 0;
+		}
+		if (existingPos < existing->Count && existing->Keys[existingPos] == soKey)
+		{
+			switch (addStrategy)
+			{
+			case AddStrategy::ReplaceExisting:
+				BeginWrite(existing);
+				existing->Values[existingPos] = value;
+				EndWrite(existing);
+				return true;
+			case AddStrategy::ReturnFalseOnExisting:
+				return false;
+			default:
+				break;
+			}
+		}
+
+		InsertAt(chunk, pos, soKey, value);
+		_count++;
+
+		ExpandIfNeeded();
+		return true;
+		// unlock
+	}
+
+	/// @brief Gets the first item with the key
+	/// @param key The key to find the item with
+	/// @param pValue To return a copy of the value. Pass in NULL to ignore the retrieval
+	/// @return true if found or false
+	bool FindFirst(KeyType key, ValueType *pValue=NULL) const
+	{
+		FirstCollector collector(pValue);
+		return Lookup(key, collector);
+	}
+
+	/// @brief Gets all the items with the key
+	/// @param key The key to find the items with
+	/// @param values All the values with the key (multiple values if duplicate values allowed)
+	/// @return true if at least one is found or false
+	bool Find(KeyType key, std::vector<ValueType> &values) const
+	{
+		AllCollector collector(values);
+		return Lookup(key, collector);
+	}
+
+	/// @brief Deletes all the items with the specified key
+	/// @param key The key to delete items with
+	/// @return The number of items deleted
+	int DeleteKey(KeyType key)
+	{
+		AllwaysTruePredicate alwaysTrue;
+		return DeleteKeyValuePairs(key, alwaysTrue);
+	}
+
+	/// @brief Delete all the items with the specified key and satisfying the predicate
+	/// @param key The key to delete items with
+	/// @param isTarget The predicate to determine if the item with the key should be deleted
+	/// @return The number of items deleted
+	template <class TPredicate>
+	int DeleteKeyValuePairs(KeyType key, TPredicate isTarget)
+	{
+		KeyType soKey = Reverse(key) | 0x1;
+
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+
+		int indexBucket = (int)(key & ((KeyType)_tableSize - 1));
+		Chunk *head = _buckets[indexBucket];
+		if (head == NULL) return 0;
+
+		std::vector<ValueType> removed;
+		KeyMatcher<TPredicate> matcher(soKey, isTarget);
+		for (Chunk *chunk = FindChunk(head, soKey); chunk != NULL; chunk = chunk->Next)
+		{
+			if (chunk->Count == 0 || chunk->Keys[0] > soKey)
+			{
+				break;
+			}
+			bool more = (chunk->Keys[chunk->Count - 1] <= soKey);
+			RemoveFromChunk(chunk, matcher, removed);
+			if (!more)
+			{
+				break;
+			}
+		}
+		if (removed.empty())
+		{
+			return 0;
+		}
+		NormalizeBucket(head);
+		_count -= (int)removed.size();
+
+		for (typename std::vector<ValueType>::iterator iter = removed.begin(); iter != removed.end(); ++iter)
+		{
+			_disposer(*iter);
+		}
+		return (int)removed.size();
+		// unlock
+	}
+
+	/// @brief Deletes all the items satisfying the predicate in a single sweep of the list
+	/// @param isTarget The predicate to determine if an item should be deleted
+	/// @return The number of items deleted
+	/// @remarks The values are disposed of after the lock is released
+	template <class TPredicate>
+	int EraseIf(TPredicate isTarget)
+	{
+		std::vector<ValueType> removed;
+		{
+			// lock
+			Qtl::System::Threading::LockGuard lock(_mutex);
+
+			ItemMatcher<TPredicate> matcher(isTarget);
+			for (Chunk *chunk = _buckets[0]; chunk != NULL; chunk = chunk->Next)
+			{
+				RemoveFromChunk(chunk, matcher, removed);
+			}
+			for (Chunk *head = _buckets[0]; head != NULL; )
+			{
+				NormalizeBucket(head);
+				Chunk *chunk = head;
+				for (; chunk->Next != NULL && !IsHead(chunk->Next); chunk = chunk->Next)
+				{
+				}
+				head = chunk->Next;
+			}
+			_count -= (int)removed.size();
+			// unlock
+		}
+
+		for (typename std::vector<ValueType>::iterator iter = removed.begin(); iter != removed.end(); ++iter)
+		{
+			_disposer(*iter);
+		}
+		return (int)removed.size();
+	}
+
+	/// @brief Calls a functor on each of the values in the split order
+	/// @param func The functor to call with a reference to each value
+	/// @return The functor after it has been called on all the values
+	/// @remarks Writers are held off for the duration
+	template <class TFunctor>
+	TFunctor ForEach(TFunctor func)
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		for (Chunk *chunk = _buckets[0]; chunk != NULL; chunk = chunk->Next)
+		{
+			for (int i = 0; i < chunk->Count; i++)
+			{
+				if ((chunk->Keys[i] & 0x1) != 0)
+				{
+					func(chunk->Values[i]);
+				}
+			}
+		}
+		return func;
+		// unlock
+	}
+
+	/// @brief Removes all the contents of the hash and reinitializes it
+	void Clear()
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+
+		Chunk *next;
+		for (Chunk *chunk = _buckets[0]; chunk != NULL; chunk = next)
+		{
+			next = chunk->Next;
+			for (int i = 0; i < chunk->Count; i++)
+			{
+				if ((chunk->Keys[i] & 0x1) != 0)
+				{
+					_disposer(chunk->Values[i]);
+				}
+			}
+			RecycleChunk(chunk);
+		}
+		ResetBuckets();
+		_count = 0;
+		// unlock
+	}
+
+private:
+	/// @brief Looks the key up without locking
+	/// @param key The key to look up
+	/// @param collector The collector of the values with the key
+	/// @return true if any value is collected
+	template <class TCollector>
+	bool Lookup(KeyType key, TCollector &collector) const
+	{
+		using namespace Qtl::System::Threading;
+
+		KeyType soKey = Reverse(key) | 0x1;
+		for (;;)
+		{
+			// the size is published after the table so the table is at least as large as the size read
+			int tableSize = AtomicLoadAcquire(&_tableSize);
+			Chunk **buckets = AtomicLoadAcquire(&_buckets);
+			const Chunk *chunk = AtomicLoadAcquire(&buckets[key & ((KeyType)tableSize - 1)]);
+			if (chunk == NULL)
+			{
+				return false;
+			}
+
+			collector.Reset();
+			const Chunk *prev = NULL;
+			unsigned int prevVersion = 0;
+			for (;;)
+			{
+				unsigned int version = AtomicLoadAcquire(&chunk->Version);
+				if ((version & 0x1) != 0)
+				{
+					break;
+				}
+				int count = chunk->Count;
+				if (count > SlotCount) count = SlotCount;
+				const Chunk *next = AtomicLoadAcquire(&chunk->Next);
+
+				int i = 0;
+				for (; i < count && chunk->Keys[i] < soKey; i++)
+				{
+				}
+				bool done = false;
+				for (; i < count; i++)
+				{
+					if (chunk->Keys[i] != soKey || !collector.Collect(chunk->Values[i]))
+					{
+						done = true;
+						break;
+					}
+				}
+
+				// the chunk must not have changed while it was read and, since unlinking a chunk changes its
+				// predecessor, the predecessor must not have changed either for the chunk to still be in the list
+				AtomicFenceAcquire();
+				if (chunk->Version != version || (prev != NULL && prev->Version != prevVersion))
+				{
+					break;
+				}
+				if (done || next == NULL)
+				{
+					return collector.Found;
+				}
+				prev = chunk;
+				prevVersion = version;
+				chunk = next;
+			}
+		}
+	}
+
+	/// @brief Marks a chunk as being modified
+	/// @param chunk The chunk
+	static void BeginWrite(Chunk *chunk)
+	{
+		Qtl::System::Threading::AtomicStoreRelease(&chunk->Version, chunk->Version + 1);
+		Qtl::System::Threading::AtomicFenceRelease();
+	}
+
+	/// @brief Marks a chunk as consistent again
+	/// @param chunk The chunk
+	static void EndWrite(Chunk *chunk)
+	{
+		Qtl::System::Threading::AtomicStoreRelease(&chunk->Version, chunk->Version + 1);
+	}
+
+	/// @brief Determines if a chunk is the head chunk of a bucket
+	/// @param chunk The chunk
+	/// @return true if it starts with a dummy key
+	static bool IsHead(const Chunk *chunk)
+	{
+		return chunk->Count > 0 && (chunk->Keys[0] & 0x1) == 0;
+	}
+
+	/// @brief Returns the position of the first slot whose key is not less than the specified
+	/// @param chunk The chunk to search
+	/// @param soKey The SO-key
+	/// @return The position, which is the count if all the keys are less
+	static int LowerBound(const Chunk *chunk, KeyType soKey)
+	{
+		int i = 0;
+		for (; i < chunk->Count && chunk->Keys[i] < soKey; i++)
+		{
+		}
+		return i;
+	}
+
+	/// @brief Returns the chunk where the first item not less than the key is or would be inserted
+	/// @param chunk The chunk to start from, whose first key has to be less than the key
+	/// @param soKey The SO-key
+	/// @return The chunk
+	static Chunk *FindChunk(Chunk *chunk, KeyType soKey)
+	{
+		for (Chunk *next = chunk->Next; next != NULL && next->Keys[0] < soKey; next = chunk->Next)
+		{
+			chunk = next;
+		}
+		return chunk;
+	}
+
+	/// @brief Inserts an item at the specified position, splitting the chunk if it is full
+	/// @param chunk The chunk
+	/// @param pos The position
+	/// @param soKey The SO-key of the item
+	/// @param value The value of the item
+	void InsertAt(Chunk *chunk, int pos, KeyType soKey, const ValueType &value)
+	{
+		if (chunk->Count < SlotCount)
+		{
+			BeginWrite(chunk);
+			InsertSlot(chunk, pos, soKey, value);
+			EndWrite(chunk);
+			return;
+		}
+
+		// the upper half goes to a new chunk, which is filled in before it is linked
+		const int half = SlotCount / 2;
+		Chunk *split = AllocateChunk();
+		CopySlots(split, 0, chunk, half, SlotCount - half);
+		split->Count = SlotCount - half;
+		split->Next = chunk->Next;
+		if (pos > half)
+		{
+			InsertSlot(split, pos - half, soKey, value);
+		}
+
+		BeginWrite(chunk);
+		chunk->Count = half;
+		if (pos <= half)
+		{
+			InsertSlot(chunk, pos, soKey, value);
+		}
+		Qtl::System::Threading::AtomicStoreRelease(&chunk->Next, split);
+		EndWrite(chunk);
+	}
+
+	/// @brief Inserts an item into a chunk that has room for it
+	/// @param chunk The chunk
+	/// @param pos The position
+	/// @param soKey The SO-key of the item
+	/// @param value The value of the item
+	static void InsertSlot(Chunk *chunk, int pos, KeyType soKey, const ValueType &value)
+	{
+		for (int i = chunk->Count; i > pos; i--)
+		{
+			chunk->Keys[i] = chunk->Keys[i-1];
+			chunk->Values[i] = chunk->Values[i-1];
+		}
+		chunk->Keys[pos] = soKey;
+		chunk->Values[pos] = value;
+		chunk->Count++;
+	}
+
+	/// @brief Copies slots between chunks
+	/// @param target The chunk to copy to
+	/// @param targetPos The position in the target to start at
+	/// @param source The chunk to copy from
+	/// @param sourcePos The position in the source to start at
+	/// @param count The number of slots to copy
+	static void CopySlots(Chunk *target, int targetPos, const Chunk *source, int sourcePos, int count)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			target->Keys[targetPos + i] = source->Keys[sourcePos + i];
+			target->Values[targetPos + i] = source->Values[sourcePos + i];
+		}
+	}
+
+	/// @brief Removes the items of a chunk picked by the matcher
+	/// @param chunk The chunk
+	/// @param matcher The matcher
+	/// @param removed To receive the values removed
+	template <class TMatcher>
+	static void RemoveFromChunk(Chunk *chunk, TMatcher &matcher, std::vector<ValueType> &removed)
+	{
+		bool writing = false;
+		int kept = 0;
+		for (int i = 0; i < chunk->Count; i++)
+		{
+			if ((chunk->Keys[i] & 0x1) != 0 && matcher(chunk->Keys[i], chunk->Values[i]))
+			{
+				if (!writing)
+				{
+					BeginWrite(chunk);
+					writing = true;
+				}
+				removed.push_back(chunk->Values[i]);
+				continue;
+			}
+			if (kept != i)
+			{
+				chunk->Keys[kept] = chunk->Keys[i];
+				chunk->Values[kept] = chunk->Values[i];
+			}
+			kept++;
+		}
+		if (writing)
+		{
+			chunk->Count = kept;
+			EndWrite(chunk);
+		}
+	}
+
+	/// @brief Unlinks the empty chunks of a bucket and merges adjacent ones that are sparse
+	/// @param head The head chunk of the bucket
+	void NormalizeBucket(Chunk *head)
+	{
+		Chunk *chunk = head;
+		while (chunk->Next != NULL && !IsHead(chunk->Next))
+		{
+			Chunk *next = chunk->Next;
+			if (next->Count == 0 || chunk->Count + next->Count <= MergeThreshold)
+			{
+				BeginWrite(chunk);
+				CopySlots(chunk, chunk->Count, next, 0, next->Count);
+				chunk->Count += next->Count;
+				Qtl::System::Threading::AtomicStoreRelease(&chunk->Next, next->Next);
+				EndWrite(chunk);
+				RecycleChunk(next);
+			}
+			else
+			{
+				chunk = next;
+			}
+		}
+	}
+
+	/// @brief Splits the list to start a new bucket at the position of its dummy key
+	/// @param start A chunk before the position, usually the head of the parent bucket
+	/// @param soDummyKey The dummy key of the new bucket
+	/// @return The head chunk of the new bucket
+	Chunk *SplitForBucket(Chunk *start, KeyType soDummyKey)
+	{
+		Chunk *chunk = FindChunk(start, soDummyKey);
+		int pos = LowerBound(chunk, soDummyKey);	// at least 1 as the first key of the chunk is less
+
+		Chunk *head = AllocateChunk();
+		head->Keys[0] = soDummyKey;
+		head->Count = 1;
+		CopySlots(head, 1, chunk, pos, chunk->Count - pos);
+		head->Count += chunk->Count - pos;
+		head->Next = chunk->Next;
+
+		BeginWrite(chunk);
+		chunk->Count = pos;
+		Qtl::System::Threading::AtomicStoreRelease(&chunk->Next, head);
+		EndWrite(chunk);
+		return head;
+	}
+
+	/// @brief Initialise a non-initialized (with a null pointer) bucket
+	/// @param indexBucket The index of the bucket
+	/// @return The head chunk the bucket now points to
+	Chunk *InitializeBucket(int indexBucket)
+	{
+		Chunk *head;
+		if (indexBucket == 0)
+		{
+			head = AllocateChunk();
+			head->Keys[0] = 0;
+			head->Count = 1;
+			head->Next = NULL;
+		}
+		else
+		{
+			int indexParent = GetParent(indexBucket);
+			Chunk *parent = _buckets[indexParent];
+			if (parent == NULL)
+			{
+				parent = InitializeBucket(indexParent);
+			}
+			head = SplitForBucket(parent, Reverse((KeyType)indexBucket));
+		}
+		Qtl::System::Threading::AtomicStoreRelease(&_buckets[indexBucket], head);
+		return head;
+	}
+
+	/// @brief Returns the parent of the specified bucket, which is the bucket with the highest bit cleared
+	/// @param indexBucket The index of the bucket
+	/// @return The index of the parent
+	static int GetParent(int indexBucket)
+	{
+		int bit = 1;
+		while (bit <= (indexBucket >> 1))
+		{
+			bit <<= 1;
+		}
+		return indexBucket & ~bit;
+	}
+
+	/// @brief Doubles the bucket table if the load is exceeded
+	/// @remarks A bucket of the new half is initialized at once if its parent has items for it, so that
+	///          the chunks of a bucket never hold items of another bucket
+	void ExpandIfNeeded()
+	{
+		if (_count <= _maxLoad * _tableSize)
+		{
+			return;
+		}
+
+		int oldSize = _tableSize;
+		Chunk **buckets = _buckets;
+		if (_capacity < oldSize * 2)
+		{
+			buckets = (Chunk**)malloc(sizeof(Chunk*) * oldSize * 2);
+			if (buckets == NULL)
+			{
+				return;
+			}
+			memcpy(buckets, _buckets, sizeof(Chunk*) * oldSize);
+			for (int i = oldSize; i < oldSize * 2; i++)
+			{
+				buckets[i] = NULL;
+			}
+		}
+		// the new half of a table kept from before a Clear() is all NULL, and readers that still go by the
+		// larger size read the slots filled in here as the right buckets of their keys
+		KeyType newMask = (KeyType)oldSize * 2 - 1;
+		for (int i = 0; i < oldSize; i++)
+		{
+			if (buckets[i] == NULL)
+			{
+				continue;
+			}
+			KeyType soDummyKey = Reverse((KeyType)(oldSize + i));
+			Chunk *chunk = FindChunk(buckets[i], soDummyKey);
+			int pos = LowerBound(chunk, soDummyKey);
+			if (pos == chunk->Count)
+			{
+				chunk = chunk->Next;
+				pos = 0;
+			}
+			if (chunk != NULL && (chunk->Keys[pos] & 0x1) != 0
+				&& (Reverse(chunk->Keys[pos]) & newMask) == (KeyType)(oldSize + i))
+			{
+				Qtl::System::Threading::AtomicStoreRelease(&buckets[oldSize + i],
+					SplitForBucket(buckets[i], soDummyKey));
+			}
+		}
+
+		if (buckets != _buckets)
+		{
+			_retiredTables.push_back((Chunk**)_buckets);
+			_capacity = oldSize * 2;
+			Qtl::System::Threading::AtomicStoreRelease(&_buckets, buckets);
+		}
+		Qtl::System::Threading::AtomicStoreRelease(&_tableSize, oldSize * 2);
+	}
+
+	/// @brief Sets buckets to initial state after clear up the contents of the hash
+	/// @remarks The table is emptied in place rather than shrunk as lock-free readers may still be indexing it
+	///          with the size they loaded
+	void ResetBuckets()
+	{
+		if (_buckets == NULL)
+		{
+			_buckets = (Chunk**)malloc(sizeof(Chunk*) * 2);
+			if (_buckets == NULL)
+			{
+				throw std::bad_alloc();
+			}
+			_capacity = 2;
+		}
+		for (int i = 0; i < _capacity; i++)
+		{
+			Qtl::System::Threading::AtomicStoreRelease(&_buckets[i], (Chunk*)NULL);
+		}
+		Qtl::System::Threading::AtomicStoreRelease(&_tableSize, 2);
+	}
+
+	/// @brief Takes a chunk from the recycled ones or the pool
+	/// @return The chunk, whose contents are to be filled in by the caller
+	Chunk *AllocateChunk()
+	{
+		if (_freeChunks != NULL)
+		{
+			Chunk *chunk = _freeChunks;
+			_freeChunks = chunk->Next;
+			return chunk;
+		}
+		if (_poolCurrent == NULL || _poolCurrent == (char*)_pages.back() + ChunksPerPage * ChunkStride)
+		{
+			void *page = Qtl::System::Memory::AllocatePages(PoolPageSize, -1);
+			if (page == NULL)
+			{
+				throw std::bad_alloc();
+			}
+			_pages.push_back(page);
+			_poolCurrent = (char*)page;
+		}
+		Chunk *chunk = new (_poolCurrent) Chunk();
+		_poolCurrent += ChunkStride;
+		return chunk;
+	}
+
+	/// @brief Puts a chunk that has been unlinked on the free list
+	/// @param chunk The chunk
+	/// @remarks The sequence number moves on so that readers still on the chunk retry
+	void RecycleChunk(Chunk *chunk)
+	{
+		BeginWrite(chunk);
+		chunk->Count = 0;
+		EndWrite(chunk);
+		chunk->Next = _freeChunks;
+		_freeChunks = chunk;
+	}
+
+	/// @brief returns the bit-reversal of the specified key
+	/// @param The key to bit-reverse
+	/// @return The bit-reversal of the key
+	static KeyType Reverse(KeyType key)
+	{
+		return BitReverse::Reverse(key);
+	}
+};
+
+}}}
+
+#endif
@@ -0,0 +1,433 @@
+#if !defined(_SOHASHMULTI_H_)
+#define _SOHASHMULTI_H_
+
+#include <vector>
+#include "sohash.h"
+#include "qtl/system/threading.h"
+
+namespace Qtl { namespace Scheme { namespace Hash {
+
+/// @brief A counted multimap on the split-ordered hash that keeps all the values of a key in one node
+/// @remarks Each distinct value of a key is stored once with the number of times it has been added; the
+///          first few are inline in the node of the key and the rest spill over to a vector. Unlike SoHash
+///          with AddStrategy::AddDuplicate, duplicates cost no node each. The writers are serialized by the
+///          multimap and the lookups take no lock: a node is only updated in place for the count of a value,
+///          otherwise the writer replaces the node with an updated copy. The hash runs in the read-mostly mode
+///          with a domain of the multimap and the lookups in its read sections, so the nodes replaced, their
+///          spilled values and the values dropped are freed and disposed of once the lookups reading them are
+///          over. The values need operator==.
+template <class TValue, class TDisposer=DefaultDisposer<TValue>, int TInlineCount=3>
+class SoHashMulti
+{
+public:	// Nested types
+
+	/// @brief The type of the key
+	typedef unsigned int KeyType;
+
+	/// @brief The type of the value
+	typedef TValue ValueType;
+
+private:
+	/// @brief A distinct value of a key with the number of times it has been added
+	struct Entry
+	{
+		ValueType Value;
+		volatile int Count;
+	};
+
+	/// @brief All the values of a key, which is the value of its node
+	/// @remarks A copy shares the spilled values, which CopyBag() doesn't
+	struct Bag
+	{
+		/// @brief The number of distinct values
+		int Size;
+
+		/// @brief The first distinct values
+		Entry Inline[TInlineCount];
+
+		/// @brief The rest of the distinct values or NULL
+		std::vector<Entry> *Overflow;
+
+		/// @brief Instantiates an empty bag
+		Bag() : Size(0), Overflow(NULL)
+		{
+		}
+
+		/// @brief Returns a distinct value
+		/// @param index The index of the value
+		/// @return The entry of the value
+		Entry &At(int index)
+		{
+			return (index < TInlineCount)? Inline[index] : (*Overflow)[index - TInlineCount];
+		}
+
+		/// @brief Returns a distinct value
+		/// @param index The index of the value
+		/// @return The entry of the value
+		const Entry &At(int index) const
+		{
+			return (index < TInlineCount)? Inline[index] : (*Overflow)[index - TInlineCount];
+		}
+
+		/// @brief Appends a distinct value
+		/// @param entry The entry of the value
+		void Append(const Entry &entry)
+		{
+			if (Size < TInlineCount)
+			{
+				Inline[Size] = entry;
+			}
+			else
+			{
+				if (Overflow == NULL)
+				{
+					Overflow = new std::vector<Entry>();
+				}
+				Overflow->push_back(entry);
+			}
+			Size++;
+		}
+
+		/// @brief Returns the index of a value
+		/// @param value The value
+		/// @return The index or -1 if it's not there
+		int IndexOf(const ValueType &value) const
+		{
+			for (int i = 0; i < Size; i++)
+			{
+				if (At(i).Value == value)
+				{
+					return i;
+				}
+			}
+			return -1;
+		}
+	};
+
+	/// @brief What a node replaced for the removal of a value leaves to free once the lookups reading it are over
+	struct Leftover
+	{
+		/// @brief The spilled values of the node or NULL
+		std::vector<Entry> *Overflow;
+
+		/// @brief The value that's not in the node replacing it
+		Entry Dropped;
+	};
+
+	/// @brief Disposes of all the values of a key and frees the spilled ones
+	struct BagDisposer
+	{
+		TDisposer Disposer;
+
+		BagDisposer(const TDisposer &disposer) : Disposer(disposer)
+		{
+		}
+
+		void operator()(Bag &bag)
+		{
+			for (int i = 0; i < bag.Size; i++)
+			{
+				Disposer(bag.At(i).Value);
+			}
+			delete bag.Overflow;
+			bag.Overflow = NULL;
+		}
+	};
+
+private:
+	/// @brief The disposer of the values
+	TDisposer _disposer;
+
+	/// @brief The domain the replaced nodes wait in for the lookups reading them, which outlives the hash
+	mutable Qtl::System::Rcu::QsbrDomain _domain;
+
+	/// @brief The hash from the keys to the values
+	SoHashLinear<Bag, BagDisposer> _hash;
+
+	/// @brief The number of values counting the duplicates
+	int _count;
+
+	/// @brief The mutex that serializes the writers
+	Qtl::System::Threading::Mutex _mutex;
+
+public:
+	/// @brief Instantiates a multimap
+	/// @param maxLoad The maximum average number of keys per bucket before the table is doubled
+	SoHashMulti(float maxLoad) : _hash(maxLoad, BagDisposer(TDisposer())), _count(0)
+	{
+		_hash.EnableReadMostly(_domain);
+	}
+
+	/// @brief Instantiates a multimap with a disposer
+	/// @param maxLoad The maximum average number of keys per bucket before the table is doubled
+	/// @param disposer The disposer a value is given to when its last occurrence is removed
+	SoHashMulti(float maxLoad, const TDisposer &disposer) : _disposer(disposer),
+		_hash(maxLoad, BagDisposer(disposer)), _count(0)
+	{
+		_hash.EnableReadMostly(_domain);
+	}
+
+	/// @brief Finalises the multimap disposing of all the values
+	~SoHashMulti()
+	{
+		_hash.Clear();
+		_domain.ReclaimNow(this);
+	}
+
+private:
+	/// @brief Disallows copying
+	SoHashMulti(const SoHashMulti &);
+
+	/// @brief Disallows assignment
+	SoHashMulti &operator=(const SoHashMulti &);
+
+public:
+	/// @brief Returns the number of values counting the duplicates
+	/// @return The number of values
+	int GetCount() const
+	{
+		return _count;
+	}
+
+	/// @brief Returns the number of distinct keys
+	/// @return The number of keys
+	int GetKeyCount() const
+	{
+		return _hash.GetCount();
+	}
+
+	/// @brief Adds an occurrence of a value to a key
+	/// @param key The key
+	/// @param value The value
+	/// @return The number of occurrences of the value with the key after the addition
+	int Add(KeyType key, const ValueType &value)
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		_count++;
+
+		Entry entry;
+		entry.Value = value;
+		entry.Count = 1;
+		Bag *bag;
+		if (!_hash.FindFirst(key, &bag))
+		{
+			Bag created;
+			created.Append(entry);
+			_hash.AddKeyValuePair(key, created);
+			return 1;
+		}
+
+		int index = bag->IndexOf(value);
+		if (index >= 0)
+		{
+			Entry &existing = bag->At(index);
+			Qtl::System::Threading::AtomicStoreRelease(&existing.Count, existing.Count + 1);
+			return existing.Count;
+		}
+		Bag grown;
+		CopyBag(*bag, -1, grown);
+		grown.Append(entry);
+		ReplaceBag(key, *bag, grown, -1);
+		_domain.Reclaim();
+		return 1;
+		// unlock
+	}
+
+	/// @brief Removes an occurrence of a value from a key
+	/// @param key The key
+	/// @param value The value
+	/// @return true if the value was there
+	/// @remarks The value is disposed of when its last occurrence is removed
+	bool Remove(KeyType key, const ValueType &value)
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		Bag *bag;
+		if (!_hash.FindFirst(key, &bag))
+		{
+			return false;
+		}
+		int index = bag->IndexOf(value);
+		if (index < 0)
+		{
+			return false;
+		}
+		_count--;
+		Entry &entry = bag->At(index);
+		if (entry.Count > 1)
+		{
+			Qtl::System::Threading::AtomicStoreRelease(&entry.Count, entry.Count - 1);
+			return true;
+		}
+
+		if (bag->Size == 1)
+		{
+			// the bag is disposed of with its only value
+			_hash.DeleteKey(key);
+		}
+		else
+		{
+			Bag shrunk;
+			CopyBag(*bag, index, shrunk);
+			ReplaceBag(key, *bag, shrunk, index);
+		}
+		_domain.Reclaim();
+		return true;
+		// unlock
+	}
+
+	/// @brief Removes all the values of a key
+	/// @param key The key
+	/// @return The number of occurrences removed
+	int DeleteKey(KeyType key)
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		Bag *bag;
+		if (!_hash.FindFirst(key, &bag))
+		{
+			return 0;
+		}
+		int removed = 0;
+		for (int i = 0; i < bag->Size; i++)
+		{
+			removed += bag->At(i).Count;
+		}
+		_hash.DeleteKey(key);
+		_count -= removed;
+		_domain.Reclaim();
+		return removed;
+		// unlock
+	}
+
+	/// @brief Returns the number of occurrences of a value with a key without taking any lock
+	/// @param key The key
+	/// @param value The value
+	/// @return The number of occurrences
+	int GetValueCount(KeyType key, const ValueType &value) const
+	{
+		int count = 0;
+		int phase = _domain.EnterReadSection(key);
+		Bag *bag;
+		if (_hash.FindFirst(key, &bag))
+		{
+			int index = bag->IndexOf(value);
+			if (index >= 0)
+			{
+				count = Qtl::System::Threading::AtomicLoadAcquire(&bag->At(index).Count);
+			}
+		}
+		_domain.ExitReadSection(phase, key);
+		return count;
+	}
+
+	/// @brief Gets the distinct values of a key without taking any lock
+	/// @param key The key
+	/// @param values The distinct values
+	/// @param counts To return the number of occurrences of each value or NULL
+	/// @return true if the key has any value
+	bool Find(KeyType key, std::vector<ValueType> &values, std::vector<int> *counts=NULL) const
+	{
+		values.clear();
+		if (counts != NULL)
+		{
+			counts->clear();
+		}
+
+		bool found = false;
+		int phase = _domain.EnterReadSection(key);
+		Bag *bag;
+		if (_hash.FindFirst(key, &bag))
+		{
+			for (int i = 0; i < bag->Size; i++)
+			{
+				values.push_back(bag->At(i).Value);
+				if (counts != NULL)
+				{
+					counts->push_back(Qtl::System::Threading::AtomicLoadAcquire(&bag->At(i).Count));
+				}
+			}
+			found = true;
+		}
+		_domain.ExitReadSection(phase, key);
+		return found;
+	}
+
+	/// @brief Removes all the keys and values
+	void Clear()
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		_hash.Clear();
+		_count = 0;
+		_domain.Reclaim();
+		// unlock
+	}
+
+private:
+	/// @brief Copies a bag the writers are to update instead of the one the lookups may be reading
+	/// @param bag The bag
+	/// @param skipped The index of a value left out of the copy or -1
+	/// @param copy The empty bag to copy to, which gets spilled values of its own
+	static void CopyBag(const Bag &bag, int skipped, Bag &copy)
+	{
+		for (int i = 0; i < bag.Size; i++)
+		{
+			if (i != skipped)
+			{
+				copy.Append(bag.At(i));
+			}
+		}
+	}
+
+	/// @brief Replaces the node of a key with one of the updated copy of its bag and retires what the
+	///        replaced node leaves
+	/// @param key The key
+	/// @param bag The bag of the node
+	/// @param copy The updated copy
+	/// @param dropped The index of the value of the bag that is not in the copy or -1
+	void ReplaceBag(KeyType key, const Bag &bag, const Bag &copy, int dropped)
+	{
+		// the node is retired by the hash without its values being disposed of
+		std::vector<Entry> *overflow = bag.Overflow;
+		Leftover *leftover = NULL;
+		if (dropped >= 0)
+		{
+			leftover = new Leftover();
+			leftover->Overflow = overflow;
+			leftover->Dropped = bag.At(dropped);
+		}
+		_hash.AddKeyValuePair(key, copy);
+		if (leftover != NULL)
+		{
+			_domain.Retire(leftover, ReclaimLeftover, this);
+		}
+		else if (overflow != NULL)
+		{
+			_domain.Retire(overflow, ReclaimOverflow, this);
+		}
+	}
+
+	/// @brief Frees the spilled values of a replaced node
+	/// @param overflow The spilled values
+	static void ReclaimOverflow(void *overflow, void *)
+	{
+		delete static_cast<std::vector<Entry>*>(overflow);
+	}
+
+	/// @brief Frees the spilled values of a replaced node and disposes of the value that was removed from it
+	/// @param leftover The leftover of the node
+	/// @param multi The multimap that retired it
+	static void ReclaimLeftover(void *leftover, void *multi)
+	{
+		Leftover *retired = static_cast<Leftover*>(leftover);
+		static_cast<SoHashMulti*>(multi)->_disposer(retired->Dropped.Value);
+		delete retired->Overflow;
+		delete retired;
+	}
+};
+
+}}}
+
+#endif
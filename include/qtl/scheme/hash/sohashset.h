@@ -0,0 +1,50 @@
+#if !defined(_SOHASHSET_H_)
+#define _SOHASHSET_H_
+
+#include "sohash.h"
+
+namespace Qtl { namespace Scheme { namespace Hash {
+
+/// @brief A concurrent set of keys on the split-ordered hash whose nodes carry no value
+/// @remarks A node takes only the SO-key and the link; lookups are lock-free as with SoHashLinear
+class SoHashSet : public SoHashLinear<SoEmpty>
+{
+private:
+	/// @brief The base class
+	typedef SoHashLinear<SoEmpty> Base;
+
+public:
+	/// @brief Instantiates a set
+	/// @param maxLoad The maximum average number of keys per bucket before the table is doubled
+	SoHashSet(float maxLoad) : Base(maxLoad)
+	{
+	}
+
+	/// @brief Adds a key to the set
+	/// @param key The key to add
+	/// @return true if the key is added or false if it's already in the set
+	bool Add(KeyType key)
+	{
+		return Base::AddKeyValuePair(key, SoEmpty(), AddStrategy::ReturnFalseOnExisting);
+	}
+
+	/// @brief Determines if the key is in the set
+	/// @param key The key to check
+	/// @return true if it is
+	bool Contains(KeyType key) const
+	{
+		return Base::FindFirst(key, (SoEmpty**)NULL);
+	}
+
+	/// @brief Removes a key from the set
+	/// @param key The key to remove
+	/// @return true if the key was in the set
+	bool Remove(KeyType key)
+	{
+		return Base::DeleteKey(key) > 0;
+	}
+};
+
+}}}
+
+#endif
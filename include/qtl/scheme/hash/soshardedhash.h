@@ -0,0 +1,521 @@
+#if !defined(_SOSHARDEDHASH_H_)
+#define _SOSHARDEDHASH_H_
+
+#include <vector>
+#include "sohash.h"
+#include "qtl/system/memory.h"
+#include "qtl/system/threading.h"
+
+namespace Qtl { namespace Scheme { namespace Hash {
+
+/// @brief A node allocator that carves nodes out of pages bound to a NUMA node
+/// @remarks Freed nodes are kept on per-size free lists and reused; the pages are only given back when the
+///          allocator is destroyed, which has to happen after the hashes using it have been destroyed
+class PagedNodeAllocator : public NodeAllocator
+{
+public:
+	/// @brief The number of bytes requested from the system at a time unless huge pages are asked for
+	static const size_t PageSize = 64 * 1024;
+
+	/// @brief The granularity of the sizes the nodes are rounded up to
+	static const size_t Granularity = 16;
+
+	/// @brief The number of size classes, nodes larger than the largest go to the global operator new
+	static const int SizeClassCount = 16;
+
+private:
+	/// @brief The header of a free node
+	struct FreeNode
+	{
+		FreeNode *Next;
+	};
+
+	/// @brief The NUMA node the pages are bound to or -1
+	int _numaNode;
+
+	/// @brief The number of bytes requested from the system at a time
+	size_t _pageSize;
+
+	/// @brief Whether the pages are requested as huge pages
+	bool _hugePages;
+
+	/// @brief The number of pages that are backed with huge pages
+	int _hugePageCount;
+
+	/// @brief The pages allocated so far
+	std::vector<void*> _pages;
+
+	/// @brief The next unused byte in the current page
+	char *_current;
+
+	/// @brief The end of the current page
+	char *_end;
+
+	/// @brief The free lists by size class
+	FreeNode *_freeLists[SizeClassCount];
+
+	/// @brief The mutex that serializes allocations and frees
+	Qtl::System::Threading::Mutex _mutex;
+
+public:
+	/// @brief Instantiates an allocator
+	/// @param numaNode The NUMA node to bind the pages to or -1 for no binding
+	/// @param hugePages Whether to take the memory from the system a huge page at a time, which falls back
+	///        to normal pages if the system has no huge pages to give
+	PagedNodeAllocator(int numaNode, bool hugePages=false) : _numaNode(numaNode),
+		_pageSize(hugePages? Qtl::System::Memory::HugePageSize : PageSize), _hugePages(hugePages),
+		_hugePageCount(0), _current(NULL), _end(NULL)
+	{
+		for (int i = 0; i < SizeClassCount; i++)
+		{
+			_freeLists[i] = NULL;
+		}
+	}
+
+	/// @brief Finalises the allocator and gives all the pages back
+	virtual ~PagedNodeAllocator()
+	{
+		for (size_t i = 0; i < _pages.size(); i++)
+		{
+			Qtl::System::Memory::FreePages(_pages[i], _pageSize);
+		}
+	}
+
+private:
+	/// @brief Disallows copying
+	PagedNodeAllocator(const PagedNodeAllocator &);
+
+	/// @brief Disallows assignment
+	PagedNodeAllocator &operator=(const PagedNodeAllocator &);
+
+public:
+	/// @brief Returns the NUMA node the pages are bound to
+	/// @return The node or -1
+	int GetNumaNode() const
+	{
+		return _numaNode;
+	}
+
+	/// @brief Returns the number of bytes taken from the system
+	/// @return The number of bytes
+	size_t GetMemorySize() const
+	{
+		return _pages.size() * _pageSize;
+	}
+
+	/// @brief Returns the number of pages taken from the system that are backed with huge pages
+	/// @return The number of huge pages, 0 if they were not asked for or the system had none
+	int GetHugePageCount() const
+	{
+		return _hugePageCount;
+	}
+
+	/// @brief Allocates memory for a node
+	/// @param size The size of the node
+	/// @return The memory
+	virtual void *Allocate(size_t size)
+	{
+		int sizeClass = GetSizeClass(size);
+		if (sizeClass >= SizeClassCount)
+		{
+			return ::operator new(size);
+		}
+
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		FreeNode *node = _freeLists[sizeClass];
+		if (node != NULL)
+		{
+			_freeLists[sizeClass] = node->Next;
+			return node;
+		}
+
+		size_t rounded = (size_t)(sizeClass + 1) * Granularity;
+		if (_current == NULL || (size_t)(_end - _current) < rounded)
+		{
+			char *page = AllocatePage();
+			if (page == NULL)
+			{
+				throw std::bad_alloc();
+			}
+			_pages.push_back(page);
+			_current = page;
+			_end = page + _pageSize;
+		}
+		void *p = _current;
+		_current += rounded;
+		return p;
+		// unlock
+	}
+
+	/// @brief Frees the memory of a node
+	/// @param p The memory returned by Allocate()
+	/// @param size The size it was allocated with
+	virtual void Free(void *p, size_t size)
+	{
+		int sizeClass = GetSizeClass(size);
+		if (sizeClass >= SizeClassCount)
+		{
+			::operator delete(p);
+			return;
+		}
+
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		FreeNode *node = (FreeNode*)p;
+		node->Next = _freeLists[sizeClass];
+		_freeLists[sizeClass] = node;
+		// unlock
+	}
+
+private:
+	/// @brief Takes a page from the system
+	/// @return The page or NULL if out of memory
+	/// @remarks It's called with the lock held
+	char *AllocatePage()
+	{
+		using namespace Qtl::System::Memory;
+		if (!_hugePages)
+		{
+			return (char*)AllocatePages(_pageSize, _numaNode);
+		}
+		size_t mappedSize;
+		PageKind::Enum kind;
+		char *page = (char*)AllocateHugePages(_pageSize, _numaNode, mappedSize, kind);
+		if (page != NULL && (kind == PageKind::ExplicitHuge || kind == PageKind::TransparentHuge))
+		{
+			_hugePageCount++;
+		}
+		return page;
+	}
+
+	/// @brief Returns the size class of a size
+	/// @param size The size
+	/// @return The size class
+	static int GetSizeClass(size_t size)
+	{
+		return (int)((size + Granularity - 1) / Granularity) - 1;
+	}
+};
+
+/// @brief A hash that spreads its keys over a number of independent split-ordered hashes
+/// @remarks A key always goes to the same shard, which is picked by the high bits of a multiplicative hash of
+///          the key so that it is independent of the low bits the shards use for their buckets. Writers to
+///          different shards do not contend and each shard can keep its nodes on its own NUMA node. Only the
+///          nodes are bound, the bucket tables are allocated by the shards as usual.
+template <class TValue, class TDisposer=DefaultDisposer<TValue> >
+class SoShardedHash
+{
+public:	// Nested types
+
+	/// @brief The type of the shards
+	typedef SoHashLinear<TValue, TDisposer> ShardType;
+
+	/// @brief The type of the key
+	typedef typename ShardType::KeyType KeyType;
+
+	/// @brief The type of the value
+	typedef TValue ValueType;
+
+	/// @brief The strategies of dealing with existing keys
+	typedef typename ShardType::AddStrategy AddStrategy;
+
+	/// @brief The iterator that walks all the items of all the shards
+	class Iterator
+	{
+	private:
+		/// @brief The hash the iterator walks
+		SoShardedHash *_owner;
+
+		/// @brief The shard the iterator is in or the number of shards at the end
+		int _shardIndex;
+
+		/// @brief The position in the shard
+		typename ShardType::Iterator _inner;
+
+	private:
+		/// @brief Instantiates an iterator at the beginning of a shard and moves it to the first item
+		/// @param owner The hash
+		/// @param shardIndex The shard to start from
+		Iterator(SoShardedHash *owner, int shardIndex) : _owner(owner), _shardIndex(shardIndex)
+		{
+			if (_shardIndex < _owner->GetShardCount())
+			{
+				_inner = _owner->_shards[_shardIndex]->GetBegin();
+				SkipEmptyShards();
+			}
+		}
+
+		friend class SoShardedHash;
+
+		/// @brief Moves on to the next shards while the current one is exhausted
+		void SkipEmptyShards()
+		{
+			while (_inner == _owner->_shards[_shardIndex]->GetEnd())
+			{
+				if (++_shardIndex == _owner->GetShardCount())
+				{
+					_inner = typename ShardType::Iterator();
+					return;
+				}
+				_inner = _owner->_shards[_shardIndex]->GetBegin();
+			}
+		}
+
+	public:
+		/// @brief Instantiates an iterator associated to no hash
+		Iterator() : _owner(NULL), _shardIndex(0)
+		{
+		}
+
+		/// @brief Determines if the two iterators are the same
+		/// @param other The iterator to compare this one to
+		/// @return true if they are considered the same or false
+		bool operator==(const Iterator &other) const
+		{
+			return (_shardIndex == other._shardIndex && _inner == other._inner);
+		}
+
+		/// @brief Determines if the two iterators are different
+		/// @param other The iterator to compare this one to
+		/// @return true if they are considered different or false
+		bool operator!=(const Iterator &other) const
+		{
+			return !(*this == other);
+		}
+
+		/// @brief Moves the iterator to the next item and returns the iterator itself after the move
+		/// @return The iterator
+		Iterator &operator++()
+		{
+			++_inner;
+			SkipEmptyShards();
+			return (*this);
+		}
+
+		/// @brief Moves the iterator to the next item and returns a copy of the iterator before the move
+		/// @return A copy of the iterator before the move
+		Iterator operator++(int)
+		{
+			Iterator result(*this);
+			++(*this);
+			return result;
+		}
+
+		/// @brief Returns the value the iterator references
+		/// @return The value
+		ValueType &operator*()
+		{
+			return *_inner;
+		}
+	};
+
+private:
+	/// @brief The shards
+	std::vector<ShardType*> _shards;
+
+	/// @brief The node allocators of the shards if they are bound to NUMA nodes
+	std::vector<PagedNodeAllocator*> _allocators;
+
+	/// @brief The number of bits of the shard index
+	int _shardBits;
+
+public:
+	/// @brief Instantiates a sharded hash
+	/// @param shardBits The number of bits of the shard index; there are 2^shardBits shards
+	/// @param maxLoad The maximum load of each shard
+	/// @param pinToNumaNodes Whether to allocate the nodes of shard i from NUMA node i modulo the number of nodes
+	SoShardedHash(int shardBits, float maxLoad, bool pinToNumaNodes=false) : _shardBits(shardBits)
+	{
+		for (int i = 0; i < (1 << shardBits); i++)
+		{
+			_shards.push_back(new ShardType(maxLoad));
+		}
+		Initialize(pinToNumaNodes);
+	}
+
+	/// @brief Instantiates a sharded hash with a disposer
+	/// @param shardBits The number of bits of the shard index; there are 2^shardBits shards
+	/// @param maxLoad The maximum load of each shard
+	/// @param pinToNumaNodes Whether to allocate the nodes of shard i from NUMA node i modulo the number of nodes
+	/// @param disposer The disposer every shard gets a copy of
+	SoShardedHash(int shardBits, float maxLoad, bool pinToNumaNodes, const TDisposer &disposer) : _shardBits(shardBits)
+	{
+		for (int i = 0; i < (1 << shardBits); i++)
+		{
+			_shards.push_back(new ShardType(maxLoad, disposer));
+		}
+		Initialize(pinToNumaNodes);
+	}
+
+	/// @brief Finalises the hash, the shards go before the allocators they use
+	~SoShardedHash()
+	{
+		for (size_t i = 0; i < _shards.size(); i++)
+		{
+			delete _shards[i];
+		}
+		for (size_t i = 0; i < _allocators.size(); i++)
+		{
+			delete _allocators[i];
+		}
+	}
+
+private:
+	/// @brief Disallows copying
+	SoShardedHash(const SoShardedHash &);
+
+	/// @brief Disallows assignment
+	SoShardedHash &operator=(const SoShardedHash &);
+
+public:
+	/// @brief Returns the number of shards
+	/// @return The number of shards
+	int GetShardCount() const
+	{
+		return (int)_shards.size();
+	}
+
+	/// @brief Returns a shard
+	/// @param index The index of the shard
+	/// @return The shard
+	ShardType &GetShard(int index)
+	{
+		return *_shards[index];
+	}
+
+	/// @brief Returns the index of the shard a key goes to
+	/// @param key The key
+	/// @return The index of the shard
+	int GetShardIndex(KeyType key) const
+	{
+		return (_shardBits > 0)? (int)((KeyType)(key * 0x9e3779b9U) >> (32 - _shardBits)) : 0;
+	}
+
+	/// @brief Returns the NUMA node the nodes of a shard are allocated from
+	/// @param index The index of the shard
+	/// @return The NUMA node or -1 if the shard is not bound
+	int GetShardNumaNode(int index) const
+	{
+		return _allocators.empty()? -1 : _allocators[index]->GetNumaNode();
+	}
+
+	/// @brief Returns the total number of items
+	/// @return The number of items
+	/// @remarks The shards are counted one after another so the result is not a snapshot under concurrent updates
+	int GetCount() const
+	{
+		int count = 0;
+		for (size_t i = 0; i < _shards.size(); i++)
+		{
+			count += _shards[i]->GetCount();
+		}
+		return count;
+	}
+
+	/// @brief Returns the iterator to the first item of the first non-empty shard
+	/// @return The iterator
+	Iterator GetBegin()
+	{
+		return Iterator(this, 0);
+	}
+
+	/// @brief Returns the iterator past the last item of the last shard
+	/// @return The iterator
+	Iterator GetEnd()
+	{
+		return Iterator(this, GetShardCount());
+	}
+
+	/// @brief Adds a key value pair to the shard of the key
+	/// @param key The numeric key to the value
+	/// @param value The value associated with the key
+	/// @param addStrategy How to deal with duplication
+	/// @return true if a new item is added or the existing one is replaced
+	bool AddKeyValuePair(KeyType key, ValueType value,
+		typename AddStrategy::Enum addStrategy=AddStrategy::ReplaceExisting)
+	{
+		return _shards[GetShardIndex(key)]->AddKeyValuePair(key, value, addStrategy);
+	}
+
+	/// @brief Gets the first item with the key
+	/// @param key The key to find the item with
+	/// @param ppValue To return the pointer to the value. Pass in NULL to ignore the retrieval
+	/// @return true if found or false
+	bool FindFirst(KeyType key, ValueType **ppValue=NULL) const
+	{
+		return _shards[GetShardIndex(key)]->FindFirst(key, ppValue, (KeyType*)NULL);
+	}
+
+	/// @brief Finds all values associated with the specified key
+	/// @param key The key to find the values with
+	/// @param values The values found
+	/// @return true if any is found
+	bool Find(KeyType key, std::vector<ValueType> &values) const
+	{
+		return _shards[GetShardIndex(key)]->Find(key, values);
+	}
+
+	/// @brief Deletes all items with the specified key
+	/// @param key The key the items to delete are associated with
+	/// @return The number of items deleted
+	int DeleteKey(KeyType key)
+	{
+		return _shards[GetShardIndex(key)]->DeleteKey(key);
+	}
+
+	/// @brief Deletes the items with the specified key that satisfy the predicate
+	/// @param key The key the items to delete are associated with
+	/// @param isTarget The predicate that checks if an item is to delete
+	/// @return The number of items deleted
+	template <class TPredicate>
+	int DeleteKeyValuePairs(KeyType key, TPredicate isTarget)
+	{
+		return _shards[GetShardIndex(key)]->DeleteKeyValuePairs(key, isTarget);
+	}
+
+	/// @brief Deletes the items of all the shards that satisfy the predicate
+	/// @param isTarget The predicate that checks if an item is to delete
+	/// @return The number of items deleted
+	template <class TPredicate>
+	int EraseIf(TPredicate isTarget)
+	{
+		int erased = 0;
+		for (size_t i = 0; i < _shards.size(); i++)
+		{
+			erased += _shards[i]->EraseIf(isTarget);
+		}
+		return erased;
+	}
+
+	/// @brief Removes the contents of all the shards
+	void Clear()
+	{
+		for (size_t i = 0; i < _shards.size(); i++)
+		{
+			_shards[i]->Clear();
+		}
+	}
+
+private:
+	/// @brief Creates the allocators if the shards are to be bound to NUMA nodes
+	/// @param pinToNumaNodes Whether to bind the shards
+	void Initialize(bool pinToNumaNodes)
+	{
+		if (!pinToNumaNodes)
+		{
+			return;
+		}
+		int numaNodeCount = Qtl::System::Memory::GetNumaNodeCount();
+		for (size_t i = 0; i < _shards.size(); i++)
+		{
+			PagedNodeAllocator *allocator = new PagedNodeAllocator((int)i % numaNodeCount);
+			_allocators.push_back(allocator);
+			_shards[i]->SetNodeAllocator(allocator);
+		}
+	}
+};
+
+}}}
+
+#endif
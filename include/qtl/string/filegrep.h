@@ -0,0 +1,308 @@
+#if !defined (_FILEGREP_H_)
+#define _FILEGREP_H_
+
+#include <string>
+#include <vector>
+#include "wildcard.h"
+#include "wildcardnfa.h"
+#include "simdsearch.h"
+#include "qtl/system/memory.h"
+#include "qtl/system/threading.h"
+
+namespace Qtl { namespace String { namespace Wildcard {
+
+    /// @brief A line that matches, as given to the sink of FileGrep
+    struct GrepLine
+    {
+        /// @brief The offset of the line in the file
+        size_t Offset;
+
+        /// @brief The number of characters in the line not counting the line feed
+        size_t Length;
+
+        /// @brief The line, which is not zero-terminated
+        const char *Text;
+
+        /// @brief The number of match entries, the first of which is the whole match
+        int EntryCount;
+
+        /// @brief The offsets in the line of the beginning and the end of each entry alternately, -1 for an end
+        ///        of a quotation that's never closed
+        const int *Entries;
+    };
+
+    /// @brief Finds the lines of a file that match a wildcard pattern on many threads
+    /// @remarks The file is mapped into memory and split into chunks that end at line feeds, which the threads
+    ///          take one at a time. The lines that match are handed to a sink in the order of the file as soon
+    ///          as the chunks before them are done, by the calling thread, which takes chunks as well while it
+    ///          waits. A line matches if the pattern matches starting anywhere in it as with Matcher::Search(),
+    ///          or only at its beginning if the grep is anchored. The quotations of a pattern that has them
+    ///          are worked out with NfaMatcher from where the match starts, which is found without them, so
+    ///          the matching of a line takes no recursion whatever its length.
+    class FileGrep
+    {
+    public:
+        /// @brief The type of the pattern, which owns a copy of the pattern string
+        typedef Pattern<std::string, const std::string&, std::string::const_iterator> PatternType;
+
+        /// @brief The traits of the matchers of the lines, which keep the match entries on the stack
+        typedef MatcherTraits<CharSpan, const char*, size_t, DefaultStringFunctorSelector,
+            FixedMatchResult<const char*, size_t, 16> > TraitsType;
+
+        /// @brief The type of the matcher of the lines
+        typedef Matcher<TraitsType> MatcherType;
+
+        /// @brief The type of the matcher of the quotations, one per thread
+        typedef NfaMatcher<TraitsType> NfaMatcherType;
+
+        /// @brief The chunk size used unless another is given
+        static const size_t DefaultChunkSize = 4 * 1024 * 1024;
+
+    private:
+        /// @brief A part of the file that ends at a line feed and the lines in it that match
+        struct Chunk
+        {
+            /// @brief The first character
+            const char *Begin;
+
+            /// @brief The end of the characters
+            const char *End;
+
+            /// @brief The offset and the length of each line that matches
+            std::vector<size_t> Lines;
+
+            /// @brief The match entries of each line that matches
+            std::vector<int> Entries;
+
+            /// @brief Set once the chunk has been matched
+            volatile long Done;
+        };
+
+        /// @brief The state the threads of a grep share
+        struct Context
+        {
+            /// @brief The grep
+            const FileGrep *Grep;
+
+            /// @brief The beginning of the file
+            const char *Data;
+
+            /// @brief The chunks
+            std::vector<Chunk> *Chunks;
+
+            /// @brief The number of chunks taken
+            volatile long Taken;
+        };
+
+    private:
+        /// @brief The pattern
+        PatternType _pattern;
+
+        /// @brief The pattern compiled for NfaMatcher
+        CompiledPattern<> _compiled;
+
+        /// @brief The number of threads other than the calling one
+        int _threadCount;
+
+        /// @brief Whether the matches have to start at the beginning of the lines
+        bool _anchored;
+
+        /// @brief The number of characters of a chunk before it's extended to a line feed
+        size_t _chunkSize;
+
+    public:
+        /// @brief Instantiates a grep
+        /// @param pattern The pattern
+        /// @param threadCount The number of threads to match with, the calling one included, or 0 for one per
+        ///        processor
+        /// @param anchored Whether the matches have to start at the beginning of the lines
+        /// @param chunkSize The number of characters of a chunk before it's extended to a line feed
+        FileGrep(const std::string &pattern, int threadCount=0, bool anchored=false,
+            size_t chunkSize=DefaultChunkSize)
+            : _pattern(pattern), _anchored(anchored), _chunkSize(chunkSize > 0? chunkSize : 1)
+        {
+            if (threadCount <= 0)
+            {
+                threadCount = Qtl::System::Threading::GetProcessorCount();
+            }
+            _threadCount = threadCount - 1;
+            _compiled.Compile(_pattern);
+        }
+
+    public:
+        /// @brief Finds the lines of a file that match
+        /// @param path The path of the file
+        /// @param sink The functor that's called with a const GrepLine& for each line that matches
+        /// @return The number of lines that match or -1 if the file cannot be mapped
+        template <class TSink>
+        long long GrepFile(const char *path, TSink &sink) const
+        {
+            Qtl::System::Memory::MappedFile file;
+            if (!file.Open(path))
+            {
+                return -1;
+            }
+            return Grep(file.GetData(), file.GetSize(), sink);
+        }
+
+        /// @brief Finds the lines of a buffer that match
+        /// @param data The buffer
+        /// @param size The number of characters in the buffer
+        /// @param sink The functor that's called with a const GrepLine& for each line that matches
+        /// @return The number of lines that match
+        template <class TSink>
+        long long Grep(const char *data, size_t size, TSink &sink) const
+        {
+            std::vector<Chunk> chunks;
+            Split(data, size, chunks);
+
+            Context context;
+            context.Grep = this;
+            context.Data = data;
+            context.Chunks = &chunks;
+            context.Taken = 0;
+            int threadCount = ((size_t)_threadCount < chunks.size())? _threadCount : (int)chunks.size() - 1;
+            std::vector<Qtl::System::Threading::Thread*> threads;
+            for (int i = 0; i < threadCount; i++)
+            {
+                threads.push_back(new Qtl::System::Threading::Thread());
+                threads.back()->Start(Work, &context);
+            }
+
+            NfaMatcherType nfaMatcher;
+            long long matchCount = 0;
+            GrepLine line;
+            line.EntryCount = _pattern.GetQuoteCount() + 1;
+            for (size_t i = 0; i < chunks.size(); i++)
+            {
+                Chunk &chunk = chunks[i];
+                while (Qtl::System::Threading::AtomicLoadAcquire(&chunk.Done) == 0)
+                {
+                    if (!TakeChunk(context, nfaMatcher))
+                    {
+                        Qtl::System::Threading::YieldThread();
+                    }
+                }
+                for (size_t k = 0; k < chunk.Lines.size(); k += 2)
+                {
+                    line.Offset = chunk.Lines[k];
+                    line.Length = chunk.Lines[k + 1];
+                    line.Text = data + line.Offset;
+                    line.Entries = &chunk.Entries[k / 2 * line.EntryCount * 2];
+                    sink(line);
+                    matchCount++;
+                }
+                // the lines of a chunk are let go of once they're out
+                std::vector<size_t>().swap(chunk.Lines);
+                std::vector<int>().swap(chunk.Entries);
+            }
+
+            for (size_t i = 0; i < threads.size(); i++)
+            {
+                threads[i]->Join();
+                delete threads[i];
+            }
+            return matchCount;
+        }
+
+    private:
+        /// @brief Splits a buffer into chunks that end at line feeds
+        /// @param data The buffer
+        /// @param size The number of characters in the buffer
+        /// @param chunks To return the chunks
+        void Split(const char *data, size_t size, std::vector<Chunk> &chunks) const
+        {
+            const char *end = data + size;
+            Chunk chunk;
+            chunk.Done = 0;
+            for (const char *begin = data; begin < end; begin = chunk.End)
+            {
+                chunk.Begin = begin;
+                chunk.End = ((size_t)(end - begin) > _chunkSize)? begin + _chunkSize : end;
+                if (chunk.End < end)
+                {
+                    chunk.End = SimdSearch::FindChar(chunk.End, end, '\n');
+                    if (chunk.End < end)
+                    {
+                        ++chunk.End;
+                    }
+                }
+                chunks.push_back(chunk);
+            }
+        }
+
+        /// @brief The function the threads other than the calling one run
+        /// @param arg The context
+        static void Work(void *arg)
+        {
+            Context &context = *(Context*)arg;
+            NfaMatcherType nfaMatcher;
+            while (TakeChunk(context, nfaMatcher))
+            {
+            }
+        }
+
+        /// @brief Takes the next chunk no thread has taken and matches its lines
+        /// @param context The context
+        /// @param nfaMatcher The matcher of the quotations of the calling thread
+        /// @return false if all the chunks have been taken
+        static bool TakeChunk(Context &context, NfaMatcherType &nfaMatcher)
+        {
+            long index = Qtl::System::Threading::AtomicAdd(&context.Taken, 1L) - 1;
+            if (index >= (long)context.Chunks->size())
+            {
+                return false;
+            }
+            Chunk &chunk = (*context.Chunks)[index];
+            context.Grep->MatchChunk(context.Data, chunk, nfaMatcher);
+            Qtl::System::Threading::AtomicStoreRelease(&chunk.Done, 1L);
+            return true;
+        }
+
+        /// @brief Matches the lines of a chunk
+        /// @param data The beginning of the file
+        /// @param chunk The chunk
+        /// @param nfaMatcher The matcher of the quotations of the calling thread
+        void MatchChunk(const char *data, Chunk &chunk, NfaMatcherType &nfaMatcher) const
+        {
+            MatcherType matcher;
+            MatcherType::MatchResultType matchResult;
+            bool quoted = _pattern.HasQuotations();
+            for (const char *lineBegin = chunk.Begin; lineBegin < chunk.End; )
+            {
+                const char *lineEnd = SimdSearch::FindChar(lineBegin, chunk.End, '\n');
+                CharSpan line(lineBegin, lineEnd - lineBegin);
+                bool matched;
+                if (quoted)
+                {
+                    // the backtracking through the quotations is exponential in the stars and recurses on every
+                    // character of a long line
+                    const char *iterStart = lineBegin;
+                    matched = _anchored? matcher.Match(line, _pattern) : matcher.Search(line, _pattern, iterStart);
+                    matched = matched && nfaMatcher.Match(CharSpan(iterStart, lineEnd - iterStart), _compiled,
+                        matchResult);
+                }
+                else
+                {
+                    matched = _anchored? matcher.Match(line, _pattern, matchResult)
+                        : matcher.Search(line, _pattern, matchResult);
+                }
+                if (matched)
+                {
+                    chunk.Lines.push_back(lineBegin - data);
+                    chunk.Lines.push_back(lineEnd - lineBegin);
+                    for (size_t i = 0; i < matchResult.Matches.size(); i++)
+                    {
+                        const char *begin = matchResult.Matches[i].Begin;
+                        const char *end = matchResult.Matches[i].End;
+                        chunk.Entries.push_back((begin != NULL)? (int)(begin - lineBegin) : -1);
+                        chunk.Entries.push_back((end != NULL)? (int)(end - lineBegin) : -1);
+                    }
+                }
+                lineBegin = lineEnd + 1;
+            }
+        }
+    };
+}}}
+
+#endif
@@ -0,0 +1,273 @@
+#if !defined (_PATTERNCACHE_H_)
+#define _PATTERNCACHE_H_
+
+#include <string>
+#include "wildcard.h"
+#include "qtl/system/threading.h"
+#include "qtl/scheme/hash/socache.h"
+
+namespace Qtl { namespace String { namespace Wildcard {
+
+    /// @brief A bounded concurrent cache of compiled patterns keyed by the pattern text
+    /// @param TCompiled The type of the compiled pattern, which has to be constructible from the pattern text
+    ///        given as a const std::string&
+    /// @remarks The patterns are kept in a SoCache under a 31-bit FNV-1a hash of their text, which evicts them
+    ///          with the CLOCK algorithm under the entry and cost limits; the cost of a pattern is the length
+    ///          of its text plus one. A hit compiles nothing. Two texts with the same hash take turns in the
+    ///          cache, the lookup of one finding the other counting as a miss. A hit takes no lock: the
+    ///          pattern is referenced within the read section of the lookup, before SoCache can drop the
+    ///          reference it holds, and insertions are serialized by SoCache alone and never compile under
+    ///          its lock. Acquired patterns are counted references, so a pattern evicted while a thread is
+    ///          matching with it lives on until it's released. The default pattern backtracks when Matcher works
+    ///          out its quotations; a TCompiled that also holds the CompiledPattern of the text is to be cached
+    ///          for sources the quotations of which are to be matched with NfaMatcher.
+    template <class TCompiled=Pattern<std::string, const std::string&, std::string::const_iterator> >
+    class PatternCache
+    {
+    public:
+        /// @brief The type of the compiled patterns
+        typedef TCompiled CompiledType;
+
+        /// @brief A cached pattern
+        class Item
+        {
+            friend class PatternCache;
+
+        private:
+            /// @brief The pattern text
+            std::string _text;
+
+            /// @brief The compiled pattern
+            CompiledType _compiled;
+
+            /// @brief The number of references held by the cache and the users
+            volatile long _refCount;
+
+        private:
+            /// @brief Instantiates an item compiling the pattern
+            /// @param text The pattern text
+            Item(const std::string &text) : _text(text), _compiled(_text), _refCount(1)
+            {
+            }
+
+            /// @brief Disallows copying
+            Item(const Item &);
+
+            /// @brief Disallows assignment
+            Item &operator=(const Item &);
+
+        public:
+            /// @brief Returns the pattern text
+            /// @return The text
+            const std::string &GetText() const
+            {
+                return _text;
+            }
+
+            /// @brief Returns the compiled pattern
+            /// @return The compiled pattern
+            const CompiledType &GetCompiled() const
+            {
+                return _compiled;
+            }
+        };
+
+        /// @brief The counters of the cache
+        struct Statistics
+        {
+            /// @brief The number of lookups that found the pattern compiled
+            long Hits;
+
+            /// @brief The number of lookups that had to compile the pattern
+            long Misses;
+
+            /// @brief The number of misses caused by another pattern text with the same hash
+            long Collisions;
+
+            /// @brief The number of patterns evicted to make room for others
+            long Evictions;
+
+            /// @brief The number of patterns in the cache
+            int Count;
+
+            /// @brief The total cost of the patterns in the cache
+            size_t Cost;
+        };
+
+        /// @brief A reference to an acquired pattern that's released when it goes out of scope
+        class Lease
+        {
+        private:
+            /// @brief The cache the pattern is acquired from
+            PatternCache &_cache;
+
+            /// @brief The acquired pattern
+            Item *_item;
+
+        public:
+            /// @brief Acquires a pattern from a cache
+            /// @param cache The cache
+            /// @param text The pattern text
+            Lease(PatternCache &cache, const std::string &text) : _cache(cache), _item(cache.Acquire(text))
+            {
+            }
+
+            /// @brief Releases the pattern
+            ~Lease()
+            {
+                _cache.Release(_item);
+            }
+
+        private:
+            /// @brief Disallows copying
+            Lease(const Lease &);
+
+            /// @brief Disallows assignment
+            Lease &operator=(const Lease &);
+
+        public:
+            /// @brief Returns the compiled pattern
+            /// @return The compiled pattern
+            const CompiledType &GetCompiled() const
+            {
+                return _item->GetCompiled();
+            }
+        };
+
+    private:
+        /// @brief Drops the reference of the cache to the items it drops
+        struct ItemDisposer
+        {
+            void operator()(Item *&item)
+            {
+                Release(item);
+            }
+        };
+
+        /// @brief References the pattern a lookup finds if it has the text looked up
+        struct AcquireAction
+        {
+            /// @brief The pattern text looked up
+            const std::string *Text;
+
+            /// @brief To return the pattern referenced or NULL if another text has the same hash
+            Item *Acquired;
+
+            void operator()(Item *const &item)
+            {
+                if (item->_text == *Text)
+                {
+                    Qtl::System::Threading::AtomicAdd(&item->_refCount, 1L);
+                    Acquired = item;
+                }
+            }
+        };
+
+        /// @brief The type of the underlying cache
+        typedef Qtl::Scheme::Hash::SoCache<Item*, ItemDisposer> CacheType;
+
+    private:
+        /// @brief The number of lookups that found another pattern text with the same hash
+        volatile long _collisions;
+
+        /// @brief The cache of the items
+        CacheType _cache;
+
+    public:
+        /// @brief Instantiates a cache
+        /// @param maxEntries The maximum number of patterns
+        /// @param maxCost The maximum total length of the pattern texts, 0 for no limit other than the number
+        ///        of patterns
+        PatternCache(int maxEntries, size_t maxCost=0) : _collisions(0), _cache(maxEntries, maxCost)
+        {
+        }
+
+    private:
+        /// @brief Disallows copying
+        PatternCache(const PatternCache &);
+
+        /// @brief Disallows assignment
+        PatternCache &operator=(const PatternCache &);
+
+    public:
+        /// @brief Returns the compiled pattern of a text, compiling and caching it if it's not in the cache
+        /// @param text The pattern text
+        /// @return The pattern, which is to be released with Release()
+        Item *Acquire(const std::string &text)
+        {
+            unsigned int key = Hash(text);
+            AcquireAction acquire;
+            acquire.Text = &text;
+            acquire.Acquired = NULL;
+            if (_cache.Visit(key, acquire))
+            {
+                if (acquire.Acquired != NULL)
+                {
+                    return acquire.Acquired;
+                }
+                Qtl::System::Threading::AtomicAdd(&_collisions, 1L);
+            }
+
+            Item *item = new Item(text);
+            // one reference for the caller and one for the cache, which it drops through the disposer
+            item->_refCount = 2;
+            _cache.Put(key, item, text.size() + 1);
+            return item;
+        }
+
+        /// @brief Releases a pattern returned by Acquire()
+        /// @param item The pattern
+        static void Release(Item *item)
+        {
+            if (Qtl::System::Threading::AtomicAdd(&item->_refCount, -1L) == 0)
+            {
+                delete item;
+            }
+        }
+
+        /// @brief Removes all the patterns from the cache
+        /// @remarks The patterns that are acquired stay valid until they are released
+        void Clear()
+        {
+            _cache.Clear();
+        }
+
+        /// @brief Returns the number of patterns in the cache
+        /// @return The number of patterns
+        int GetCount() const
+        {
+            return _cache.GetCount();
+        }
+
+        /// @brief Returns the counters of the cache
+        /// @param stats To return the counters
+        void GetStatistics(Statistics &stats) const
+        {
+            typename CacheType::Statistics cacheStats;
+            _cache.GetStatistics(cacheStats);
+            // a collision is a hit for the underlying cache
+            stats.Collisions = Qtl::System::Threading::AtomicLoadAcquire(&_collisions);
+            stats.Hits = cacheStats.Hits - stats.Collisions;
+            stats.Misses = cacheStats.Misses + stats.Collisions;
+            stats.Evictions = cacheStats.Evictions;
+            stats.Count = cacheStats.Count;
+            stats.Cost = cacheStats.Cost;
+        }
+
+        /// @brief Returns the key a pattern text is cached with
+        /// @param text The pattern text
+        /// @return The 32-bit FNV-1a hash of the text with the highest bit cleared, which the hash doesn't keep
+        static unsigned int Hash(const std::string &text)
+        {
+            unsigned int hash = 2166136261u;
+            for (size_t i = 0; i < text.size(); i++)
+            {
+                hash ^= (unsigned char)text[i];
+                hash *= 16777619u;
+            }
+            return hash & 0x7fffffff;
+        }
+    };
+}}}
+
+#endif
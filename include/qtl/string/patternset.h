@@ -0,0 +1,406 @@
+#if !defined (_PATTERNSET_H_)
+#define _PATTERNSET_H_
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "wildcard.h"
+
+namespace Qtl { namespace String { namespace Wildcard {
+
+    /// @brief A set of wildcard patterns that a source string is matched against all at once
+    /// @remarks The longest literal fragment of each pattern goes into an Aho-Corasick automaton. One pass of the
+    ///          source through it finds the patterns whose fragments occur, and only those, along with the
+    ///          patterns that have no literal at all, are verified with the two-pointer matching, which works
+    ///          out no quotations and so never backtracks. A pattern
+    ///          matches as with Matcher, the source only has to start with a match of it. Build() has to be
+    ///          called once the patterns are added and before matching; Match() can then be called by many
+    ///          threads at the same time.
+    class PatternSet
+    {
+    public:
+        /// @brief The per-thread state of the matching, which saves the matching from allocating for the
+        ///        states of the automaton each time
+        /// @remarks A scratch can be used with any set but by one thread at a time
+        class Scratch
+        {
+            friend class PatternSet;
+
+        private:
+            /// @brief The generation each state was last visited in
+            std::vector<unsigned> _stamps;
+
+            /// @brief The generation of the matching in progress
+            unsigned _generation;
+
+        public:
+            /// @brief Instantiates a scratch
+            Scratch() : _generation(0)
+            {
+            }
+        };
+
+    private:
+        /// @brief A pattern of the set
+        struct Entry
+        {
+            /// @brief The pattern string
+            std::string Text;
+
+            /// @brief The pattern on the string
+            Pattern<> *Compiled;
+
+            /// @brief The ID the pattern was added with
+            int Id;
+
+            /// @brief The literal fragment that has to occur in a matching source or empty if there's none
+            std::string Fragment;
+        };
+
+    private:
+        /// @brief The patterns in the order they were added
+        std::vector<Entry*> _entries;
+
+        /// @brief The entries without any literal fragment, which are verified against every source
+        std::vector<int> _unfiltered;
+
+        /// @brief The states of the root, reached from the root by each character, which are looked up directly
+        int _rootTransitions[256];
+
+        /// @brief The first transition of each state in _transitionChars and _transitionTargets, one more than
+        ///        the number of states
+        std::vector<int> _transitionBegin;
+
+        /// @brief The characters of the transitions of all the states, sorted for each state
+        std::vector<unsigned char> _transitionChars;
+
+        /// @brief The target states of the transitions
+        std::vector<int> _transitionTargets;
+
+        /// @brief The state of the longest proper suffix of each state's string that's in the automaton
+        std::vector<int> _fail;
+
+        /// @brief The nearest state on the failure chain of each state where fragments end or -1
+        std::vector<int> _outputLink;
+
+        /// @brief The first entry ending at each state in _outputs, one more than the number of states
+        std::vector<int> _outputBegin;
+
+        /// @brief The entries whose fragments end at each state
+        std::vector<int> _outputs;
+
+        /// @brief Whether the automaton is up to date with the entries
+        bool _built;
+
+    public:
+        /// @brief Instantiates an empty set
+        PatternSet() : _built(false)
+        {
+        }
+
+        /// @brief Finalises the set
+        ~PatternSet()
+        {
+            Clear();
+        }
+
+    private:
+        /// @brief Disallows copying
+        PatternSet(const PatternSet &);
+
+        /// @brief Disallows assignment
+        PatternSet &operator=(const PatternSet &);
+
+    public:
+        /// @brief Adds a pattern to the set
+        /// @param pattern The pattern string
+        /// @param id The ID to return for the pattern when it matches
+        /// @remarks Build() has to be called again before the next matching
+        void Add(const char *pattern, int id)
+        {
+            Entry *entry = new Entry();
+            entry->Text = pattern;
+            entry->Compiled = new Pattern<>(entry->Text.c_str());
+            entry->Id = id;
+            entry->Fragment = GetLongestLiteral(*entry->Compiled);
+            _entries.push_back(entry);
+            _built = false;
+        }
+
+        /// @brief Removes all the patterns
+        void Clear()
+        {
+            for (size_t i = 0; i < _entries.size(); i++)
+            {
+                delete _entries[i]->Compiled;
+                delete _entries[i];
+            }
+            _entries.clear();
+            _built = false;
+        }
+
+        /// @brief Returns the number of patterns
+        /// @return The number of patterns
+        int GetCount() const
+        {
+            return (int)_entries.size();
+        }
+
+        /// @brief Returns the number of states of the automaton
+        /// @return The number of states
+        int GetStateCount() const
+        {
+            return (int)_fail.size();
+        }
+
+        /// @brief Builds the automaton over the fragments of the patterns added so far
+        void Build()
+        {
+            // the trie, with the children kept in maps while it's being built
+            std::vector<std::map<unsigned char, int> > children(1);
+            std::vector<std::vector<int> > outputs(1);
+            _unfiltered.clear();
+            for (int i = 0; i < (int)_entries.size(); i++)
+            {
+                const std::string &fragment = _entries[i]->Fragment;
+                if (fragment.empty())
+                {
+                    _unfiltered.push_back(i);
+                    continue;
+                }
+                int state = 0;
+                for (size_t k = 0; k < fragment.size(); k++)
+                {
+                    unsigned char ch = (unsigned char)fragment[k];
+                    std::map<unsigned char, int>::iterator iter = children[state].find(ch);
+                    if (iter != children[state].end())
+                    {
+                        state = iter->second;
+                        continue;
+                    }
+                    int child = (int)children.size();
+                    children[state][ch] = child;
+                    children.push_back(std::map<unsigned char, int>());
+                    outputs.push_back(std::vector<int>());
+                    state = child;
+                }
+                outputs[state].push_back(i);
+            }
+
+            // flattens the trie
+            int stateCount = (int)children.size();
+            _transitionBegin.assign(1, 0);
+            _transitionChars.clear();
+            _transitionTargets.clear();
+            _outputBegin.assign(1, 0);
+            _outputs.clear();
+            for (int state = 0; state < stateCount; state++)
+            {
+                for (std::map<unsigned char, int>::const_iterator iter = children[state].begin();
+                    iter != children[state].end(); ++iter)
+                {
+                    _transitionChars.push_back(iter->first);
+                    _transitionTargets.push_back(iter->second);
+                }
+                _transitionBegin.push_back((int)_transitionChars.size());
+                _outputs.insert(_outputs.end(), outputs[state].begin(), outputs[state].end());
+                _outputBegin.push_back((int)_outputs.size());
+            }
+            for (int ch = 0; ch < 256; ch++)
+            {
+                _rootTransitions[ch] = 0;
+            }
+            for (int k = _transitionBegin[0]; k < _transitionBegin[1]; k++)
+            {
+                _rootTransitions[_transitionChars[k]] = _transitionTargets[k];
+            }
+
+            // the failure and output links in breadth-first order, each state after the states nearer the root
+            _fail.assign(stateCount, 0);
+            _outputLink.assign(stateCount, -1);
+            std::vector<int> queue;
+            queue.reserve(stateCount);
+            for (int k = _transitionBegin[0]; k < _transitionBegin[1]; k++)
+            {
+                queue.push_back(_transitionTargets[k]);
+            }
+            for (size_t head = 0; head < queue.size(); head++)
+            {
+                int state = queue[head];
+                for (int k = _transitionBegin[state]; k < _transitionBegin[state + 1]; k++)
+                {
+                    int child = _transitionTargets[k];
+                    int fail = Next(_fail[state], _transitionChars[k]);
+                    _fail[child] = fail;
+                    _outputLink[child] = (_outputBegin[fail] < _outputBegin[fail + 1])? fail : _outputLink[fail];
+                    queue.push_back(child);
+                }
+            }
+            _built = true;
+        }
+
+        /// @brief Finds all the patterns a source matches
+        /// @param source The source string
+        /// @param ids To return the IDs of the matching patterns in the order the patterns were added
+        /// @return The number of matching patterns or -1 if the set hasn't been built since the last addition
+        /// @remarks The output states visited are kept in a sorted list, which costs nothing for the states
+        ///          that aren't; Match() with a Scratch is faster when many fragments occur
+        int Match(const char *source, std::vector<int> &ids) const
+        {
+            return FindMatches(source, ids, NULL);
+        }
+
+        /// @brief Finds all the patterns a source matches with the state of a thread
+        /// @param source The source string
+        /// @param ids To return the IDs of the matching patterns in the order the patterns were added
+        /// @param scratch The scratch of the calling thread
+        /// @return The number of matching patterns or -1 if the set hasn't been built since the last addition
+        int Match(const char *source, std::vector<int> &ids, Scratch &scratch) const
+        {
+            return FindMatches(source, ids, &scratch);
+        }
+
+    private:
+        /// @brief Finds all the patterns a source matches
+        /// @param source The source string
+        /// @param ids To return the IDs of the matching patterns
+        /// @param scratch The scratch of the calling thread or NULL to keep the visited states in a list
+        /// @return The number of matching patterns or -1 if the set hasn't been built since the last addition
+        int FindMatches(const char *source, std::vector<int> &ids, Scratch *scratch) const
+        {
+            ids.clear();
+            if (!_built)
+            {
+                return -1;
+            }
+            if (scratch != NULL)
+            {
+                if (scratch->_stamps.size() < _fail.size())
+                {
+                    scratch->_stamps.resize(_fail.size(), 0);
+                }
+                if (++scratch->_generation == 0)
+                {
+                    std::fill(scratch->_stamps.begin(), scratch->_stamps.end(), 0);
+                    scratch->_generation = 1;
+                }
+            }
+
+            // the candidates are collected in the output list itself; a fragment ends at one state only and
+            // the output chain of a state visited before is all in already, so each entry goes in once
+            std::vector<int> visited;
+            int state = 0;
+            for (const char *iter = source; *iter != 0; ++iter)
+            {
+                state = Next(state, (unsigned char)*iter);
+                int output = (_outputBegin[state] < _outputBegin[state + 1])? state : _outputLink[state];
+                for (; output >= 0 && Visit(output, scratch, visited); output = _outputLink[output])
+                {
+                    ids.insert(ids.end(), _outputs.begin() + _outputBegin[output],
+                        _outputs.begin() + _outputBegin[output + 1]);
+                }
+            }
+            ids.insert(ids.end(), _unfiltered.begin(), _unfiltered.end());
+            std::sort(ids.begin(), ids.end());
+
+            // the entries are shared but the matching without quotations doesn't change them
+            Matcher<> matcher;
+            size_t kept = 0;
+            for (size_t i = 0; i < ids.size(); i++)
+            {
+                Entry *entry = _entries[ids[i]];
+                if (matcher.Match(source, *entry->Compiled))
+                {
+                    ids[kept++] = entry->Id;
+                }
+            }
+            ids.resize(kept);
+            return (int)kept;
+        }
+
+        /// @brief Marks an output state visited
+        /// @param state The state
+        /// @param scratch The scratch the state is stamped in or NULL
+        /// @param visited The sorted list of the states visited if there's no scratch
+        /// @return false if the state was visited already
+        bool Visit(int state, Scratch *scratch, std::vector<int> &visited) const
+        {
+            if (scratch != NULL)
+            {
+                if (scratch->_stamps[state] == scratch->_generation)
+                {
+                    return false;
+                }
+                scratch->_stamps[state] = scratch->_generation;
+                return true;
+            }
+            std::vector<int>::iterator found = std::lower_bound(visited.begin(), visited.end(), state);
+            if (found != visited.end() && *found == state)
+            {
+                return false;
+            }
+            visited.insert(found, state);
+            return true;
+        }
+
+        /// @brief Returns the state the automaton goes to from a state with a character
+        /// @param state The state
+        /// @param ch The character
+        /// @return The next state
+        int Next(int state, unsigned char ch) const
+        {
+            for (;;)
+            {
+                if (state == 0)
+                {
+                    return _rootTransitions[ch];
+                }
+                int begin = _transitionBegin[state];
+                int end = _transitionBegin[state + 1];
+                const unsigned char *found = std::lower_bound(&_transitionChars[0] + begin,
+                    &_transitionChars[0] + end, ch);
+                if (found != &_transitionChars[0] + end && *found == ch)
+                {
+                    return _transitionTargets[found - &_transitionChars[0]];
+                }
+                state = _fail[state];
+            }
+        }
+
+        /// @brief Returns the longest literal run of a pattern
+        /// @param pattern The pattern
+        /// @return The literal with the escapes resolved or empty if the pattern has no literal
+        /// @remarks Parentheses match nothing, so a run goes on past them
+        static std::string GetLongestLiteral(const Pattern<> &pattern)
+        {
+            typedef Pattern<>::Token Token;
+            std::string longest;
+            std::string current;
+            for (const Token *token = pattern.GetTokens(); ; ++token)
+            {
+                if (token->Type == Token::Kind::Literal)
+                {
+                    current.push_back(token->Char);
+                    continue;
+                }
+                if (token->Type == Token::Kind::Open || token->Type == Token::Kind::Close)
+                {
+                    continue;
+                }
+                if (current.size() > longest.size())
+                {
+                    longest = current;
+                }
+                if (token->Type == Token::Kind::End || token->Type == Token::Kind::Fail)
+                {
+                    // a trailing escape character never matches, which the verification finds out
+                    return longest;
+                }
+                current.clear();
+            }
+        }
+    };
+}}}
+
+#endif
@@ -0,0 +1,423 @@
+#if !defined (_SIMDSEARCH_H_)
+#define _SIMDSEARCH_H_
+
+#include <cstddef>
+#include <cstring>
+#include "qtl/system/system.h"
+
+// The vector kernels are compiled for their instruction sets whatever the compiler options are and the one
+// to use is picked at the first search according to what the processor supports
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#   define _QTL_SIMDSEARCH_X86 1
+#   define _QTL_SIMDSEARCH_SSE2 __attribute__((target("sse2")))
+#   define _QTL_SIMDSEARCH_AVX2 __attribute__((target("avx2")))
+// the search for the terminator reads the whole aligned blocks the string ends in
+#   define _QTL_SIMDSEARCH_NOASAN __attribute__((no_sanitize_address))
+#   include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#   define _QTL_SIMDSEARCH_X86 1
+#   define _QTL_SIMDSEARCH_SSE2
+#   define _QTL_SIMDSEARCH_AVX2
+#   define _QTL_SIMDSEARCH_NOASAN
+#   include <intrin.h>
+#   include <immintrin.h>
+#endif
+
+namespace Qtl { namespace String {
+
+/// @brief Character and substring searches over byte strings with vector kernels selected at run time
+/// @remarks FindChar(), FindString() and FindCharOrNull() are bound to the widest kernel the processor
+///          supports, the kernels themselves are kept accessible for comparison and testing
+struct SimdSearch
+{
+	/// @brief The kernels that can be selected
+	struct Kernel
+	{
+		enum Enum
+		{
+			Scalar,	///< one byte at a time
+			Sse2,	///< 16 bytes at a time
+			Avx2	///< 32 bytes at a time
+		};
+	};
+
+	/// @brief Returns the kernel the searches are bound to
+	/// @return The widest kernel the processor supports
+	static Kernel::Enum GetKernel()
+	{
+		// a race on the first calls only makes each thread detect the same kernel
+		static Kernel::Enum kernel = DetectKernel();
+		return kernel;
+	}
+
+	/// @brief Finds the first occurrence of a character
+	/// @param begin The beginning of the bytes to search
+	/// @param end The end of the bytes to search
+	/// @param ch The character to find
+	/// @return The position of the character or end if it's not there
+	static const char *FindChar(const char *begin, const char *end, char ch)
+	{
+#if _QTL_SIMDSEARCH_X86
+		switch (GetKernel())
+		{
+		case Kernel::Avx2:
+			return FindCharAvx2(begin, end, ch);
+		case Kernel::Sse2:
+			return FindCharSse2(begin, end, ch);
+		default:
+			break;
+		}
+#endif
+		return FindCharScalar(begin, end, ch);
+	}
+
+	/// @brief Finds the first occurrence of a substring
+	/// @param begin The beginning of the bytes to search
+	/// @param end The end of the bytes to search
+	/// @param needle The substring to find
+	/// @param needleLen The length of the substring
+	/// @return The position of the substring or end if it's not there
+	static const char *FindString(const char *begin, const char *end, const char *needle, size_t needleLen)
+	{
+		if (needleLen == 0)
+		{
+			return begin;
+		}
+		if (needleLen == 1)
+		{
+			return FindChar(begin, end, needle[0]);
+		}
+#if _QTL_SIMDSEARCH_X86
+		switch (GetKernel())
+		{
+		case Kernel::Avx2:
+			return FindStringAvx2(begin, end, needle, needleLen);
+		case Kernel::Sse2:
+			return FindStringSse2(begin, end, needle, needleLen);
+		default:
+			break;
+		}
+#endif
+		return FindStringScalar(begin, end, needle, needleLen);
+	}
+
+	/// @brief Finds the first occurrence of a character in a zero-terminated string
+	/// @param str The string
+	/// @param ch The character to find
+	/// @return The position of the character or that of the terminator if it's not there
+	static const char *FindCharOrNull(const char *str, char ch)
+	{
+#if _QTL_SIMDSEARCH_X86
+		switch (GetKernel())
+		{
+		case Kernel::Avx2:
+			return FindCharOrNullAvx2(str, ch);
+		case Kernel::Sse2:
+			return FindCharOrNullSse2(str, ch);
+		default:
+			break;
+		}
+#endif
+		return FindCharOrNullScalar(str, ch);
+	}
+
+	/// @brief Finds the first occurrence of a substring in a zero-terminated string
+	/// @param str The string
+	/// @param needle The substring to find, which doesn't contain the terminator
+	/// @param needleLen The length of the substring
+	/// @return The position of the substring or NULL if it's not there
+	/// @remarks The string is not measured first, so finding an early occurrence only reads up to there
+	static const char *FindStringInPsz(const char *str, const char *needle, size_t needleLen)
+	{
+		if (needleLen == 0)
+		{
+			return str;
+		}
+		for (const char *p = str; ; ++p)
+		{
+			p = FindCharOrNull(p, needle[0]);
+			if (*p == 0)
+			{
+				return NULL;
+			}
+			// stops at the terminator if the string is shorter than the substring
+			if (strncmp(p + 1, needle + 1, needleLen - 1) == 0)
+			{
+				return p;
+			}
+		}
+	}
+
+public:
+	/// @brief Finds the first occurrence of a character one byte at a time
+	/// @param begin The beginning of the bytes to search
+	/// @param end The end of the bytes to search
+	/// @param ch The character to find
+	/// @return The position of the character or end if it's not there
+	static const char *FindCharScalar(const char *begin, const char *end, char ch)
+	{
+		for (; begin < end; ++begin)
+		{
+			if (*begin == ch)
+			{
+				return begin;
+			}
+		}
+		return end;
+	}
+
+	/// @brief Finds the first occurrence of a substring one position at a time
+	/// @param begin The beginning of the bytes to search
+	/// @param end The end of the bytes to search
+	/// @param needle The substring to find
+	/// @param needleLen The length of the substring, which is at least 1
+	/// @return The position of the substring or end if it's not there
+	static const char *FindStringScalar(const char *begin, const char *end, const char *needle, size_t needleLen)
+	{
+		if ((size_t)(end - begin) < needleLen)
+		{
+			return end;
+		}
+		const char *last = end - needleLen;
+		for (const char *p = begin; p <= last; ++p)
+		{
+			if (*p == needle[0] && memcmp(p + 1, needle + 1, needleLen - 1) == 0)
+			{
+				return p;
+			}
+		}
+		return end;
+	}
+
+	/// @brief Finds the first occurrence of a character or the terminator one byte at a time
+	/// @param str The zero-terminated string
+	/// @param ch The character to find
+	/// @return The position of the character or that of the terminator
+	static const char *FindCharOrNullScalar(const char *str, char ch)
+	{
+		while (*str != ch && *str != 0)
+		{
+			++str;
+		}
+		return str;
+	}
+
+#if _QTL_SIMDSEARCH_X86
+	/// @brief Finds the first occurrence of a character 16 bytes at a time
+	/// @param begin The beginning of the bytes to search
+	/// @param end The end of the bytes to search
+	/// @param ch The character to find
+	/// @return The position of the character or end if it's not there
+	_QTL_SIMDSEARCH_SSE2 static const char *FindCharSse2(const char *begin, const char *end, char ch)
+	{
+		const __m128i target = _mm_set1_epi8(ch);
+		const char *p = begin;
+		for (; end - p >= 16; p += 16)
+		{
+			__m128i block = _mm_loadu_si128((const __m128i*)p);
+			unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(block, target));
+			if (mask != 0)
+			{
+				return p + CountTrailingZeros(mask);
+			}
+		}
+		return FindCharScalar(p, end, ch);
+	}
+
+	/// @brief Finds the first occurrence of a character 32 bytes at a time
+	/// @param begin The beginning of the bytes to search
+	/// @param end The end of the bytes to search
+	/// @param ch The character to find
+	/// @return The position of the character or end if it's not there
+	_QTL_SIMDSEARCH_AVX2 static const char *FindCharAvx2(const char *begin, const char *end, char ch)
+	{
+		const __m256i target = _mm256_set1_epi8(ch);
+		const char *p = begin;
+		for (; end - p >= 32; p += 32)
+		{
+			__m256i block = _mm256_loadu_si256((const __m256i*)p);
+			unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, target));
+			if (mask != 0)
+			{
+				return p + CountTrailingZeros(mask);
+			}
+		}
+		return FindCharScalar(p, end, ch);
+	}
+
+	/// @brief Finds the first occurrence of a substring checking 16 positions at a time
+	/// @param begin The beginning of the bytes to search
+	/// @param end The end of the bytes to search
+	/// @param needle The substring to find
+	/// @param needleLen The length of the substring, which is at least 2
+	/// @return The position of the substring or end if it's not there
+	/// @remarks Only the positions where both the first and the last characters of the substring are found
+	///          are compared in full
+	_QTL_SIMDSEARCH_SSE2 static const char *FindStringSse2(const char *begin, const char *end, const char *needle,
+		size_t needleLen)
+	{
+		const __m128i first = _mm_set1_epi8(needle[0]);
+		const __m128i last = _mm_set1_epi8(needle[needleLen - 1]);
+		const char *p = begin;
+		for (; end - p >= (ptrdiff_t)(needleLen - 1 + 16); p += 16)
+		{
+			__m128i blockFirst = _mm_loadu_si128((const __m128i*)p);
+			__m128i blockLast = _mm_loadu_si128((const __m128i*)(p + needleLen - 1));
+			unsigned int mask = (unsigned int)_mm_movemask_epi8(
+				_mm_and_si128(_mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, last)));
+			for (; mask != 0; mask &= mask - 1)
+			{
+				int offset = CountTrailingZeros(mask);
+				if (memcmp(p + offset + 1, needle + 1, needleLen - 2) == 0)
+				{
+					return p + offset;
+				}
+			}
+		}
+		return FindStringScalar(p, end, needle, needleLen);
+	}
+
+	/// @brief Finds the first occurrence of a substring checking 32 positions at a time
+	/// @param begin The beginning of the bytes to search
+	/// @param end The end of the bytes to search
+	/// @param needle The substring to find
+	/// @param needleLen The length of the substring, which is at least 2
+	/// @return The position of the substring or end if it's not there
+	_QTL_SIMDSEARCH_AVX2 static const char *FindStringAvx2(const char *begin, const char *end, const char *needle,
+		size_t needleLen)
+	{
+		const __m256i first = _mm256_set1_epi8(needle[0]);
+		const __m256i last = _mm256_set1_epi8(needle[needleLen - 1]);
+		const char *p = begin;
+		for (; end - p >= (ptrdiff_t)(needleLen - 1 + 32); p += 32)
+		{
+			__m256i blockFirst = _mm256_loadu_si256((const __m256i*)p);
+			__m256i blockLast = _mm256_loadu_si256((const __m256i*)(p + needleLen - 1));
+			unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+				_mm256_and_si256(_mm256_cmpeq_epi8(blockFirst, first), _mm256_cmpeq_epi8(blockLast, last)));
+			for (; mask != 0; mask &= mask - 1)
+			{
+				int offset = CountTrailingZeros(mask);
+				if (memcmp(p + offset + 1, needle + 1, needleLen - 2) == 0)
+				{
+					return p + offset;
+				}
+			}
+		}
+		return FindStringScalar(p, end, needle, needleLen);
+	}
+
+	/// @brief Finds the first occurrence of a character or the terminator 16 bytes at a time
+	/// @param str The zero-terminated string
+	/// @param ch The character to find
+	/// @return The position of the character or that of the terminator
+	/// @remarks The loads are aligned so that they never cross into a page the string doesn't reach
+	_QTL_SIMDSEARCH_SSE2 _QTL_SIMDSEARCH_NOASAN static const char *FindCharOrNullSse2(const char *str, char ch)
+	{
+		const __m128i target = _mm_set1_epi8(ch);
+		const __m128i zero = _mm_setzero_si128();
+		size_t misalignment = (size_t)str & 15;
+		const char *p = str - misalignment;
+		__m128i block = _mm_load_si128((const __m128i*)p);
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(
+			_mm_or_si128(_mm_cmpeq_epi8(block, target), _mm_cmpeq_epi8(block, zero))) >> misalignment;
+		if (mask != 0)
+		{
+			return str + CountTrailingZeros(mask);
+		}
+		for (p += 16; ; p += 16)
+		{
+			block = _mm_load_si128((const __m128i*)p);
+			mask = (unsigned int)_mm_movemask_epi8(
+				_mm_or_si128(_mm_cmpeq_epi8(block, target), _mm_cmpeq_epi8(block, zero)));
+			if (mask != 0)
+			{
+				return p + CountTrailingZeros(mask);
+			}
+		}
+	}
+
+	/// @brief Finds the first occurrence of a character or the terminator 32 bytes at a time
+	/// @param str The zero-terminated string
+	/// @param ch The character to find
+	/// @return The position of the character or that of the terminator
+	_QTL_SIMDSEARCH_AVX2 _QTL_SIMDSEARCH_NOASAN static const char *FindCharOrNullAvx2(const char *str, char ch)
+	{
+		const __m256i target = _mm256_set1_epi8(ch);
+		const __m256i zero = _mm256_setzero_si256();
+		size_t misalignment = (size_t)str & 31;
+		const char *p = str - misalignment;
+		__m256i block = _mm256_load_si256((const __m256i*)p);
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+			_mm256_or_si256(_mm256_cmpeq_epi8(block, target), _mm256_cmpeq_epi8(block, zero))) >> misalignment;
+		if (mask != 0)
+		{
+			return str + CountTrailingZeros(mask);
+		}
+		for (p += 32; ; p += 32)
+		{
+			block = _mm256_load_si256((const __m256i*)p);
+			mask = (unsigned int)_mm256_movemask_epi8(
+				_mm256_or_si256(_mm256_cmpeq_epi8(block, target), _mm256_cmpeq_epi8(block, zero)));
+			if (mask != 0)
+			{
+				return p + CountTrailingZeros(mask);
+			}
+		}
+	}
+#endif
+
+private:
+	/// @brief Finds out the widest kernel the processor supports
+	/// @return The kernel
+	static Kernel::Enum DetectKernel()
+	{
+#if _QTL_SIMDSEARCH_X86 && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] >= 7)
+		{
+			__cpuid(info, 1);
+			// the operating system has to save the AVX registers as well
+			bool osSavesAvx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+			__cpuidex(info, 7, 0);
+			if (osSavesAvx && (info[1] & (1 << 5)) != 0)
+			{
+				return Kernel::Avx2;
+			}
+		}
+		return Kernel::Sse2;
+#elif _QTL_SIMDSEARCH_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+		{
+			return Kernel::Avx2;
+		}
+		if (__builtin_cpu_supports("sse2"))
+		{
+			return Kernel::Sse2;
+		}
+		return Kernel::Scalar;
+#else
+		return Kernel::Scalar;
+#endif
+	}
+
+	/// @brief Returns the index of the lowest set bit
+	/// @param mask The bits, which are not all zero
+	/// @return The index
+	static int CountTrailingZeros(unsigned int mask)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return (int)index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+};
+
+}}
+
+#endif
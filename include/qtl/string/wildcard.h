@@ -33,14 +33,45 @@
 #if !defined (_WILDCARD_H_)
 #define _WILDCARD_H_
 
-#include <map>
+#include <algorithm>
+#include <iterator>
 #include <vector>
 #include <cstring>
 #include <string>
+#include "simdsearch.h"
 
 /// @brief Contains class definitions that deal with wildcard matching
 namespace Qtl { namespace String { namespace Wildcard {
 
+    /// @brief A character string given by a pointer and a length, which doesn't have to be zero-terminated
+    /// @remarks It's passed by value and the characters it points to have to outlive it
+    struct CharSpan
+    {
+        /// @brief The first character
+        const char *Data;
+
+        /// @brief The number of characters
+        size_t Length;
+
+        /// @brief Instantiates an empty span
+        CharSpan() : Data(NULL), Length(0)
+        {
+        }
+
+        /// @brief Instantiates a span over a buffer
+        /// @param data The first character
+        /// @param length The number of characters
+        CharSpan(const char *data, size_t length) : Data(data), Length(length)
+        {
+        }
+
+        /// @brief Instantiates a span over a zero-terminated string without the terminator
+        /// @param psz The string
+        CharSpan(const char *psz) : Data(psz), Length(strlen(psz))
+        {
+        }
+    };
+
     /// @brief An implementation of the functor that returns the length of string whose iterators are applicable 
     ///        to subtract operator
     template <class TStringRef, class TSubtractableIter>
@@ -71,6 +102,15 @@ namespace Qtl { namespace String { namespace Wildcard {
         }
     };
     
+    /// @brief An implementation of the functor that returns the position of the first character for a span
+    struct StringBeginFunctorSpan
+    {
+        const char * operator()(CharSpan str)
+        {
+            return str.Data;
+        }
+    };
+
     /// @brief An implementation of the functor that determines if the position is at the end of a character-based
     ///        zero-terminated string
     struct StringEndFunctorPsz
@@ -90,6 +130,17 @@ namespace Qtl { namespace String { namespace Wildcard {
         }
     };
 
+    /// @brief An implementation of the functor that determines if the position is at the end of a span
+    /// @remarks Unlike the check for the terminator this doesn't read the character, so the comparison is against
+    ///          a bound the compiler can hoist out of the loops
+    struct StringEndFunctorSpan
+    {
+        bool operator()(const char *iter, CharSpan str)
+        {
+            return (iter == str.Data + str.Length);
+        }
+    };
+
     /// @brief An implementation of the functor that appends a character to a character-based zero-terminated string
     struct AppendCharFunctorPsz
     {
@@ -132,6 +183,15 @@ namespace Qtl { namespace String { namespace Wildcard {
 		typedef CharDistFunctorIndexed<std::string::const_iterator, std::string::const_iterator>    CharDistFunctor;
 	};
 
+	/// @brief The rebinder to the span based string functors
+	template <>
+	struct DefaultStringFunctors<CharSpan, const char*>
+	{
+		typedef StringBeginFunctorSpan              StringBeginFunctor;
+		typedef StringEndFunctorSpan                StringEndFunctor;
+		typedef CharDistFunctorIndexed<CharSpan, const char*>   CharDistFunctor;
+	};
+
     /// @brief The default class that provides string functors
     struct DefaultStringFunctorSelector
     {
@@ -172,12 +232,381 @@ namespace Qtl { namespace String { namespace Wildcard {
 		};
     };
     
+    /// @brief The generic seeker of a literal in a source string, which tries one position at a time
+    /// @param TStringRef The type of the reference to the source string
+    /// @param TCharIter The type of the iterator through the source string
+    /// @param TStringEndFunctor The type of the functor that determines if an iterator is at the end of the
+    ///        source string; the vector kernels are only used with the default ones, which they agree with
+    template <class TStringRef, class TCharIter, class TStringEndFunctor>
+    struct LiteralSeeker
+    {
+        /// @brief Moves to the first position at or after the current one where the literal begins
+        /// @param source The source string
+        /// @param iter The current position, to return the position of the literal
+        /// @param literal The literal, which is not empty
+        /// @param isEnd The functor that determines if an iterator is at the end of the source string
+        /// @return true if the literal is found
+        template <class TLiteral>
+        static bool Seek(TStringRef source, TCharIter &iter, const TLiteral &literal, TStringEndFunctor &isEnd)
+        {
+            for (; !isEnd(iter, source); ++iter)
+            {
+                TCharIter iterSource = iter;
+                size_t i = 0;
+                for (; i < literal.size() && !isEnd(iterSource, source) && *iterSource == literal[i]; ++i)
+                {
+                    ++iterSource;
+                }
+                if (i == literal.size())
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    /// @brief The seeker of a literal in a character-based zero-terminated string with vector kernels
+    template <>
+    struct LiteralSeeker<const char*, const char*, StringEndFunctorPsz>
+    {
+        static bool Seek(const char *source, const char *&iter, const std::string &literal,
+            StringEndFunctorPsz &isEnd)
+        {
+            const char *found = SimdSearch::FindStringInPsz(iter, literal.data(), literal.size());
+            if (found == NULL)
+            {
+                return false;
+            }
+            iter = found;
+            return true;
+        }
+    };
+
+    /// @brief The seeker of a literal in a std::string with vector kernels
+    template <>
+    struct LiteralSeeker<const std::string&, std::string::const_iterator, StringEndFunctorStdStr>
+    {
+        static bool Seek(const std::string &source, std::string::const_iterator &iter, const std::string &literal,
+            StringEndFunctorStdStr &isEnd)
+        {
+            const char *data = source.data();
+            const char *end = data + source.size();
+            const char *found = SimdSearch::FindString(data + (iter - source.begin()), end, literal.data(),
+                literal.size());
+            if (found == end)
+            {
+                return false;
+            }
+            iter = source.begin() + (found - data);
+            return true;
+        }
+    };
+
+    /// @brief The seeker of a literal in a span with vector kernels
+    template <>
+    struct LiteralSeeker<CharSpan, const char*, StringEndFunctorSpan>
+    {
+        static bool Seek(CharSpan source, const char *&iter, const std::string &literal, StringEndFunctorSpan &isEnd)
+        {
+            const char *end = source.Data + source.Length;
+            const char *found = SimdSearch::FindString(iter, end, literal.data(), literal.size());
+            if (found == end)
+            {
+                return false;
+            }
+            iter = found;
+            return true;
+        }
+    };
+
+    /// @brief The generic finder of the end of a source string, which walks through it
+    /// @param TStringRef The type of the reference to the source string
+    /// @param TCharIter The type of the iterator through the source string
+    /// @param TStringEndFunctor The type of the functor that determines if an iterator is at the end of the
+    ///        source string; the end is only taken from the string itself with the default ones
+    template <class TStringRef, class TCharIter, class TStringEndFunctor>
+    struct SourceEndFinder
+    {
+        /// @brief Returns the end of the source string
+        /// @param source The source string
+        /// @param iter A position in the source string to start from
+        /// @param isEnd The functor that determines if an iterator is at the end of the source string
+        /// @return The iterator at the end
+        static TCharIter Find(TStringRef source, TCharIter iter, TStringEndFunctor &isEnd)
+        {
+            while (!isEnd(iter, source))
+            {
+                ++iter;
+            }
+            return iter;
+        }
+    };
+
+    /// @brief The finder of the end of a character-based zero-terminated string
+    template <>
+    struct SourceEndFinder<const char*, const char*, StringEndFunctorPsz>
+    {
+        static const char *Find(const char *source, const char *iter, StringEndFunctorPsz &isEnd)
+        {
+            return iter + strlen(iter);
+        }
+    };
+
+    /// @brief The finder of the end of a std::string
+    template <>
+    struct SourceEndFinder<const std::string&, std::string::const_iterator, StringEndFunctorStdStr>
+    {
+        static std::string::const_iterator Find(const std::string &source, std::string::const_iterator iter,
+            StringEndFunctorStdStr &isEnd)
+        {
+            return source.end();
+        }
+    };
+
+    /// @brief The finder of the end of a span
+    template <>
+    struct SourceEndFinder<CharSpan, const char*, StringEndFunctorSpan>
+    {
+        static const char *Find(CharSpan source, const char *iter, StringEndFunctorSpan &isEnd)
+        {
+            return source.Data + source.Length;
+        }
+    };
+
+    /// @brief A Boyer-Moore-Horspool searcher of a literal
+    /// @param TChar The type of the characters
+    /// @remarks The shifts are looked up by the low 8 bits of a character, which for wider characters makes
+    ///          the ones sharing them take the smallest of their shifts
+    template <class TChar>
+    class HorspoolSearcher
+    {
+    public:
+        /// @brief The type of the literal
+        typedef std::basic_string<TChar> LiteralString;
+
+    private:
+        /// @brief The literal
+        LiteralString _needle;
+
+        /// @brief How far the window can move on given its last character
+        size_t _skip[256];
+
+    public:
+        /// @brief Instantiates a searcher of the empty literal
+        HorspoolSearcher()
+        {
+            Assign(LiteralString());
+        }
+
+    public:
+        /// @brief Sets the literal and builds the skip table for it
+        /// @param needle The literal
+        void Assign(const LiteralString &needle)
+        {
+            _needle = needle;
+            size_t length = _needle.size();
+            for (int i = 0; i < 256; i++)
+            {
+                _skip[i] = (length > 0)? length : 1;
+            }
+            for (size_t i = 0; i + 1 < length; i++)
+            {
+                _skip[Bucket(_needle[i])] = length - 1 - i;
+            }
+        }
+
+        /// @brief Returns the literal
+        /// @return The literal
+        const LiteralString &GetNeedle() const
+        {
+            return _needle;
+        }
+
+        /// @brief Finds the first occurrence of the literal
+        /// @param begin The first character to search from
+        /// @param end The end of the characters
+        /// @return The beginning of the occurrence or end if there's none
+        template <class TIter>
+        TIter Find(TIter begin, TIter end) const
+        {
+            size_t length = _needle.size();
+            if (length == 0)
+            {
+                return begin;
+            }
+            for (TIter iter = begin; (size_t)(end - iter) >= length; iter += _skip[Bucket(iter[length - 1])])
+            {
+                size_t i = length;
+                while (i > 0 && iter[i - 1] == _needle[i - 1])
+                {
+                    i--;
+                }
+                if (i == 0)
+                {
+                    return iter;
+                }
+            }
+            return end;
+        }
+
+    private:
+        /// @brief Returns the entry of the skip table of a character
+        /// @param ch The character
+        /// @return The index into the table
+        static int Bucket(TChar ch)
+        {
+            return (int)((unsigned long)ch & 0xff);
+        }
+    };
+
+    /// @brief A bracketed character class of a pattern, such as [a-z] or [!0-9]
+    /// @remarks The class is a 256-bit bitmap over the character codes, negation applied, so that checking a
+    ///          character is a single lookup. Characters with codes beyond 255 can't be listed and are in a class
+    ///          only if it's negated.
+    class CharClass
+    {
+    private:
+        /// @brief The bit of each character code
+        unsigned int _bits[8];
+
+        /// @brief Whether the class has the characters it doesn't list
+        bool _negated;
+
+    public:
+        /// @brief Instantiates an empty class
+        CharClass() : _negated(false)
+        {
+            Clear();
+        }
+
+    public:
+        /// @brief Removes all the characters and the negation
+        void Clear()
+        {
+            for (int i = 0; i < 8; i++)
+            {
+                _bits[i] = 0;
+            }
+            _negated = false;
+        }
+
+        /// @brief Adds the characters in a range
+        /// @param first The code of the first character
+        /// @param last The code of the last character, a range backwards being empty
+        /// @remarks The negation has to be applied once the characters are added
+        void AddRange(unsigned long first, unsigned long last)
+        {
+            for (unsigned long code = first; code <= last && code < 256; code++)
+            {
+                _bits[code >> 5] |= 1u << (code & 31);
+            }
+        }
+
+        /// @brief Makes the class have the characters it doesn't list and only those
+        void Negate()
+        {
+            for (int i = 0; i < 8; i++)
+            {
+                _bits[i] = ~_bits[i];
+            }
+            _negated = !_negated;
+        }
+
+        /// @brief Determines if the class is negated
+        /// @return true if it is
+        bool IsNegated() const
+        {
+            return _negated;
+        }
+
+        /// @brief Determines if a character code is in the class
+        /// @param code The code
+        /// @return true if it is
+        bool Contains(unsigned char code) const
+        {
+            return ((_bits[code >> 5] >> (code & 31)) & 1) != 0;
+        }
+
+        /// @brief Determines if a character is in the class
+        /// @param ch The character
+        /// @return true if it is
+        bool Contains(char ch) const
+        {
+            return Contains((unsigned char)ch);
+        }
+
+        /// @brief Determines if a wide character is in the class
+        /// @param ch The character
+        /// @return true if it is
+        template <class TChar>
+        bool Contains(TChar ch) const
+        {
+            unsigned long code = GetCode(ch);
+            return (code < 256)? Contains((unsigned char)code) : _negated;
+        }
+
+        /// @brief Returns the code of a character
+        /// @param ch The character
+        /// @return The code, which for a char is that of the unsigned char
+        static unsigned long GetCode(char ch)
+        {
+            return (unsigned char)ch;
+        }
+
+        /// @brief Returns the code of a wide character
+        /// @param ch The character
+        /// @return The code
+        template <class TChar>
+        static unsigned long GetCode(TChar ch)
+        {
+            return (unsigned long)ch;
+        }
+    };
+
+    /// @brief A token of a preprocessed wildcard pattern
+    /// @param TChar The type of the characters of the pattern
+    template <class TChar>
+    struct PatternToken
+    {
+        /// @brief The kinds of token
+        struct Kind
+        {
+            enum Enum
+            {
+                Literal,    ///< a character to match exactly, escaped or not
+                AnyChar,    ///< a question mark
+                Class,      ///< a bracketed character class
+                Star,       ///< an asterisk
+                Open,       ///< an opening parenthesis
+                Close,      ///< a closing parenthesis
+                Fail,       ///< a trailing escape character, which never matches
+                End         ///< the end of the pattern
+            };
+        };
+
+        /// @brief The kind of the token
+        typename Kind::Enum Type;
+
+        /// @brief The character of a literal
+        TChar Char;
+
+        /// @brief The match entry index of a parenthesis, the index of the character class of a class, or for a
+        ///        star the index of the literal that follows or -1 if no literal follows
+        int Index;
+
+        /// @brief The number of pattern characters before the token
+        int Offset;
+    };
+
     /// @brief A class that encapsulates a wildcard expression
     /// @param TString The type of the pattern string
     /// @param TStringRef The type of the reference to the pattern string (for efficient parameter passing)
     /// @param TCharIter The type of the iterator through the characters
     /// @param TStringBeginFunctor The type of the functor that returns the iterator at the beginning of a string
     /// @param TStringEndFunctor The type of the functor that determines if the iterator is at the end of a string
+    /// @remarks The pattern string is preprocessed into an array of tokens with the escapes and the match entry
+    ///          indices resolved, which is what the matchers go through
     template <class TString=const char*, class TStringRef=const char*, class TCharIter=const char*,
         class TStringFunctorSelector=DefaultStringFunctorSelector>
     class Pattern
@@ -187,6 +616,15 @@ namespace Qtl { namespace String { namespace Wildcard {
 
         /// @brief The type of iterator through the characters in the pattern string
         typedef TCharIter CharIter;
+
+        /// @brief The type of the characters in the pattern string
+        typedef typename std::iterator_traits<TCharIter>::value_type CharType;
+
+        /// @brief The type of the tokens the pattern is preprocessed into
+        typedef PatternToken<CharType> Token;
+
+        /// @brief The type of the literal segments that follow the stars
+        typedef std::basic_string<CharType> LiteralString;
         
         /// @brief The type of the functor that returns the iterator at the beginning of a string
         typedef typename TStringFunctorSelector::template rebind<TStringRef, TCharIter>::StringBeginFunctor StringBeginFunctor;
@@ -210,12 +648,39 @@ namespace Qtl { namespace String { namespace Wildcard {
         /// @brief The functor that returns the distance between two characters
         CharDistFunctor         _getCharDist;
         
-        /// @brief The look-up table that maps iterator of pattern to the index of match result entry
-        std::map<CharIter, int> _mapIterToIndex;
+        /// @brief The tokens in the order of the pattern followed by an end token
+        std::vector<Token>      _tokens;
+
+        /// @brief The literal segments that follow the stars
+        std::vector<LiteralString> _literals;
+
+        /// @brief The character classes of the class tokens
+        std::vector<CharClass>  _classes;
+
+        /// @brief The literal after a star that's followed by a wildcard
+        LiteralString           _emptyLiteral;
+
+        /// @brief The index of the last star token or -1
+        int                     _lastStar;
+
+        /// @brief The largest match entry index
+        int                     _quoteCount;
 
 		/// @brief The length of the pattern
 		int						_patternLen;
 
+        /// @brief The searcher of the longest literal run before the first star
+        HorspoolSearcher<CharType> _anchorSearcher;
+
+        /// @brief The number of characters a match takes before the literal run of _anchorSearcher
+        int                     _anchorOffset;
+
+        /// @brief The number of characters a match takes before the first star or to its end if there's no star
+        int                     _prefixWidth;
+
+        /// @brief Whether a star comes first, with nothing but parentheses before it
+        bool                    _leadingStar;
+
     public:
         // a typical wildcard expression: 
         //   a*b?C(*)
@@ -228,45 +693,181 @@ namespace Qtl { namespace String { namespace Wildcard {
         ///          where normal characters (alphanumerics, punctuation etc) expect exact match, asteroids match whatever 
         ///          string of whatever length, question marks match any single character and an escape character 
         ///          (back-slash) turns a succeeding special character to a normal matching character.
+        ///          A bracketed class like [a-z_] matches any single character it lists, [!0-9] or [^0-9] any it
+        ///          doesn't; a '[' without a closing bracket is a normal character.
         Pattern(TStringRef pattern, StringBeginFunctor stringBegin, StringBeginFunctor stringEnd) 
             : _pattern(pattern), _getStringBegin(stringBegin), _isStringEnd(stringEnd)
         {
-            PreProcessParentheses();
+            Tokenize();
         }
 
         /// @brief Instantiates a pattern with the pattern string
         /// @param pattern The pattern string
         Pattern(TStringRef pattern) : _pattern(pattern)
         {
-            PreProcessParentheses();
+            Tokenize();
         }
 
     private:
-        /// @brief Creates the mapping from parenthesis pointer to index from the pattern string
-        void PreProcessParentheses()
+        /// @brief Preprocesses the pattern string into the tokens
+        /// @remarks The parentheses are given their match entry indices and each star the literal segment that
+        ///          follows it, which runs up to the next wildcard with the parentheses skipped as they match nothing
+        void Tokenize()
         {
-            _mapIterToIndex.clear();
+            _tokens.clear();
+            _literals.clear();
+            _classes.clear();
+            CharClass charClass;
+            int classLength;
+            _lastStar = -1;
+            _quoteCount = 0;
             int openingIndex = 1;	// 1-based as 0 is reserved for overral match
             int closingIndex = 1;
 			_patternLen = 0;
             for (CharIter iter = GetBegin(); !IsEnd(iter); ++iter, ++_patternLen)
             {
+                Token token;
+                token.Char = CharType();
+                token.Index = 0;
+                token.Offset = _patternLen;
                 if (*iter=='\\')
                 {
-                    ++iter; // skip the character that follows
+                    ++iter; // the character that follows is a literal
 					++_patternLen;
+                    if (IsEnd(iter))
+                    {
+                        token.Type = Token::Kind::Fail;
+                        _tokens.push_back(token);
+                        break;
+                    }
+                    token.Type = Token::Kind::Literal;
+                    token.Char = *iter;
+                }
+                else if (*iter == '[' && (classLength = ReadClass(iter, charClass)) > 0)
+                {
+                    for (int k = 0; k < classLength; k++, ++_patternLen)
+                    {
+                        ++iter; // up to the closing bracket
+                    }
+                    token.Type = Token::Kind::Class;
+                    token.Index = (int)_classes.size();
+                    _classes.push_back(charClass);
+                }
+                else if (*iter == '*')
+                {
+                    token.Type = Token::Kind::Star;
+                    token.Index = -1;
+                    _lastStar = (int)_tokens.size();
+                }
+                else if (*iter == '?')
+                {
+                    token.Type = Token::Kind::AnyChar;
                 }
                 else if (*iter == '(')
                 {
-                    _mapIterToIndex[iter] = closingIndex = openingIndex++;
+                    token.Type = Token::Kind::Open;
+                    token.Index = closingIndex = openingIndex++;
+                    _quoteCount = token.Index;
                 }
                 else if (*iter == ')')
                 {
-                    // NOTE We don't need to differentiate opening and closing parentheses as
-                    //      the matcher has the knowledge of the pattern characters
-                    _mapIterToIndex[iter] = closingIndex--;
+                    token.Type = Token::Kind::Close;
+                    token.Index = closingIndex--;
+                }
+                else
+                {
+                    token.Type = Token::Kind::Literal;
+                    token.Char = *iter;
+                }
+                _tokens.push_back(token);
+            }
+
+            // a closing parenthesis without an opening one has no entry to record to
+            size_t kept = 0;
+            for (size_t i = 0; i < _tokens.size(); i++)
+            {
+                if (_tokens[i].Type != Token::Kind::Close || (_tokens[i].Index >= 1 && _tokens[i].Index <= _quoteCount))
+                {
+                    if (_tokens[i].Type == Token::Kind::Star)
+                    {
+                        _lastStar = (int)kept;
+                    }
+                    _tokens[kept++] = _tokens[i];
+                }
+            }
+            _tokens.resize(kept);
+            Token end;
+            end.Type = Token::Kind::End;
+            end.Char = CharType();
+            end.Index = 0;
+            end.Offset = _patternLen;
+            _tokens.push_back(end);
+
+            for (size_t i = 0; i < _tokens.size(); i++)
+            {
+                if (_tokens[i].Type != Token::Kind::Star)
+                {
+                    continue;
+                }
+                LiteralString literal;
+                for (size_t k = i + 1; _tokens[k].Type == Token::Kind::Literal || _tokens[k].Type == Token::Kind::Open
+                    || _tokens[k].Type == Token::Kind::Close; k++)
+                {
+                    if (_tokens[k].Type == Token::Kind::Literal)
+                    {
+                        literal.push_back(_tokens[k].Char);
+                    }
+                }
+                if (!literal.empty())
+                {
+                    _tokens[i].Index = (int)_literals.size();
+                    _literals.push_back(literal);
                 }
             }
+            PreProcessSearch();
+        }
+
+        /// @brief Finds what an unanchored search can skip ahead with
+        /// @remarks The characters before the first star are at fixed distances from the start of a match, so
+        ///          the longest literal run among them tells where matches may start
+        void PreProcessSearch()
+        {
+            LiteralString longest;
+            LiteralString current;
+            int currentOffset = 0;
+            _anchorOffset = 0;
+            _prefixWidth = 0;
+            _leadingStar = false;
+            for (const Token *token = GetTokens(); ; ++token)
+            {
+                if (token->Type == Token::Kind::Open || token->Type == Token::Kind::Close)
+                {
+                    continue;
+                }
+                if (token->Type == Token::Kind::Literal)
+                {
+                    if (current.empty())
+                    {
+                        currentOffset = _prefixWidth;
+                    }
+                    current.push_back(token->Char);
+                    _prefixWidth++;
+                    continue;
+                }
+                if (current.size() > longest.size())
+                {
+                    longest = current;
+                    _anchorOffset = currentOffset;
+                }
+                current.clear();
+                if (token->Type != Token::Kind::AnyChar && token->Type != Token::Kind::Class)
+                {
+                    _leadingStar = (token->Type == Token::Kind::Star && _prefixWidth == 0);
+                    break;
+                }
+                _prefixWidth++;
+            }
+            _anchorSearcher.Assign(longest);
         }
 
     public:
@@ -292,28 +893,223 @@ namespace Qtl { namespace String { namespace Wildcard {
 			return _patternLen;
 		}
 
-        /// @brief Returns the match entry index for the specified parenthesis pointer
-        /// @return The match entry index
-        int PatternIterToIndex(CharIter patternIter)
+        /// @brief Returns the tokens
+        /// @return The first token, the last of which is an end token
+        const Token *GetTokens() const
         {
-            return _mapIterToIndex[patternIter];
+            return &_tokens[0];
         }
 
-        /// @brief Returns the distance between two characters (the number of characters in between plus one)
-        /// @param iterBegin The iterator that points to the character on the left hand
-        /// @param iterEnd The iterator that points to the character on the right hand
-        /// @return The distance
-        size_t GetQuotedLength(CharIter iterBegin, CharIter iterEnd)
+        /// @brief Returns the number of tokens
+        /// @return The number of tokens not counting the end token
+        int GetTokenCount() const
         {
-            return _getCharDist(_pattern, iterBegin, iterEnd);
+            return (int)_tokens.size() - 1;
         }
-    };
 
-    /// @brief A class that converts a wildcard expression to its equivalent regular expression
-    /// @param TPattern The type of the pattern class 
-    /// @param TRegexStringRef The type of the reference to the string for regular expression
-    /// @param TRegexCharIter The iterator through characters in the string for regular expression
-    /// @param TPatternFunctorSelector The functor selector for pattern
+        /// @brief Returns the index of the last star token
+        /// @return The index or -1 if there is no star
+        int GetLastStar() const
+        {
+            return _lastStar;
+        }
+
+        /// @brief Returns the largest match entry index, which is the number of quotations in a well formed pattern
+        /// @return The index
+        int GetQuoteCount() const
+        {
+            return _quoteCount;
+        }
+
+        /// @brief Determines if the pattern has any parentheses
+        /// @return true if it has
+        bool HasQuotations() const
+        {
+            return _quoteCount > 0;
+        }
+
+        /// @brief Returns the searcher of the longest literal run before the first star
+        /// @return The searcher, whose literal is empty if there's no literal before the first star
+        const HorspoolSearcher<CharType> &GetAnchorSearcher() const
+        {
+            return _anchorSearcher;
+        }
+
+        /// @brief Returns the number of characters a match takes before the literal of GetAnchorSearcher()
+        /// @return The number of characters
+        int GetAnchorOffset() const
+        {
+            return _anchorOffset;
+        }
+
+        /// @brief Returns the number of characters a match takes before the first star
+        /// @return The number of characters, for the whole pattern if it has no star
+        int GetPrefixWidth() const
+        {
+            return _prefixWidth;
+        }
+
+        /// @brief Determines if the pattern starts with a star, parentheses aside
+        /// @return true if it does
+        bool HasLeadingStar() const
+        {
+            return _leadingStar;
+        }
+
+        /// @brief Returns the literal segment that follows a star
+        /// @param star The star token
+        /// @return The literal, which is empty if a wildcard or the end of the pattern follows
+        const LiteralString &GetStarLiteral(const Token &star) const
+        {
+            return (star.Index >= 0)? _literals[star.Index] : _emptyLiteral;
+        }
+
+        /// @brief Returns the character class of a class token
+        /// @param token The class token
+        /// @return The class
+        const CharClass &GetClass(const Token &token) const
+        {
+            return _classes[token.Index];
+        }
+
+        /// @brief Reads a bracketed character class
+        /// @param iter The iterator at the opening bracket
+        /// @param charClass To return the class
+        /// @return The number of pattern characters after the opening bracket up to and including the closing
+        ///         one, or 0 if the class isn't closed
+        /// @remarks A '!' or '^' right after the opening bracket negates the class, a ']' first in the class or
+        ///          a '-' first or last is a normal character and an escape character makes the character that
+        ///          follows a normal one; a range like z-a that goes backwards is empty
+        int ReadClass(CharIter iter, CharClass &charClass)
+        {
+            charClass.Clear();
+            int length = 0;
+            ++iter;
+            bool negated = !IsEnd(iter) && (*iter == '!' || *iter == '^');
+            if (negated)
+            {
+                ++iter;
+                ++length;
+            }
+            for (bool first = true; ; first = false)
+            {
+                if (IsEnd(iter))
+                {
+                    return 0;
+                }
+                if (*iter == ']' && !first)
+                {
+                    break;
+                }
+                unsigned long low;
+                if (!ReadClassChar(iter, length, low))
+                {
+                    return 0;
+                }
+                unsigned long high = low;
+                if (!IsEnd(iter) && *iter == '-')
+                {
+                    CharIter iterHigh = iter;
+                    ++iterHigh;
+                    if (!IsEnd(iterHigh) && *iterHigh != ']')
+                    {
+                        iter = iterHigh;
+                        ++length;
+                        if (!ReadClassChar(iter, length, high))
+                        {
+                            return 0;
+                        }
+                    }
+                }
+                charClass.AddRange(low, high);
+            }
+            if (negated)
+            {
+                charClass.Negate();
+            }
+            return length + 1;
+        }
+
+    private:
+        /// @brief Reads a character of a class, which may be escaped
+        /// @param iter The iterator at the character, to return the position after it
+        /// @param length The number of pattern characters read, to add the ones of the character to
+        /// @param code To return the code of the character
+        /// @return false if the pattern ends with an escape character
+        bool ReadClassChar(CharIter &iter, int &length, unsigned long &code)
+        {
+            if (*iter == '\\')
+            {
+                ++iter;
+                ++length;
+                if (IsEnd(iter))
+                {
+                    return false;
+                }
+            }
+            code = CharClass::GetCode(*iter);
+            ++iter;
+            ++length;
+            return true;
+        }
+
+    public:
+        /// @brief Returns the index of the token that starts at an iterator
+        /// @param patternIter The iterator
+        /// @return The index of the first token at or after the iterator
+        int IterToToken(CharIter patternIter)
+        {
+            return OffsetToToken((int)GetQuotedLength(GetBegin(), patternIter));
+        }
+
+        /// @brief Returns the match entry index for the specified parenthesis pointer
+        /// @return The match entry index or 0 if it's not at a parenthesis with an entry
+        int PatternIterToIndex(CharIter patternIter)
+        {
+            int offset = (int)GetQuotedLength(GetBegin(), patternIter);
+            const Token &token = _tokens[OffsetToToken(offset)];
+            bool isParenthesis = (token.Type == Token::Kind::Open || token.Type == Token::Kind::Close);
+            return (isParenthesis && token.Offset == offset)? token.Index : 0;
+        }
+
+        /// @brief Returns the distance between two characters (the number of characters in between plus one)
+        /// @param iterBegin The iterator that points to the character on the left hand
+        /// @param iterEnd The iterator that points to the character on the right hand
+        /// @return The distance
+        size_t GetQuotedLength(CharIter iterBegin, CharIter iterEnd)
+        {
+            return _getCharDist(_pattern, iterBegin, iterEnd);
+        }
+
+    private:
+        /// @brief Returns the index of the first token at or after an offset
+        /// @param offset The number of pattern characters before the position
+        /// @return The index of the token
+        int OffsetToToken(int offset) const
+        {
+            int low = 0;
+            int high = (int)_tokens.size() - 1;
+            while (low < high)
+            {
+                int middle = (low + high) / 2;
+                if (_tokens[middle].Offset < offset)
+                {
+                    low = middle + 1;
+                }
+                else
+                {
+                    high = middle;
+                }
+            }
+            return low;
+        }
+    };
+
+    /// @brief A class that converts a wildcard expression to its equivalent regular expression
+    /// @param TPattern The type of the pattern class 
+    /// @param TRegexStringRef The type of the reference to the string for regular expression
+    /// @param TRegexCharIter The iterator through characters in the string for regular expression
+    /// @param TPatternFunctorSelector The functor selector for pattern
     /// @param TRegexAppendCharFunctorSelector The append-character functor selector for regular expression
     /// @remarks NOTE TRegexChar has to be compatible with the character type TPattern::CharIter iterates through
     template <class TPattern=Pattern<>, class TRegexStringRef=char*, class TRegexCharIter=char*, 
@@ -365,6 +1161,8 @@ namespace Qtl { namespace String { namespace Wildcard {
         ///          for more detail. It has yet to be tested though.
         void Convert(TPattern &pattern, TRegexStringRef regex, TRegexCharIter &iterRegex)
         {
+            CharClass charClass;
+            int classLength;
             for (PatternStringIter iter = pattern.GetBegin(); !pattern.IsEnd(iter); ++iter)
             {
                 switch (*iter)
@@ -393,7 +1191,21 @@ namespace Qtl { namespace String { namespace Wildcard {
                 case '(': case ')':
                     _regexAppendChar(regex, iterRegex, *iter);
                     break;
-                case '[': case ']': case '{': case '}': case '^': case '.': case '-': case '+':
+                case '[':
+                    classLength = pattern.ReadClass(iter, charClass);
+                    if (classLength > 0)
+                    {
+                        AppendClass(regex, iterRegex, charClass);
+                        for (int k = 0; k < classLength; k++)
+                        {
+                            ++iter;
+                        }
+                        break;
+                    }
+                    _regexAppendChar(regex, iterRegex, '\\');
+                    _regexAppendChar(regex, iterRegex, *iter);
+                    break;
+                case ']': case '{': case '}': case '^': case '.': case '-': case '+':
                     _regexAppendChar(regex, iterRegex, '\\');
                     _regexAppendChar(regex, iterRegex, *iter);
                     break;
@@ -403,6 +1215,93 @@ namespace Qtl { namespace String { namespace Wildcard {
                 }
             }
         }
+
+    private:
+        /// @brief Appends a character class as a bracket expression
+        /// @param regex The regular expression
+        /// @param iterRegex The iterator to the characters in the regular expression
+        /// @param charClass The class
+        /// @remarks The characters are written as the ranges of the codes in the class, or not in it if it's
+        ///          negated, with the ones special in a bracket expression escaped. A class that matches no
+        ///          character or every one is written as one with all the codes, negated for none, since an
+        ///          empty bracket expression isn't one
+        void AppendClass(TRegexStringRef regex, TRegexCharIter &iterRegex, const CharClass &charClass)
+        {
+            bool negated = charClass.IsNegated();
+            int written = 0;
+            for (int code = 0; code < 256; code++)
+            {
+                if (charClass.Contains((unsigned char)code) != negated)
+                {
+                    written++;
+                }
+            }
+            if (written == 0 || written == 256)
+            {
+                AppendAllCodes(regex, iterRegex, (written == 0) != negated);
+                return;
+            }
+            _regexAppendChar(regex, iterRegex, '[');
+            if (negated)
+            {
+                _regexAppendChar(regex, iterRegex, '^');
+            }
+            for (int code = 0; code < 256; )
+            {
+                if (charClass.Contains((unsigned char)code) == negated)
+                {
+                    code++;
+                    continue;
+                }
+                int last = code;
+                while (last < 255 && charClass.Contains((unsigned char)(last + 1)) != negated)
+                {
+                    last++;
+                }
+                AppendClassChar(regex, iterRegex, code);
+                if (last > code + 1)
+                {
+                    _regexAppendChar(regex, iterRegex, '-');
+                }
+                if (last > code)
+                {
+                    AppendClassChar(regex, iterRegex, last);
+                }
+                code = last + 1;
+            }
+            _regexAppendChar(regex, iterRegex, ']');
+        }
+
+        /// @brief Appends the bracket expression of all the codes
+        /// @param regex The regular expression
+        /// @param iterRegex The iterator to the characters in the regular expression
+        /// @param negated Whether the expression is negated to match no character
+        void AppendAllCodes(TRegexStringRef regex, TRegexCharIter &iterRegex, bool negated)
+        {
+            const char *codes = "\\x00-\\xff]";
+            _regexAppendChar(regex, iterRegex, '[');
+            if (negated)
+            {
+                _regexAppendChar(regex, iterRegex, '^');
+            }
+            for (const char *iter = codes; *iter != 0; ++iter)
+            {
+                _regexAppendChar(regex, iterRegex, *iter);
+            }
+        }
+
+        /// @brief Appends a character of a bracket expression
+        /// @param regex The regular expression
+        /// @param iterRegex The iterator to the characters in the regular expression
+        /// @param code The code of the character
+        void AppendClassChar(TRegexStringRef regex, TRegexCharIter &iterRegex, int code)
+        {
+            if (code == '\\' || code == ']' || code == '[' || code == '^' || code == '-')
+            {
+                _regexAppendChar(regex, iterRegex, '\\');
+            }
+            _regexAppendChar(regex, iterRegex, (RegexChar)(unsigned char)code);
+        }
     };
 
     /// @brief A class that represents a match of quotation enclosed by a pair of parentheses in the pattern
@@ -447,6 +1346,16 @@ namespace Qtl { namespace String { namespace Wildcard {
         MatchList Matches;
 
     public:
+        /// @brief Prepares the result for a new matching, keeping the memory of the entries
+        /// @param quoteCount The number of quotations of the pattern
+        /// @param iterBegin The beginning of the source string
+        void Reset(int quoteCount, CharIter iterBegin)
+        {
+            Matches.assign(quoteCount + 1, MatchType());
+            Matches[0].Begin = iterBegin;
+            Matches[0].End = iterBegin;
+        }
+
         /// @brief Records the beginning of a quotation encountered
         /// @param index The index of the match entry. Note it's 1-based as 0 is reserved
 		///        for the overall match
@@ -466,7 +1375,226 @@ namespace Qtl { namespace String { namespace Wildcard {
         /// @param iterChar The pointer to the source string where the quotation ends
         void Close(int index, CharIter iterChar)
         {
-            // cell index must have already been allocated in the array of Matches
+            // a closing parenthesis may come first in an ill-formed pattern like ")("
+            while (index >= (int)Matches.size())
+            {
+                Matches.push_back(MatchType());
+            }
+            Matches[index].End = iterChar;
+        }
+    };
+
+    /// @brief A list of match entries with inline storage for the first few of them
+    /// @param TMatch The type of the match entries
+    /// @param TInlineCount The number of entries stored inline
+    /// @remarks The entries are either all inline or, when there are more of them, all in a vector, so they stay
+    ///          contiguous. The vector isn't shrunk, so a list that's reused doesn't allocate again.
+    template <class TMatch, int TInlineCount>
+    class InlineMatchList
+    {
+    public:
+        /// @brief The iterator through the entries
+        typedef TMatch *        iterator;
+        /// @brief The iterator through the entries of a constant list
+        typedef const TMatch *  const_iterator;
+
+    private:
+        /// @brief The inline entries
+        TMatch _inline[TInlineCount];
+
+        /// @brief The entries if there are more than TInlineCount of them
+        std::vector<TMatch> _overflow;
+
+        /// @brief The number of entries
+        int _size;
+
+    public:
+        /// @brief Instantiates an empty list
+        InlineMatchList() : _size(0)
+        {
+        }
+
+    public:
+        /// @brief Returns the number of entries
+        /// @return The number of entries
+        size_t size() const
+        {
+            return (size_t)_size;
+        }
+
+        /// @brief Returns the first entry
+        /// @return The iterator at the first entry
+        iterator begin()
+        {
+            return GetItems();
+        }
+
+        /// @brief Returns the first entry
+        /// @return The iterator at the first entry
+        const_iterator begin() const
+        {
+            return GetItems();
+        }
+
+        /// @brief Returns the end of the entries
+        /// @return The iterator past the last entry
+        iterator end()
+        {
+            return GetItems() + _size;
+        }
+
+        /// @brief Returns the end of the entries
+        /// @return The iterator past the last entry
+        const_iterator end() const
+        {
+            return GetItems() + _size;
+        }
+
+        /// @brief Returns an entry
+        /// @param index The index of the entry
+        /// @return The entry
+        TMatch &operator[](size_t index)
+        {
+            return GetItems()[index];
+        }
+
+        /// @brief Returns an entry
+        /// @param index The index of the entry
+        /// @return The entry
+        const TMatch &operator[](size_t index) const
+        {
+            return GetItems()[index];
+        }
+
+        /// @brief Removes all the entries
+        void clear()
+        {
+            _size = 0;
+        }
+
+        /// @brief Sets the number of entries, all of them to the same value
+        /// @param size The number of entries
+        /// @param match The value of the entries
+        void assign(size_t size, const TMatch &match)
+        {
+            _size = (int)size;
+            if (_size > TInlineCount && _overflow.size() < size)
+            {
+                _overflow.resize(size);
+            }
+            std::fill(begin(), end(), match);
+        }
+
+        /// @brief Sets the number of entries, keeping the existing ones
+        /// @param size The number of entries
+        void resize(size_t size)
+        {
+            int newSize = (int)size;
+            if (newSize > TInlineCount && _size <= TInlineCount)
+            {
+                // moves the entries out of the inline storage
+                if (_overflow.size() < size)
+                {
+                    _overflow.resize(size);
+                }
+                std::copy(_inline, _inline + _size, _overflow.begin());
+            }
+            else if (newSize <= TInlineCount && _size > TInlineCount)
+            {
+                std::copy(_overflow.begin(), _overflow.begin() + newSize, _inline);
+            }
+            else if (newSize > TInlineCount && _overflow.size() < size)
+            {
+                _overflow.resize(size);
+            }
+            for (int i = _size; i < newSize; i++)
+            {
+                GetItems()[i] = TMatch();
+            }
+            _size = newSize;
+        }
+
+        /// @brief Appends an entry
+        /// @param match The entry
+        void push_back(const TMatch &match)
+        {
+            resize(_size + 1);
+            GetItems()[_size - 1] = match;
+        }
+
+    private:
+        /// @brief Returns the storage the entries are in
+        /// @return The first entry
+        TMatch *GetItems()
+        {
+            return (_size <= TInlineCount)? _inline : &_overflow[0];
+        }
+
+        /// @brief Returns the storage the entries are in
+        /// @return The first entry
+        const TMatch *GetItems() const
+        {
+            return (_size <= TInlineCount)? _inline : &_overflow[0];
+        }
+    };
+
+    /// @brief A match result that keeps the entries of up to a number of quotations inline
+    /// @param TCharIter The iterator through the source string
+    /// @param TDiff The type of the integer that indicates a string length or a character distance
+    /// @param TInlineCount The number of match entries stored inline, the overall match included
+    /// @remarks A result reused across matchings doesn't allocate once it has held the largest number of entries,
+    ///          and never does for patterns with fewer than TInlineCount quotations
+    template <class TCharIter=const char*, class TDiff=size_t, int TInlineCount=8>
+    class FixedMatchResult
+    {
+    public:
+        /// @brief The iterator through the source string
+        typedef TCharIter       CharIter;
+        /// @brief The type of the integer that indicates a string length or a character distance
+        typedef TDiff           Diff;
+        /// @brief The type of match entries listed in this object
+        typedef MatchQuote<CharIter, Diff>  MatchType;
+
+        typedef InlineMatchList<MatchType, TInlineCount>    MatchList;
+
+    public:
+        /// @brief A list of matched quotation entries
+        MatchList Matches;
+
+    public:
+        /// @brief Prepares the result for a new matching
+        /// @param quoteCount The number of quotations of the pattern
+        /// @param iterBegin The beginning of the source string
+        void Reset(int quoteCount, CharIter iterBegin)
+        {
+            Matches.assign(quoteCount + 1, MatchType());
+            Matches[0].Begin = iterBegin;
+            Matches[0].End = iterBegin;
+        }
+
+        /// @brief Records the beginning of a quotation encountered
+        /// @param index The index of the match entry. Note it's 1-based as 0 is reserved
+        ///        for the overall match
+        /// @param iterChar The pointer to the source string where the quotation starts
+        void Open(int index, CharIter iterChar)
+        {
+            if (index >= (int)Matches.size())
+            {
+                Matches.resize(index + 1);
+            }
+            Matches[index].Begin = iterChar;
+        }
+
+        /// @brief Records the end of a quotation encountered
+        /// @param index The index of the match entry. Note it's 1-based as 0 is reserved
+        ///        for the overall match
+        /// @param iterChar The pointer to the source string where the quotation ends
+        void Close(int index, CharIter iterChar)
+        {
+            if (index >= (int)Matches.size())
+            {
+                Matches.resize(index + 1);
+            }
             Matches[index].End = iterChar;
         }
     };
@@ -474,7 +1602,7 @@ namespace Qtl { namespace String { namespace Wildcard {
     /// @brief A default trait class that provides types needed by Matcher
     /// @param TChar 
     template <class TStringRef=const char*, class TCharIter=const char*, class TDiff=size_t,
-        class TStringFunctorSelector=DefaultStringFunctorSelector>
+        class TStringFunctorSelector=DefaultStringFunctorSelector, class TMatchResult=MatchResult<TCharIter, TDiff> >
     struct MatcherTraits
     {
         /// @brief The type of the reference to the source string 
@@ -483,7 +1611,7 @@ namespace Qtl { namespace String { namespace Wildcard {
         typedef TCharIter   CharIter;
         
         /// @brief The type of the match result (matched quotation entry container)
-        typedef MatchResult<TCharIter, TDiff>   MatchResultType;
+        typedef TMatchResult                    MatchResultType;
         /// @brief The type of the reference to the match result
         typedef MatchResultType &               MatchResultRef;
         
@@ -494,6 +1622,12 @@ namespace Qtl { namespace String { namespace Wildcard {
     };
     
     /// @brief A wildcard string matcher
+    /// @remarks Patterns without parentheses, and any pattern when the quotations aren't asked for, are matched
+    ///          with the two-pointer algorithm in O(n*m) time without recursion. Working out the quotations
+    ///          backtracks instead: it takes time exponential in the number of stars in the worst case and
+    ///          recurses once per candidate position of a star, so the stack grows with the length of the
+    ///          source. Sources that aren't trusted or may be long are to be matched with NfaMatcher for the
+    ///          quotations, from the position found by the overloads that don't work them out.
     template <class Traits = MatcherTraits<> >
     class Matcher
     {
@@ -542,17 +1676,94 @@ namespace Qtl { namespace String { namespace Wildcard {
         /// @param matchResult The container of matched quotation entries. Note the first entry
 		///        refers to the entire match
         /// @return true if the matching is successful (the pattern is completely consumed)
+        /// @remarks A pattern without parentheses is matched without recursion in O(n*m) time; one with them
+        ///          backtracks, see the remarks of the class
         template <class TPattern>
         bool Match(StringRef source, TPattern &pattern, MatchResultRef matchResult)
+        {
+            return MatchAt(source, _stringBegin(source), pattern, matchResult);
+        }
+
+        /// @brief Finds the first position in the source where a match starts
+        /// @param source The source string to search
+        /// @param pattern The pattern to match
+        /// @param matchResult The container of matched quotation entries, the first entry of which refers to the
+        ///        match found
+        /// @return true if a match is found
+        /// @remarks A match is what Match() finds starting at a position, the leftmost one. The candidate
+        ///          positions are the ones the longest literal before the first star is found at with a
+        ///          Boyer-Moore-Horspool skip, less the characters before it.
+        template <class TPattern>
+        bool Search(StringRef source, TPattern &pattern, MatchResultRef matchResult)
+        {
+            CharIter iterBegin = _stringBegin(source);
+            CharIter iterEnd = SourceEndFinder<StringRef, CharIter, StringEndFunctor>::Find(source, iterBegin,
+                _stringEnd);
+            CharIter iterStart = iterBegin;
+            return SearchFrom(source, iterBegin, iterEnd, pattern, &matchResult, iterStart);
+        }
+
+        /// @brief Finds the first position in the source where a match starts without working out the quotations
+        /// @param source The source string to search
+        /// @param pattern The pattern to match
+        /// @param iterStart To return the position the match found starts at
+        /// @return true if a match is found
+        /// @remarks The positions are tried as with Search() but the parentheses are ignored and each is matched
+        ///          without recursion in O(n*m) time, so the quotations of the match can be worked out from the
+        ///          position found with NfaMatcher instead
+        template <class TPattern>
+        bool Search(StringRef source, TPattern &pattern, CharIter &iterStart)
+        {
+            CharIter iterBegin = _stringBegin(source);
+            CharIter iterEnd = SourceEndFinder<StringRef, CharIter, StringEndFunctor>::Find(source, iterBegin,
+                _stringEnd);
+            iterStart = iterBegin;
+            return SearchFrom(source, iterBegin, iterEnd, pattern, NULL, iterStart);
+        }
+
+        /// @brief Finds all the matches in the source that don't overlap
+        /// @param source The source string to search
+        /// @param pattern The pattern to match
+        /// @param matches To return the result of each match in the order they are found
+        /// @return The number of matches
+        /// @remarks Each search starts where the previous match ends, or a character after where it starts if
+        ///          it's empty. As a star takes as much as it can, a pattern that ends with one matches up to
+        ///          the end of the source.
+        template <class TPattern>
+        int FindAll(StringRef source, TPattern &pattern, std::vector<MatchResultType> &matches)
+        {
+            matches.clear();
+            CharIter iterBegin = _stringBegin(source);
+            CharIter iterEnd = SourceEndFinder<StringRef, CharIter, StringEndFunctor>::Find(source, iterBegin,
+                _stringEnd);
+            MatchResultType matchResult;
+            CharIter iterStart = iterBegin;
+            while (SearchFrom(source, iterBegin, iterEnd, pattern, &matchResult, iterStart))
+            {
+                matches.push_back(matchResult);
+                if (matchResult.Matches[0].End == iterEnd)
+                {
+                    break;
+                }
+                iterBegin = matchResult.Matches[0].End;
+                if (iterBegin == matchResult.Matches[0].Begin)
+                {
+                    ++iterBegin;
+                }
+            }
+            return (int)matches.size();
+        }
+
+        /// @brief Determines if the source matches the pattern without working out the quotations
+        /// @param source The source string to match
+        /// @param pattern The pattern to match against
+        /// @return true if the matching is successful (the pattern is completely consumed)
+        /// @remarks The parentheses are ignored and the pattern is matched without recursion in O(n*m) time
+        template <class TPattern>
+        bool Match(StringRef source, TPattern &pattern)
         {
             CharIter iterSource = _stringBegin(source);
-            typename TPattern::CharIter iterPattern = pattern.GetBegin();
-			matchResult.Matches.clear();
-			matchResult.Matches.push_back(typename MatchResultType::MatchType());
-			matchResult.Matches[0].Begin = iterSource;
-            bool matched = Match(source, iterSource, pattern, iterPattern, matchResult);
-			matchResult.Matches[0].End = iterSource;
-			return matched;
+            return MatchLeftmost(source, iterSource, pattern, pattern.GetTokens(), NULL);
         }
         
         /// @brief Match the source to the pattern (recursive)
@@ -566,70 +1777,323 @@ namespace Qtl { namespace String { namespace Wildcard {
         bool Match(StringRef source, CharIter &iterSource, TPattern &pattern, typename TPattern::CharIter &iterPattern, 
             MatchResultRef matchResult)
         {
-            while (! pattern.IsEnd(iterPattern))
+            const typename TPattern::Token *token = pattern.GetTokens() + pattern.IterToToken(iterPattern);
+            return MatchTokens(source, iterSource, pattern, token, matchResult);
+        }
+
+    private:
+        /// @brief Matches the source to the pattern from a position
+        /// @param source The source string to match
+        /// @param iterStart The position to start the matching at
+        /// @param pattern The pattern to match against
+        /// @param matchResult The container of matched quotation entries
+        /// @return true if the matching is successful
+        template <class TPattern>
+        bool MatchAt(StringRef source, CharIter iterStart, TPattern &pattern, MatchResultRef matchResult)
+        {
+            CharIter iterSource = iterStart;
+            // the entries of all the quotations are there from the start, so the recursion doesn't grow them
+            matchResult.Reset(pattern.GetQuoteCount(), iterSource);
+            bool matched;
+            if (pattern.HasQuotations())
+            {
+                matched = MatchTokens(source, iterSource, pattern, pattern.GetTokens(), matchResult);
+            }
+            else
             {
-                if (*iterPattern == '\\')
+                matched = MatchPlain(source, iterSource, pattern);
+            }
+			matchResult.Matches[0].End = iterSource;
+			return matched;
+        }
+
+        /// @brief Finds the first position at or after a position where a match starts
+        /// @param source The source string to search
+        /// @param iterBegin The position to search from
+        /// @param iterEnd The end of the source string
+        /// @param pattern The pattern to match
+        /// @param matchResult The container of matched quotation entries or NULL to only tell if it matches
+        /// @param iterStart To return the position the match found starts at
+        /// @return true if a match is found
+        template <class TPattern>
+        bool SearchFrom(StringRef source, CharIter iterBegin, CharIter iterEnd, TPattern &pattern,
+            MatchResultType *matchResult, CharIter &iterStart)
+        {
+            iterStart = iterBegin;
+            if (pattern.HasLeadingStar())
+            {
+                // the star reaches any match a later start would find
+                return MatchesAt(source, iterBegin, pattern, matchResult);
+            }
+            int prefixWidth = pattern.GetPrefixWidth();
+            int anchorOffset = pattern.GetAnchorOffset();
+            bool anchored = !pattern.GetAnchorSearcher().GetNeedle().empty();
+            for (; iterEnd - iterStart >= prefixWidth; ++iterStart)
+            {
+                if (anchored)
+                {
+                    CharIter iterAnchor = pattern.GetAnchorSearcher().Find(iterStart + anchorOffset, iterEnd);
+                    if (iterAnchor == iterEnd)
+                    {
+                        return false;
+                    }
+                    iterStart = iterAnchor - anchorOffset;
+                }
+                if (MatchesAt(source, iterStart, pattern, matchResult))
                 {
-                    ++iterPattern;
+                    return true;
                 }
-                else if (*iterPattern == '*')
+            }
+            return false;
+        }
+
+        /// @brief Matches the source to the pattern from a position, working out the quotations or not
+        /// @param source The source string to match
+        /// @param iterStart The position to start the matching at
+        /// @param pattern The pattern to match against
+        /// @param matchResult The container of matched quotation entries or NULL to only tell if it matches
+        /// @return true if the matching is successful
+        template <class TPattern>
+        bool MatchesAt(StringRef source, CharIter iterStart, TPattern &pattern, MatchResultType *matchResult)
+        {
+            if (matchResult != NULL)
+            {
+                return MatchAt(source, iterStart, pattern, *matchResult);
+            }
+            return MatchLeftmost(source, iterStart, pattern, pattern.GetTokens(), NULL);
+        }
+
+        /// @brief Match the source to the tokens of the pattern (recursive)
+        /// @param source The source string to match
+        /// @param iterSource The iterator through the source string at its current position
+        /// @param pattern The pattern to match against
+        /// @param token The current token of the pattern
+        /// @param matchResult The container of matched quotation entries
+        /// @return true if the matching is successful (the pattern is completely consumed)
+        template <class TPattern>
+        bool MatchTokens(StringRef source, CharIter &iterSource, TPattern &pattern,
+            const typename TPattern::Token *token, MatchResultRef matchResult)
+        {
+            typedef typename TPattern::Token Token;
+            for (; ; ++token)
+            {
+                switch (token->Type)
                 {
-                    CharIter savedIterSource = iterSource;
-                    typename TPattern::CharIter savedIterPattern = iterPattern;
-                    // greedy strategy
-                    if (!_stringEnd(savedIterSource, source))
+                case Token::Kind::End:
+                    return true;
+                case Token::Kind::Star:
+                    return MatchStar(source, iterSource, pattern, token + 1, pattern.GetStarLiteral(*token),
+                        matchResult);
+                case Token::Kind::AnyChar:
+                    if (_stringEnd(iterSource, source))
                     {
-                        ++iterSource;
-                        if (Match(source, iterSource, pattern, savedIterPattern, matchResult))
-                        {
-                            return true;
-                        }
+                        return false;
                     }
-                    ++iterPattern;
-                    if (Match(source, savedIterSource, pattern, iterPattern, matchResult))
+                    ++iterSource;
+                    break;
+                case Token::Kind::Open:
+                    matchResult.Open(token->Index, iterSource);
+                    break;
+                case Token::Kind::Close:
+                    matchResult.Close(token->Index, iterSource);
+                    break;
+                case Token::Kind::Literal:
+                    if (_stringEnd(iterSource, source) || !(*iterSource == token->Char))
                     {
-                        return true;
+                        return false;
+                    }
+                    ++iterSource;
+                    break;
+                case Token::Kind::Class:
+                    if (_stringEnd(iterSource, source) || !pattern.GetClass(*token).Contains(*iterSource))
+                    {
+                        return false;
                     }
+                    ++iterSource;
+                    break;
+                default:
                     return false;
                 }
-                else if (*iterPattern == '?')
+            }
+        }
+
+        /// @brief Matches the rest of the pattern after a star (recursive)
+        /// @param source The source string to match
+        /// @param iterSource The position the star starts at, to return where the pattern is consumed
+        /// @param pattern The pattern to match against
+        /// @param rest The token right after the star
+        /// @param literal The literal that follows the star
+        /// @param matchResult The container of matched quotation entries
+        /// @return true if the matching is successful
+        /// @remarks The star takes as much as it can (greedy strategy), so the later candidate positions for the
+        ///          rest are tried first; only the positions the literal is found at are candidates
+        template <class TPattern>
+        bool MatchStar(StringRef source, CharIter &iterSource, TPattern &pattern,
+            const typename TPattern::Token *rest, const typename TPattern::LiteralString &literal,
+            MatchResultRef matchResult)
+        {
+            CharIter iterCandidate = iterSource;
+            if (!SeekLiteral(source, iterCandidate, literal))
+            {
+                return false;
+            }
+            if (!_stringEnd(iterCandidate, source))
+            {
+                CharIter iterLater = iterCandidate;
+                ++iterLater;
+                if (MatchStar(source, iterLater, pattern, rest, literal, matchResult))
                 {
-                    if (_stringEnd(iterSource, source))
+                    iterSource = iterLater;
+                    return true;
+                }
+            }
+            if (MatchTokens(source, iterCandidate, pattern, rest, matchResult))
+            {
+                // the caller's position has to be where the pattern got consumed on this path
+                iterSource = iterCandidate;
+                return true;
+            }
+            return false;
+        }
+
+        /// @brief Moves to the first position at or after the current one where a literal begins
+        /// @param source The source string
+        /// @param iterSource The current position, to return the position of the literal
+        /// @param literal The literal
+        /// @return true if the literal is found or it is empty
+        template <class TLiteral>
+        bool SeekLiteral(StringRef source, CharIter &iterSource, const TLiteral &literal)
+        {
+            return literal.empty() ||
+                LiteralSeeker<StringRef, CharIter, StringEndFunctor>::Seek(source, iterSource, literal, _stringEnd);
+        }
+
+        /// @brief Matches a pattern without parentheses with the result of the recursive matching
+        /// @param source The source string to match
+        /// @param iterSource The beginning of the source, to return where the pattern is consumed
+        /// @param pattern The pattern to match against
+        /// @return true if the matching is successful
+        /// @remarks The recursion makes each star take as much as it can, which leaves every segment but the
+        ///          last where it fits first; the last segment, after the last star, ends up where it fits last
+        template <class TPattern>
+        bool MatchPlain(StringRef source, CharIter &iterSource, TPattern &pattern)
+        {
+            typedef typename TPattern::Token Token;
+            const Token *tokens = pattern.GetTokens();
+            int lastStar = pattern.GetLastStar();
+            if (!MatchLeftmost(source, iterSource, pattern, tokens, (lastStar >= 0)? tokens + lastStar : NULL))
+            {
+                return false;
+            }
+            if (lastStar < 0)
+            {
+                return true;
+            }
+
+            const Token *lastSegment = tokens + lastStar + 1;
+            if (lastSegment->Type == Token::Kind::End)
+            {
+                // a trailing star takes the rest of the source
+                while (!_stringEnd(iterSource, source))
+                {
+                    ++iterSource;
+                }
+                return true;
+            }
+            const typename TPattern::LiteralString &literal = pattern.GetStarLiteral(tokens[lastStar]);
+            bool found = false;
+            CharIter iterFound = iterSource;
+            for (CharIter iterTry = iterSource; SeekLiteral(source, iterTry, literal); ++iterTry)
+            {
+                CharIter iterSegment = iterTry;
+                if (MatchLeftmost(source, iterSegment, pattern, lastSegment, NULL))
+                {
+                    found = true;
+                    iterFound = iterSegment;
+                }
+                if (_stringEnd(iterTry, source))
+                {
+                    break;
+                }
+            }
+            iterSource = iterFound;
+            return found;
+        }
+
+        /// @brief Matches the source to the pattern with the stars taking as little as they can
+        /// @param source The source string to match
+        /// @param iterSource The current position of the source, to return where the pattern is consumed
+        /// @param pattern The pattern to match against
+        /// @param token The current token of the pattern
+        /// @param stop The token to stop at as if it were the end or NULL
+        /// @return true if the matching is successful
+        /// @remarks Only the last star is ever gone back to, each time taking one more character (the two-pointer
+        ///          algorithm), which is enough since the segment after an earlier star can stay where it fits
+        ///          first; the parentheses are skipped
+        template <class TPattern>
+        bool MatchLeftmost(StringRef source, CharIter &iterSource, TPattern &pattern,
+            const typename TPattern::Token *token, const typename TPattern::Token *stop)
+        {
+            typedef typename TPattern::Token Token;
+            const Token *starRest = NULL;
+            CharIter iterStarSource = iterSource;
+            const typename TPattern::LiteralString *literal = NULL;
+            for (;;)
+            {
+                if (token == stop || token->Type == Token::Kind::End)
+                {
+                    return true;
+                }
+                if (token->Type == Token::Kind::Star)
+                {
+                    // the positions before the next occurrence of the literal can't be where the segment starts
+                    literal = &pattern.GetStarLiteral(*token);
+                    if (!SeekLiteral(source, iterSource, *literal))
                     {
                         return false;
                     }
-                    ++iterPattern;
-                    ++iterSource;
+                    starRest = ++token;
+                    iterStarSource = iterSource;
                     continue;
                 }
-                else if (*iterPattern == '(')
+                if (token->Type == Token::Kind::Open || token->Type == Token::Kind::Close)
                 {
-                    int index = pattern.PatternIterToIndex(iterPattern);
-                    matchResult.Open(index, iterSource);
-                    ++iterPattern;
+                    ++token;
                     continue;
                 }
-                else if (*iterPattern == ')')
+
+                if (!_stringEnd(iterSource, source) && (token->Type == Token::Kind::AnyChar
+                    || (token->Type == Token::Kind::Literal && *iterSource == token->Char)
+                    || (token->Type == Token::Kind::Class && pattern.GetClass(*token).Contains(*iterSource))))
                 {
-                    int index = pattern.PatternIterToIndex(iterPattern);
-                    matchResult.Close(index, iterSource);
-                    ++iterPattern;
+                    ++token;
+                    ++iterSource;
                     continue;
                 }
-                
-                if (!_stringEnd(iterSource, source) && *iterPattern == *iterSource)
+
+                if (starRest == NULL || _stringEnd(iterStarSource, source))
                 {
-                    ++iterPattern;
-                    ++iterSource;
+                    return false;
                 }
-                else
+                ++iterStarSource;
+                if (!SeekLiteral(source, iterStarSource, *literal))
                 {
                     return false;
                 }
+                token = starRest;
+                iterSource = iterStarSource;
             }
-            return true;
         }
     };
+
+    /// @brief A pattern given by a span, which doesn't have to be zero-terminated
+    typedef Pattern<CharSpan, CharSpan, const char*>    SpanPattern;
+
+    /// @brief The traits of a matcher of spans
+    typedef MatcherTraits<CharSpan, const char*>        SpanMatcherTraits;
+
+    /// @brief A matcher of sources given by spans, which don't have to be zero-terminated
+    typedef Matcher<SpanMatcherTraits>                  SpanMatcher;
 }}}
 
 #endif
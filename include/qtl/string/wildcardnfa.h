@@ -0,0 +1,691 @@
+#if !defined (_WILDCARDNFA_H_)
+#define _WILDCARDNFA_H_
+
+#include <algorithm>
+#include <vector>
+#include "wildcard.h"
+
+namespace Qtl { namespace String { namespace Wildcard {
+
+    /// @brief A wildcard pattern compiled to a program of a nondeterministic automaton
+    /// @param TChar The type of the characters of the pattern
+    /// @remarks Each instruction is a state; the states are linked in the order of the pattern, a star state
+    ///          also loops on itself. Parenthesis states are epsilon transitions that record the position of the
+    ///          source as the backtracking Matcher does, with the same quotation indices.
+    template <class TChar=char>
+    class CompiledPattern
+    {
+    public:
+        /// @brief The type of the characters of the pattern
+        typedef TChar CharType;
+
+        /// @brief The kinds of instruction
+        struct Opcode
+        {
+            enum Enum
+            {
+                Literal,    ///< consumes the character of the instruction
+                AnyChar,    ///< consumes any character ('?')
+                Class,      ///< consumes a character of the class of the instruction ('[...]')
+                Star,       ///< consumes any character and stays or moves on without consuming ('*')
+                Open,       ///< records the beginning of a quotation ('(')
+                Close,      ///< records the end of a quotation (')')
+                Fail,       ///< matches nothing (a trailing escape character)
+                Accept      ///< the whole pattern has been consumed
+            };
+        };
+
+        /// @brief An instruction of the program
+        struct Instruction
+        {
+            /// @brief What the instruction does
+            typename Opcode::Enum Op;
+
+            /// @brief The character a literal instruction consumes
+            TChar Char;
+
+            /// @brief The quotation index of an open or close instruction or the class index of a class one
+            int Index;
+        };
+
+    private:
+        /// @brief The instructions, the last of which is the accepting one
+        std::vector<Instruction> _program;
+
+        /// @brief The character classes of the class instructions
+        std::vector<CharClass> _classes;
+
+        /// @brief The largest quotation index in the pattern
+        int _quoteCount;
+
+    public:
+        /// @brief Instantiates a program that accepts anything
+        CompiledPattern() : _quoteCount(0)
+        {
+            Append(Opcode::Accept, 0, 0);
+        }
+
+        /// @brief Instantiates a program compiled from a pattern
+        /// @param pattern The pattern to compile
+        template <class TPattern>
+        explicit CompiledPattern(TPattern &pattern) : _quoteCount(0)
+        {
+            Compile(pattern);
+        }
+
+    public:
+        /// @brief Compiles a pattern replacing the current program
+        /// @param pattern The pattern to compile
+        template <class TPattern>
+        void Compile(TPattern &pattern)
+        {
+            typedef typename TPattern::Token Token;
+            _program.clear();
+            _classes.clear();
+            _quoteCount = pattern.GetQuoteCount();
+            // the tokens map one to one, the indices already resolved and the stray parentheses dropped
+            for (const Token *token = pattern.GetTokens(); ; ++token)
+            {
+                switch (token->Type)
+                {
+                case Token::Kind::Literal:
+                    Append(Opcode::Literal, token->Char, 0);
+                    break;
+                case Token::Kind::AnyChar:
+                    Append(Opcode::AnyChar, 0, 0);
+                    break;
+                case Token::Kind::Class:
+                    Append(Opcode::Class, 0, (int)_classes.size());
+                    _classes.push_back(pattern.GetClass(*token));
+                    break;
+                case Token::Kind::Star:
+                    Append(Opcode::Star, 0, 0);
+                    break;
+                case Token::Kind::Open:
+                    Append(Opcode::Open, 0, token->Index);
+                    break;
+                case Token::Kind::Close:
+                    Append(Opcode::Close, 0, token->Index);
+                    break;
+                case Token::Kind::Fail:
+                    // the backtracking matcher never gets past a trailing escape character either
+                    Append(Opcode::Fail, 0, 0);
+                    break;
+                default:
+                    Append(Opcode::Accept, 0, 0);
+                    return;
+                }
+            }
+        }
+
+        /// @brief Returns an instruction
+        /// @param pc The index of the instruction
+        /// @return The instruction
+        const Instruction &operator[](int pc) const
+        {
+            return _program[pc];
+        }
+
+        /// @brief Returns the character class of a class instruction
+        /// @param instruction The instruction
+        /// @return The class
+        const CharClass &GetClass(const Instruction &instruction) const
+        {
+            return _classes[instruction.Index];
+        }
+
+        /// @brief Returns the number of instructions including the accepting one
+        /// @return The number of instructions
+        int GetSize() const
+        {
+            return (int)_program.size();
+        }
+
+        /// @brief Returns the largest quotation index, which is the number of quotations in a well formed pattern
+        /// @return The index
+        int GetQuoteCount() const
+        {
+            return _quoteCount;
+        }
+
+    private:
+        /// @brief Appends an instruction
+        /// @param op What the instruction does
+        /// @param ch The character of a literal instruction
+        /// @param index The quotation index of an open or close instruction
+        void Append(typename Opcode::Enum op, TChar ch, int index)
+        {
+            Instruction instruction;
+            instruction.Op = op;
+            instruction.Char = ch;
+            instruction.Index = index;
+            _program.push_back(instruction);
+        }
+    };
+
+    /// @brief The paths a Pike VM advances through a compiled pattern together
+    /// @param TPosition The type of the source positions the quotations are recorded with
+    /// @remarks The paths are kept in the order the backtracking Matcher would try them (a star consumes before
+    ///          it moves on) and a path that reaches the accepting state cuts off the paths of lower priority, so
+    ///          the last accepted path gives the same result as the backtracking matching. Positions are only
+    ///          copied, so they can be iterators into the source or offsets of a stream alike.
+    template <class TPosition>
+    class NfaPathSet
+    {
+    public:
+        /// @brief The type of the source positions
+        typedef TPosition Position;
+
+    private:
+        /// @brief The paths alive at a source position in the order of priority
+        struct ThreadList
+        {
+            /// @brief The states of the paths
+            std::vector<int> Pcs;
+
+            /// @brief The recorded quotation positions of the paths, one run of slots per path
+            std::vector<Position> Slots;
+
+            /// @brief The number of paths
+            int Count;
+        };
+
+        /// @brief A recorded position to restore once the epsilon transitions have been followed
+        struct Undo
+        {
+            int Slot;
+            Position Saved;
+        };
+
+    private:
+        /// @brief The paths at the current and the next source positions
+        ThreadList          _lists[2];
+
+        /// @brief The index in _lists of the paths at the current position
+        int                 _current;
+
+        /// @brief The generation at which each state was last added to a list
+        std::vector<unsigned int> _visited;
+
+        /// @brief The current generation
+        unsigned int        _generation;
+
+        /// @brief The quotation positions of the path being followed
+        std::vector<Position> _slots;
+
+        /// @brief The quotation positions of the last accepted path
+        std::vector<Position> _matchedSlots;
+
+        /// @brief The positions to restore after following the epsilon transitions
+        std::vector<Undo>   _undo;
+
+        /// @brief The number of slots per path
+        int                 _slotCount;
+
+    public:
+        /// @brief Instantiates a set with no paths
+        NfaPathSet() : _current(0), _generation(0), _slotCount(0)
+        {
+            _lists[0].Count = 0;
+            _lists[1].Count = 0;
+        }
+
+    public:
+        /// @brief Starts the paths at the beginning of a source
+        /// @param compiled The program
+        /// @param position The position of the beginning of the source
+        /// @param unset The position of a quotation boundary that hasn't been reached
+        template <class TChar>
+        void Start(const CompiledPattern<TChar> &compiled, Position position, Position unset)
+        {
+            Prepare(compiled.GetSize(), compiled.GetQuoteCount());
+            _current = 0;
+            _lists[0].Count = 0;
+            NextGeneration();
+            _slots.assign(_slotCount, unset);
+            _matchedSlots.assign(_slotCount, unset);
+            Follow(_lists[0], compiled, 0, position);
+        }
+
+        /// @brief Advances the paths over a character of the source
+        /// @param compiled The program
+        /// @param ch The character or NULL at the end of the source
+        /// @param position The position of the character
+        /// @param nextPosition The position after the character
+        /// @return true if a path accepts before the character, in which case its quotations are kept and the
+        ///         paths of lower priority are dropped
+        /// @remarks No path is left at the end of the source
+        template <class TChar>
+        bool Step(const CompiledPattern<TChar> &compiled, const TChar *ch, Position position, Position nextPosition)
+        {
+            typedef CompiledPattern<TChar> Program;
+            typedef typename Program::Instruction Instruction;
+
+            ThreadList &current = _lists[_current];
+            ThreadList &next = _lists[1 - _current];
+            next.Count = 0;
+            NextGeneration();
+
+            bool accepted = false;
+            for (int i = 0; i < current.Count; i++)
+            {
+                int pc = current.Pcs[i];
+                const Instruction &instruction = compiled[pc];
+                if (instruction.Op == Program::Opcode::Accept)
+                {
+                    // the paths after this one would have been tried only if it had failed
+                    accepted = true;
+                    _matchedSlots.assign(current.Slots.begin() + i * _slotCount,
+                        current.Slots.begin() + (i + 1) * _slotCount);
+                    break;
+                }
+                if (ch == NULL)
+                {
+                    continue;
+                }
+
+                int target;
+                switch (instruction.Op)
+                {
+                case Program::Opcode::Literal:
+                    if (!(*ch == instruction.Char))
+                    {
+                        continue;
+                    }
+                    target = pc + 1;
+                    break;
+                case Program::Opcode::AnyChar:
+                    target = pc + 1;
+                    break;
+                case Program::Opcode::Class:
+                    if (!compiled.GetClass(instruction).Contains(*ch))
+                    {
+                        continue;
+                    }
+                    target = pc + 1;
+                    break;
+                case Program::Opcode::Star:
+                    target = pc;
+                    break;
+                default:
+                    continue;
+                }
+                _slots.assign(current.Slots.begin() + i * _slotCount,
+                    current.Slots.begin() + (i + 1) * _slotCount);
+                Follow(next, compiled, target, nextPosition);
+            }
+            current.Count = 0;
+            _current = 1 - _current;
+            return accepted;
+        }
+
+        /// @brief Returns the number of paths alive
+        /// @return The number of paths
+        int GetCount() const
+        {
+            return _lists[_current].Count;
+        }
+
+        /// @brief Returns a quotation position of the last accepted path
+        /// @param slot The index of the quotation times 2, plus 1 for its end
+        /// @return The position
+        Position GetMatchedSlot(int slot) const
+        {
+            return _matchedSlots[slot];
+        }
+
+    private:
+        /// @brief Sizes the scratch memory for a program
+        /// @param programSize The number of instructions
+        /// @param quoteCount The largest quotation index
+        void Prepare(int programSize, int quoteCount)
+        {
+            _slotCount = (quoteCount + 1) * 2;
+            if ((int)_visited.size() < programSize)
+            {
+                _visited.resize(programSize, 0);
+            }
+            for (int i = 0; i < 2; i++)
+            {
+                // a state is in a list at most once
+                if ((int)_lists[i].Pcs.size() < programSize)
+                {
+                    _lists[i].Pcs.resize(programSize);
+                }
+                if ((int)_lists[i].Slots.size() < programSize * _slotCount)
+                {
+                    _lists[i].Slots.resize(programSize * _slotCount);
+                }
+            }
+        }
+
+        /// @brief Starts a new generation of the visited states
+        void NextGeneration()
+        {
+            if (++_generation == 0)
+            {
+                std::fill(_visited.begin(), _visited.end(), 0);
+                _generation = 1;
+            }
+        }
+
+        /// @brief Adds the path in _slots to a list at a state and at the states reachable from it without
+        ///        consuming a character
+        /// @param list The list to add to
+        /// @param compiled The program
+        /// @param pc The state
+        /// @param position The source position the states are reached at
+        /// @remarks The epsilon transitions form a chain, so no state branches into more than one new path;
+        ///          a state already in the list has been reached by a path of higher priority
+        template <class TChar>
+        void Follow(ThreadList &list, const CompiledPattern<TChar> &compiled, int pc, Position position)
+        {
+            typedef CompiledPattern<TChar> Program;
+
+            _undo.clear();
+            for (;;)
+            {
+                if (_visited[pc] == _generation)
+                {
+                    break;
+                }
+                _visited[pc] = _generation;
+                const typename Program::Instruction &instruction = compiled[pc];
+                if (instruction.Op == Program::Opcode::Open || instruction.Op == Program::Opcode::Close)
+                {
+                    Undo undo;
+                    undo.Slot = instruction.Index * 2 + (instruction.Op == Program::Opcode::Close? 1 : 0);
+                    undo.Saved = _slots[undo.Slot];
+                    _undo.push_back(undo);
+                    _slots[undo.Slot] = position;
+                    ++pc;
+                    continue;
+                }
+                Push(list, pc);
+                if (instruction.Op != Program::Opcode::Star)
+                {
+                    break;
+                }
+                // a star also moves on without consuming, with lower priority than consuming
+                ++pc;
+            }
+            for (size_t i = _undo.size(); i > 0; i--)
+            {
+                _slots[_undo[i - 1].Slot] = _undo[i - 1].Saved;
+            }
+        }
+
+        /// @brief Appends the path in _slots to a list
+        /// @param list The list
+        /// @param pc The state of the path
+        void Push(ThreadList &list, int pc)
+        {
+            list.Pcs[list.Count] = pc;
+            std::copy(_slots.begin(), _slots.end(), list.Slots.begin() + list.Count * _slotCount);
+            list.Count++;
+        }
+    };
+
+    /// @brief A wildcard string matcher that simulates the automaton of a compiled pattern (Pike VM)
+    /// @remarks All the candidate paths are advanced together one source character at a time and the paths
+    ///          that reach the same state are merged, so matching takes O(n*m) time for a source of n characters
+    ///          and a pattern of m, whereas the backtracking Matcher is exponential in the number of stars in the
+    ///          worst case. The paths are kept in the order the backtracking Matcher would try them, so the
+    ///          result, the quotations included, is the same as the backtracking one. The matcher keeps its
+    ///          scratch memory between calls; an instance is not to be shared by threads.
+    template <class Traits = MatcherTraits<> >
+    class NfaMatcher
+    {
+    public:
+        /// @brief The type of the reference to the source string
+        typedef typename Traits::StringRef          StringRef;
+        /// @brief The type of iterator through the characters in the source string
+        typedef typename Traits::CharIter           CharIter;
+
+        /// @brief The type of the match result data structure
+        typedef typename Traits::MatchResultType    MatchResultType;
+
+        /// @brief The type of the reference to the match result
+        typedef typename Traits::MatchResultRef     MatchResultRef;
+
+        /// @brief The type of the functor that returns the beginning of a string
+        typedef typename Traits::StringBeginFunctor StringBeginFunctor;
+        /// @brief The type of the functor that determines if an iterator is at the end of a string
+        typedef typename Traits::StringEndFunctor   StringEndFunctor;
+
+    private:
+        /// @brief The functor that returns the beginning of a string
+        StringBeginFunctor  _stringBegin;
+
+        /// @brief The functor that determines if an iterator is at the end of a string
+        StringEndFunctor    _stringEnd;
+
+        /// @brief The paths through the pattern
+        NfaPathSet<CharIter> _paths;
+
+    public:
+        /// @brief Instantiates a matcher with the specified string functor instances
+        /// @param stringBegin The functor that returns the beginning of a string
+        /// @param stringEnd The functor that determines if an iterator is at the end of a string
+        NfaMatcher(StringBeginFunctor &stringBegin, StringEndFunctor &stringEnd)
+            : _stringBegin(stringBegin), _stringEnd(stringEnd)
+        {
+        }
+
+        /// @brief Instantiates a matcher with default settings
+        NfaMatcher()
+        {
+        }
+
+    public:
+        /// @brief Matches the source to a compiled pattern
+        /// @param source The source string to match
+        /// @param compiled The compiled pattern to match against
+        /// @param matchResult The container of matched quotation entries. Note the first entry
+        ///        refers to the entire match
+        /// @return true if the matching is successful (the pattern is completely consumed)
+        /// @remarks As with Matcher the source only has to start with a match of the pattern
+        template <class TChar>
+        bool Match(StringRef source, const CompiledPattern<TChar> &compiled, MatchResultRef matchResult)
+        {
+            CharIter iterSource = _stringBegin(source);
+            CharIter iterBegin = iterSource;
+            CharIter iterEnd = iterSource;
+            bool matched = false;
+
+            // like the entries of MatchResult, a quotation that never gets closed is left value-initialised
+            _paths.Start(compiled, iterSource, CharIter());
+            while (_paths.GetCount() > 0)
+            {
+                bool atEnd = _stringEnd(iterSource, source);
+                TChar ch = atEnd? TChar() : *iterSource;
+                CharIter iterNext = iterSource;
+                if (!atEnd)
+                {
+                    ++iterNext;
+                }
+                if (_paths.Step(compiled, atEnd? (const TChar*)NULL : &ch, iterSource, iterNext))
+                {
+                    matched = true;
+                    iterEnd = iterSource;
+                }
+                if (atEnd)
+                {
+                    break;
+                }
+                iterSource = iterNext;
+            }
+
+            matchResult.Reset(compiled.GetQuoteCount(), iterBegin);
+            if (!matched)
+            {
+                return false;
+            }
+            matchResult.Matches[0].End = iterEnd;
+            for (int i = 1; i <= compiled.GetQuoteCount(); i++)
+            {
+                matchResult.Open(i, _paths.GetMatchedSlot(i * 2));
+                matchResult.Close(i, _paths.GetMatchedSlot(i * 2 + 1));
+            }
+            return true;
+        }
+    };
+
+    /// @brief A wildcard matcher that takes the source in chunks, as it arrives, and keeps its state in between
+    /// @param TChar The type of the characters of the source and the pattern
+    /// @param TMatchResult The type of the match result, whose positions are the offsets of the characters
+    ///        from the beginning of the stream
+    /// @remarks The chunks are run through the automaton of NfaMatcher, so nothing of a chunk is kept once it's
+    ///          fed and the result is the same as matching the whole source at once. The source only has to
+    ///          start with a match of the pattern, so the matching is over as soon as no path is left, which
+    ///          Feed() tells, and the rest of the stream need not be fed. A match found while paths of higher
+    ///          priority are still alive can yet be replaced by a longer one; Finish() ends the stream.
+    template <class TChar=char, class TMatchResult=MatchResult<size_t> >
+    class StreamMatcher
+    {
+    public:
+        /// @brief The type of the offsets in the stream
+        typedef typename TMatchResult::CharIter Offset;
+
+        /// @brief The type of the match result data structure
+        typedef TMatchResult MatchResultType;
+
+        /// @brief The type of the reference to the match result
+        typedef TMatchResult &MatchResultRef;
+
+        /// @brief The states of the matching
+        struct Status
+        {
+            enum Enum
+            {
+                Running,    ///< more of the stream can change the result
+                Matched,    ///< the stream starts with a match and no more of it can change the match
+                Failed      ///< the stream doesn't start with a match
+            };
+        };
+
+        /// @brief The offset of a quotation boundary that the match never reached
+        static Offset GetNoOffset()
+        {
+            return (Offset)-1;
+        }
+
+    private:
+        /// @brief The compiled pattern
+        const CompiledPattern<TChar> *_compiled;
+
+        /// @brief The paths through the pattern
+        NfaPathSet<Offset> _paths;
+
+        /// @brief The offset in the stream of the next character to feed
+        Offset _offset;
+
+        /// @brief The offset where the stream begins
+        Offset _begin;
+
+        /// @brief The end of the last match found or GetNoOffset() if none is found
+        Offset _matchEnd;
+
+        /// @brief The state of the matching
+        typename Status::Enum _status;
+
+    public:
+        /// @brief Instantiates a matcher at the beginning of a stream
+        /// @param compiled The compiled pattern, which has to outlive the matcher
+        /// @param offset The offset of the beginning of the stream
+        explicit StreamMatcher(const CompiledPattern<TChar> &compiled, Offset offset=0) : _compiled(&compiled)
+        {
+            Reset(offset);
+        }
+
+    public:
+        /// @brief Starts matching a new stream
+        /// @param offset The offset of the beginning of the stream
+        void Reset(Offset offset=0)
+        {
+            _offset = offset;
+            _begin = offset;
+            _matchEnd = GetNoOffset();
+            _status = Status::Running;
+            _paths.Start(*_compiled, offset, GetNoOffset());
+        }
+
+        /// @brief Feeds the next chunk of the stream
+        /// @param data The characters of the chunk
+        /// @param length The number of characters
+        /// @return The state of the matching, which stops taking characters once it's over
+        typename Status::Enum Feed(const TChar *data, size_t length)
+        {
+            const TChar *end = data + length;
+            for (const TChar *iter = data; iter != end && _paths.GetCount() > 0; ++iter)
+            {
+                if (_paths.Step(*_compiled, iter, _offset, _offset + 1))
+                {
+                    _matchEnd = _offset;
+                }
+                ++_offset;
+            }
+            return Update();
+        }
+
+        /// @brief Ends the stream
+        /// @return The state of the matching, which is over
+        typename Status::Enum Finish()
+        {
+            if (_paths.GetCount() > 0 && _paths.Step(*_compiled, (const TChar*)NULL, _offset, _offset))
+            {
+                _matchEnd = _offset;
+            }
+            return Update();
+        }
+
+        /// @brief Returns the state of the matching
+        /// @return The state
+        typename Status::Enum GetStatus() const
+        {
+            return _status;
+        }
+
+        /// @brief Returns the offset of the next character to feed
+        /// @return The offset, which stays where the matching was over
+        Offset GetOffset() const
+        {
+            return _offset;
+        }
+
+        /// @brief Returns the match found so far
+        /// @param matchResult The container of matched quotation entries with the offsets in the stream. Note
+        ///        the first entry refers to the entire match; the boundaries of quotations the match never
+        ///        reached are GetNoOffset()
+        /// @return true if a match has been found, which is final unless the status is Running
+        bool GetResult(MatchResultRef matchResult) const
+        {
+            matchResult.Reset(_compiled->GetQuoteCount(), _begin);
+            if (_matchEnd == GetNoOffset())
+            {
+                return false;
+            }
+            matchResult.Matches[0].End = _matchEnd;
+            for (int i = 1; i <= _compiled->GetQuoteCount(); i++)
+            {
+                matchResult.Open(i, _paths.GetMatchedSlot(i * 2));
+                matchResult.Close(i, _paths.GetMatchedSlot(i * 2 + 1));
+            }
+            return true;
+        }
+
+    private:
+        /// @brief Updates the state of the matching after characters are fed
+        /// @return The state
+        typename Status::Enum Update()
+        {
+            if (_paths.GetCount() == 0)
+            {
+                _status = (_matchEnd != GetNoOffset())? Status::Matched : Status::Failed;
+            }
+            return _status;
+        }
+    };
+}}}
+
+#endif
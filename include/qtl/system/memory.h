@@ -0,0 +1,362 @@
+#if !defined(_MEMORY_H_)
+#define _MEMORY_H_
+
+#include <cstddef>
+#include <cstdio>
+#include "system.h"
+
+#if _QTL_OS_UNIX
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   if _QTL_OS_LINUX
+#      include <sys/syscall.h>
+#   endif
+#elif _QTL_OS_WINDOWS
+#   include <Windows.h>
+#endif
+
+namespace Qtl { namespace System { namespace Memory {
+
+/// @brief The size of the huge pages asked for
+const size_t HugePageSize = 2 * 1024 * 1024;
+
+/// @brief The size of a cache line
+const size_t CacheLineSize = 64;
+
+/// @brief The kinds of memory a block can be backed with
+struct PageKind
+{
+	enum Enum
+	{
+		Heap,			///< the C heap
+		Normal,			///< pages of the normal size mapped for the block
+		TransparentHuge,	///< normal pages the kernel was advised to back with transparent huge pages
+		ExplicitHuge	///< huge pages reserved by the system for huge page mappings
+	};
+};
+
+/// @brief Returns the number of NUMA nodes of the machine
+/// @return The number of nodes, which is 1 if the machine is not NUMA or it cannot be told
+inline int GetNumaNodeCount()
+{
+#if _QTL_OS_LINUX
+	int count = 0;
+	for (;;)
+	{
+		char path[64];
+		struct stat st;
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", count);
+		if (stat(path, &st) != 0)
+		{
+			break;
+		}
+		count++;
+	}
+	return count > 0? count : 1;
+#elif _QTL_OS_WINDOWS
+	ULONG highest = 0;
+	if (!GetNumaHighestNodeNumber(&highest))
+	{
+		return 1;
+	}
+	return (int)highest + 1;
+#else
+	return 1;
+#endif
+}
+
+#if _QTL_OS_LINUX && defined(SYS_mbind)
+/// @brief Binds pages to the memory of a NUMA node on a best effort basis
+/// @param p The first page
+/// @param size The number of bytes
+/// @param numaNode The node or -1 for no binding
+inline void BindPages(void *p, size_t size, int numaNode)
+{
+	if (numaNode >= 0 && numaNode < (int)(sizeof(unsigned long) * 8))
+	{
+		// MPOL_BIND from <numaif.h> which is not necessarily installed
+		const int mpolBind = 2;
+		unsigned long nodeMask = 1UL << numaNode;
+		syscall(SYS_mbind, p, size, mpolBind, &nodeMask, sizeof(nodeMask) * 8, 0);
+	}
+}
+#endif
+
+/// @brief Allocates whole pages, preferably from the memory of the specified NUMA node
+/// @param size The number of bytes to allocate
+/// @param numaNode The node to bind the pages to or -1 for no binding
+/// @return The zero-filled pages or NULL if out of memory
+/// @remarks Binding is best effort, the pages are still returned if the node cannot be bound to
+inline void *AllocatePages(size_t size, int numaNode)
+{
+#if _QTL_OS_UNIX
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		return NULL;
+	}
+#   if _QTL_OS_LINUX && defined(SYS_mbind)
+	BindPages(p, size, numaNode);
+#   else
+	(void)numaNode;
+#   endif
+	return p;
+#elif _QTL_OS_WINDOWS
+	if (numaNode >= 0)
+	{
+		void *p = VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT,
+			PAGE_READWRITE, (DWORD)numaNode);
+		if (p != NULL)
+		{
+			return p;
+		}
+	}
+	return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#endif
+}
+
+/// @brief Frees the pages allocated by AllocatePages()
+/// @param p The pages
+/// @param size The number of bytes they were allocated with
+inline void FreePages(void *p, size_t size)
+{
+	if (p == NULL)
+	{
+		return;
+	}
+#if _QTL_OS_UNIX
+	munmap(p, size);
+#elif _QTL_OS_WINDOWS
+	(void)size;
+	VirtualFree(p, 0, MEM_RELEASE);
+#endif
+}
+
+/// @brief Allocates memory backed by huge pages if the system can provide them or by normal pages if not
+/// @param size The number of bytes to allocate
+/// @param numaNode The NUMA node to bind the pages to or -1 for no binding
+/// @param mappedSize To return the number of bytes mapped, which is to be passed to FreePages()
+/// @param kind To return the kind of pages the memory is backed with
+/// @return The zero-filled memory aligned to a huge page if huge pages are used, or NULL if out of memory
+/// @remarks Pages from the reserved huge page pool are tried first, then normal pages aligned to the huge
+///          page size and advised to be backed by transparent huge pages
+inline void *AllocateHugePages(size_t size, int numaNode, size_t &mappedSize, PageKind::Enum &kind)
+{
+	mappedSize = (size + HugePageSize - 1) / HugePageSize * HugePageSize;
+#if _QTL_OS_LINUX
+#   if defined(MAP_HUGETLB)
+	void *p = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+	{
+#      if defined(SYS_mbind)
+		BindPages(p, mappedSize, numaNode);
+#      endif
+		kind = PageKind::ExplicitHuge;
+		return p;
+	}
+#   endif
+	// over-allocates to trim the mapping to a huge page boundary
+	char *raw = (char*)mmap(NULL, mappedSize + HugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+		-1, 0);
+	if (raw == (char*)MAP_FAILED)
+	{
+		return NULL;
+	}
+	char *aligned = (char*)(((size_t)raw + HugePageSize - 1) / HugePageSize * HugePageSize);
+	if (aligned != raw)
+	{
+		munmap(raw, aligned - raw);
+	}
+	size_t tail = (raw + mappedSize + HugePageSize) - (aligned + mappedSize);
+	if (tail > 0)
+	{
+		munmap(aligned + mappedSize, tail);
+	}
+	kind = PageKind::Normal;
+#   if defined(MADV_HUGEPAGE)
+	if (madvise(aligned, mappedSize, MADV_HUGEPAGE) == 0)
+	{
+		kind = PageKind::TransparentHuge;
+	}
+#   endif
+#   if defined(SYS_mbind)
+	BindPages(aligned, mappedSize, numaNode);
+#   endif
+	return aligned;
+#elif _QTL_OS_WINDOWS
+	SIZE_T largePage = GetLargePageMinimum();
+	if (largePage != 0)
+	{
+		size_t largeSize = (size + largePage - 1) / largePage * largePage;
+		void *p = VirtualAlloc(NULL, largeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (p != NULL)
+		{
+			mappedSize = largeSize;
+			kind = PageKind::ExplicitHuge;
+			return p;
+		}
+	}
+	kind = PageKind::Normal;
+	return AllocatePages(mappedSize, numaNode);
+#else
+	kind = PageKind::Normal;
+	return AllocatePages(mappedSize, numaNode);
+#endif
+}
+
+/// @brief A file mapped into memory for reading
+/// @remarks The whole file is mapped read-only at once, so the pages are only read in as they are touched and
+///          nothing is copied. An empty file maps to no data.
+class MappedFile
+{
+private:
+	/// @brief The first byte of the file or NULL
+	const char *_data;
+
+	/// @brief The number of bytes of the file
+	size_t _size;
+
+#if _QTL_OS_WINDOWS
+	/// @brief The handle to the file
+	HANDLE _file;
+
+	/// @brief The handle to the mapping of the file
+	HANDLE _mapping;
+#endif
+
+public:
+	/// @brief Instantiates an object with no file mapped
+	MappedFile() : _data(NULL), _size(0)
+#if _QTL_OS_WINDOWS
+		, _file(INVALID_HANDLE_VALUE), _mapping(NULL)
+#endif
+	{
+	}
+
+	/// @brief Unmaps the file
+	~MappedFile()
+	{
+		Close();
+	}
+
+private:
+	/// @brief Disallows copying
+	MappedFile(const MappedFile &);
+
+	/// @brief Disallows assignment
+	MappedFile &operator=(const MappedFile &);
+
+public:
+	/// @brief Maps a file, unmapping the one mapped before
+	/// @param path The path of the file
+	/// @return false if the file cannot be opened or mapped
+	/// @remarks The kernel is advised that the file is to be read sequentially
+	bool Open(const char *path)
+	{
+		Close();
+#if _QTL_OS_UNIX
+		int fd = open(path, O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			close(fd);
+			return false;
+		}
+		_size = (size_t)st.st_size;
+		if (_size > 0)
+		{
+			void *p = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED)
+			{
+				close(fd);
+				_size = 0;
+				return false;
+			}
+#   if defined(MADV_SEQUENTIAL)
+			madvise(p, _size, MADV_SEQUENTIAL);
+#   endif
+			_data = (const char*)p;
+		}
+		// the mapping keeps the file referenced
+		close(fd);
+		return true;
+#elif _QTL_OS_WINDOWS
+		_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+			NULL);
+		if (_file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(_file, &size))
+		{
+			Close();
+			return false;
+		}
+		_size = (size_t)size.QuadPart;
+		if (_size > 0)
+		{
+			_mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+			_data = (_mapping != NULL)? (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+			if (_data == NULL)
+			{
+				Close();
+				return false;
+			}
+		}
+		return true;
+#endif
+	}
+
+	/// @brief Unmaps the file if one is mapped
+	void Close()
+	{
+#if _QTL_OS_UNIX
+		if (_data != NULL)
+		{
+			munmap((void*)_data, _size);
+		}
+#elif _QTL_OS_WINDOWS
+		if (_data != NULL)
+		{
+			UnmapViewOfFile(_data);
+		}
+		if (_mapping != NULL)
+		{
+			CloseHandle(_mapping);
+			_mapping = NULL;
+		}
+		if (_file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(_file);
+			_file = INVALID_HANDLE_VALUE;
+		}
+#endif
+		_data = NULL;
+		_size = 0;
+	}
+
+	/// @brief Returns the content of the file
+	/// @return The first byte or NULL if the file is empty or none is mapped
+	const char *GetData() const
+	{
+		return _data;
+	}
+
+	/// @brief Returns the size of the file
+	/// @return The number of bytes
+	size_t GetSize() const
+	{
+		return _size;
+	}
+};
+
+}}}
+
+#endif
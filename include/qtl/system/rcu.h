@@ -0,0 +1,408 @@
+#if !defined(_RCU_H_)
+#define _RCU_H_
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include "system.h"
+#include "threading.h"
+
+namespace Qtl { namespace System { namespace Rcu {
+
+/// @brief A quiescent-state-based reclamation (QSBR) domain
+/// @remarks Readers register once and then announce quiescent states, points where they hold no
+///          references to shared objects, e.g. between two requests. In between they read the shared
+///          structures without any locking and without writing anything but their own reader slot at
+///          the quiescent states. Writers unlink objects and retire them to the domain, which reclaims
+///          each of them once every online reader has gone through a quiescent state after it was retired.
+///          A reader that is about to block for long should go offline so that it does not hold up
+///          reclamation. Threads that are not registered read in read sections instead, which count them
+///          on striped counters of the current phase; a phase is over once its counters drop to zero and
+///          an object is reclaimed after the sections of the phase it was retired in and of the one before
+///          have ended, as well as the grace period of the registered readers.
+class QsbrDomain
+{
+public:
+	/// @brief The function that frees a retired object
+	/// @param object The object
+	/// @param context The context given when the object was retired
+	typedef void (*ReclaimFunction)(void *object, void *context);
+
+	/// @brief The slot of a registered reader
+	class Reader
+	{
+	private:
+		friend class QsbrDomain;
+
+		/// @brief The last epoch the reader has observed at a quiescent state or 0 if it is offline
+		volatile unsigned long long _epoch;
+
+		/// @brief Keeps the slots of the readers on separate cache lines
+		char _padding[64 - sizeof(unsigned long long)];
+
+		/// @brief Instantiates a reader slot
+		Reader() : _epoch(0)
+		{
+		}
+	};
+
+	/// @brief The number of retirements after which the retiring writer tries to reclaim
+	static const int ReclaimBatch = 64;
+
+	/// @brief The number of stripes the counters of the read sections are spread over
+	static const int SectionStripes = 16;
+
+private:
+	/// @brief An object waiting for a grace period
+	struct RetiredObject
+	{
+		void *Object;
+		ReclaimFunction Reclaim;
+		void *Context;
+		unsigned long long Epoch;
+		unsigned long long SectionEpoch;
+	};
+
+	/// @brief A counter padded to a cache line so that the stripes don't share one
+	struct PaddedCounter
+	{
+		volatile long Value;
+		char Padding[64 - sizeof(long)];
+	};
+
+	/// @brief The global epoch, advanced by every retirement
+	volatile unsigned long long _epoch;
+
+	/// @brief The registered readers
+	std::vector<Reader*> _readers;
+
+	/// @brief The objects waiting for a grace period in the order they were retired, which is the order of
+	///        their epochs, so the ones whose grace periods have elapsed are at the front
+	std::deque<RetiredObject> _retired;
+
+	/// @brief The number of retirements since the last attempt to reclaim
+	int _retiredSinceReclaim;
+
+	/// @brief The counters of the read sections of the two phases, striped by the hints of the readers
+	PaddedCounter _sections[2][SectionStripes];
+
+	/// @brief The number of times the read sections have moved on to the next phase, whose parity is the
+	///        phase new sections are counted in
+	volatile unsigned long long _sectionEpoch;
+
+	/// @brief The section epoch up to which all the read sections have ended
+	unsigned long long _drainedEpoch;
+
+	/// @brief The mutex that protects the readers and the retired objects
+	mutable Qtl::System::Threading::Mutex _mutex;
+
+public:
+	/// @brief Instantiates a domain
+	QsbrDomain() : _epoch(1), _retiredSinceReclaim(0), _sectionEpoch(1), _drainedEpoch(0)
+	{
+		for (int i = 0; i < SectionStripes; i++)
+		{
+			_sections[0][i].Value = 0;
+			_sections[1][i].Value = 0;
+		}
+	}
+
+	/// @brief Finalises the domain, reclaiming all the objects left
+	/// @remarks No reader can be accessing the shared structures at this point
+	~QsbrDomain()
+	{
+		for (size_t i = 0; i < _retired.size(); i++)
+		{
+			_retired[i].Reclaim(_retired[i].Object, _retired[i].Context);
+		}
+		for (size_t i = 0; i < _readers.size(); i++)
+		{
+			delete _readers[i];
+		}
+	}
+
+private:
+	/// @brief Disallows copying
+	QsbrDomain(const QsbrDomain &);
+
+	/// @brief Disallows assignment
+	QsbrDomain &operator=(const QsbrDomain &);
+
+public:
+	/// @brief Registers the calling thread as a reader, which starts online
+	/// @return The slot of the reader to pass to the other reader methods
+	Reader *RegisterReader()
+	{
+		Reader *reader = new Reader();
+		{
+			// lock
+			Qtl::System::Threading::LockGuard lock(_mutex);
+			_readers.push_back(reader);
+			// unlock
+		}
+		Online(reader);
+		return reader;
+	}
+
+	/// @brief Unregisters a reader
+	/// @param reader The slot returned by RegisterReader()
+	void UnregisterReader(Reader *reader)
+	{
+		{
+			// lock
+			Qtl::System::Threading::LockGuard lock(_mutex);
+			for (std::vector<Reader*>::iterator iter = _readers.begin(); iter != _readers.end(); ++iter)
+			{
+				if (*iter == reader)
+				{
+					_readers.erase(iter);
+					break;
+				}
+			}
+			// unlock
+		}
+		delete reader;
+	}
+
+	/// @brief Announces that the reader holds no references to shared objects
+	/// @param reader The slot of the reader
+	/// @remarks This only writes the reader's own slot
+	void QuiescentState(Reader *reader)
+	{
+		using namespace Qtl::System::Threading;
+		AtomicStoreRelease(&reader->_epoch, AtomicLoadAcquire(&_epoch));
+	}
+
+	/// @brief Takes the reader out of the grace period computation until it goes online again
+	/// @param reader The slot of the reader
+	void Offline(Reader *reader)
+	{
+		Qtl::System::Threading::AtomicStoreRelease(&reader->_epoch, 0ULL);
+	}
+
+	/// @brief Puts the reader back into the grace period computation before it reads shared objects again
+	/// @param reader The slot of the reader
+	void Online(Reader *reader)
+	{
+		using namespace Qtl::System::Threading;
+		AtomicStoreRelease(&reader->_epoch, AtomicLoadAcquire(&_epoch));
+		// the slot has to be visible to the writers before any shared object is read
+		AtomicFenceFull();
+	}
+
+	/// @brief Starts a read section of a thread that is not a registered reader
+	/// @param hint A number that spreads the sections over the counters, e.g. the key looked up
+	/// @return The phase to pass to ExitReadSection()
+	/// @remarks The objects read in the section stay valid until it ends. The thread must not call
+	///          Synchronize() in the section or it would wait for itself
+	int EnterReadSection(unsigned int hint)
+	{
+		using namespace Qtl::System::Threading;
+		int phase = (int)(AtomicLoadAcquire(&_sectionEpoch) & 1);
+		AtomicAdd(&_sections[phase][hint % SectionStripes].Value, 1L);
+		// the count has to be visible to the writers before any shared object is read
+		AtomicFenceFull();
+		return phase;
+	}
+
+	/// @brief Ends a read section
+	/// @param phase The phase returned by EnterReadSection()
+	/// @param hint The hint given to EnterReadSection()
+	void ExitReadSection(int phase, unsigned int hint)
+	{
+		Qtl::System::Threading::AtomicAdd(&_sections[phase][hint % SectionStripes].Value, -1L);
+	}
+
+	/// @brief Hands over an object that has been unlinked from the shared structures
+	/// @param object The object
+	/// @param reclaim The function to free the object with after the grace period
+	/// @param context The context to pass to the function
+	void Retire(void *object, ReclaimFunction reclaim, void *context)
+	{
+		RetireBatch(&object, 1, reclaim, context);
+	}
+
+	/// @brief Hands over objects that have been unlinked from the shared structures under one epoch
+	/// @param objects The objects
+	/// @param count The number of objects
+	/// @param reclaim The function to free each object with after the grace period
+	/// @param context The context to pass to the function
+	/// @remarks The lock is taken and the epoch advanced once for all the objects, e.g. the nodes of a
+	///          bulk deletion
+	template <class TObject>
+	void RetireBatch(TObject *const *objects, int count, ReclaimFunction reclaim, void *context)
+	{
+		if (count <= 0)
+		{
+			return;
+		}
+		bool reclaimNow;
+		{
+			// lock
+			Qtl::System::Threading::LockGuard lock(_mutex);
+			RetiredObject retired;
+			retired.Reclaim = reclaim;
+			retired.Context = context;
+			retired.Epoch = Qtl::System::Threading::AtomicAdd(&_epoch, 1ULL) - 1;
+			retired.SectionEpoch = _sectionEpoch;
+			for (int i = 0; i < count; i++)
+			{
+				retired.Object = (void*)objects[i];
+				_retired.push_back(retired);
+			}
+			_retiredSinceReclaim += count;
+			reclaimNow = (_retiredSinceReclaim >= ReclaimBatch);
+			// unlock
+		}
+		if (reclaimNow)
+		{
+			Reclaim();
+		}
+	}
+
+	/// @brief Reclaims the objects whose grace periods have elapsed without waiting
+	/// @return The number of objects reclaimed
+	/// @remarks Only the objects at the front whose grace periods have elapsed are looked at
+	int Reclaim()
+	{
+		std::vector<RetiredObject> ready;
+		{
+			// lock
+			Qtl::System::Threading::LockGuard lock(_mutex);
+			_retiredSinceReclaim = 0;
+			unsigned long long minEpoch = GetMinReaderEpoch();
+			// the objects retired in the current phase wait for the sections of the previous one as well
+			for (int i = 0; i < 3 && !_retired.empty() && _drainedEpoch < _retired.back().SectionEpoch + 2; i++)
+			{
+				if (!AdvanceSections())
+				{
+					break;
+				}
+			}
+			while (!_retired.empty() && _retired.front().Epoch < minEpoch
+				&& _retired.front().SectionEpoch + 2 <= _drainedEpoch)
+			{
+				ready.push_back(_retired.front());
+				_retired.pop_front();
+			}
+			// unlock
+		}
+		for (size_t i = 0; i < ready.size(); i++)
+		{
+			ready[i].Reclaim(ready[i].Object, ready[i].Context);
+		}
+		return (int)ready.size();
+	}
+
+	/// @brief Waits for a grace period and reclaims all the objects retired before the call
+	/// @remarks The calling thread must not be an online reader of this domain or it would wait for itself
+	void Synchronize()
+	{
+		unsigned long long target = Qtl::System::Threading::AtomicAdd(&_epoch, 1ULL);
+		unsigned long long sectionTarget = Qtl::System::Threading::AtomicLoadAcquire(&_sectionEpoch) + 2;
+		for (;;)
+		{
+			{
+				// lock
+				Qtl::System::Threading::LockGuard lock(_mutex);
+				while (_drainedEpoch < sectionTarget && AdvanceSections())
+				{
+				}
+				if (GetMinReaderEpoch() >= target && _drainedEpoch >= sectionTarget)
+				{
+					break;
+				}
+				// unlock
+			}
+			Qtl::System::Threading::YieldThread();
+		}
+		Reclaim();
+	}
+
+	/// @brief Reclaims the retired objects with the specified context without a grace period
+	/// @param context The context the objects were retired with
+	/// @return The number of objects reclaimed
+	/// @remarks This is for an owner being destroyed, when no reader can reach its objects anymore
+	int ReclaimNow(void *context)
+	{
+		std::vector<RetiredObject> ready;
+		{
+			// lock
+			Qtl::System::Threading::LockGuard lock(_mutex);
+			size_t kept = 0;
+			for (size_t i = 0; i < _retired.size(); i++)
+			{
+				if (_retired[i].Context == context)
+				{
+					ready.push_back(_retired[i]);
+				}
+				else
+				{
+					_retired[kept++] = _retired[i];
+				}
+			}
+			_retired.resize(kept);
+			// unlock
+		}
+		for (size_t i = 0; i < ready.size(); i++)
+		{
+			ready[i].Reclaim(ready[i].Object, ready[i].Context);
+		}
+		return (int)ready.size();
+	}
+
+	/// @brief Returns the number of objects waiting for their grace periods
+	/// @return The number of objects
+	int GetPendingCount() const
+	{
+		// lock
+		Qtl::System::Threading::LockGuard lock(_mutex);
+		return (int)_retired.size();
+		// unlock
+	}
+
+private:
+	/// @brief Returns the oldest epoch observed by the online readers
+	/// @return The epoch or the largest possible value if no reader is online
+	/// @remarks It's called with the lock held
+	unsigned long long GetMinReaderEpoch() const
+	{
+		unsigned long long minEpoch = ~0ULL;
+		for (size_t i = 0; i < _readers.size(); i++)
+		{
+			unsigned long long epoch = Qtl::System::Threading::AtomicLoadAcquire(&_readers[i]->_epoch);
+			if (epoch != 0 && epoch < minEpoch)
+			{
+				minEpoch = epoch;
+			}
+		}
+		return minEpoch;
+	}
+
+	/// @brief Moves the read sections on to the next phase if all the sections of the previous one have ended
+	/// @return true if the sections have moved on
+	/// @remarks It's called with the lock held
+	bool AdvanceSections()
+	{
+		using namespace Qtl::System::Threading;
+		// the objects retired have to be unlinked for all to see before the counters are read
+		AtomicFenceFull();
+		PaddedCounter *counters = _sections[(_sectionEpoch - 1) & 1];
+		long active = 0;
+		for (int i = 0; i < SectionStripes; i++)
+		{
+			active += AtomicLoadAcquire(&counters[i].Value);
+		}
+		if (active != 0)
+		{
+			return false;
+		}
+		_drainedEpoch = _sectionEpoch;
+		AtomicStoreRelease(&_sectionEpoch, _sectionEpoch + 1);
+		return true;
+	}
+};
+
+}}}
+
+#endif
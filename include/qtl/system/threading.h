@@ -9,8 +9,12 @@
 #endif
 
 #if _QTL_OS_UNIX
+#   include <pthread.h>
+#   include <sched.h>
 #   include <sys/stat.h>
 #   include <sys/time.h>
+#   include <time.h>
+#   include <unistd.h>
 #elif _QTL_OS_WINDOWS
 #   include <direct.h>
 #   include <Windows.h>
@@ -111,6 +115,336 @@ typedef std::lock_guard<Mutex>	LockGuard;
 
 #endif
 
+/// @brief Returns the time elapsed since an arbitrary point in the past that does not change while the
+///        process is running
+/// @return The time in milliseconds
+inline long long GetTickMilliseconds()
+{
+#if _QTL_OS_UNIX
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#elif _QTL_OS_WINDOWS
+	return (long long)GetTickCount64();
+#endif
+}
+
+/// @brief Returns the number of processors the threads of the process can run on
+/// @return The number of processors, at least 1
+inline int GetProcessorCount()
+{
+#if _QTL_OS_UNIX
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (count > 0)? (int)count : 1;
+#elif _QTL_OS_WINDOWS
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (info.dwNumberOfProcessors > 0)? (int)info.dwNumberOfProcessors : 1;
+#endif
+}
+
+/// @brief Gives up the rest of the time slice of the calling thread
+inline void YieldThread()
+{
+#if _QTL_OS_UNIX
+	sched_yield();
+#elif _QTL_OS_WINDOWS
+	SwitchToThread();
+#endif
+}
+
+/// @brief A thread that runs a function and is joined before it is destroyed
+class Thread
+{
+public:
+	/// @brief The function a thread runs
+	/// @param arg The argument given to Start()
+	typedef void (*ThreadFunction)(void *arg);
+
+private:
+#if _QTL_OS_UNIX
+	pthread_t _handle;
+#elif _QTL_OS_WINDOWS
+	HANDLE _handle;
+#endif
+
+	/// @brief Whether the thread has been started and not yet joined
+	bool _running;
+
+	/// @brief The function the thread runs
+	ThreadFunction _function;
+
+	/// @brief The argument to the function
+	void *_arg;
+
+public:
+	/// @brief Instantiates a thread that is not started
+	Thread() : _running(false), _function(NULL), _arg(NULL)
+	{
+	}
+
+	/// @brief Finalises the thread, waiting for it to finish if it is running
+	~Thread()
+	{
+		Join();
+	}
+
+private:
+	/// @brief Disallows copying
+	Thread(const Thread &);
+
+	/// @brief Disallows assignment
+	Thread &operator=(const Thread &);
+
+public:
+	/// @brief Starts running a function on the thread
+	/// @param function The function
+	/// @param arg The argument to the function
+	/// @return false if the thread is already running or could not be created
+	bool Start(ThreadFunction function, void *arg)
+	{
+		if (_running)
+		{
+			return false;
+		}
+		_function = function;
+		_arg = arg;
+#if _QTL_OS_UNIX
+		_running = (pthread_create(&_handle, NULL, Run, this) == 0);
+#elif _QTL_OS_WINDOWS
+		_handle = CreateThread(NULL, 0, Run, this, 0, NULL);
+		_running = (_handle != NULL);
+#endif
+		return _running;
+	}
+
+	/// @brief Waits for the function to return
+	/// @remarks It returns straight away if the thread is not running
+	void Join()
+	{
+		if (!_running)
+		{
+			return;
+		}
+#if _QTL_OS_UNIX
+		pthread_join(_handle, NULL);
+#elif _QTL_OS_WINDOWS
+		WaitForSingleObject(_handle, INFINITE);
+		CloseHandle(_handle);
+#endif
+		_running = false;
+	}
+
+private:
+	/// @brief The entry point of the thread
+	/// @param thread The thread object
+#if _QTL_OS_UNIX
+	static void *Run(void *thread)
+	{
+		Thread *self = static_cast<Thread*>(thread);
+		self->_function(self->_arg);
+		return NULL;
+	}
+#elif _QTL_OS_WINDOWS
+	static DWORD WINAPI Run(LPVOID thread)
+	{
+		Thread *self = static_cast<Thread*>(thread);
+		self->_function(self->_arg);
+		return 0;
+	}
+#endif
+};
+
+/// @brief An object each thread has an instance of, created the first time the thread gets it
+/// @param T The type of the object, which has to be default constructible
+/// @remarks The instance of a thread is destroyed when the thread exits; the instances of the threads still
+///          running when the ThreadLocal itself is destroyed are not, so it is meant to live as long as the
+///          process, e.g. as a static object
+template <class T>
+class ThreadLocal
+{
+private:
+#if _QTL_OS_UNIX
+	pthread_key_t _key;
+#elif _QTL_OS_WINDOWS
+	DWORD _key;
+#endif
+
+public:
+	/// @brief Instantiates an object no thread has an instance of yet
+	ThreadLocal()
+	{
+#if _QTL_OS_UNIX
+		pthread_key_create(&_key, Destroy);
+#elif _QTL_OS_WINDOWS
+		_key = FlsAlloc(Destroy);
+#endif
+	}
+
+	/// @brief Finalises the object
+	~ThreadLocal()
+	{
+#if _QTL_OS_UNIX
+		pthread_key_delete(_key);
+#elif _QTL_OS_WINDOWS
+		FlsFree(_key);
+#endif
+	}
+
+private:
+	/// @brief Disallows copying
+	ThreadLocal(const ThreadLocal &);
+
+	/// @brief Disallows assignment
+	ThreadLocal &operator=(const ThreadLocal &);
+
+public:
+	/// @brief Returns the instance of the calling thread
+	/// @return The instance
+	T &Get()
+	{
+#if _QTL_OS_UNIX
+		T *instance = static_cast<T*>(pthread_getspecific(_key));
+		if (instance == NULL)
+		{
+			instance = new T();
+			pthread_setspecific(_key, instance);
+		}
+#elif _QTL_OS_WINDOWS
+		T *instance = static_cast<T*>(FlsGetValue(_key));
+		if (instance == NULL)
+		{
+			instance = new T();
+			FlsSetValue(_key, instance);
+		}
+#endif
+		return *instance;
+	}
+
+private:
+	/// @brief Destroys the instance of a thread that exits
+	/// @param instance The instance
+#if _QTL_OS_UNIX
+	static void Destroy(void *instance)
+#elif _QTL_OS_WINDOWS
+	static VOID WINAPI Destroy(PVOID instance)
+#endif
+	{
+		delete static_cast<T*>(instance);
+	}
+};
+
+// Atomic operations
+
+#if _QTL_COMPILER_GCC || _QTL_COMPILER_CLANG
+
+/// @brief Reads a variable shared with other threads so that writes published before it are visible
+/// @param target The variable to read
+/// @return The value of the variable
+template <class T>
+inline T AtomicLoadAcquire(const volatile T *target)
+{
+	return __atomic_load_n(target, __ATOMIC_ACQUIRE);
+}
+
+/// @brief Writes a variable shared with other threads so that writes before it are published with it
+/// @param target The variable to write
+/// @param value The value to write
+template <class T>
+inline void AtomicStoreRelease(volatile T *target, T value)
+{
+	__atomic_store_n(target, value, __ATOMIC_RELEASE);
+}
+
+/// @brief Atomically adds a value to an integer variable
+/// @param target The variable to add to
+/// @param value The value to add
+/// @return The value of the variable after the addition
+template <class T>
+inline T AtomicAdd(volatile T *target, T value)
+{
+	return __atomic_add_fetch(target, value, __ATOMIC_SEQ_CST);
+}
+
+/// @brief Atomically adds a value to an integer variable without ordering the reads and writes around it,
+///        e.g. for counters only read for statistics
+/// @param target The variable to add to
+/// @param value The value to add
+/// @return The value of the variable after the addition
+template <class T>
+inline T AtomicAddRelaxed(volatile T *target, T value)
+{
+	return __atomic_add_fetch(target, value, __ATOMIC_RELAXED);
+}
+
+/// @brief Keeps the reads before the fence from being reordered with the reads and writes after it
+inline void AtomicFenceAcquire()
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+/// @brief Keeps the reads and writes before the fence from being reordered with the writes after it
+inline void AtomicFenceRelease()
+{
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/// @brief Keeps all the reads and writes before the fence from being reordered with any after it
+inline void AtomicFenceFull()
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#elif _QTL_COMPILER_MSVC
+
+template <class T>
+inline T AtomicLoadAcquire(const volatile T *target)
+{
+	T value = *target;	// volatile reads have acquire semantics with MSVC
+	_ReadWriteBarrier();
+	return value;
+}
+
+template <class T>
+inline void AtomicStoreRelease(volatile T *target, T value)
+{
+	_ReadWriteBarrier();
+	*target = value;	// volatile writes have release semantics with MSVC
+}
+
+template <class T>
+inline T AtomicAdd(volatile T *target, T value)
+{
+	if (sizeof(T) == sizeof(LONGLONG))
+	{
+		return (T)(InterlockedExchangeAdd64((volatile LONGLONG*)target, (LONGLONG)value) + (LONGLONG)value);
+	}
+	return (T)(InterlockedExchangeAdd((volatile LONG*)target, (LONG)value) + (LONG)value);
+}
+
+template <class T>
+inline T AtomicAddRelaxed(volatile T *target, T value)
+{
+	return AtomicAdd(target, value);	// the interlocked instructions order everything on x86 and x64
+}
+
+inline void AtomicFenceAcquire()
+{
+	_ReadWriteBarrier();	// x86 and x64 do not reorder loads with other loads
+}
+
+inline void AtomicFenceRelease()
+{
+	_ReadWriteBarrier();	// x86 and x64 do not reorder stores with other stores
+}
+
+inline void AtomicFenceFull()
+{
+	MemoryBarrier();
+}
+
+#endif
+
 }}}
 
 #endif
@@ -0,0 +1,124 @@
+// bitreversebench.cpp : Compares the bit reversal kernels used by the split-ordered hash.
+//
+
+#if defined(_MSC_VER)
+#	include "stdafx.h"
+#endif
+
+#include "qtl/system/system.h"
+#include "qtl/scheme/hash/sohash.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+using namespace Qtl::Scheme::Hash;
+
+namespace {
+
+typedef BitReverse::ValueType (*ReverseKernel)(BitReverse::ValueType);
+
+const int BenchKeyCount = 1 << 20;
+const int BenchRounds = 32;
+
+void RunKernel(const char *name, ReverseKernel kernel, const std::vector<BitReverse::ValueType> &keys)
+{
+	BitReverse::ValueType check = 0;
+	clock_t start = clock();
+	for (int r = 0; r < BenchRounds; r++)
+	{
+		for (int i = 0; i < BenchKeyCount; i++)
+		{
+			check += kernel(keys[i]);
+		}
+	}
+	double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+	printf("%-10s %8.2f ns/key (check %08x)\n", name, elapsed * 1e9 / ((double)BenchKeyCount * BenchRounds), check);
+}
+
+void RunBatch(const std::vector<BitReverse::ValueType> &keys)
+{
+	std::vector<BitReverse::ValueType> reversed(keys.size());
+	BitReverse::ValueType check = 0;
+	clock_t start = clock();
+	for (int r = 0; r < BenchRounds; r++)
+	{
+		BitReverse::ReverseBatch(&keys[0], &reversed[0], keys.size());
+		check += reversed[r];
+	}
+	double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+	printf("%-10s %8.2f ns/key (check %08x)\n", "batch", elapsed * 1e9 / ((double)BenchKeyCount * BenchRounds), check);
+}
+
+}
+
+void BitReverseBench()
+{
+	printf("+%s...\n", _QTL_FUNC);
+
+	std::vector<BitReverse::ValueType> keys(BenchKeyCount);
+	for (int i = 0; i < BenchKeyCount; i++)
+	{
+		keys[i] = ((BitReverse::ValueType)rand() << 16) ^ (BitReverse::ValueType)rand();
+	}
+
+	// all the kernels have to agree before their timings mean anything
+	std::vector<BitReverse::ValueType> reversed(keys.size());
+	BitReverse::ReverseBatch(&keys[0], &reversed[0], keys.size());
+	for (int i = 0; i < BenchKeyCount; i++)
+	{
+		BitReverse::ValueType expected = BitReverse::Multiply(keys[i]);
+		if (BitReverse::Table(keys[i]) != expected || BitReverse::Swap(keys[i]) != expected
+			|| BitReverse::Reverse(keys[i]) != expected || reversed[i] != expected)
+		{
+			printf("error in bit reversal of %08x\n", keys[i]);
+			return;
+		}
+	}
+
+	RunKernel("multiply", BitReverse::Multiply, keys);
+	RunKernel("table", BitReverse::Table, keys);
+	RunKernel("swap", BitReverse::Swap, keys);
+	RunKernel("selected", BitReverse::Reverse, keys);
+	RunBatch(keys);
+
+	// lookups one by one against lookups in batches
+	const int hashKeyCount = 1 << 16;
+	SoHashLinear<int> sohash(4);
+	for (int i = 0; i < hashKeyCount; i++)
+	{
+		sohash.AddKeyValuePair(keys[i] % (hashKeyCount * 2), i);
+	}
+	std::vector<SoHashLinear<int>::KeyType> lookups(hashKeyCount);
+	for (int i = 0; i < hashKeyCount; i++)
+	{
+		lookups[i] = keys[hashKeyCount + i] % (hashKeyCount * 2);
+	}
+
+	int found = 0;
+	clock_t start = clock();
+	for (int r = 0; r < BenchRounds; r++)
+	{
+		for (int i = 0; i < hashKeyCount; i++)
+		{
+			found += sohash.FindFirst(lookups[i], (int**)NULL)? 1 : 0;
+		}
+	}
+	double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+	printf("%-10s %8.2f ns/key (found %d)\n", "find", elapsed * 1e9 / ((double)hashKeyCount * BenchRounds), found);
+
+	std::vector<int*> values(hashKeyCount);
+	int foundBatch = 0;
+	start = clock();
+	for (int r = 0; r < BenchRounds; r++)
+	{
+		foundBatch += sohash.FindBatch(&lookups[0], hashKeyCount, &values[0]);
+	}
+	elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+	printf("%-10s %8.2f ns/key (found %d)\n", "findbatch", elapsed * 1e9 / ((double)hashKeyCount * BenchRounds), foundBatch);
+	if (found != foundBatch)
+	{
+		printf("error in batch lookup\n");
+	}
+}
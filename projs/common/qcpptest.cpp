@@ -13,13 +13,37 @@ extern void TestLsz();
 extern void TestStdStr();
 extern void TestWcToRegexLsz();
 extern void TestWcToRegexStdStr();
+extern void TestNfa();
+extern void TestPlain();
+extern void TestSimdSearch();
+extern void TestPatternSet();
+extern void TestFixedMatchResult();
+extern void TestSpan();
+extern void TestPatternCache();
+extern void TestSearch();
+extern void TestFileGrep();
+extern void TestStreamMatcher();
+extern void TestCharClass();
 extern void TestBiPointer();
 
 extern void SoHashTest();
+extern void SoHashFilterTest();
+extern void SoCacheTest();
+extern void SoHashEraseIfTest();
+extern void SoShardedHashTest();
+extern void SoHashChunkedTest();
+extern void SoHashReadMostlyTest();
+extern void SoHashSetTest();
+extern void SoHashHugePageTest();
+extern void SoHashMigrateTest();
+extern void BitReverseBench();
 
 extern "C" void QcTestWc();
 extern "C" void QcTestWcToRegex();
+extern "C" void QcTestWcCompiled();
 extern "C" void QcSoHashTest();
+extern "C" void QcSoHashManyTest();
+extern "C" void QcSoHashCursorTest();
 
 int _tmain(int argc, _TCHAR* argv[])
 {
@@ -31,13 +55,37 @@ int _tmain(int argc, _TCHAR* argv[])
 	TestStdStr();
 	TestWcToRegexLsz();
 	TestWcToRegexStdStr();
+	TestNfa();
+	TestPlain();
+	TestSimdSearch();
+	TestPatternSet();
+	TestFixedMatchResult();
+	TestSpan();
+	TestPatternCache();
+	TestSearch();
+	TestFileGrep();
+	TestStreamMatcher();
+	TestCharClass();
 
 	QcTestWc();
 	QcTestWcToRegex();
+	QcTestWcCompiled();
 
 	SoHashTest();
+	SoHashFilterTest();
+	SoCacheTest();
+	SoHashEraseIfTest();
+	SoShardedHashTest();
+	SoHashChunkedTest();
+	SoHashReadMostlyTest();
+	SoHashSetTest();
+	SoHashHugePageTest();
+	SoHashMigrateTest();
+	BitReverseBench();
 #endif
 	QcSoHashTest();
+	QcSoHashManyTest();
+	QcSoHashCursorTest();
 #endif
 	return 0;
 }
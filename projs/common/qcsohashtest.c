@@ -62,3 +62,120 @@ void QcSoHashTest()
 
 	QcSoHashDestroy(pSH);
 }
+
+void QcSoHashManyTest()
+{
+	enum { Count = 1000 };
+	unsigned int keys[Count];
+	unsigned long long values[Count];
+	unsigned long long found[Count];
+	void *pointers[Count];
+	void *foundPointers[Count];
+	BOOL isFound[Count];
+	void *pSH = QcSoHashU64Create(4);
+	void *pPtrSH = QcSoHashCreate(4, DeleteValue);
+	int i, numFound, numRemoved;
+
+	for (i = 0; i < Count; i++)
+	{
+		ValueType *value = (ValueType*)malloc(sizeof(ValueType));
+		keys[i] = (unsigned int)i * 2654435761u;
+		values[i] = (unsigned long long)i << 40 | i;
+		value->Value = i;
+		pointers[i] = value;
+	}
+	QcSoHashU64SetMany(pSH, keys, values, Count);
+	QcSoHashSetMany(pPtrSH, keys, pointers, Count);
+
+	/* the even keys are removed in one batch */
+	for (i = 0; i < Count / 2; i++)
+	{
+		keys[i] = keys[i * 2];
+	}
+	numRemoved = QcSoHashU64RemoveMany(pSH, keys, Count / 2);
+	numRemoved += QcSoHashRemoveMany(pPtrSH, keys, Count / 2);
+	for (i = 0; i < Count; i++)
+	{
+		keys[i] = (unsigned int)i * 2654435761u;
+	}
+
+	numFound = QcSoHashU64FindMany(pSH, keys, Count, found, isFound);
+	for (i = 0; i < Count; i++)
+	{
+		if (isFound[i] != (i % 2 != 0) || found[i] != (isFound[i]? values[i] : 0))
+		{
+			printf("error in 64-bit so-hash at key %u\n", keys[i]);
+			break;
+		}
+	}
+	if (QcSoHashFindMany(pPtrSH, keys, Count, foundPointers, NULL) != numFound
+		|| ((ValueType*)foundPointers[1])->Value != 1 || foundPointers[0] != NULL)
+	{
+		printf("error in so-hash batch lookup\n");
+	}
+	printf("%d removed and %d found in so-hash batches\n", numRemoved, numFound);
+
+	QcSoHashU64Destroy(pSH);
+	QcSoHashDestroy(pPtrSH);
+}
+
+static int SumValues(unsigned int key, void *pValue, void *pContext)
+{
+	*(unsigned long long*)pContext += *(unsigned long long*)pValue;
+	return 0;
+}
+
+void QcSoHashCursorTest()
+{
+	enum { Count = 10000, RunSize = 300 };
+	unsigned int keys[RunSize];
+	unsigned long long values[RunSize];
+	unsigned long long sum = 0, iterated = 0, expected = 0, removed = 0;
+	void *pSH = QcSoHashU64Create(2);
+	void *pCursor;
+	QcSoHashStats stats;
+	int i, n, total = 0;
+
+	QcSoHashU64Reserve(pSH, Count);
+	QcSoHashU64GetStats(pSH, &stats);
+	if (stats.TableSize * stats.MaxLoad < Count || stats.Count != 0)
+	{
+		printf("error: so-hash table of %d buckets reserved for %d items\n", stats.TableSize, Count);
+	}
+	for (i = 0; i < Count; i++)
+	{
+		QcSoHashU64Set(pSH, (unsigned int)i * 7, (unsigned long long)i);
+		expected += i;
+	}
+
+	/* the cursor resumes after its position even if the item at the position is removed */
+	pCursor = QcSoHashCursorCreate(pSH);
+	while ((n = QcSoHashU64CursorNext(pCursor, keys, values, RunSize)) > 0)
+	{
+		for (i = 0; i < n; i++)
+		{
+			if (keys[i] != values[i] * 7)
+			{
+				printf("error: so-hash cursor returned value %llu for key %u\n", values[i], keys[i]);
+			}
+			sum += values[i];
+		}
+		if (total == 0)
+		{
+			QcSoHashU64Remove(pSH, keys[n - 1]);
+			removed = values[n - 1];
+		}
+		total += n;
+	}
+	QcSoHashCursorDestroy(pCursor);
+
+	QcSoHashU64Iterate(pSH, SumValues, &iterated);
+	QcSoHashU64GetStats(pSH, &stats);
+	if (sum != expected || total != Count || stats.Count != Count - 1 || iterated != expected - removed
+		|| QcSoHashU64Count(pSH) != Count - 1)
+	{
+		printf("error: so-hash cursor read %d items summing to %llu, %llu expected\n", total, sum, expected);
+	}
+	printf("%d items read by so-hash cursor, %d buckets of %d items\n", total, stats.TableSize, stats.Count);
+	QcSoHashU64Destroy(pSH);
+}
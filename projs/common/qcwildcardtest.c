@@ -49,3 +49,38 @@ void QcTestWcToRegex()
 	printf("\n");
 	free(regex);
 }
+
+void QcTestWcCompiled()
+{
+	const char *sources[] = { "abcdarrCgdd(tfabtabcq", "abCxdd(tfabcq and more", "abCdd(tfabcq", "xabCgdd(tfabcq" };
+	const char *buffer = "abCgdd(tfabcqabCgdd(tf";
+	int lengths[] = { -1, -1, -1, -1 };
+	BOOL matched[4];
+	int matches[8];
+	int matchCount;
+	int i;
+	void *pattern = QcWildcardCompile("ab(*)C(?)dd\\(t(f(*)abc)q");
+
+	printf("+%s...\n", _QTL_FUNC);
+
+	/* the entries beyond the buffer are counted but not written */
+	matchCount = QcWildcardMatchCompiled(pattern, sources[0], -1, matches, 4);
+	printf("%d entries:", matchCount);
+	for (i = 0; i < matchCount && i < 4; i++)
+	{
+		printf(" %.*s", matches[i*2+1] - matches[i*2], sources[0] + matches[i*2]);
+	}
+	printf("\n");
+
+	/* a slice of a buffer that's not terminated where the slice ends */
+	printf("slice: %d, whole: %d\n", QcWildcardMatchCompiled(pattern, buffer, 13, NULL, 0),
+		QcWildcardMatchCompiled(pattern, buffer + 13, -1, NULL, 0));
+
+	printf("batch: %d of 4 matched:", QcWildcardMatchMany(pattern, sources, lengths, 4, matched));
+	for (i = 0; i < 4; i++)
+	{
+		printf(" %d", matched[i]);
+	}
+	printf("\n\n");
+	QcWildcardFree(pattern);
+}
@@ -1,6 +1,13 @@
 #include "qtl/scheme/hash/sohash.h"
+#include "qtl/scheme/hash/socache.h"
+#include "qtl/scheme/hash/soshardedhash.h"
+#include "qtl/scheme/hash/sohashchunked.h"
+#include "qtl/scheme/hash/sohashmulti.h"
+#include "qtl/scheme/hash/sohashset.h"
+#include "qtl/system/rcu.h"
 
 #include <cstdio>
+#include <ctime>
 #include <vector>
 #include <map>
 
@@ -57,3 +64,672 @@ void SoHashTest()
 	}
 }
 
+
+void SoHashFilterTest()
+{
+	std::map<int, int> mapref;
+	SoHashLinear<int> sohash(4);
+	typedef SoHashLinear<int>::KeyType KeyType;
+	sohash.EnableNegativeFilter();
+	for (int i = 0; i < 2000; i++)
+	{
+		KeyType key = rand()%100000;
+		sohash.AddKeyValuePair(key, i);
+		mapref[key] = i;
+	}
+	for (int i = 0; i < 1000; i++)
+	{
+		KeyType key = rand()%100000;
+		sohash.DeleteKey(key);
+		mapref.erase(key);
+	}
+
+	for (int i = 0; i < 100000; i++)
+	{
+		KeyType key = rand()%100000;
+		bool refFound = (mapref.find(key) != mapref.end());
+		bool sohashFound = sohash.FindFirst(key, (int**)NULL);
+		if (refFound != sohashFound)
+		{
+			printf("error in filtered so-hash lookup of %u\n", key);
+			return;
+		}
+	}
+
+	SoHashLinear<int>::FilterStatistics stats;
+	sohash.GetFilterStatistics(stats);
+	printf("filter rejections %ld, false positives %ld, rate %.4f, %u bytes\n", stats.Rejections,
+		stats.FalsePositives, stats.FalsePositiveRate, (unsigned)stats.MemorySize);
+
+	// a filter enabled again reuses the one disabled and still turns down no present key
+	for (int cycle = 0; cycle < 4; cycle++)
+	{
+		sohash.DisableNegativeFilter();
+		for (KeyType key = 100000 + cycle*10; key < 100000 + cycle*10 + 10; key++)
+		{
+			sohash.AddKeyValuePair(key, (int)key);
+			mapref[key] = (int)key;
+		}
+		sohash.EnableNegativeFilter();
+	}
+	for (KeyType key = 0; key < 100100; key++)
+	{
+		if ((mapref.find(key) != mapref.end()) != sohash.FindFirst(key, (int**)NULL))
+		{
+			printf("error in so-hash lookup of %u with the filter enabled again\n", key);
+			return;
+		}
+	}
+}
+
+struct CountingDisposer
+{
+	int *Disposed;
+
+	void operator()(int &value)
+	{
+		(*Disposed)++;
+	}
+};
+
+void SoCacheTest()
+{
+	int disposed = 0;
+	CountingDisposer disposer;
+	disposer.Disposed = &disposed;
+	{
+		SoCache<int, CountingDisposer> cache(100, 0, 0, 2, disposer);
+		for (int i = 0; i < 1000; i++)
+		{
+			cache.Put(i, i);
+			int value;
+			// keeps the first ten entries hot so the clock hand spares them
+			for (int k = 0; k < 10; k++)
+			{
+				cache.Get(k, value);
+			}
+		}
+		int value;
+		for (int k = 0; k < 10; k++)
+		{
+			if (!cache.Get(k, value) || value != k)
+			{
+				printf("error: hot entry %d evicted\n", k);
+			}
+		}
+		if (cache.GetCount() != 100 || disposed != 900)
+		{
+			printf("error: %d entries cached and %d disposed\n", cache.GetCount(), disposed);
+		}
+
+		cache.Put(5000, 5000, 1, 1);
+		long long start = Qtl::System::Threading::GetTickMilliseconds();
+		while (Qtl::System::Threading::GetTickMilliseconds() - start < 3)
+		{
+		}
+		if (cache.Get(5000, value) || cache.PurgeExpired() != 1)
+		{
+			printf("error: entry not expired\n");
+		}
+
+		SoCache<int, CountingDisposer>::Statistics stats;
+		cache.GetStatistics(stats);
+		printf("cache hits %ld, misses %ld, evictions %ld, expirations %ld, count %d\n", stats.Hits, stats.Misses,
+			stats.Evictions, stats.Expirations, stats.Count);
+	}
+	if (disposed != 1001)
+	{
+		printf("error: %d values disposed\n", disposed);
+	}
+
+	SoCache<int> costly(1000, 64);
+	for (int i = 0; i < 100; i++)
+	{
+		costly.Put(i, i, 16);
+	}
+	if (costly.GetCount() != 4)
+	{
+		printf("error: %d entries cached within the cost budget\n", costly.GetCount());
+	}
+}
+
+struct IsEvenPredicate
+{
+	bool operator()(int value)
+	{
+		return (value % 2) == 0;
+	}
+};
+
+struct CountedIsEvenPredicate
+{
+	int *Calls;
+
+	bool operator()(int value)
+	{
+		(*Calls)++;
+		return (value % 2) == 0;
+	}
+};
+
+void SoHashEraseIfTest()
+{
+	std::map<int, int> mapref;
+	SoHashLinear<int> sohash(4);
+	typedef SoHashLinear<int>::KeyType KeyType;
+	for (int i = 0; i < 1000; i++)
+	{
+		KeyType key = rand()%2000;
+		sohash.AddKeyValuePair(key, i);
+		mapref[key] = i;
+	}
+	int expected = 0;
+	for (std::map<int, int>::iterator iter = mapref.begin(); iter != mapref.end();)
+	{
+		if (iter->second % 2 == 0)
+		{
+			mapref.erase(iter++);
+			expected++;
+		}
+		else
+		{
+			++iter;
+		}
+	}
+
+	int erased = sohash.EraseIf(IsEvenPredicate());
+	if (erased != expected || sohash.GetCount() != (int)mapref.size())
+	{
+		printf("error: %d items erased, %d expected\n", erased, expected);
+	}
+	for (KeyType key = 0; key < 2000; key++)
+	{
+		int *pVal;
+		bool refFound = (mapref.find(key) != mapref.end());
+		if (sohash.FindFirst(key, &pVal) != refFound || (refFound && *pVal != mapref[key]))
+		{
+			printf("error in so-hash after erasing at key %u\n", key);
+			break;
+		}
+	}
+	printf("erased %d items\n", erased);
+}
+
+void SoShardedHashTest()
+{
+	std::map<int, int> mapref;
+	SoShardedHash<int> sharded(3, 2, true);
+	typedef SoShardedHash<int>::KeyType KeyType;
+	for (int i = 0; i < 2000; i++)
+	{
+		KeyType key = rand()%4000;
+		sharded.AddKeyValuePair(key, i);
+		mapref[key] = i;
+	}
+	for (KeyType key = 0; key < 4000; key += 3)
+	{
+		sharded.DeleteKey(key);
+		mapref.erase(key);
+	}
+	if (sharded.GetCount() != (int)mapref.size())
+	{
+		printf("error: %d items in sharded hash, %d expected\n", sharded.GetCount(), (int)mapref.size());
+	}
+	for (KeyType key = 0; key < 4000; key++)
+	{
+		int *pVal;
+		bool refFound = (mapref.find(key) != mapref.end());
+		if (sharded.FindFirst(key, &pVal) != refFound || (refFound && *pVal != mapref[key]))
+		{
+			printf("error in sharded hash at key %u\n", key);
+			break;
+		}
+	}
+
+	// every item is visited once across the shards
+	long long sum = 0, sumref = 0;
+	int visited = 0;
+	for (SoShardedHash<int>::Iterator iter = sharded.GetBegin(); iter != sharded.GetEnd(); ++iter)
+	{
+		sum += *iter;
+		visited++;
+	}
+	for (std::map<int, int>::iterator iter = mapref.begin(); iter != mapref.end(); ++iter)
+	{
+		sumref += iter->second;
+	}
+	if (visited != (int)mapref.size() || sum != sumref)
+	{
+		printf("error in sharded hash iteration: %d items visited\n", visited);
+	}
+
+	sharded.Clear();
+	if (sharded.GetCount() != 0 || sharded.GetBegin() != sharded.GetEnd())
+	{
+		printf("error: sharded hash not empty after clearing\n");
+	}
+	printf("%d shards on %d NUMA nodes\n", sharded.GetShardCount(), Qtl::System::Memory::GetNumaNodeCount());
+}
+
+namespace {
+
+struct SumFunctor
+{
+	long long Sum;
+	int Count;
+
+	SumFunctor() : Sum(0), Count(0)
+	{
+	}
+
+	void operator()(int value)
+	{
+		Sum += value;
+		Count++;
+	}
+};
+
+}
+
+void SoHashChunkedTest()
+{
+	std::map<int, int> mapref;
+	SoHashChunked<int> chunked(4);
+	typedef SoHashChunked<int>::KeyType KeyType;
+	for (int i = 0; i < 20000; i++)
+	{
+		KeyType key = rand()%10000;
+		if (rand()%4 == 0)
+		{
+			int deleted = chunked.DeleteKey(key);
+			if (deleted != (int)mapref.erase(key))
+			{
+				printf("error in deleting key %u from chunked so-hash\n", key);
+				return;
+			}
+		}
+		else
+		{
+			chunked.AddKeyValuePair(key, i);
+			mapref[key] = i;
+		}
+	}
+	int erased = chunked.EraseIf(IsEvenPredicate());
+	for (std::map<int, int>::iterator iter = mapref.begin(); iter != mapref.end();)
+	{
+		if (iter->second % 2 == 0)
+		{
+			mapref.erase(iter++);
+			erased--;
+		}
+		else
+		{
+			++iter;
+		}
+	}
+	if (erased != 0 || chunked.GetCount() != (int)mapref.size())
+	{
+		printf("error: %d items in chunked so-hash, %d expected\n", chunked.GetCount(), (int)mapref.size());
+	}
+	for (KeyType key = 0; key < 10000; key++)
+	{
+		int value;
+		bool refFound = (mapref.find(key) != mapref.end());
+		if (chunked.FindFirst(key, &value) != refFound || (refFound && value != mapref[key]))
+		{
+			printf("error in chunked so-hash at key %u\n", key);
+			break;
+		}
+	}
+	SumFunctor sum = chunked.ForEach(SumFunctor());
+	long long sumref = 0;
+	for (std::map<int, int>::iterator iter = mapref.begin(); iter != mapref.end(); ++iter)
+	{
+		sumref += iter->second;
+	}
+	if (sum.Count != (int)mapref.size() || sum.Sum != sumref)
+	{
+		printf("error in chunked so-hash iteration: %d items visited\n", sum.Count);
+	}
+
+	// lookups against the node-per-item hash with the same load
+	const int lookupCount = 1 << 20;
+	SoHashLinear<int> linear(4);
+	chunked.Clear();
+	for (int i = 0; i < lookupCount / 4; i++)
+	{
+		linear.AddKeyValuePair((KeyType)i * 7, i);
+		chunked.AddKeyValuePair((KeyType)i * 7, i);
+	}
+	int found = 0;
+	clock_t start = clock();
+	for (int i = 0; i < lookupCount; i++)
+	{
+		found += linear.FindFirst((KeyType)(i * 7 + i % 2) % (lookupCount * 7 / 4), (int**)NULL)? 1 : 0;
+	}
+	double linearTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+	int foundChunked = 0;
+	start = clock();
+	for (int i = 0; i < lookupCount; i++)
+	{
+		foundChunked += chunked.FindFirst((KeyType)(i * 7 + i % 2) % (lookupCount * 7 / 4))? 1 : 0;
+	}
+	double chunkedTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+	if (found != foundChunked)
+	{
+		printf("error: %d found in chunked so-hash, %d expected\n", foundChunked, found);
+	}
+	printf("%d chunks; lookups %.2f ns linear, %.2f ns chunked\n", chunked.GetChunkCount(),
+		linearTime * 1e9 / lookupCount, chunkedTime * 1e9 / lookupCount);
+}
+
+void SoHashReadMostlyTest()
+{
+	using Qtl::System::Rcu::QsbrDomain;
+
+	QsbrDomain domain;
+	QsbrDomain::Reader *reader = domain.RegisterReader();
+	int disposed = 0;
+	CountingDisposer disposer;
+	disposer.Disposed = &disposed;
+	{
+		SoHashLinear<int, CountingDisposer> sohash(2, disposer);
+		sohash.EnableReadMostly(domain);
+		for (int i = 0; i < 1000; i++)
+		{
+			sohash.AddKeyValuePair(i, i);
+		}
+
+		// the reader holds on to a value while it is replaced and then deleted
+		int *pVal = NULL;
+		if (!sohash.FindFirst(7, &pVal))
+		{
+			printf("error: key 7 not found in read-mostly so-hash\n");
+		}
+		sohash.AddKeyValuePair(7, 70);
+		int deleted = 0;
+		for (int i = 0; i < 1000; i += 2)
+		{
+			deleted += sohash.DeleteKey(i);
+		}
+		domain.Reclaim();
+		if (pVal == NULL || *pVal != 7 || disposed != 0)
+		{
+			printf("error: value reclaimed before the reader's quiescent state\n");
+		}
+
+		domain.QuiescentState(reader);
+		domain.Reclaim();
+		if (disposed != deleted || domain.GetPendingCount() != 0)
+		{
+			printf("error: %d values disposed of after the grace period, %d expected\n", disposed, deleted);
+		}
+		int *pNew;
+		if (!sohash.FindFirst(7, &pNew) || *pNew != 70 || sohash.GetCount() != 500)
+		{
+			printf("error in read-mostly so-hash after updates\n");
+		}
+	}
+	domain.UnregisterReader(reader);
+	printf("%d values disposed of\n", disposed);
+}
+
+void SoHashSetTest()
+{
+	std::map<int, int> mapref;
+	SoHashSet set(4);
+	SoHashMulti<int> multi(4);
+	typedef SoHashSet::KeyType KeyType;
+	for (int i = 0; i < 5000; i++)
+	{
+		KeyType key = rand()%1000;
+		int value = rand()%4;
+		bool isNew = (mapref.find(key) == mapref.end());
+		if (set.Add(key) != isNew)
+		{
+			printf("error in adding key %u to so-hash set\n", key);
+			return;
+		}
+		multi.Add(key, value);
+		mapref[key]++;
+	}
+	for (KeyType key = 0; key < 1000; key += 2)
+	{
+		if (set.Remove(key) != (mapref.find(key) != mapref.end()))
+		{
+			printf("error in removing key %u from so-hash set\n", key);
+			return;
+		}
+		int removed = multi.DeleteKey(key);
+		if (removed != mapref[key])
+		{
+			printf("error: %d values of key %u removed from so-hash multimap, %d expected\n", removed, key,
+				mapref[key]);
+		}
+		mapref.erase(key);
+	}
+
+	int total = 0;
+	for (KeyType key = 0; key < 1000; key++)
+	{
+		std::map<int, int>::iterator iter = mapref.find(key);
+		if (set.Contains(key) != (iter != mapref.end()))
+		{
+			printf("error in so-hash set at key %u\n", key);
+			break;
+		}
+		std::vector<int> values, counts;
+		multi.Find(key, values, &counts);
+		int count = 0;
+		for (size_t i = 0; i < counts.size(); i++)
+		{
+			count += counts[i];
+			if (multi.GetValueCount(key, values[i]) != counts[i])
+			{
+				printf("error in so-hash multimap at key %u\n", key);
+			}
+		}
+		if (count != (iter != mapref.end()? iter->second : 0))
+		{
+			printf("error: %d values of key %u in so-hash multimap\n", count, key);
+			break;
+		}
+		total += count;
+	}
+
+	// removing the occurrences one by one leaves the key out at the end
+	std::vector<int> values, counts;
+	KeyType key = mapref.begin()->first;
+	multi.Find(key, values, &counts);
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		for (int k = 0; k < counts[i]; k++)
+		{
+			multi.Remove(key, values[i]);
+		}
+	}
+	if (multi.Find(key, values) || multi.GetCount() != total - mapref.begin()->second
+		|| multi.GetKeyCount() != (int)mapref.size() - 1 || set.GetCount() != (int)mapref.size())
+	{
+		printf("error in so-hash multimap after removing all the values of key %u\n", key);
+	}
+	printf("%d keys in set, %d values in multimap\n", set.GetCount(), multi.GetCount());
+}
+
+void SoHashHugePageTest()
+{
+	// enough keys for the bucket table to outgrow the heap and be mapped
+	const int count = 600000;
+	SoHashLinear<int, DefaultDisposer<int>, HugePageTableAllocator> hash(2);
+	TableStatistics stats;
+	hash.GetTableStatistics(stats);
+	if (stats.Kind != Qtl::System::Memory::PageKind::Heap || stats.HugePages != 0)
+	{
+		printf("error: small huge page table is not on the heap\n");
+	}
+	for (int i = 0; i < count; i++)
+	{
+		hash.AddKeyValuePair(i, i);
+	}
+	for (int i = 0; i < count; i += 7)
+	{
+		int *value;
+		if (!hash.FindFirst(i, &value) || *value != i)
+		{
+			printf("error in so-hash with huge page table at key %d\n", i);
+			return;
+		}
+	}
+	hash.GetTableStatistics(stats);
+	if (stats.Kind == Qtl::System::Memory::PageKind::Heap || stats.MappedBytes < stats.Bytes
+		|| stats.MappedBytes % Qtl::System::Memory::HugePageSize != 0)
+	{
+		printf("error: large so-hash table is not mapped\n");
+	}
+	printf("so-hash table of %lu bytes in %lu mapped bytes, %d huge pages (kind %d)\n",
+		(unsigned long)stats.Bytes, (unsigned long)stats.MappedBytes, stats.HugePages, (int)stats.Kind);
+
+	hash.Clear();
+	hash.GetTableStatistics(stats);
+	if (stats.Kind != Qtl::System::Memory::PageKind::Heap || hash.GetCount() != 0)
+	{
+		printf("error: cleared so-hash table is still mapped\n");
+	}
+
+	PagedNodeAllocator allocator(-1, true);
+	SoHashLinear<int> nodes(2);
+	nodes.SetNodeAllocator(&allocator);
+	for (int i = 0; i < 1000; i++)
+	{
+		nodes.AddKeyValuePair(i, i);
+	}
+	if (allocator.GetMemorySize() != Qtl::System::Memory::HugePageSize)
+	{
+		printf("error: %lu bytes in the huge page node allocator\n", (unsigned long)allocator.GetMemorySize());
+	}
+	nodes.Clear();
+	printf("node allocator with %d huge pages\n", allocator.GetHugePageCount());
+}
+
+void SoHashMigrateTest()
+{
+	typedef SoHashLinear<int, CountingDisposer> SourceHash;
+	typedef SoHashLinear<int, CountingDisposer, HugePageTableAllocator> TargetHash;
+	typedef SourceHash::KeyType KeyType;
+	typedef SourceHash::MigrationMode MigrationMode;
+
+	int disposed = 0;
+	CountingDisposer disposer;
+	disposer.Disposed = &disposed;
+	std::map<KeyType, int> mapref;
+	{
+		SourceHash source(4, disposer);
+		for (int i = 0; i < 100000; i++)
+		{
+			KeyType key = (KeyType)rand() * 7919;
+			source.AddKeyValuePair(key, i);
+			mapref[key] = i;
+		}
+
+		// copying leaves the source as it is
+		{
+			TargetHash copy(1, disposer);
+			int migrated = source.MigrateTo(copy, 4);
+			if (migrated != (int)mapref.size() || copy.GetCount() != migrated || source.GetCount() != migrated
+				|| copy.GetTableIndexBits() <= source.GetTableIndexBits())
+			{
+				printf("error: %d items copied to so-hash, %d expected\n", migrated, (int)mapref.size());
+			}
+			for (std::map<KeyType, int>::iterator iter = mapref.begin(); iter != mapref.end(); ++iter)
+			{
+				int *value;
+				if (!copy.FindFirst(iter->first, &value) || *value != iter->second)
+				{
+					printf("error in so-hash copy at key %u\n", iter->first);
+					break;
+				}
+			}
+			if (source.MigrateTo(copy, 4) != -1)
+			{
+				printf("error: so-hash migrated to a non-empty hash\n");
+			}
+		}
+		disposed = 0;
+
+		// mirroring keeps the target up to date until the migration is finished
+		TargetHash target(1, disposer);
+		source.MigrateTo(target, 3, MigrationMode::Mirror);
+		for (int i = 0; i < 1000; i++)
+		{
+			KeyType key = (KeyType)rand() * 7919;
+			source.AddKeyValuePair(key, -i);
+			mapref[key] = -i;
+		}
+		int deleted = 0;
+		for (std::map<KeyType, int>::iterator iter = mapref.begin(); iter != mapref.end(); )
+		{
+			if (iter->second % 3 == 0)
+			{
+				deleted += source.DeleteKey(iter->first);
+				mapref.erase(iter++);
+			}
+			else
+			{
+				++iter;
+			}
+		}
+
+		// the duplicates are even and go with the even items, the predicate seeing each item once
+		for (int i = 0; i < 100; i++)
+		{
+			source.AddKeyValuePair(mapref.begin()->first + (KeyType)i * 7919, 2 * i,
+				SourceHash::AddStrategy::AddDuplicate);
+		}
+		int calls = 0;
+		CountedIsEvenPredicate isEven;
+		isEven.Calls = &calls;
+		int itemCount = source.GetCount();
+		int erased = source.EraseIf(isEven);
+		deleted += erased;
+		for (std::map<KeyType, int>::iterator iter = mapref.begin(); iter != mapref.end(); )
+		{
+			if (iter->second % 2 == 0)
+			{
+				mapref.erase(iter++);
+			}
+			else
+			{
+				++iter;
+			}
+		}
+		if (calls != itemCount || source.GetCount() != target.GetCount())
+		{
+			printf("error: so-hash erase predicate called %d times for %d items\n", calls, itemCount);
+		}
+		if (!source.FinishMigration() || source.GetCount() != 0 || target.GetCount() != (int)mapref.size()
+			|| disposed != deleted)
+		{
+			printf("error: so-hash mirror has %d items, %d expected, %d values disposed of\n",
+				target.GetCount(), (int)mapref.size(), disposed);
+		}
+		for (std::map<KeyType, int>::iterator iter = mapref.begin(); iter != mapref.end(); ++iter)
+		{
+			int *value;
+			if (!target.FindFirst(iter->first, &value) || *value != iter->second)
+			{
+				printf("error in so-hash mirror at key %u\n", iter->first);
+				break;
+			}
+		}
+
+		// moving hands the values over without disposing of them
+		disposed = 0;
+		SourceHash moved(4, disposer);
+		if (target.MigrateTo(moved, 2, MigrationMode::Move) != (int)mapref.size() || target.GetCount() != 0
+			|| disposed != 0)
+		{
+			printf("error in moving so-hash\n");
+		}
+	}
+	printf("%d items migrated, %d values disposed of\n", (int)mapref.size(), disposed);
+}
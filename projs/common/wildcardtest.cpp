@@ -13,17 +13,26 @@
 
 #include "qtl/system/system.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #if _QTL_MINGW
 #	include <malloc.h>
 #else
 #	include <stdlib.h>
 #endif
 #include <string>
+#include <vector>
 
 #include "qtl/string/wildcard.h"
+#include "qtl/string/wildcardnfa.h"
+#include "qtl/string/simdsearch.h"
+#include "qtl/string/patternset.h"
+#include "qtl/string/patterncache.h"
+#include "qtl/string/filegrep.h"
 
 using namespace Qtl::String::Wildcard;
+using Qtl::String::SimdSearch;
 
 void TestLsz()
 {	
@@ -95,3 +104,989 @@ void TestWcToRegexStdStr()
 	printf("%s\n", regex.c_str());
 	printf("\n");
 }
+
+/// @brief Makes a random pattern of literals, wildcards, escapes and well nested quotations
+static void MakeRandomPattern(std::string &pattern, int length, bool quotations=true)
+{
+	const char *tokens = quotations? "ab*?\\(" : "ab*?\\";
+	int depth = 0;
+	pattern.clear();
+	for (int i = 0; i < length; i++)
+	{
+		char token = tokens[rand() % (quotations? 6 : 5)];
+		if (token == '(' && rand() % 2 == 0 && depth > 0)
+		{
+			token = ')';
+		}
+		pattern.push_back(token);
+		if (token == '(')
+		{
+			depth++;
+		}
+		else if (token == ')')
+		{
+			depth--;
+		}
+		else if (token == '\\')
+		{
+			pattern.push_back("ab*("[rand() % 4]);
+		}
+	}
+	for (; depth > 0; depth--)
+	{
+		pattern.push_back(')');
+	}
+	if (rand() % 16 == 0)
+	{
+		// a trailing escape character
+		pattern.push_back('\\');
+	}
+}
+
+/// @brief Makes a random source of the characters the random patterns are made of
+static void MakeRandomSource(std::string &source, int length, const char *chars="ab*(")
+{
+	int charCount = (int)strlen(chars);
+	source.clear();
+	for (int i = 0; i < length; i++)
+	{
+		source.push_back(chars[rand() % charCount]);
+	}
+}
+
+/// @brief Tells whether two results of the same matching have the same entries
+template <class TResult, class TOtherResult>
+static bool HaveSameEntries(const TResult &result, const TOtherResult &other)
+{
+	if (result.Matches.size() != other.Matches.size())
+	{
+		return false;
+	}
+	for (size_t k = 0; k < result.Matches.size(); k++)
+	{
+		if (result.Matches[k].Begin != other.Matches[k].Begin || result.Matches[k].End != other.Matches[k].End)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/// @brief Makes the random cases of a differential test, the comparisons of matchers derive from it
+struct RandomCases
+{
+	/// @brief The bound on the number of tokens of a pattern
+	int MaxPatternLength;
+
+	/// @brief The bound on the number of characters of a source
+	int MaxSourceLength;
+
+	/// @brief Whether every other pattern has no quotation
+	bool AlternateQuotations;
+
+	RandomCases(int maxPatternLength, int maxSourceLength, bool alternateQuotations)
+		: MaxPatternLength(maxPatternLength), MaxSourceLength(maxSourceLength),
+		AlternateQuotations(alternateQuotations)
+	{
+	}
+
+	void MakeCase(int i, std::string &patternString, std::string &source)
+	{
+		MakeRandomPattern(patternString, rand() % MaxPatternLength, !AlternateQuotations || i % 2 == 0);
+		MakeRandomSource(source, rand() % MaxSourceLength);
+	}
+};
+
+/// @brief Matches 20000 random sources against random patterns with two matchers and reports where they differ
+/// @param comparison The functor with MakeCase(int i, std::string &patternString, std::string &source), which
+///        makes the i-th case, and Compare(const std::string &patternString, const std::string &source,
+///        bool &matched), which matches with both and returns whether they agree
+/// @param outcome How the summary calls a source that matched
+template <class TComparison>
+static void RunDifferentialTest(TComparison &comparison, const char *outcome="matched")
+{
+	int matchedCount = 0;
+	int mismatchCount = 0;
+	std::string patternString;
+	std::string source;
+	for (int i = 0; i < 20000; i++)
+	{
+		comparison.MakeCase(i, patternString, source);
+		bool matched = false;
+		bool same = comparison.Compare(patternString, source, matched);
+		if (matched)
+		{
+			matchedCount++;
+		}
+		if (!same && mismatchCount++ < 5)
+		{
+			printf("mismatch '%s' on '%s'\n", patternString.c_str(), source.c_str());
+		}
+	}
+	printf("%d of 20000 %s, %d mismatches\n", matchedCount, outcome, mismatchCount);
+}
+
+/// @brief Compares the automaton with the backtracking matcher on the outcome and on every quotation
+struct NfaComparison : RandomCases
+{
+	Matcher<> Backtracking;
+	NfaMatcher<> Nfa;
+	MatchResult<> Result;
+	MatchResult<> NfaResult;
+
+	NfaComparison() : RandomCases(10, 40, false)
+	{
+	}
+
+	bool Compare(const std::string &patternString, const std::string &source, bool &matched)
+	{
+		Pattern<> pattern(patternString.c_str());
+		CompiledPattern<> compiled(pattern);
+		matched = Backtracking.Match(source.c_str(), pattern, Result);
+		return Nfa.Match(source.c_str(), compiled, NfaResult) == matched
+			&& (!matched || HaveSameEntries(Result, NfaResult));
+	}
+};
+
+void TestNfa()
+{
+	printf("+%s...\n", _QTL_FUNC);
+	NfaMatcher<> nfaMatcher;
+	MatchResult<> nfaMatchResult;
+
+	// the automaton agrees with the backtracking matcher on the outcome and on every quotation
+	NfaComparison comparison;
+	RunDifferentialTest(comparison);
+
+	// stars that would make the backtracking matcher try exponentially many splits
+	std::string longSource(5000, 'a');
+	Pattern<> hardPattern("*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*b");
+	CompiledPattern<> hardCompiled(hardPattern);
+	printf("pathological: %s\n", nfaMatcher.Match(longSource.c_str(), hardCompiled, nfaMatchResult)?
+		"matched" : "unmatched");
+	Pattern<> quotedPattern("(*a)(*)");
+	CompiledPattern<> quotedCompiled(quotedPattern);
+	nfaMatcher.Match(longSource.c_str(), quotedCompiled, nfaMatchResult);
+	printf("quotations: %d, %d\n", (int)(nfaMatchResult.Matches[1].End - nfaMatchResult.Matches[1].Begin),
+		(int)(nfaMatchResult.Matches[2].End - nfaMatchResult.Matches[2].Begin));
+	printf("\n");
+}
+
+/// @brief Compares the two-pointer path with the recursion, which patterns without parentheses end the same way
+struct PlainComparison : RandomCases
+{
+	Matcher<> Backtracking;
+	MatchResult<> Result;
+	MatchResult<> RecursiveResult;
+	bool Quotations;
+
+	PlainComparison() : RandomCases(10, 40, true), Quotations(true)
+	{
+	}
+
+	void MakeCase(int i, std::string &patternString, std::string &source)
+	{
+		Quotations = (i % 2 == 0);
+		RandomCases::MakeCase(i, patternString, source);
+	}
+
+	bool Compare(const std::string &patternString, const std::string &source, bool &matched)
+	{
+		Pattern<> pattern(patternString.c_str());
+		const char *iterSource = source.c_str();
+		const char *iterPattern = pattern.GetBegin();
+		RecursiveResult.Matches.resize(1);
+		matched = Backtracking.Match(source.c_str(), iterSource, pattern, iterPattern, RecursiveResult);
+		bool same = (Backtracking.Match(source.c_str(), pattern) == matched);
+		if (!Quotations)
+		{
+			bool plainMatched = Backtracking.Match(source.c_str(), pattern, Result);
+			same = same && (plainMatched == matched) && (!matched || Result.Matches[0].End == iterSource);
+		}
+		return same;
+	}
+};
+
+void TestPlain()
+{
+	printf("+%s...\n", _QTL_FUNC);
+	Matcher<> matcher;
+	MatchResult<> matchResult;
+
+	// patterns without parentheses take the two-pointer path and end where the recursion would
+	PlainComparison comparison;
+	RunDifferentialTest(comparison);
+
+	std::string line = "2014-03-01 12:00:00 ERROR connection to 10.0.0.1 lost: timeout after 30s";
+	Pattern<> logPattern("*ERROR*timeout*");
+	printf("log line: %s\n", matcher.Match(line.c_str(), logPattern)? "matched" : "unmatched");
+	std::string longSource(5000, 'a');
+	Pattern<> hardPattern("*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*a*b");
+	printf("pathological: %s\n", matcher.Match(longSource.c_str(), hardPattern, matchResult)?
+		"matched" : "unmatched");
+	printf("\n");
+}
+
+/// @brief The end of a zero-terminated string or a bound before it
+struct BoundedEndFunctor
+{
+	const char *Bound;
+
+	bool operator()(const char *iter, const char *str)
+	{
+		return iter == Bound || *iter == 0;
+	}
+};
+
+/// @brief Selects the bounded end of zero-terminated strings
+struct BoundedFunctorSelector
+{
+	template <class TStringRef, class TCharIter>
+	struct rebind
+	{
+		typedef StringBeginFunctorPsz StringBeginFunctor;
+		typedef BoundedEndFunctor StringEndFunctor;
+	};
+};
+
+void TestSimdSearch()
+{
+	printf("+%s...\n", _QTL_FUNC);
+	printf("kernel: %d\n", (int)SimdSearch::GetKernel());
+
+	// every kernel finds what the scalar one finds at all the alignments and lengths
+	const int bufferSize = 256;
+	char buffer[bufferSize + 64];
+	int mismatchCount = 0;
+	for (int i = 0; i < 20000; i++)
+	{
+		int offset = rand() % 64;
+		int length = rand() % bufferSize;
+		char *begin = buffer + offset;
+		for (int j = 0; j < length; j++)
+		{
+			begin[j] = "abcd"[rand() % 4];
+		}
+		begin[length] = 0;
+		const char *end = begin + length;
+		char needle[5];
+		int needleLength = 1 + rand() % 4;
+		for (int j = 0; j < needleLength; j++)
+		{
+			needle[j] = "abcd"[rand() % 4];
+		}
+		needle[needleLength] = 0;
+		char ch = "abcde"[rand() % 5];
+
+		const char *expectedChar = SimdSearch::FindCharScalar(begin, end, ch);
+		const char *expectedString = SimdSearch::FindStringScalar(begin, end, needle, needleLength);
+		const char *expectedPsz = strstr(begin, needle);
+		bool same = SimdSearch::FindChar(begin, end, ch) == expectedChar
+			&& SimdSearch::FindString(begin, end, needle, needleLength) == expectedString
+			&& SimdSearch::FindCharOrNull(begin, ch) == SimdSearch::FindCharOrNullScalar(begin, ch)
+			&& SimdSearch::FindStringInPsz(begin, needle, needleLength) == expectedPsz;
+#if _QTL_SIMDSEARCH_X86
+		if (SimdSearch::GetKernel() == SimdSearch::Kernel::Avx2)
+		{
+			same = same && SimdSearch::FindCharSse2(begin, end, ch) == expectedChar
+				&& SimdSearch::FindCharOrNullSse2(begin, ch) == SimdSearch::FindCharOrNullScalar(begin, ch)
+				&& (needleLength < 2 || SimdSearch::FindStringSse2(begin, end, needle, needleLength) == expectedString);
+		}
+#endif
+		if (!same && mismatchCount++ < 5)
+		{
+			printf("mismatch '%s' in '%s'\n", needle, begin);
+		}
+	}
+	printf("%d mismatches\n", mismatchCount);
+
+	// the literals after the stars are sought in std::string sources as well
+	typedef MatcherTraits<const std::string&, std::string::const_iterator, size_t> Traits;
+	Matcher<Traits> matcher;
+	MatchResult<std::string::const_iterator, size_t> matchResult;
+	std::string line = "2014-03-01 12:00:00 ERROR connection to 10.0.0.1 lost: timeout after 30s";
+	Pattern<> logPattern("*ERROR*(t?meout)*");
+	if (matcher.Match(line, logPattern, matchResult))
+	{
+		printf("quoted: %s\n", std::string(matchResult.Matches[1].Begin, matchResult.Matches[1].End).c_str());
+	}
+
+	// a custom end functor keeps the literals from being sought past it
+	const char *bounded = "abXc";
+	StringBeginFunctorPsz boundedBegin;
+	BoundedEndFunctor boundedEnd;
+	boundedEnd.Bound = bounded + 2;
+	Matcher<MatcherTraits<const char*, const char*, size_t, BoundedFunctorSelector> > boundedMatcher(boundedBegin,
+		boundedEnd);
+	MatchResult<> boundedResult;
+	Pattern<> beyondBound("*c");
+	Pattern<> withinBound("*b");
+	printf("bounded: %d %d\n", boundedMatcher.Match(bounded, beyondBound, boundedResult),
+		boundedMatcher.Match(bounded, withinBound, boundedResult));
+	printf("\n");
+}
+
+void TestPatternSet()
+{
+	printf("+%s...\n", _QTL_FUNC);
+	const char *words[] = { "orders", "trades", "eu", "us", "error", "audit", "fx", "v2" };
+	const int wordCount = sizeof(words) / sizeof(words[0]);
+
+	// topic subscriptions like orders.*.eu or *.error? or au?it.(*)
+	PatternSet patternSet;
+	std::vector<std::string> patternStrings;
+	for (int i = 0; i < 5000; i++)
+	{
+		std::string patternString;
+		int parts = 1 + rand() % 3;
+		for (int j = 0; j < parts; j++)
+		{
+			if (j > 0)
+			{
+				patternString.push_back('.');
+			}
+			switch (rand() % 6)
+			{
+			case 0:
+				patternString.push_back('*');
+				break;
+			case 1:
+				patternString += "(*)";
+				break;
+			case 2:
+				patternString += words[rand() % wordCount];
+				patternString[patternString.size() - 1] = '?';
+				break;
+			default:
+				patternString += words[rand() % wordCount];
+				break;
+			}
+		}
+		patternStrings.push_back(patternString);
+		patternSet.Add(patternString.c_str(), i);
+	}
+	std::vector<int> ids;
+	printf("unbuilt: %d\n", patternSet.Match("orders", ids));
+	patternSet.Build();
+	printf("%d patterns, %d states\n", patternSet.GetCount(), patternSet.GetStateCount());
+
+	// the set finds exactly the patterns a loop over them all finds
+	std::vector<Pattern<> > patterns;
+	for (size_t k = 0; k < patternStrings.size(); k++)
+	{
+		patterns.push_back(Pattern<>(patternStrings[k].c_str()));
+	}
+	Matcher<> matcher;
+	PatternSet::Scratch scratch;
+	int mismatchCount = 0;
+	int matchedCount = 0;
+	for (int i = 0; i < 2000; i++)
+	{
+		std::string topic;
+		int parts = 1 + rand() % 4;
+		for (int j = 0; j < parts; j++)
+		{
+			if (j > 0)
+			{
+				topic.push_back('.');
+			}
+			topic += words[rand() % wordCount];
+		}
+		if (i % 2 == 0)
+		{
+			patternSet.Match(topic.c_str(), ids);
+		}
+		else
+		{
+			patternSet.Match(topic.c_str(), ids, scratch);
+		}
+		std::vector<int> expected;
+		for (int k = 0; k < (int)patterns.size(); k++)
+		{
+			if (matcher.Match(topic.c_str(), patterns[k]))
+			{
+				expected.push_back(k);
+			}
+		}
+		matchedCount += (int)ids.size();
+		if (ids != expected && mismatchCount++ < 5)
+		{
+			printf("mismatch on '%s': %d against %d\n", topic.c_str(), (int)ids.size(), (int)expected.size());
+		}
+	}
+	printf("%d matches, %d mismatches\n", matchedCount, mismatchCount);
+	printf("\n");
+}
+
+/// @brief Compares the matchers with a fixed result with the one with a growing result
+struct FixedMatchResultComparison : RandomCases
+{
+	typedef FixedMatchResult<const char*, size_t, 3> FixedR;
+	typedef MatcherTraits<const char*, const char*, size_t, DefaultStringFunctorSelector, FixedR> FixedTraits;
+
+	Matcher<> Backtracking;
+	Matcher<FixedTraits> Fixed;
+	NfaMatcher<FixedTraits> Nfa;
+	MatchResult<> Result;
+	FixedR FixedResult;
+	FixedR NfaResult;
+
+	FixedMatchResultComparison() : RandomCases(14, 40, false)
+	{
+	}
+
+	bool Compare(const std::string &patternString, const std::string &source, bool &matched)
+	{
+		Pattern<> pattern(patternString.c_str());
+		CompiledPattern<> compiled(pattern);
+		matched = Backtracking.Match(source.c_str(), pattern, Result);
+		return Fixed.Match(source.c_str(), pattern, FixedResult) == matched
+			&& Nfa.Match(source.c_str(), compiled, NfaResult) == matched
+			&& (!matched || (HaveSameEntries(Result, FixedResult) && HaveSameEntries(Result, NfaResult)));
+	}
+};
+
+void TestFixedMatchResult()
+{
+	printf("+%s...\n", _QTL_FUNC);
+	typedef FixedMatchResultComparison::FixedR FixedR;
+	typedef FixedMatchResultComparison::FixedTraits FixedTraits;
+	Matcher<FixedTraits> fixedMatcher;
+	FixedR fixedMatchResult;
+
+	// one result of each kind is reused throughout, going in and out of the inline storage
+	FixedMatchResultComparison comparison;
+	RunDifferentialTest(comparison);
+
+	// the entries are laid out contiguously whether they're inline or not
+	Pattern<> manyPattern("(a)(b)(c)(d)(e)");
+	fixedMatcher.Match("abcde", manyPattern, fixedMatchResult);
+	for (FixedR::MatchList::iterator iter = fixedMatchResult.Matches.begin();
+		iter != fixedMatchResult.Matches.end(); ++iter)
+	{
+		printf("%.*s ", (int)(iter->End - iter->Begin), iter->Begin);
+	}
+	printf("\n\n");
+}
+
+/// @brief Returns the offset of a match boundary or -1 for one that's never been recorded
+static int GetOffset(const char *iter, const char *source)
+{
+	return (iter != NULL)? (int)(iter - source) : -1;
+}
+
+/// @brief Compares the span matchers on buffers without a terminator with the one on zero-terminated strings
+struct SpanComparison : RandomCases
+{
+	Matcher<> Backtracking;
+	SpanMatcher Span;
+	NfaMatcher<SpanMatcherTraits> Nfa;
+	MatchResult<> Result;
+	MatchResult<> SpanResult;
+	MatchResult<> NfaResult;
+
+	SpanComparison() : RandomCases(10, 40, true)
+	{
+	}
+
+	bool Compare(const std::string &patternString, const std::string &source, bool &matched)
+	{
+		char *buffer = new char[source.size()];
+		memcpy(buffer, source.data(), source.size());
+		CharSpan span(buffer, source.size());
+		char *patternBuffer = new char[patternString.size()];
+		memcpy(patternBuffer, patternString.data(), patternString.size());
+		SpanPattern spanPattern(CharSpan(patternBuffer, patternString.size()));
+		Pattern<> pattern(patternString.c_str());
+		CompiledPattern<> compiled(spanPattern);
+
+		matched = Backtracking.Match(source.c_str(), pattern, Result);
+		bool same = (Span.Match(span, spanPattern, SpanResult) == matched)
+			&& (Span.Match(span, pattern) == matched)
+			&& (Nfa.Match(span, compiled, NfaResult) == matched);
+		if (same && matched)
+		{
+			same = (Result.Matches.size() == SpanResult.Matches.size());
+			for (size_t k = 0; same && k < Result.Matches.size(); k++)
+			{
+				same = (GetOffset(Result.Matches[k].Begin, source.c_str())
+						== GetOffset(SpanResult.Matches[k].Begin, buffer)
+					&& GetOffset(Result.Matches[k].End, source.c_str())
+						== GetOffset(SpanResult.Matches[k].End, buffer)
+					&& NfaResult.Matches[k].Begin == SpanResult.Matches[k].Begin
+					&& NfaResult.Matches[k].End == SpanResult.Matches[k].End);
+			}
+		}
+		delete[] buffer;
+		delete[] patternBuffer;
+		return same;
+	}
+};
+
+void TestSpan()
+{
+	printf("+%s...\n", _QTL_FUNC);
+	SpanMatcher spanMatcher;
+	MatchResult<> spanMatchResult;
+
+	// the sources are copied to buffers without a terminator, which the sanitisers would catch reading past
+	SpanComparison comparison;
+	RunDifferentialTest(comparison);
+
+	// a slice in the middle of a larger buffer, which goes on with characters the pattern would take
+	const char *packet = "GET /index.html HTTP/1.1\r\nHost: example.com\r\n";
+	CharSpan requestLine(packet, strchr(packet, '\r') - packet);
+	SpanPattern requestPattern("GET (*) HTTP/1.?*");
+	if (spanMatcher.Match(requestLine, requestPattern, spanMatchResult))
+	{
+		printf("path: %.*s, line: %d\n", (int)(spanMatchResult.Matches[1].End - spanMatchResult.Matches[1].Begin),
+			spanMatchResult.Matches[1].Begin, (int)(spanMatchResult.Matches[0].End - spanMatchResult.Matches[0].Begin));
+	}
+	printf("\n");
+}
+
+/// @brief The shared state of the threads that match through a pattern cache
+struct PatternCacheContext
+{
+	PatternCache<> *Cache;
+	volatile long Mismatches;
+	int Seed;
+};
+
+/// @brief Matches sources against patterns looked up in a small cache so that they keep being evicted
+static void MatchThroughCache(void *arg)
+{
+	PatternCacheContext *context = (PatternCacheContext*)arg;
+	typedef MatcherTraits<const std::string&, std::string::const_iterator> Traits;
+	Matcher<Traits> matcher;
+	char text[16];
+	for (int i = 0; i < 20000; i++)
+	{
+		int n = (i * 7 + context->Seed) % 64;
+		sprintf(text, "*%c%d*", 'a' + n % 3, n);
+		std::string source = "x" + std::string(text + 1, strlen(text) - 2) + "y";
+		PatternCache<>::Lease lease(*context->Cache, text);
+		if (!matcher.Match(source, lease.GetCompiled()))
+		{
+			Qtl::System::Threading::AtomicAdd(&context->Mismatches, 1L);
+		}
+	}
+}
+
+void TestPatternCache()
+{
+	printf("+%s...\n", _QTL_FUNC);
+	PatternCache<> cache(4);
+	typedef MatcherTraits<const std::string&, std::string::const_iterator> Traits;
+	Matcher<Traits> matcher;
+
+	// the second lookup of a pattern finds it compiled
+	PatternCache<>::Item *first = cache.Acquire("*ERROR*");
+	PatternCache<>::Item *second = cache.Acquire("*ERROR*");
+	printf("same: %d, matched: %d\n", first == second,
+		matcher.Match(std::string("12:00 ERROR lost"), first->GetCompiled()));
+
+	// an acquired pattern outlives its eviction
+	for (int i = 0; i < 10; i++)
+	{
+		char text[16];
+		sprintf(text, "*%d", i);
+		cache.Release(cache.Acquire(text));
+	}
+	printf("evicted still matches: %d\n", matcher.Match(std::string("an ERROR"), second->GetCompiled()));
+	cache.Release(first);
+	cache.Release(second);
+
+	PatternCache<>::Statistics stats;
+	cache.GetStatistics(stats);
+	printf("hits %ld, misses %ld, collisions %ld, evictions %ld, count %d, cost %d\n", stats.Hits, stats.Misses,
+		stats.Collisions, stats.Evictions, stats.Count, (int)stats.Cost);
+
+	// threads sharing a cache too small for their patterns
+	PatternCache<> shared(16);
+	PatternCacheContext contexts[4];
+	Qtl::System::Threading::Thread threads[4];
+	for (int i = 0; i < 4; i++)
+	{
+		contexts[i].Cache = &shared;
+		contexts[i].Mismatches = 0;
+		contexts[i].Seed = i * 13;
+		threads[i].Start(MatchThroughCache, &contexts[i]);
+	}
+	long mismatches = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		threads[i].Join();
+		mismatches += contexts[i].Mismatches;
+	}
+	shared.GetStatistics(stats);
+	printf("threads: %ld mismatches, %ld lookups\n", mismatches, stats.Hits + stats.Misses);
+	printf("\n");
+}
+
+/// @brief Compares the skipping search with trying every start in turn
+struct SearchComparison : RandomCases
+{
+	Matcher<> Backtracking;
+	MatchResult<> Result;
+	MatchResult<> ExpectedResult;
+	std::vector<MatchResult<> > Matches;
+
+	SearchComparison() : RandomCases(10, 60, true)
+	{
+	}
+
+	bool Compare(const std::string &patternString, const std::string &source, bool &found)
+	{
+		Pattern<> pattern(patternString.c_str());
+		std::vector<MatchResult<> > expectedMatches;
+		const char *iterStart = source.c_str();
+		for (const char *iter = iterStart; ; ++iter)
+		{
+			if (iter >= iterStart && Backtracking.Match(iter, pattern, ExpectedResult))
+			{
+				expectedMatches.push_back(ExpectedResult);
+				const char *iterEnd = ExpectedResult.Matches[0].End;
+				if (*iterEnd == 0)
+				{
+					break;
+				}
+				iterStart = (iterEnd == iter)? iter + 1 : iterEnd;
+				iter = iterStart - 1;
+			}
+			if (*iter == 0)
+			{
+				break;
+			}
+		}
+
+		found = Backtracking.Search(source.c_str(), pattern, Result);
+		bool same = (found == !expectedMatches.empty());
+		same = same && (Backtracking.FindAll(source.c_str(), pattern, Matches) == (int)expectedMatches.size());
+		for (size_t k = 0; same && k < Matches.size(); k++)
+		{
+			same = HaveSameEntries(Matches[k], expectedMatches[k]);
+		}
+		if (same && found)
+		{
+			same = (Result.Matches[0].Begin == Matches[0].Matches[0].Begin
+				&& Result.Matches[0].End == Matches[0].Matches[0].End);
+		}
+		return same;
+	}
+};
+
+void TestSearch()
+{
+	printf("+%s...\n", _QTL_FUNC);
+	MatchResult<> matchResult;
+
+	// the skipping search finds what trying every start in turn does
+	SearchComparison comparison;
+	RunDifferentialTest(comparison, "found");
+
+	// the times of the errors in a log, found by skipping to the literal after the time
+	std::string log = "12:00 ERROR [db] lost\n12:01 INFO [web] ok\n12:02 ERROR [web] timeout\n";
+	typedef MatcherTraits<const std::string&, std::string::const_iterator> Traits;
+	Matcher<Traits> stringMatcher;
+	std::vector<MatchResult<std::string::const_iterator> > logMatches;
+	Pattern<> logPattern("(?\?:?\?) ERROR");
+	stringMatcher.FindAll(log, logPattern, logMatches);
+	for (size_t k = 0; k < logMatches.size(); k++)
+	{
+		printf("%s ", std::string(logMatches[k].Matches[1].Begin, logMatches[k].Matches[1].End).c_str());
+	}
+	printf("\n");
+
+	// a custom end functor bounds the source searched
+	const char *bounded = "abXc";
+	StringBeginFunctorPsz boundedBegin;
+	BoundedEndFunctor boundedEnd;
+	boundedEnd.Bound = bounded + 2;
+	Matcher<MatcherTraits<const char*, const char*, size_t, BoundedFunctorSelector> > boundedMatcher(boundedBegin,
+		boundedEnd);
+	std::vector<MatchResult<> > boundedMatches;
+	Pattern<> anyChar("?");
+	Pattern<> beyondBound("c");
+	printf("bounded: %d %d\n\n", boundedMatcher.FindAll(bounded, anyChar, boundedMatches),
+		boundedMatcher.Search(bounded, beyondBound, matchResult));
+}
+
+/// @brief Collects the lines a grep finds
+struct GrepCollector
+{
+	std::vector<size_t> Offsets;
+	std::vector<int> Entries;
+
+	void operator()(const GrepLine &line)
+	{
+		Offsets.push_back(line.Offset);
+		Entries.insert(Entries.end(), line.Entries, line.Entries + line.EntryCount * 2);
+	}
+};
+
+void TestFileGrep()
+{
+	printf("+%s...\n", _QTL_FUNC);
+	const char *path = "filegreptest.tmp";
+
+	// a grep with small chunks on many threads finds what matching the lines one by one does
+	int mismatchCount = 0;
+	long long foundCount = 0;
+	std::string patternString;
+	std::string text;
+	for (int i = 0; i < 200; i++)
+	{
+		MakeRandomPattern(patternString, rand() % 8, i % 2 == 0);
+		text.clear();
+		int lineCount = rand() % 200;
+		for (int j = 0; j < lineCount; j++)
+		{
+			int lineLength = rand() % 20;
+			for (int k = 0; k < lineLength; k++)
+			{
+				text.push_back("ab*("[rand() % 4]);
+			}
+			if (j < lineCount - 1 || i % 3 != 0)
+			{
+				text.push_back('\n');
+			}
+		}
+		FILE *file = fopen(path, "wb");
+		fwrite(text.data(), 1, text.size(), file);
+		fclose(file);
+
+		bool anchored = (i % 4 == 1);
+		FileGrep grep(patternString, 4, anchored, 1 + rand() % 64);
+		GrepCollector found;
+		long long count = grep.GrepFile(path, found);
+
+		FileGrep::PatternType pattern(patternString);
+		FileGrep::MatcherType matcher;
+		FileGrep::MatcherType::MatchResultType matchResult;
+		GrepCollector expected;
+		for (size_t begin = 0; begin < text.size(); )
+		{
+			size_t end = text.find('\n', begin);
+			end = (end != std::string::npos)? end : text.size();
+			const char *line = text.data() + begin;
+			CharSpan span(line, end - begin);
+			if (anchored? matcher.Match(span, pattern, matchResult) : matcher.Search(span, pattern, matchResult))
+			{
+				expected.Offsets.push_back(begin);
+				for (size_t m = 0; m < matchResult.Matches.size(); m++)
+				{
+					expected.Entries.push_back((matchResult.Matches[m].Begin != NULL)?
+						(int)(matchResult.Matches[m].Begin - line) : -1);
+					expected.Entries.push_back((matchResult.Matches[m].End != NULL)?
+						(int)(matchResult.Matches[m].End - line) : -1);
+				}
+			}
+			begin = end + 1;
+		}
+		foundCount += count;
+		bool same = (count == (long long)expected.Offsets.size() && found.Offsets == expected.Offsets
+			&& found.Entries == expected.Entries);
+		if (!same && mismatchCount++ < 5)
+		{
+			printf("mismatch '%s'\n", patternString.c_str());
+		}
+	}
+	printf("%lld lines found, %d mismatches\n", foundCount, mismatchCount);
+
+	// quotations on long lines and with many stars take neither exponential time nor a frame per character
+	std::string longLine(3000000, 'a');
+	longLine += "b\n";
+	longLine += std::string(160, 'a');
+	FILE *file = fopen(path, "wb");
+	fwrite(longLine.data(), 1, longLine.size(), file);
+	fclose(file);
+	FileGrep lastB("(*)[b]", 2, true);
+	GrepCollector lastBFound;
+	long long lastBCount = lastB.GrepFile(path, lastBFound);
+	FileGrep manyStars("(*a*a*a*a*a*a*b)", 2, true);
+	GrepCollector manyStarsFound;
+	long long manyStarsCount = manyStars.GrepFile(path, manyStarsFound);
+	printf("long line: %lld found, quoted %d; many stars: %lld found\n", lastBCount,
+		(lastBCount == 1)? lastBFound.Entries[3] - lastBFound.Entries[2] : -1, manyStarsCount);
+
+	// an empty file has no lines and a missing one cannot be grepped
+	file = fopen(path, "wb");
+	fclose(file);
+	FileGrep grep("*");
+	GrepCollector found;
+	long long emptyCount = grep.GrepFile(path, found);
+	remove(path);
+	long long missingCount = grep.GrepFile(path, found);
+	printf("empty: %lld, missing: %lld\n\n", emptyCount, missingCount);
+}
+
+/// @brief Returns the offset of a position in a source or the offset a stream matcher gives a boundary never
+///        reached
+static size_t GetStreamOffset(const char *iter, const char *source)
+{
+	return (iter != NULL)? (size_t)(iter - source) : StreamMatcher<>::GetNoOffset();
+}
+
+/// @brief Compares feeding a source in random chunks with matching it at once
+struct StreamComparison : RandomCases
+{
+	Matcher<> Backtracking;
+	MatchResult<> Result;
+	StreamMatcher<>::MatchResultType StreamResult;
+
+	StreamComparison() : RandomCases(10, 40, true)
+	{
+	}
+
+	bool Compare(const std::string &patternString, const std::string &source, bool &matched)
+	{
+		Pattern<> pattern(patternString.c_str());
+		CompiledPattern<> compiled(pattern);
+		StreamMatcher<> streamMatcher(compiled, 100);
+		StreamMatcher<>::Status::Enum status = StreamMatcher<>::Status::Running;
+		for (size_t fed = 0; fed < source.size() && status == StreamMatcher<>::Status::Running; )
+		{
+			size_t length = std::min(source.size() - fed, (size_t)(rand() % 5));
+			status = streamMatcher.Feed(source.data() + fed, length);
+			fed += length;
+		}
+		if (status == StreamMatcher<>::Status::Running)
+		{
+			status = streamMatcher.Finish();
+		}
+
+		matched = Backtracking.Match(source.c_str(), pattern, Result);
+		bool streamMatched = streamMatcher.GetResult(StreamResult);
+		bool same = (matched == streamMatched
+			&& status == (matched? StreamMatcher<>::Status::Matched : StreamMatcher<>::Status::Failed));
+		if (same && matched)
+		{
+			same = (Result.Matches.size() == StreamResult.Matches.size());
+			for (size_t k = 0; same && k < Result.Matches.size(); k++)
+			{
+				size_t begin = GetStreamOffset(Result.Matches[k].Begin, source.c_str());
+				size_t end = GetStreamOffset(Result.Matches[k].End, source.c_str());
+				same = ((begin == StreamMatcher<>::GetNoOffset()? begin : begin + 100)
+					== StreamResult.Matches[k].Begin
+					&& (end == StreamMatcher<>::GetNoOffset()? end : end + 100) == StreamResult.Matches[k].End);
+			}
+		}
+		return same;
+	}
+};
+
+void TestStreamMatcher()
+{
+	printf("+%s...\n", _QTL_FUNC);
+	StreamMatcher<>::MatchResultType streamResult;
+
+	// feeding the source in random chunks gives what matching it at once does
+	StreamComparison comparison;
+	RunDifferentialTest(comparison);
+
+	// a status line split across reads, whose matching is over before the rest of the response arrives
+	Pattern<> statusPattern("HTTP/1.? (?\?\?) ");
+	CompiledPattern<> statusCompiled(statusPattern);
+	StreamMatcher<> statusMatcher(statusCompiled);
+	const char *reads[] = { "HTT", "P/1.1 2", "00 OK\r\nContent-", "Length: 0\r\n" };
+	StreamMatcher<>::Status::Enum status = StreamMatcher<>::Status::Running;
+	int readCount = 0;
+	for (; readCount < 4 && status == StreamMatcher<>::Status::Running; readCount++)
+	{
+		status = statusMatcher.Feed(reads[readCount], strlen(reads[readCount]));
+	}
+	statusMatcher.GetResult(streamResult);
+	printf("after %d reads: %s, status code at %d-%d\n\n", readCount,
+		status == StreamMatcher<>::Status::Matched? "matched" : "not matched",
+		(int)streamResult.Matches[1].Begin, (int)streamResult.Matches[1].End);
+}
+
+/// @brief Compares the backtracking matcher, its plain path, the automaton and the search on patterns with
+///        classes spliced in
+struct CharClassComparison : RandomCases
+{
+	Matcher<> Backtracking;
+	NfaMatcher<> Nfa;
+	MatchResult<> Result;
+	MatchResult<> NfaResult;
+
+	CharClassComparison() : RandomCases(8, 30, true)
+	{
+	}
+
+	void MakeCase(int i, std::string &patternString, std::string &source)
+	{
+		static const char *classes[] = { "[ab]", "[!a]", "[^b]", "[a-b]", "[(*]", "[]a]", "[a" };
+		MakeRandomPattern(patternString, rand() % MaxPatternLength, i % 2 == 0);
+		for (int k = rand() % 3; k > 0; k--)
+		{
+			size_t at = rand() % (patternString.size() + 1);
+			if (at > 0 && patternString[at - 1] == '\\')
+			{
+				at--;
+			}
+			patternString.insert(at, classes[rand() % 7]);
+		}
+		MakeRandomSource(source, rand() % MaxSourceLength, "ab*([");
+	}
+
+	bool Compare(const std::string &patternString, const std::string &source, bool &matched)
+	{
+		Pattern<> pattern(patternString.c_str());
+		CompiledPattern<> compiled(pattern);
+		matched = Backtracking.Match(source.c_str(), pattern, Result);
+		bool same = (Backtracking.Match(source.c_str(), pattern) == matched
+			&& Nfa.Match(source.c_str(), compiled, NfaResult) == matched);
+		same = same && (!matched || HaveSameEntries(Result, NfaResult));
+		const char *iterFirst = NULL;
+		for (const char *iter = source.c_str(); iterFirst == NULL; ++iter)
+		{
+			if (Backtracking.Match(iter, pattern))
+			{
+				iterFirst = iter;
+			}
+			if (*iter == 0)
+			{
+				break;
+			}
+		}
+		bool found = Backtracking.Search(source.c_str(), pattern, Result);
+		return same && (found == (iterFirst != NULL)) && (!found || Result.Matches[0].Begin == iterFirst);
+	}
+};
+
+void TestCharClass()
+{
+	printf("+%s...\n", _QTL_FUNC);
+	Matcher<> matcher;
+
+	const char *cases[][2] = {
+		{ "[a-c]x", "bx" }, { "[a-c]x", "dx" }, { "[!0-9]*", "a1" }, { "[^0-9]*", "1a" },
+		{ "[]a]", "]" }, { "[a-]", "-" }, { "[\\]]", "]" }, { "[z-a]", "m" }, { "[a", "[a" }, { "a]", "a]" }
+	};
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		Pattern<> pattern(cases[i][0]);
+		printf("%s %s %s\n", cases[i][0], matcher.Match(cases[i][1], pattern)? "matches" : "doesn't match",
+			cases[i][1]);
+	}
+
+	// with classes spliced in, the backtracking matcher, its plain path, the automaton and the search agree
+	CharClassComparison comparison;
+	RunDifferentialTest(comparison);
+
+	Pattern<> regexPattern("[a-z]*[!0-9](?)[\\]^-]\\[x[");
+	WildCardToRegex<Pattern<>, std::string&, std::string::iterator> wc2regex;
+	std::string regex;
+	std::string::iterator dummy = regex.begin();
+	wc2regex.Convert(regexPattern, regex, dummy);
+	printf("regex: %s\n", regex.c_str());
+
+	// a class of no character, and its negation of every one, have no bracket expression of their own
+	Pattern<> emptyClassPattern("[z-a]x[!z-a]");
+	regex.clear();
+	dummy = regex.begin();
+	wc2regex.Convert(emptyClassPattern, regex, dummy);
+	printf("regex: %s\n\n", regex.c_str());
+}
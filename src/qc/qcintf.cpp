@@ -3,6 +3,8 @@
 
 // implementations in qtl
 #include "qtl/string/wildcard.h"
+#include "qtl/string/wildcardnfa.h"
+#include "qtl/system/threading.h"
 #include "qtl/scheme/hash/sohash.h"
 
 #include "qc/qcintf.h"
@@ -26,7 +28,19 @@ int QcWildcardMatch(const char *pszSource, const char *pszPattern, int **paMatch
 	Matcher<> matcher;
 	Matcher<>::MatchResultType matchResult;
 	Pattern<> pattern(pszPattern);
-	if (!matcher.Match(pszSource, pattern, matchResult))
+	bool matched;
+	if (pattern.HasQuotations())
+	{
+		// the backtracking through the quotations is exponential in the stars
+		CompiledPattern<> compiled(pattern);
+		NfaMatcher<> nfaMatcher;
+		matched = nfaMatcher.Match(pszSource, compiled, matchResult);
+	}
+	else
+	{
+		matched = matcher.Match(pszSource, pattern, matchResult);
+	}
+	if (!matched)
 	{
 		return -1;
 	}
@@ -64,6 +78,124 @@ int QcWildCardToRegex(const char *pszWcPattern, char **pszRegex)
 	return len;
 }
 
+/// @brief What a compiled pattern handle points to
+struct QcCompiledPattern
+{
+	/// @brief The pattern, which owns a copy of the pattern string
+	Qtl::String::Wildcard::Pattern<std::string, const std::string&, std::string::const_iterator> Parsed;
+
+	/// @brief The program the quotations are worked out with
+	Qtl::String::Wildcard::CompiledPattern<> Compiled;
+
+	QcCompiledPattern(const std::string &text) : Parsed(text), Compiled(Parsed)
+	{
+	}
+};
+
+/// @brief The traits of the matchers of sources given by their lengths, with the match entries kept on the stack
+typedef Qtl::String::Wildcard::MatcherTraits<Qtl::String::Wildcard::CharSpan, const char*, size_t,
+	Qtl::String::Wildcard::DefaultStringFunctorSelector,
+	Qtl::String::Wildcard::FixedMatchResult<const char*, size_t, 16> > QcSpanTraits;
+
+/// @brief The matcher of the patterns without quotations and of whether a source matches at all
+typedef Qtl::String::Wildcard::Matcher<QcSpanTraits> QcSpanMatcher;
+
+/// @brief The matcher of the patterns with quotations, whose time is linear in the source
+typedef Qtl::String::Wildcard::NfaMatcher<QcSpanTraits> QcNfaMatcher;
+
+/// @brief The automaton matcher of each thread, which keeps its scratch memory between the calls
+static Qtl::System::Threading::ThreadLocal<QcNfaMatcher> s_nfaMatchers;
+
+/// @brief Compiles a wildcard pattern for matching many times
+/// @param pszPattern The wildcard pattern, which is copied
+/// @return The compiled pattern
+void* QcWildcardCompile(const char *pszPattern)
+{
+	return new QcCompiledPattern(std::string(pszPattern));
+}
+
+/// @brief Matches a source string to a compiled pattern
+/// @param pPattern The compiled pattern
+/// @param pSource The source string, which doesn't have to be zero-terminated if its length is given
+/// @param length The number of characters in the source string or -1 if it's zero-terminated
+/// @param aMatches To return the offsets in the source of the beginning and end of each match entry,
+///        alternately, or NULL. An end of a quotation that's never closed is returned as -1.
+/// @param maxMatches The maximum number of match entries to return, each taking two integers
+/// @return The number of match entries if matching, which can be more than maxMatches, or -1
+int QcWildcardMatchCompiled(void *pPattern, const char *pSource, int length, int *aMatches, int maxMatches)
+{
+	using namespace Qtl::String::Wildcard;
+	QcCompiledPattern *pCompiled = (QcCompiledPattern*)pPattern;
+	CharSpan source = (length >= 0)? CharSpan(pSource, length) : CharSpan(pSource);
+	QcSpanMatcher::MatchResultType matchResult;
+	bool matched;
+	if (pCompiled->Parsed.HasQuotations())
+	{
+		// the backtracking through the quotations is exponential in the stars
+		matched = s_nfaMatchers.Get().Match(source, pCompiled->Compiled, matchResult);
+	}
+	else
+	{
+		QcSpanMatcher matcher;
+		matched = matcher.Match(source, pCompiled->Parsed, matchResult);
+	}
+	if (!matched)
+	{
+		return -1;
+	}
+	int matchCount = (int)matchResult.Matches.size();
+	if (aMatches != NULL)
+	{
+		for (int i = 0; i < matchCount && i < maxMatches; i++)
+		{
+			const char *begin = matchResult.Matches[i].Begin;
+			const char *end = matchResult.Matches[i].End;
+			aMatches[i*2] = (begin != NULL)? (int)(begin - pSource) : -1;
+			aMatches[i*2+1] = (end != NULL)? (int)(end - pSource) : -1;
+		}
+	}
+	return matchCount;
+}
+
+/// @brief Determines which of a batch of source strings match a compiled pattern
+/// @param pPattern The compiled pattern
+/// @param apSources The source strings
+/// @param aLengths The number of characters in each source, -1 for a zero-terminated one, or NULL if they
+///        are all zero-terminated
+/// @param count The number of source strings
+/// @param aMatched To return whether each source matches or NULL to ignore
+/// @return The number of sources that match
+int QcWildcardMatchMany(void *pPattern, const char *const *apSources, const int *aLengths, int count,
+	BOOL *aMatched)
+{
+	using namespace Qtl::String::Wildcard;
+	QcCompiledPattern *pCompiled = (QcCompiledPattern*)pPattern;
+	QcSpanMatcher matcher;
+	int matchedCount = 0;
+	for (int i = 0; i < count; i++)
+	{
+		int length = (aLengths != NULL)? aLengths[i] : -1;
+		CharSpan source = (length >= 0)? CharSpan(apSources[i], length) : CharSpan(apSources[i]);
+		bool matched = matcher.Match(source, pCompiled->Parsed);
+		if (matched)
+		{
+			matchedCount++;
+		}
+		if (aMatched != NULL)
+		{
+			aMatched[i] = matched? TRUE : FALSE;
+		}
+	}
+	return matchedCount;
+}
+
+/// @brief Finalises a compiled pattern
+/// @param pPattern The compiled pattern
+void QcWildcardFree(void *pPattern)
+{
+	delete (QcCompiledPattern*)pPattern;
+}
+
 /// @brief Creates a split-ordered hash table
 /// @param The max-load which is the ratio of item count to table size at which the table should be expanded
 /// @param The function that dispose of the values added to the table
@@ -124,3 +256,412 @@ void QcSoHashDestroy(void *pSoHash)
 	SoHashType *pSH = (SoHashType*)pSoHash;
 	delete pSH;
 }
+
+/// @brief Looks for the items with the specified keys in blocks
+/// @param pSH The hash table
+/// @param aKeys The keys to the items to look for
+/// @param count The number of keys
+/// @param aValues To return the values, the default value for the keys that are not found
+/// @param aFound To return whether each key is found or NULL to ignore
+/// @return The number of keys found
+template <class TSoHash>
+static int FindMany(const TSoHash *pSH, const unsigned int *aKeys, int count,
+	typename TSoHash::ValueType *aValues, BOOL *aFound)
+{
+	typedef typename TSoHash::ValueType ValueType;
+	const int blockSize = 64;
+	ValueType *apFound[blockSize];
+	int numFound = 0;
+	for (int start = 0; start < count; start += blockSize)
+	{
+		int blockCount = (count - start < blockSize)? count - start : blockSize;
+		numFound += pSH->FindBatch(aKeys + start, blockCount, apFound);
+		for (int i = 0; i < blockCount; i++)
+		{
+			aValues[start+i] = (apFound[i] != NULL)? *apFound[i] : ValueType();
+			if (aFound != NULL)
+			{
+				aFound[start+i] = (apFound[i] != NULL)? TRUE : FALSE;
+			}
+		}
+	}
+	return numFound;
+}
+
+/// @brief The state of a cursor over the items of a table
+struct SoHashCursor
+{
+	/// @brief The hash table
+	void *SoHash;
+
+	/// @brief The SO-key of the last item read
+	unsigned int SoKey;
+
+	/// @brief The number of items with the SO-key that have been read
+	int Skip;
+};
+
+/// @brief Reads the next run of items with a cursor
+/// @param pCursor The cursor
+/// @param aKeys To return the keys
+/// @param aValues To return the values
+/// @param max The maximum number of items to read
+/// @return The number of items read
+template <class TSoHash>
+static int CursorNext(SoHashCursor *pCursor, unsigned int *aKeys, typename TSoHash::ValueType *aValues, int max)
+{
+	typename TSoHash::ItemPosition position;
+	position.SoKey = pCursor->SoKey;
+	position.Skip = pCursor->Skip;
+	int count = ((const TSoHash*)pCursor->SoHash)->GetItems(position, aKeys, aValues, max);
+	pCursor->SoKey = position.SoKey;
+	pCursor->Skip = position.Skip;
+	return count;
+}
+
+/// @brief Returns what the iteration callback is given for a pointer value
+/// @param value The value
+/// @return The value itself
+static void *ToCallbackValue(void *&value)
+{
+	return value;
+}
+
+/// @brief Returns what the iteration callback is given for a 64-bit integer value
+/// @param value The value
+/// @return The pointer to the value
+static void *ToCallbackValue(unsigned long long &value)
+{
+	return &value;
+}
+
+/// @brief Calls a function for each item of a table, reading the items in runs
+/// @param pSH The hash table
+/// @param callback The function
+/// @param pContext The context to pass to the function
+/// @return The number of items the function has been called for
+template <class TSoHash>
+static int Iterate(const TSoHash *pSH, QcSoHashCallback callback, void *pContext)
+{
+	typedef typename TSoHash::ValueType ValueType;
+	const int runSize = 256;
+	unsigned int aKeys[runSize];
+	ValueType aValues[runSize];
+	typename TSoHash::ItemPosition position;
+	int total = 0;
+	for (;;)
+	{
+		int count = pSH->GetItems(position, aKeys, aValues, runSize);
+		if (count == 0)
+		{
+			return total;
+		}
+		for (int i = 0; i < count; i++)
+		{
+			total++;
+			if (callback(aKeys[i], ToCallbackValue(aValues[i]), pContext) != 0)
+			{
+				return total;
+			}
+		}
+	}
+}
+
+/// @brief Gets the statistics of a table
+/// @param pSH The hash table
+/// @param pStats To return the statistics
+template <class TSoHash>
+static void GetStats(const TSoHash *pSH, QcSoHashStats *pStats)
+{
+	Qtl::Scheme::Hash::TableStatistics tableStats;
+	pSH->GetTableStatistics(tableStats);
+	pStats->Count = pSH->GetCount();
+	pStats->TableSize = 1 << pSH->GetTableIndexBits();
+	pStats->MaxLoad = pSH->GetMaxLoad();
+	pStats->TableBytes = tableStats.Bytes;
+	pStats->NodeBytes = pSH->GetNodeSize();
+}
+
+/// @brief Adds items to a split-ordered hash table in a batch (existing ones will be replaced)
+/// @param pSoHash The hash table
+/// @param aKeys The keys to the items to add
+/// @param apValues The values the keys are mapped to, one for each key
+/// @param count The number of items
+/// @return The number of items added or replaced
+int QcSoHashSetMany(void *pSoHash, const unsigned int *aKeys, void *const *apValues, int count)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<void *, void(*)(void*)> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	return pSH->AddBatch(aKeys, apValues, count);
+}
+
+/// @brief Looks for the items with the specified keys in a split-ordered hash table
+/// @param pSoHash The hash table
+/// @param aKeys The keys to the items to look for
+/// @param count The number of keys
+/// @param apValues To return the values, NULL for the keys that are not found
+/// @param aFound To return whether each key is found or NULL to ignore
+/// @return The number of keys found
+int QcSoHashFindMany(void *pSoHash, const unsigned int *aKeys, int count, void **apValues, BOOL *aFound)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<void *, void(*)(void*)> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	return FindMany(pSH, aKeys, count, apValues, aFound);
+}
+
+/// @brief Removes the items with the specified keys from a split-ordered hash table in a batch
+/// @param pSoHash The hash table
+/// @param aKeys The keys to the items to remove
+/// @param count The number of keys
+/// @return The number of items removed
+int QcSoHashRemoveMany(void *pSoHash, const unsigned int *aKeys, int count)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<void *, void(*)(void*)> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	return pSH->DeleteBatch(aKeys, count);
+}
+
+/// @brief Creates a split-ordered hash table with 64-bit integer values stored in the items
+/// @param maxLoad The ratio of item count to table size at which the table should be expanded
+/// @return The split-ordered hash table
+void* QcSoHashU64Create(float maxLoad)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<unsigned long long> SoHashType;
+	return new SoHashType(maxLoad);
+}
+
+/// @brief Adds an item to a 64-bit integer valued table (an existing one will be replaced)
+/// @param pSoHash The hash table
+/// @param key The key to the item to add
+/// @param value The value the key is mapped to
+void QcSoHashU64Set(void *pSoHash, unsigned int key, unsigned long long value)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<unsigned long long> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	pSH->AddKeyValuePair(key, value);
+}
+
+/// @brief Looks for the item with the specified key in a 64-bit integer valued table
+/// @param pSoHash The hash table
+/// @param key The key to the item to look for
+/// @param pValue To return the value or NULL to ignore
+/// @return 0 if the item has been found or -1 if it's not found
+int QcSoHashU64Find(void *pSoHash, unsigned int key, unsigned long long *pValue)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<unsigned long long> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	unsigned long long *pFound;
+	if (!pSH->FindFirst(key, &pFound))
+	{
+		return -1;
+	}
+	if (pValue != NULL)
+	{
+		*pValue = *pFound;
+	}
+	return 0;
+}
+
+/// @brief Removes an item from a 64-bit integer valued table
+/// @param pSoHash The hash table
+/// @param key The key to the item to remove
+/// @return 0 if the item has been removed or -1 if it's not found
+int QcSoHashU64Remove(void *pSoHash, unsigned int key)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<unsigned long long> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	return (pSH->DeleteKey(key) > 0)? 0 : -1;
+}
+
+/// @brief Adds items to a 64-bit integer valued table in a batch (existing ones will be replaced)
+/// @param pSoHash The hash table
+/// @param aKeys The keys to the items to add
+/// @param aValues The values the keys are mapped to, one for each key
+/// @param count The number of items
+/// @return The number of items added or replaced
+int QcSoHashU64SetMany(void *pSoHash, const unsigned int *aKeys, const unsigned long long *aValues, int count)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<unsigned long long> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	return pSH->AddBatch(aKeys, aValues, count);
+}
+
+/// @brief Looks for the items with the specified keys in a 64-bit integer valued table
+/// @param pSoHash The hash table
+/// @param aKeys The keys to the items to look for
+/// @param count The number of keys
+/// @param aValues To return the values, 0 for the keys that are not found
+/// @param aFound To return whether each key is found or NULL to ignore
+/// @return The number of keys found
+int QcSoHashU64FindMany(void *pSoHash, const unsigned int *aKeys, int count, unsigned long long *aValues,
+	BOOL *aFound)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<unsigned long long> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	return FindMany(pSH, aKeys, count, aValues, aFound);
+}
+
+/// @brief Removes the items with the specified keys from a 64-bit integer valued table in a batch
+/// @param pSoHash The hash table
+/// @param aKeys The keys to the items to remove
+/// @param count The number of keys
+/// @return The number of items removed
+int QcSoHashU64RemoveMany(void *pSoHash, const unsigned int *aKeys, int count)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<unsigned long long> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	return pSH->DeleteBatch(aKeys, count);
+}
+
+/// @brief Finalises a 64-bit integer valued table
+/// @param pSoHash The hash table to finalise
+void QcSoHashU64Destroy(void *pSoHash)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<unsigned long long> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	delete pSH;
+}
+
+/// @brief Returns the number of items in a split-ordered hash table
+/// @param pSoHash The hash table
+/// @return The number of items
+int QcSoHashCount(void *pSoHash)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<void *, void(*)(void*)> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	return pSH->GetCount();
+}
+
+/// @brief Grows the bucket table of a split-ordered hash table in advance for a number of items
+/// @param pSoHash The hash table
+/// @param count The number of items
+void QcSoHashReserve(void *pSoHash, int count)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<void *, void(*)(void*)> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	pSH->Reserve(count);
+}
+
+/// @brief Gets the statistics of a split-ordered hash table
+/// @param pSoHash The hash table
+/// @param pStats To return the statistics
+void QcSoHashGetStats(void *pSoHash, QcSoHashStats *pStats)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<void *, void(*)(void*)> SoHashType;
+	GetStats((SoHashType*)pSoHash, pStats);
+}
+
+/// @brief Calls a function for each item of a split-ordered hash table in the split order
+/// @param pSoHash The hash table
+/// @param callback The function
+/// @param pContext The context to pass to the function
+/// @return The number of items the function has been called for
+int QcSoHashIterate(void *pSoHash, QcSoHashCallback callback, void *pContext)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<void *, void(*)(void*)> SoHashType;
+	return Iterate((SoHashType*)pSoHash, callback, pContext);
+}
+
+/// @brief Creates a cursor that reads the items of a table in runs, of either kind of table
+/// @param pSoHash The hash table, which is to outlive the cursor
+/// @return The cursor
+void* QcSoHashCursorCreate(void *pSoHash)
+{
+	SoHashCursor *pCursor = (SoHashCursor*)malloc(sizeof(SoHashCursor));
+	pCursor->SoHash = pSoHash;
+	pCursor->SoKey = 0;
+	pCursor->Skip = 0;
+	return pCursor;
+}
+
+/// @brief Reads the next run of items of a split-ordered hash table with a cursor
+/// @param pCursor The cursor
+/// @param aKeys To return the keys, modulo 2^31
+/// @param apValues To return the values
+/// @param max The maximum number of items to read
+/// @return The number of items read, 0 at the end
+int QcSoHashCursorNext(void *pCursor, unsigned int *aKeys, void **apValues, int max)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<void *, void(*)(void*)> SoHashType;
+	return CursorNext<SoHashType>((SoHashCursor*)pCursor, aKeys, apValues, max);
+}
+
+/// @brief Finalises a cursor
+/// @param pCursor The cursor
+void QcSoHashCursorDestroy(void *pCursor)
+{
+	free(pCursor);
+}
+
+/// @brief Returns the number of items in a 64-bit integer valued table
+/// @param pSoHash The hash table
+/// @return The number of items
+int QcSoHashU64Count(void *pSoHash)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<unsigned long long> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	return pSH->GetCount();
+}
+
+/// @brief Grows the bucket table of a 64-bit integer valued table in advance for a number of items
+/// @param pSoHash The hash table
+/// @param count The number of items
+void QcSoHashU64Reserve(void *pSoHash, int count)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<unsigned long long> SoHashType;
+	SoHashType *pSH = (SoHashType*)pSoHash;
+	pSH->Reserve(count);
+}
+
+/// @brief Gets the statistics of a 64-bit integer valued table
+/// @param pSoHash The hash table
+/// @param pStats To return the statistics
+void QcSoHashU64GetStats(void *pSoHash, QcSoHashStats *pStats)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<unsigned long long> SoHashType;
+	GetStats((SoHashType*)pSoHash, pStats);
+}
+
+/// @brief Calls a function for each item of a 64-bit integer valued table in the split order
+/// @param pSoHash The hash table
+/// @param callback The function, which is given a pointer to a copy of each value
+/// @param pContext The context to pass to the function
+/// @return The number of items the function has been called for
+int QcSoHashU64Iterate(void *pSoHash, QcSoHashCallback callback, void *pContext)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<unsigned long long> SoHashType;
+	return Iterate((SoHashType*)pSoHash, callback, pContext);
+}
+
+/// @brief Reads the next run of items of a 64-bit integer valued table with a cursor
+/// @param pCursor The cursor created with QcSoHashCursorCreate()
+/// @param aKeys To return the keys, modulo 2^31
+/// @param aValues To return the values
+/// @param max The maximum number of items to read
+/// @return The number of items read, 0 at the end
+int QcSoHashU64CursorNext(void *pCursor, unsigned int *aKeys, unsigned long long *aValues, int max)
+{
+	using namespace Qtl::Scheme::Hash;
+	typedef SoHashLinear<unsigned long long> SoHashType;
+	return CursorNext<SoHashType>((SoHashCursor*)pCursor, aKeys, aValues, max);
+}
@@ -0,0 +1,89 @@
+#include "qtl/system/system.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// implementations in qtl
+#include "qtl/string/filegrep.h"
+
+/// @brief Prints the lines that match as the offset, the line and the quotations
+struct LinePrinter
+{
+	/// @brief Whether the quotations are printed
+	bool PrintQuotes;
+
+	/// @brief Prints a line
+	/// @param line The line
+	void operator()(const Qtl::String::Wildcard::GrepLine &line)
+	{
+		printf("%llu:%.*s\n", (unsigned long long)line.Offset, (int)line.Length, line.Text);
+		if (!PrintQuotes)
+		{
+			return;
+		}
+		for (int i = 1; i < line.EntryCount; i++)
+		{
+			int begin = line.Entries[i*2];
+			int end = line.Entries[i*2+1];
+			if (begin < 0 || end < 0)
+			{
+				printf("\t%d:\n", i);
+				continue;
+			}
+			printf("\t%d:%.*s\n", i, end - begin, line.Text + begin);
+		}
+	}
+};
+
+/// @brief Prints how the program is used
+static void PrintUsage()
+{
+	fprintf(stderr, "usage: qgrep [-a] [-q] [-j threads] pattern file\n"
+		"  -a          the lines have to start with a match\n"
+		"  -q          prints the quotations of each line\n"
+		"  -j threads  the number of threads, one per processor by default\n");
+}
+
+int main(int argc, char *argv[])
+{
+	bool anchored = false;
+	LinePrinter printer;
+	printer.PrintQuotes = false;
+	int threadCount = 0;
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; i++)
+	{
+		if (strcmp(argv[i], "-a") == 0)
+		{
+			anchored = true;
+		}
+		else if (strcmp(argv[i], "-q") == 0)
+		{
+			printer.PrintQuotes = true;
+		}
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+		{
+			threadCount = atoi(argv[++i]);
+		}
+		else
+		{
+			PrintUsage();
+			return 2;
+		}
+	}
+	if (argc - i != 2)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	Qtl::String::Wildcard::FileGrep grep(argv[i], threadCount, anchored);
+	long long matchCount = grep.GrepFile(argv[i+1], printer);
+	if (matchCount < 0)
+	{
+		fprintf(stderr, "qgrep: cannot map %s\n", argv[i+1]);
+		return 2;
+	}
+	// as grep does, 1 means no line matches
+	return (matchCount > 0)? 0 : 1;
+}